@@ -106,6 +106,8 @@ void thread_main_c(thread* t)
 {
     debug_early_u64("thread_main_c: thread* t=", (u64)t);
 
+    // A new thread doesn't return through reschedule_from_interrupt()
+    cpu::current()->send_migrating_thread();
     arch::irq_enable();
 
 #ifdef CONF_preempt
@@ -14,6 +14,18 @@ extern "C"
 void *memset_base(void *__restrict dest, int c, size_t n);
 extern "C"
 void *memcpy_base_backwards(void *__restrict dest, const void *__restrict src, size_t n);
+extern "C"
+size_t strlen_base(const char *s);
+extern "C"
+char *strchr_base(const char *s, int c);
+extern "C"
+int strcmp_base(const char *l, const char *r);
+extern "C"
+void *memchr_base(const void *s, int c, size_t n);
+extern "C"
+void *memrchr_base(const void *s, int c, size_t n);
+extern "C"
+int memcmp_base(const void *l, const void *r, size_t n);
 
 
 extern "C"
@@ -33,3 +45,39 @@ void *memset(void *__restrict dest, int c, size_t n)
 {
     return memset_base(dest, c, n);
 }
+
+extern "C"
+size_t strlen(const char *s)
+{
+    return strlen_base(s);
+}
+
+extern "C"
+char *strchr(const char *s, int c)
+{
+    return strchr_base(s, c);
+}
+
+extern "C"
+int strcmp(const char *l, const char *r)
+{
+    return strcmp_base(l, r);
+}
+
+extern "C"
+void *memchr(const void *s, int c, size_t n)
+{
+    return memchr_base(s, c, n);
+}
+
+extern "C"
+void *memrchr(const void *s, int c, size_t n)
+{
+    return memrchr_base(s, c, n);
+}
+
+extern "C"
+int memcmp(const void *l, const void *r, size_t n)
+{
+    return memcmp_base(l, r, n);
+}
@@ -10,6 +10,7 @@
 
 #include "msr.hh"
 #include <osv/barrier.hh>
+#include <osv/mempool.hh>
 #include <string.h>
 
 extern "C" {
@@ -102,6 +103,9 @@ void thread::init_stack()
         stack.size = 65536;
     }
     if (!stack.begin) {
+        // A pinned thread's stack belongs on its cpu's NUMA node
+        auto node = _attr._pinned_cpu ? _attr._pinned_cpu->node : memory::numa_node();
+        memory::numa_node_scope scope(node);
         stack.begin = malloc(stack.size);
         stack.deleter = stack.default_deleter;
     }
@@ -130,6 +134,8 @@ void thread::free_tcb()
 
 void thread_main_c(thread* t)
 {
+    // A new thread doesn't return through reschedule_from_interrupt()
+    cpu::current()->send_migrating_thread();
     arch::irq_enable();
 #ifdef CONF_preempt
     preempt_enable();
@@ -55,6 +55,7 @@ cpuid_bit cpuid_bits[] = {
     { 1, 'd', 19, &f::clflush },
     { 7, 'b', 0, &f::fsgsbase, 0 },
     { 7, 'b', 9, &f::repmovsb, 0 },
+    { 7, 'b', 29, &f::sha, 0 },
     { 0x80000001, 'd', 26, &f::gbpage },
     { 0x80000007, 'd', 8, &f::invariant_tsc },
     { 0x40000001, 'a', 0, &f::kvm_clocksource, 0, &kvm_signature },
@@ -25,6 +25,7 @@ struct features_type {
     bool clflush;
     bool fsgsbase;
     bool repmovsb;
+    bool sha;
     bool gbpage;
     bool invariant_tsc;
     bool kvm_clocksource;
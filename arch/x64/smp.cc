@@ -20,7 +20,10 @@ extern "C" {
 #include <osv/sched.hh>
 #include <osv/barrier.hh>
 #include <osv/prio.hh>
+#include <osv/numa.hh>
+#include <osv/mempool.hh>
 #include "osv/percpu.hh"
+#include <unordered_map>
 
 extern "C" { void smp_main(void); }
 
@@ -37,7 +40,86 @@ volatile unsigned smp_processors = 1;
 
 using boost::intrusive::get_parent_from_member;
 
-void parse_madt()
+// Reads the NUMA topology from the SRAT: the node of each range of physical
+// memory, and of each cpu, which is returned by apic id. Without an SRAT,
+// everything stays on node 0.
+static std::unordered_map<u32, unsigned> parse_srat()
+{
+    std::unordered_map<u32, unsigned> apic_nodes;
+    char srat_sig[] = ACPI_SIG_SRAT;
+    ACPI_TABLE_HEADER* srat_header;
+    auto st = AcpiGetTable(srat_sig, 0, &srat_header);
+    if (st != AE_OK) {
+        return apic_nodes;
+    }
+    auto srat = get_parent_from_member(srat_header, &ACPI_TABLE_SRAT::Header);
+    void* subtable = srat + 1;
+    void* srat_end = static_cast<void*>(srat) + srat->Header.Length;
+    while (subtable < srat_end) {
+        auto s = static_cast<ACPI_SUBTABLE_HEADER*>(subtable);
+        if (!s->Length) {
+            break;
+        }
+        switch (s->Type) {
+        case ACPI_SRAT_TYPE_CPU_AFFINITY: {
+            auto cpu = get_parent_from_member(s, &ACPI_SRAT_CPU_AFFINITY::Header);
+            if (!(cpu->Flags & ACPI_SRAT_CPU_USE_AFFINITY)) {
+                break;
+            }
+            u32 domain = cpu->ProximityDomainLo |
+                    cpu->ProximityDomainHi[0] << 8 |
+                    cpu->ProximityDomainHi[1] << 16 |
+                    cpu->ProximityDomainHi[2] << 24;
+            apic_nodes[cpu->ApicId] = numa::node_for_domain(domain);
+            break;
+        }
+        case ACPI_SRAT_TYPE_X2APIC_CPU_AFFINITY: {
+            auto cpu = get_parent_from_member(s, &ACPI_SRAT_X2APIC_CPU_AFFINITY::Header);
+            if (!(cpu->Flags & ACPI_SRAT_CPU_ENABLED)) {
+                break;
+            }
+            apic_nodes[cpu->ApicId] = numa::node_for_domain(cpu->ProximityDomain);
+            break;
+        }
+        case ACPI_SRAT_TYPE_MEMORY_AFFINITY: {
+            auto mem = get_parent_from_member(s, &ACPI_SRAT_MEM_AFFINITY::Header);
+            if (!(mem->Flags & ACPI_SRAT_MEM_ENABLED) || !mem->Length) {
+                break;
+            }
+            numa::add_memory(mem->BaseAddress, mem->Length,
+                             numa::node_for_domain(mem->ProximityDomain));
+            break;
+        }
+        default:
+            break;
+        }
+        subtable += s->Length;
+    }
+    return apic_nodes;
+}
+
+// Reads the distances between the nodes from the SLIT, if there is one.
+static void parse_slit()
+{
+    char slit_sig[] = ACPI_SIG_SLIT;
+    ACPI_TABLE_HEADER* slit_header;
+    auto st = AcpiGetTable(slit_sig, 0, &slit_header);
+    if (st != AE_OK) {
+        return;
+    }
+    auto slit = get_parent_from_member(slit_header, &ACPI_TABLE_SLIT::Header);
+    auto n = slit->LocalityCount;
+    if (sizeof(*slit) - 1 + n * n > slit->Header.Length) {
+        return;
+    }
+    for (u64 i = 0; i < n; i++) {
+        for (u64 j = 0; j < n; j++) {
+            numa::set_domain_distance(i, j, slit->Entry[i * n + j]);
+        }
+    }
+}
+
+static void parse_madt(const std::unordered_map<u32, unsigned>& apic_nodes)
 {
     char madt_sig[] = ACPI_SIG_MADT;
     ACPI_TABLE_HEADER* madt_header;
@@ -55,7 +137,15 @@ void parse_madt()
             if (!(lapic->LapicFlags & ACPI_MADT_ENABLED)) {
                 break;
             }
+            unsigned node = 0;
+            auto n = apic_nodes.find(lapic->Id);
+            if (n != apic_nodes.end()) {
+                node = n->second;
+            }
+            // The cpu's per-cpu area should be on its own node
+            memory::numa_node_scope scope(node);
             auto c = new sched::cpu(nr_cpus++);
+            c->node = node;
             c->arch.apic_id = lapic->Id;
             c->arch.acpi_id = lapic->ProcessorId;
             c->arch.initstack.next = smp_stack_free;
@@ -73,9 +163,17 @@ void parse_madt()
 
 void __attribute__((constructor(init_prio::sched))) smp_init()
 {
-    parse_madt();
+    auto apic_nodes = parse_srat();
+    parse_slit();
+    numa::commit_topology();
+    memory::setup_numa();
+    if (numa::nr_nodes() > 1) {
+        debug(fmt("%d NUMA nodes detected\n") % numa::nr_nodes());
+    }
+    parse_madt(apic_nodes);
     sched::current_cpu = sched::cpus[0];
     for (auto c : sched::cpus) {
+        memory::numa_node_scope scope(c->node);
         c->incoming_wakeups = new sched::cpu::incoming_wakeup_queue[sched::cpus.size()];
     }
     smpboot_cr0 = read_cr0();
@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef STRING_SIMD_HH
+#define STRING_SIMD_HH
+
+// Vectorized string functions, written once for any vector width and
+// instantiated by string-sse2.cc. There is no AVX2 instance: OSv saves the
+// FPU state with fxsave, which leaves out the upper halves of the ymm
+// registers, so a thread using them could have them clobbered.
+//
+// A vector type V provides:
+//
+//   size                   bytes in a vector
+//   load(p)                aligned load
+//   loadu(p)               unaligned load
+//   zero(), splat(c)
+//   eq(a, b)               0xff in the bytes where a and b are equal, else 0
+//   min(a, b)              unsigned bytewise minimum
+//   xor_(a, b), and_(a, b), or_(a, b)
+//   mask(v)                the top bit of each byte, first byte lowest
+//
+// Reading past the end of a string, or before the start of a buffer, is
+// fine as long as the read stays within a page that has some of the string
+// in it, as those pages are known to be mapped. So the functions either
+// use aligned loads, which never cross a page, masking off the bytes they
+// should not look at, or check explicitly before an unaligned load.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace simd {
+// Each file gets its own copy of everything, even of what does not depend
+// on the vector type, so nothing built for a wider instruction set would
+// be shared with the rest
+namespace {
+
+constexpr uintptr_t page_size = 4096;
+
+inline uint64_t low_bits(size_t n)
+{
+    return (uint64_t(1) << n) - 1;
+}
+
+template <typename T>
+inline T* align_down(T* p, size_t align)
+{
+    return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(p) & ~(align - 1));
+}
+
+template <typename T>
+inline bool is_aligned(T* p, size_t align)
+{
+    return !(reinterpret_cast<uintptr_t>(p) & (align - 1));
+}
+
+// Whether an unaligned vector load at @p would touch the next page
+template <typename V>
+inline bool crosses_page(const void* p)
+{
+    return (reinterpret_cast<uintptr_t>(p) & (page_size - 1)) > page_size - V::size;
+}
+
+template <typename V>
+inline uint64_t zeros(typename V::type v)
+{
+    return V::mask(V::eq(v, V::zero()));
+}
+
+// Zero in the bytes that are either @c or the terminator
+template <typename V>
+inline typename V::type c_or_nul(typename V::type v, typename V::type c)
+{
+    return V::min(V::xor_(v, c), v);
+}
+
+template <typename V>
+size_t strlen(const char* s)
+{
+    auto p = align_down(s, V::size);
+    uint64_t m = zeros<V>(V::load(p)) >> (s - p);
+    if (m) {
+        return __builtin_ctzll(m);
+    }
+    p += V::size;
+    // One vector at a time up to a group of four, then four vectors per
+    // iteration: an aligned group does not cross a page either
+    for (; !is_aligned(p, 4 * V::size); p += V::size) {
+        m = zeros<V>(V::load(p));
+        if (m) {
+            return p - s + __builtin_ctzll(m);
+        }
+    }
+    for (;; p += 4 * V::size) {
+        auto v0 = V::load(p);
+        auto v1 = V::load(p + V::size);
+        auto v2 = V::load(p + 2 * V::size);
+        auto v3 = V::load(p + 3 * V::size);
+        if (zeros<V>(V::min(V::min(v0, v1), V::min(v2, v3)))) {
+            break;
+        }
+    }
+    for (;; p += V::size) {
+        m = zeros<V>(V::load(p));
+        if (m) {
+            return p - s + __builtin_ctzll(m);
+        }
+    }
+}
+
+template <typename V>
+char* strchr(const char* s, int c)
+{
+    auto cc = V::splat(c);
+    auto p = align_down(s, V::size);
+    uint64_t m = zeros<V>(c_or_nul<V>(V::load(p), cc)) >> (s - p);
+    if (m) {
+        p = s + __builtin_ctzll(m);
+        return *p == char(c) ? const_cast<char*>(p) : nullptr;
+    }
+    // As strlen()
+    for (p += V::size; !is_aligned(p, 4 * V::size); p += V::size) {
+        m = zeros<V>(c_or_nul<V>(V::load(p), cc));
+        if (m) {
+            goto found;
+        }
+    }
+    for (;; p += 4 * V::size) {
+        auto v0 = c_or_nul<V>(V::load(p), cc);
+        auto v1 = c_or_nul<V>(V::load(p + V::size), cc);
+        auto v2 = c_or_nul<V>(V::load(p + 2 * V::size), cc);
+        auto v3 = c_or_nul<V>(V::load(p + 3 * V::size), cc);
+        if (zeros<V>(V::min(V::min(v0, v1), V::min(v2, v3)))) {
+            break;
+        }
+    }
+    for (;; p += V::size) {
+        m = zeros<V>(c_or_nul<V>(V::load(p), cc));
+        if (m) {
+            break;
+        }
+    }
+found:
+    p += __builtin_ctzll(m);
+    return *p == char(c) ? const_cast<char*>(p) : nullptr;
+}
+
+template <typename V>
+void* memchr(const void* src, int c, size_t n)
+{
+    if (!n) {
+        return nullptr;
+    }
+    auto s = static_cast<const char*>(src);
+    // n may be larger than what is left of the address space, as in
+    // strnlen(s, SIZE_MAX), and end must not wrap around
+    auto end = n > UINTPTR_MAX - reinterpret_cast<uintptr_t>(s)
+        ? reinterpret_cast<const char*>(UINTPTR_MAX) : s + n;
+    auto cc = V::splat(c);
+    auto p = align_down(s, V::size);
+    uint64_t m = V::mask(V::eq(V::load(p), cc)) >> (s - p);
+    if (n < size_t(p + V::size - s)) {
+        m &= low_bits(n);
+    }
+    if (m) {
+        return const_cast<char*>(s + __builtin_ctzll(m));
+    }
+    // The loads below are all aligned, and all start before end
+    for (p += V::size; p + 4 * V::size <= end; p += 4 * V::size) {
+        auto e0 = V::eq(V::load(p), cc);
+        auto e1 = V::eq(V::load(p + V::size), cc);
+        auto e2 = V::eq(V::load(p + 2 * V::size), cc);
+        auto e3 = V::eq(V::load(p + 3 * V::size), cc);
+        if (V::mask(V::or_(V::or_(e0, e1), V::or_(e2, e3)))) {
+            break;
+        }
+    }
+    for (; p < end; p += V::size) {
+        m = V::mask(V::eq(V::load(p), cc));
+        if (size_t(end - p) < V::size) {
+            m &= low_bits(end - p);
+        }
+        if (m) {
+            return const_cast<char*>(p + __builtin_ctzll(m));
+        }
+    }
+    return nullptr;
+}
+
+template <typename V>
+void* memrchr(const void* src, int c, size_t n)
+{
+    if (!n) {
+        return nullptr;
+    }
+    auto s = static_cast<const char*>(src);
+    auto end = s + n;
+    auto cc = V::splat(c);
+    auto p = align_down(end - 1, V::size);
+    uint64_t m = V::mask(V::eq(V::load(p), cc)) & low_bits(end - p);
+    if (!m) {
+        // Four vectors at a time, while they are all in the buffer
+        for (; p >= s + 4 * V::size; p -= 4 * V::size) {
+            auto e0 = V::eq(V::load(p - V::size), cc);
+            auto e1 = V::eq(V::load(p - 2 * V::size), cc);
+            auto e2 = V::eq(V::load(p - 3 * V::size), cc);
+            auto e3 = V::eq(V::load(p - 4 * V::size), cc);
+            if (V::mask(V::or_(V::or_(e0, e1), V::or_(e2, e3)))) {
+                break;
+            }
+        }
+    }
+    for (;;) {
+        if (p <= s) {
+            m &= ~low_bits(s - p);
+            break;
+        }
+        if (m) {
+            break;
+        }
+        p -= V::size;
+        m = V::mask(V::eq(V::load(p), cc));
+    }
+    return m ? const_cast<char*>(p + 63 - __builtin_clzll(m)) : nullptr;
+}
+
+template <typename V>
+inline uint64_t differences(const unsigned char* l, const unsigned char* r)
+{
+    return ~V::mask(V::eq(V::loadu(l), V::loadu(r))) & low_bits(V::size);
+}
+
+template <typename V>
+int memcmp(const void* vl, const void* vr, size_t n)
+{
+    auto l = static_cast<const unsigned char*>(vl);
+    auto r = static_cast<const unsigned char*>(vr);
+    if (n < V::size) {
+        // A whole vector can only be read if it stays in the buffers' pages
+        if (!n) {
+            return 0;
+        }
+        if (crosses_page<V>(l) || crosses_page<V>(r)) {
+            for (; n && *l == *r; n--, l++, r++);
+            return n ? *l - *r : 0;
+        }
+        uint64_t m = differences<V>(l, r) & low_bits(n);
+        if (!m) {
+            return 0;
+        }
+        auto i = __builtin_ctzll(m);
+        return l[i] - r[i];
+    }
+    size_t i = 0;
+    for (; i + 4 * V::size <= n; i += 4 * V::size) {
+        auto e = V::and_(V::and_(V::eq(V::loadu(l + i), V::loadu(r + i)),
+                                 V::eq(V::loadu(l + i + V::size), V::loadu(r + i + V::size))),
+                         V::and_(V::eq(V::loadu(l + i + 2 * V::size), V::loadu(r + i + 2 * V::size)),
+                                 V::eq(V::loadu(l + i + 3 * V::size), V::loadu(r + i + 3 * V::size))));
+        if (V::mask(e) != low_bits(V::size)) {
+            break;
+        }
+    }
+    for (;; i += V::size) {
+        // The last vector overlaps the one before it, rather than reading
+        // past the end
+        if (i + V::size > n) {
+            i = n - V::size;
+        }
+        uint64_t m = differences<V>(l + i, r + i);
+        if (m) {
+            i += __builtin_ctzll(m);
+            return l[i] - r[i];
+        }
+        if (i + V::size == n) {
+            return 0;
+        }
+    }
+}
+
+template <typename V>
+int strcmp(const char* vl, const char* vr)
+{
+    auto l = reinterpret_cast<const unsigned char*>(vl);
+    auto r = reinterpret_cast<const unsigned char*>(vr);
+    // The strings are aligned differently, so the loads are unaligned and
+    // each is checked for crossing into a page neither string might reach
+    for (;; l += V::size, r += V::size) {
+        if (crosses_page<V>(l) || crosses_page<V>(r)) {
+            for (size_t i = 0; i < V::size; i++) {
+                if (l[i] != r[i] || !l[i]) {
+                    return l[i] - r[i];
+                }
+            }
+            continue;
+        }
+        auto lv = V::loadu(l);
+        // Zero where the strings differ, or where they both end
+        uint64_t m = zeros<V>(V::min(V::eq(lv, V::loadu(r)), lv));
+        if (m) {
+            auto i = __builtin_ctzll(m);
+            return l[i] - r[i];
+        }
+    }
+}
+
+}
+}
+
+#endif
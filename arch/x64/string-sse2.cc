@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// strlen() and friends. The kernel exports these versions under the
+// standard names, see the aliases at the end; the _sse2 names are for
+// tst-string and misc-string, which compare them with the C versions.
+
+#include "string-simd.hh"
+#include <emmintrin.h>
+
+namespace {
+
+struct sse2 {
+    typedef __m128i type;
+    static constexpr size_t size = 16;
+    static type load(const void* p) { return _mm_load_si128(static_cast<const type*>(p)); }
+    static type loadu(const void* p) { return _mm_loadu_si128(static_cast<const type*>(p)); }
+    static type zero() { return _mm_setzero_si128(); }
+    static type splat(int c) { return _mm_set1_epi8(c); }
+    static type eq(type a, type b) { return _mm_cmpeq_epi8(a, b); }
+    static type min(type a, type b) { return _mm_min_epu8(a, b); }
+    static type xor_(type a, type b) { return _mm_xor_si128(a, b); }
+    static type and_(type a, type b) { return _mm_and_si128(a, b); }
+    static type or_(type a, type b) { return _mm_or_si128(a, b); }
+    static uint64_t mask(type v) { return unsigned(_mm_movemask_epi8(v)); }
+};
+
+}
+
+extern "C" size_t strlen_sse2(const char* s)
+{
+    return simd::strlen<sse2>(s);
+}
+
+extern "C" char* strchr_sse2(const char* s, int c)
+{
+    return simd::strchr<sse2>(s, c);
+}
+
+extern "C" int strcmp_sse2(const char* l, const char* r)
+{
+    return simd::strcmp<sse2>(l, r);
+}
+
+extern "C" void* memchr_sse2(const void* s, int c, size_t n)
+{
+    return simd::memchr<sse2>(s, c, n);
+}
+
+extern "C" void* memrchr_sse2(const void* s, int c, size_t n)
+{
+    return simd::memrchr<sse2>(s, c, n);
+}
+
+extern "C" int memcmp_sse2(const void* l, const void* r, size_t n)
+{
+    return simd::memcmp<sse2>(l, r, n);
+}
+
+extern "C" {
+size_t strlen(const char* s) __attribute__((alias("strlen_sse2")));
+char* strchr(const char* s, int c) __attribute__((alias("strchr_sse2")));
+int strcmp(const char* l, const char* r) __attribute__((alias("strcmp_sse2")));
+void* memchr(const void* s, int c, size_t n) __attribute__((alias("memchr_sse2")));
+void* memrchr(const void* s, int c, size_t n) __attribute__((alias("memrchr_sse2")));
+int memcmp(const void* l, const void* r, size_t n) __attribute__((alias("memcmp_sse2")));
+}
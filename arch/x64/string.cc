@@ -9,6 +9,7 @@
 #include <string.h>
 #include <stdint.h>
 #include "cpuid.hh"
+#include "processor.hh"
 #include <osv/string.h>
 #include <osv/prio.hh>
 #include "memcpy_decode.hh"
@@ -36,6 +37,18 @@ extern "C" void memcpy_fixup_long(exception_frame *ef, size_t fixup)
     ef->rcx -= fixup / sizeof(long);
 }
 
+// The block loops below count 64-byte blocks in rcx, and check it with a
+// jrcxz (two bytes long) just before the load that faults. They resume
+// from there, so that a fixup can also skip the rest of the copy.
+extern "C" void memcpy_fixup_block(exception_frame *ef, size_t fixup)
+{
+    assert(fixup/64 <= ef->rcx);
+    ef->rdi += fixup;
+    ef->rsi += fixup;
+    ef->rcx -= fixup / 64;
+    ef->rip -= 2;
+}
+
 // Please note that the arguments to those functions are passed by reference. That
 // allow us to reuse the fact that the updates to src and dest will be held in the
 // registers themselves, and avoid storing that temporarily.
@@ -107,7 +120,11 @@ void* do_small_memcpy(void *dest, const void *src)
     struct [[gnu::packed]] data {
         char x[N];
     };
-    *static_cast<data*>(dest) = *static_cast<const data*>(src);
+    // Through a temporary, so that the compiler loads everything before it
+    // stores anything: memmove() relies on memcpy() to move down overlapping
+    // ranges
+    data tmp = *static_cast<const data*>(src);
+    *static_cast<data*>(dest) = tmp;
     return dest;
 }
 
@@ -194,6 +211,102 @@ static inline void* sse_memcpy(void* dest, const void* src, size_t n)
     return dest;
 }
 
+// Copies much larger than the cache go around it with non-temporal stores,
+// instead of evicting everything else from it. The threshold is set up by
+// resolve_memcpy(), before any copy.
+static size_t nt_threshold;
+
+// The size of the largest cache, from the cache descriptors Intel has in
+// leaf 4 and AMD in leaf 0x8000001d, or 0 if neither has them
+static size_t largest_cache_size()
+{
+    using processor::cpuid;
+    size_t largest = 0;
+    for (unsigned leaf : { 4u, 0x8000001du }) {
+        if (cpuid(leaf & 0x80000000).a < leaf) {
+            continue;
+        }
+        for (unsigned i = 0; ; i++) {
+            auto c = cpuid(leaf, i);
+            if (!(c.a & 0x1f)) {
+                break;
+            }
+            size_t ways = (c.b >> 22) + 1;
+            size_t partitions = ((c.b >> 12) & 0x3ff) + 1;
+            size_t line = (c.b & 0xfff) + 1;
+            size_t sets = size_t(c.c) + 1;
+            largest = std::max(largest, ways * partitions * line * sets);
+        }
+        if (largest) {
+            break;
+        }
+    }
+    return largest;
+}
+
+static void setup_bulk_copies()
+{
+    auto cache = largest_cache_size();
+    nt_threshold = std::max(cache ? cache / 2 : 4 << 20, size_t(1) << 20);
+}
+
+// Copies @nblocks 64-byte blocks from a 64-byte aligned source, so that a
+// fault on the source, as memcpy_decoder users expect, is always on the
+// first load of a block: it is registered with memcpy_fixup_block(). The
+// non-temporal stores also need the destination aligned.
+static inline __always_inline void
+sse_stream_blocks(void *__restrict &dest, const void *__restrict &src, size_t &nblocks)
+{
+    asm volatile
+       ("0: \n\t"
+        "jrcxz 2f\n\t"
+        "1: \n\t"
+        "movdqa (%%rsi), %%xmm0\n\t"
+        "movdqa 16(%%rsi), %%xmm1\n\t"
+        "movdqa 32(%%rsi), %%xmm2\n\t"
+        "movdqa 48(%%rsi), %%xmm3\n\t"
+        "movntdq %%xmm0, (%%rdi)\n\t"
+        "movntdq %%xmm1, 16(%%rdi)\n\t"
+        "movntdq %%xmm2, 32(%%rdi)\n\t"
+        "movntdq %%xmm3, 48(%%rdi)\n\t"
+        "add $64, %%rsi\n\t"
+        "add $64, %%rdi\n\t"
+        "dec %%rcx\n\t"
+        "jmp 0b\n\t"
+        "2: \n\t"
+        "sfence\n\t"
+        ".pushsection .memcpy_decode, \"ax\" \n\t"
+        ".quad 1b, 64, memcpy_fixup_block\n\t"
+        ".popsection\n"
+            : "+D"(dest), "+S"(src), "+c"(nblocks) : : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+}
+
+// Copies the bytes up to an aligned source, then the blocks, then the rest.
+// The first and the last bytes are copied with rep movsb, for the fixups.
+// Only for copies of 256 bytes or more.
+template <void (*copy_blocks)(void *__restrict &, const void *__restrict &, size_t &)>
+static inline __always_inline void
+block_memcpy(void *__restrict dest, const void *__restrict src, size_t n)
+{
+    size_t head = -reinterpret_cast<uintptr_t>(src) & 63;
+    size_t nblocks = (n - head) / 64;
+    size_t tail = (n - head) & 63;
+    repmovsb(dest, src, head);
+    copy_blocks(dest, src, nblocks);
+    repmovsb(dest, src, tail);
+}
+
+// The non-temporal stores need the destination aligned, as the source will
+// be; other copies are left to rep movs
+static inline bool stream_memcpy(void *__restrict dest, const void *__restrict src, size_t n)
+{
+    if (n < nt_threshold || ((uintptr_t(dest) - uintptr_t(src)) & 15)) {
+        return false;
+    }
+    block_memcpy<sse_stream_blocks>(dest, src, n);
+    return true;
+}
+
 extern "C"
 void *memcpy_repmov_old(void *__restrict dest, const void *__restrict src, size_t n)
 {
@@ -201,6 +314,8 @@ void *memcpy_repmov_old(void *__restrict dest, const void *__restrict src, size_
         return small_memcpy(dest, src, n);
     } else if (n < 256) {
         return sse_memcpy(dest, src, n);
+    } else if (stream_memcpy(dest, src, n)) {
+        return dest;
     } else {
         auto ret = dest;
         auto nw = n / 8;
@@ -220,6 +335,8 @@ void *memcpy_repmov(void *__restrict dest, const void *__restrict src, size_t n)
         return small_memcpy(dest, src, n);
     } else if (n < 256) {
         return sse_memcpy(dest, src, n);
+    } else if (stream_memcpy(dest, src, n)) {
+        return dest;
     } else {
         auto ret = dest;
         repmovsb(dest, src, n);
@@ -230,6 +347,7 @@ void *memcpy_repmov(void *__restrict dest, const void *__restrict src, size_t n)
 extern "C"
 void *(*resolve_memcpy())(void *__restrict dest, const void *__restrict src, size_t n)
 {
+    setup_bulk_copies();
     if (processor::features().repmovsb) {
         return memcpy_repmov;
     }
@@ -298,6 +416,59 @@ long_backwards(char * &d, const char * &s, size_t& n)
     }
 }
 
+// Large moves go 64 bytes at a time. All four loads come before the stores,
+// so this works for overlapping moves to a higher address, too.
+static inline __always_inline void
+block_backwards(char * &d, const char * &s, size_t& n)
+{
+    for (; n >= 64; n -= 64) {
+        d -= 64;
+        s -= 64;
+        asm volatile
+            (
+             "1:\n\t"
+             "movdqu   (%1), %%xmm0\n\t"
+             "movdqu 16(%1), %%xmm1\n\t"
+             "movdqu 32(%1), %%xmm2\n\t"
+             "movdqu 48(%1), %%xmm3\n\t"
+             "movdqu %%xmm0,   (%0)\n\t"
+             "movdqu %%xmm1, 16(%0)\n\t"
+             "movdqu %%xmm2, 32(%0)\n\t"
+             "movdqu %%xmm3, 48(%0)\n\t"
+             ".pushsection .memcpy_decode, \"ax\" \n\t"
+             ".quad 1b, 1, backwards_fixup\n\t"
+             ".popsection\n"
+                : "+D"(d), "+S"(s), "+c"(n) : : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+    }
+}
+
+// The same for moves larger than the cache, with non-temporal stores, which
+// need @d 16-byte aligned
+static inline __always_inline void
+stream_backwards(char * &d, const char * &s, size_t& n)
+{
+    for (; n >= 64; n -= 64) {
+        d -= 64;
+        s -= 64;
+        asm volatile
+            (
+             "1:\n\t"
+             "movdqu   (%1), %%xmm0\n\t"
+             "movdqu 16(%1), %%xmm1\n\t"
+             "movdqu 32(%1), %%xmm2\n\t"
+             "movdqu 48(%1), %%xmm3\n\t"
+             "movntdq %%xmm0,   (%0)\n\t"
+             "movntdq %%xmm1, 16(%0)\n\t"
+             "movntdq %%xmm2, 32(%0)\n\t"
+             "movntdq %%xmm3, 48(%0)\n\t"
+             ".pushsection .memcpy_decode, \"ax\" \n\t"
+             ".quad 1b, 1, backwards_fixup\n\t"
+             ".popsection\n"
+                : "+D"(d), "+S"(s), "+c"(n) : : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+    }
+    asm volatile("sfence" : : : "memory");
+}
+
 // According to Avi, this is likely to be faster than repmov with the direction
 // flag set. Still, although always copying it byte by byte would be a lot simpler,
 // it is faster to copy 8-byte aligned regions if we can. We'll go through the pain
@@ -321,15 +492,24 @@ void *memcpy_backwards(void *dst, const void *src, size_t n)
     // part, and only then introduce a fixup block.
     d += n;
     s += n;
+    if (n >= nt_threshold) {
+        size_t head = (uintptr_t)d & 63;
+        n -= head;
+        byte_backwards(d, s, head);
+        stream_backwards(d, s, n);
+    }
     if ((uintptr_t)s % sizeof(unsigned long) == (uintptr_t)d % sizeof(unsigned long)) {
         while ((uintptr_t)(d) % sizeof(unsigned long)) {
             if (!n--) {
                 return dst;
             }
-            *d-- = *s--;
+            *--d = *--s;
         }
 
+        block_backwards(d, s, n);
         long_backwards(d, s, n);
+    } else {
+        block_backwards(d, s, n);
     }
 
     byte_backwards(d, s, n);
@@ -404,14 +584,38 @@ static inline void small_memset(void *dest, int c, size_t n)
     }
 }
 
+// Large memsets go around the cache, as large copies do
+static inline void stream_memset(void *__restrict dest, int c, size_t n)
+{
+    size_t head = -reinterpret_cast<uintptr_t>(dest) & 63;
+    small_memset(dest, c, head);
+    dest += head;
+    n -= head;
+    size_t nblocks = n / 64;
+    auto v = _mm_set1_epi8(c);
+    asm volatile
+       ("1: \n\t"
+        "movntdq %[v], (%%rdi)\n\t"
+        "movntdq %[v], 16(%%rdi)\n\t"
+        "movntdq %[v], 32(%%rdi)\n\t"
+        "movntdq %[v], 48(%%rdi)\n\t"
+        "add $64, %%rdi\n\t"
+        "dec %%rcx\n\t"
+        "jnz 1b\n\t"
+        "sfence\n\t"
+            : "+D"(dest), "+c"(nblocks) : [v]"x"(v) : "memory");
+    small_memset(dest, c, n & 63);
+}
+
 extern "C"
 void *memset_repstos_old(void *__restrict dest, int c, size_t n)
 {
     auto ret = dest;
     if (n <= 64) {
         small_memset(dest, c, n);
-    }
-    else {
+    } else if (n >= nt_threshold) {
+        stream_memset(dest, c, n);
+    } else {
         auto nw = n / 8;
         auto nb = n & 7;
         auto cw = (uint8_t)c * 0x0101010101010101ull;
@@ -427,6 +631,8 @@ void *memset_repstosb(void *__restrict dest, int c, size_t n)
     auto ret = dest;
     if (n <= 64) {
         small_memset(dest, c, n);
+    } else if (n >= nt_threshold) {
+        stream_memset(dest, c, n);
     } else {
         asm volatile("rep stosb" : "+D"(dest), "+c"(n) : "a"(c) : "memory");
     }
@@ -436,6 +642,7 @@ void *memset_repstosb(void *__restrict dest, int c, size_t n)
 extern "C"
 void *(*resolve_memset())(void *__restrict dest, int c, size_t n)
 {
+    setup_bulk_copies();
     if (processor::features().repmovsb) {
         return memset_repstosb;
     }
@@ -444,5 +651,3 @@ void *(*resolve_memset())(void *__restrict dest, int c, size_t n)
 
 void *memset(void *__restrict dest, int c, size_t n)
     __attribute__((ifunc("resolve_memset")));
-
-
@@ -190,6 +190,22 @@ in_pseudo(u_int32_t a, u_int32_t b, u_int32_t c)
 	return (sum);
 }
 
+u_short
+in_cksum_copy(const void *src, void *dst, int len)
+{
+	u_int64_t sum;
+	union q_util q_util;
+	union l_util l_util;
+
+	memcpy(dst, src, len);
+	sum = in_cksumdata(dst, len);
+	REDUCE16;
+	/* in_cksumdata() counts the words from even addresses, this from dst */
+	if (1 & (long) dst)
+		sum = ((sum & 0xff) << 8) | (sum >> 8);
+	return (sum);
+}
+
 u_short
 in_cksum_skip(struct mbuf *m, int len, int skip)
 {
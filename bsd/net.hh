@@ -10,6 +10,9 @@
 
 void net_init(void);
 
+// Default busy poll time of new sockets, in microseconds (see SO_BUSY_POLL)
+extern int net_busy_poll;
+
 
 #endif // NET_HH
 
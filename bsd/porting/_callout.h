@@ -40,10 +40,15 @@
 
 #include <osv/mutex.h>
 #include <osv/clock.hh>
+#include <boost/intrusive/list_hook.hpp>
 
 struct callout {
-	/* OSv waiter thread for drain (drain) */
-	void *waiter_thread;
+	/* Link in the per-CPU timer set or expired list of c_cpu */
+	boost::intrusive::list_member_hook<> c_link;
+	/* CPU whose callout base holds (and will run) this callout */
+	unsigned c_cpu;
+	/* Which list of that base c_link is on, see callout.cc */
+	int c_queued;
 	/* State of this entry */
 	int c_flags;
 	uint64_t c_ticks;
@@ -57,6 +62,8 @@ struct callout {
 	struct mtx* c_mtx;
 	/* Rwlock */
 	struct rwlock *c_rwlock;
+
+	osv::clock::uptime::time_point get_timeout() const { return c_to_ns; }
 };
 
 #endif
@@ -6,11 +6,14 @@
  */
 
 #include <mutex>
-#include <set>
+#include <vector>
 #include "osv/trace.hh"
 #include <osv/debug.hh>
 #include <osv/sched.hh>
 #include <osv/clock.hh>
+#include <osv/waitqueue.hh>
+#include <osv/timer-set.hh>
+#include <osv/printf.hh>
 using namespace osv::clock::literals;
 
 #include <bsd/porting/rwlock.h>
@@ -19,196 +22,261 @@ using namespace osv::clock::literals;
 #include <bsd/porting/sync_stub.h>
 
 TRACEPOINT(trace_callout_init, "C=%p", void *);
-TRACEPOINT(trace_callout_reset, "C=%p to_ticks=%d fn=%p arg=%p", void *, uint64_t, void *, void *);
+TRACEPOINT(trace_callout_reset, "C=%p to_ticks=%d fn=%p arg=%p cpu=%d", void *, uint64_t, void *, void *, unsigned);
 TRACEPOINT(trace_callout_stop_wait, "C=%p", void *);
 TRACEPOINT(trace_callout_stop, "C=%p flags=%d, is_drain=%d", void *, int, int);
-TRACEPOINT(trace_callout_thread_waiting, "C=%p", void *);
+TRACEPOINT(trace_callout_thread_waiting, "cpu=%d", unsigned);
 TRACEPOINT(trace_callout_thread_retry, "C=%p", void *);
 TRACEPOINT(trace_callout_thread_dispatching, "C=%p fn=%p", void *, void *);
-TRACEPOINT(trace_callout_thread_waking, "C=%p thread=%p", void *, void *);
-
-int _callout_stop_safe_locked(struct callout *c, int safe);
+TRACEPOINT(trace_callout_thread_waking, "C=%p", void *);
 
+/*
+ * Every CPU has its own callout base: a timer_set (the same structure the
+ * scheduler keeps its timers in) holding the callouts armed on that CPU,
+ * and a dispatcher thread pinned to it which runs them when they expire.
+ *
+ * Arming and cancelling a callout is O(1) and only takes the lock of the
+ * base the callout is on, so TCP connections being served on different
+ * CPUs never contend on their timers. callout_reset() moves the callout
+ * to the current CPU's base, unless its handler is running right now.
+ *
+ * A callout's state (c_flags, c_queued, c_link) is protected by the lock
+ * of the base c_cpu points to; c_cpu itself only changes with that lock,
+ * and the lock of the base it is moved to, held.
+ */
 namespace callouts {
 
-    struct callout_compare {
-        bool operator() (callout *a, callout *b) const {
-            if (a->c_to_ns == b->c_to_ns) {
-                return (a < b);
-            }
-
-            return (a->c_to_ns < b->c_to_ns);
-        }
+    enum {
+        not_queued = 0,
+        queued_timers = 1,      // in the timer set, waiting for its time
+        queued_expired = 2,     // expired, waiting for the dispatcher to run it
     };
 
-    // We manage callouts in a single ordered set
-    std::set<callout *, callout_compare> _callouts;
-
-    // Both global data and callout structure are protected using this lock
-    mutex _callout_mutex;
-    void lock(void) { _callout_mutex.lock(); }
-    void unlock(void) { _callout_mutex.unlock(); }
-
-    // The callout dispatcher thread
-    sched::thread *_callout_dispatcher = nullptr;
-    bool _have_work = false;
+    typedef bi::list<callout,
+        bi::member_hook<callout, bi::list_member_hook<>, &callout::c_link>>
+        callout_list;
+
+    struct callout_base {
+        explicit callout_base(sched::cpu* cpu);
+        void run();
+        void dispatch(callout* c);
+
+        mutex lock;
+        timer_set<callout, &callout::c_link, osv::clock::uptime> timers;
+        callout_list expired;
+        sched::thread dispatcher;
+        bool have_work = false;
+        // The callout whose handler is being run by the dispatcher, and
+        // whether it was stopped or reset since it was picked up. The
+        // dispatcher doesn't touch it once cancelled, nor once its handler
+        // was called, as the handler or its owner may have freed it.
+        callout* running = nullptr;
+        bool cancelled = false;
+        // callout_drain() callers waiting for running to change
+        waitqueue drain_wq;
+    };
 
-    void add_callout(callout *c)
-    {
-        _callouts.insert(c);
-    }
+    std::vector<callout_base*> bases;
 
-    void remove_callout(callout *c)
+    callout_base::callout_base(sched::cpu* cpu)
+        : dispatcher([=] { run(); },
+            sched::thread::attr().pin(cpu).name(osv::sprintf("callout%d", cpu->id)))
     {
-        _callouts.erase(c);
     }
 
-    callout *get_one(void)
+    // Locks and returns the base @c is on, coping with it moving to
+    // another CPU while we were waiting for the lock.
+    callout_base* lock(callout* c)
     {
-        if (_callouts.empty()) {
-            return (nullptr);
+        for (;;) {
+            auto cb = bases[c->c_cpu];
+            cb->lock.lock();
+            if (cb == bases[c->c_cpu]) {
+                return cb;
+            }
+            cb->lock.unlock();
         }
-        return (*_callouts.begin());
     }
 
-    // FIXME: optimize this function
-    bool have_callout(callout *c)
+    // Locks the base @c is on, and the one of @cpu, in CPU order.
+    callout_base* lock_pair(callout* c, unsigned cpu)
     {
-        for (auto i: _callouts) {
-            if (i == c) {
-                return (true);
+        auto to = bases[cpu];
+        for (;;) {
+            unsigned from = c->c_cpu;
+            auto cb = bases[from];
+            if (from == cpu) {
+                cb->lock.lock();
+            } else if (from < cpu) {
+                cb->lock.lock();
+                to->lock.lock();
+            } else {
+                to->lock.lock();
+                cb->lock.lock();
+            }
+            if (from == c->c_cpu) {
+                return cb;
+            }
+            cb->lock.unlock();
+            if (cb != to) {
+                to->lock.unlock();
             }
         }
-
-        return (false);
     }
 
-    void mark_have_work(void)
+    void remove(callout_base* cb, callout* c)
     {
-        _have_work = true;
+        switch (c->c_queued) {
+        case queued_timers:
+            cb->timers.remove(*c);
+            break;
+        case queued_expired:
+            cb->expired.erase(cb->expired.iterator_to(*c));
+            break;
+        }
+        c->c_queued = not_queued;
     }
 
-    // wakes the dispatcher
-    void wake_dispatcher(void)
+    // Returns true if the dispatcher needs to be woken up to rearm its timer
+    bool insert(callout_base* cb, callout* c)
     {
-        _callout_dispatcher->wake();
+        c->c_queued = queued_timers;
+        if (cb->timers.insert(*c)) {
+            cb->have_work = true;
+            return true;
+        }
+        return false;
     }
 }
 
-static sched::thread* callout_get_waiter(struct callout *c)
-{
-    return reinterpret_cast<sched::thread*>(c->waiter_thread);
-}
+using callouts::callout_base;
 
-static void callout_set_waiter(struct callout *c, sched::thread* t)
+// Called with the base lock held, returns with it held. The lock is
+// dropped while waiting for the callout's own lock and while running it.
+void callout_base::dispatch(callout* c)
 {
-    if (t != NULL)
-        assert(c->waiter_thread == NULL);
-
-    c->waiter_thread = reinterpret_cast<void*>(t);
-}
+    auto fn = c->c_fn;
+    auto arg = c->c_arg;
+    struct mtx* c_mtx = c->c_mtx;
+    struct rwlock* c_rwlock = c->c_rwlock;
+    bool return_unlocked = ((c->c_flags & CALLOUT_RETURNUNLOCKED) == 0);
+
+    running = c;
+    cancelled = false;
+
+    bool fire = true;
+    if (c_rwlock || c_mtx) {
+        // The callout's lock is taken before ours by callout_stop() callers,
+        // so we can't wait for it with the base locked.
+        lock.unlock();
+        if (c_rwlock)
+            rw_wlock(c_rwlock);
+        if (c_mtx)
+            mtx_lock(c_mtx);
+        lock.lock();
 
-static void _callout_thread(void)
-{
-    callouts::lock();
+        if (cancelled) {
+            trace_callout_thread_retry(c);
+            lock.unlock();
+            if (c_rwlock)
+                rw_wunlock(c_rwlock);
+            if (c_mtx)
+                mtx_unlock(c_mtx);
+            lock.lock();
+            fire = false;
+        }
+    }
 
-    while (true) {
+    if (fire) {
+        // The handler may free the callout, so this is the last time it is
+        // written to: callout_completed() looks at running for the rest.
+        c->c_flags &= ~CALLOUT_PENDING;
+        c->c_flags |= CALLOUT_COMPLETED;
 
-        // Wait for work
-        sched::thread::wait_until(callouts::_callout_mutex, [] {
-            return (callouts::get_one() != nullptr);
-        });
+        lock.unlock();
 
-        // get the first callout with the earliest time
-        callout *c = callouts::get_one();
+        // Callout handler
+        trace_callout_thread_dispatching(c, (void*)fn);
+        fn(arg);
 
-        assert(c->c_flags & (CALLOUT_ACTIVE | CALLOUT_PENDING));
+        if (return_unlocked) {
+            if (c_rwlock)
+                rw_wunlock(c_rwlock);
+            if (c_mtx)
+                mtx_unlock(c_mtx);
+        }
 
-        //////////////////////
-        // Wait for timeout //
-        //////////////////////
+        lock.lock();
+    }
 
-        auto cur = osv::clock::uptime::now();
-        bool expired = true;
-        if (cur < c->c_to_ns-1_ms) {
-            sched::timer t(*sched::thread::current());
-            t.set(c->c_to_ns);
+    running = nullptr;
+    trace_callout_thread_waking(c);
+    drain_wq.wake_all(lock);
+}
 
-            trace_callout_thread_waiting(c);
-            sched::thread::wait_until(callouts::_callout_mutex, [&] {
-                return ( (t.expired()) || (callouts::_have_work));
-            });
+void callout_base::run()
+{
+    sched::timer tmr(*sched::thread::current());
 
-            callouts::_have_work = false;
-            expired = t.expired();
+    lock.lock();
+    while (true) {
+        timers.expire(osv::clock::uptime::now());
+        while (auto c = timers.pop_expired()) {
+            assert(c->c_flags & (CALLOUT_ACTIVE | CALLOUT_PENDING));
+            c->c_queued = callouts::queued_expired;
+            expired.push_back(*c);
         }
 
-        if (!expired  || (!callouts::have_callout(c))) {
-            trace_callout_thread_retry(c);
-            continue;
+        while (!expired.empty()) {
+            auto c = &expired.front();
+            expired.pop_front();
+            c->c_queued = callouts::not_queued;
+            dispatch(c);
         }
 
-        ///////////////
-        // Dispatch! //
-        ///////////////
-
-        auto fn = c->c_fn;
-        auto arg = c->c_arg;
-        struct mtx* c_mtx = c->c_mtx;
-        struct rwlock* c_rwlock = c->c_rwlock;
-        bool return_unlocked = ((c->c_flags & CALLOUT_RETURNUNLOCKED) == 0);
+        have_work = false;
+        if (timers.empty()) {
+            tmr.cancel();
+        } else {
+            tmr.reset(timers.get_next_timeout());
+        }
 
-        if (c_rwlock)
-            rw_wlock(c_rwlock);
-        if (c_mtx)
-            mtx_lock(c_mtx);
+        trace_callout_thread_waiting(sched::cpu::current()->id);
+        sched::thread::wait_until(lock, [&] {
+            return tmr.expired() || have_work;
+        });
+    }
+}
 
-        c->c_flags &= ~CALLOUT_PENDING;
+// callout_stop() and callout_drain(), with the callout's base locked
+static int _callout_stop_safe_locked(callout_base* cb, struct callout *c,
+    int is_drain)
+{
+    int result = 0;
 
-        callouts::unlock();
+    trace_callout_stop(c, c->c_flags, is_drain);
 
-        // Callout handler
-        trace_callout_thread_dispatching(c, (void*)fn);
-        fn(arg);
+    bool pending = c->c_queued != callouts::not_queued;
+    callouts::remove(cb, c);
 
-        callouts::lock();
-
-        sched::thread* waiter = nullptr;
-
-        //
-        // note: after the handler have been invoked the callout structure
-        // can look much differently, the handler may reschedule the callout
-        // or even freed it.
-        //
-        // if the callout is in the set it means that it hasn't been freed
-        // by the user
-        //
-        // reset || drain || !stop
-        if (callouts::have_callout(c)) {
-
-            waiter = callout_get_waiter(c);
-            callout_set_waiter(c, NULL);
-            // if the callout hadn't been reschedule, remove it
-            if ( ((c->c_flags & CALLOUT_PENDING) == 0) || (waiter) ) {
-                c->c_flags |= CALLOUT_COMPLETED;
-                callouts::remove_callout(c);
+    if (cb->running == c) {
+        cb->cancelled = true;
+        if (is_drain && sched::thread::current() != &cb->dispatcher) {
+            // Wait for the handler
+            trace_callout_stop_wait(c);
+            while (cb->running == c) {
+                cb->drain_wq.wait(cb->lock);
             }
+            result = 1;
         }
+    } else if (is_drain && pending) {
+        result = 1;
+    }
 
-        // FIXME: should we do this in case the caller called callout_stop?
-        if (return_unlocked) {
-            if (c_rwlock)
-                rw_wunlock(c_rwlock);
-            if (c_mtx)
-                mtx_unlock(c_mtx);
-        }
+    // Clear flags
+    c->c_flags &= ~(CALLOUT_ACTIVE | CALLOUT_PENDING | CALLOUT_COMPLETED);
 
-        // if we have a waiter then the callout structure must be valid
-        if (waiter) {
-            trace_callout_thread_waking(c, waiter);
-            waiter->wake();
-        }
-    }
+    return (result);
 }
 
 int callout_reset_on(struct callout *c, u64 to_ticks, void (*fn)(void *),
@@ -219,13 +287,16 @@ int callout_reset_on(struct callout *c, u64 to_ticks, void (*fn)(void *),
             std::chrono::duration_cast<std::chrono::nanoseconds>
                 (cur.time_since_epoch()).count());
     int result = 0;
-    bool queued_first = false;
 
-    callouts::lock();
+    // Callouts fire on the CPU that armed them; callout_reset_curcpu()
+    // and callout_reset() are therefore the same.
+    unsigned cpu = sched::cpu::current()->id;
+    auto cb = callouts::lock_pair(c, cpu);
+    auto to = callouts::bases[cpu];
 
-    trace_callout_reset(c, to_ticks, (void*)fn, arg);
+    trace_callout_reset(c, to_ticks, (void*)fn, arg, cpu);
 
-    result = _callout_stop_safe_locked(c, 0);
+    result = _callout_stop_safe_locked(cb, c, 0);
 
     // Reset the callout
     c->c_ticks = to_ticks;
@@ -235,69 +306,53 @@ int callout_reset_on(struct callout *c, u64 to_ticks, void (*fn)(void *),
     c->c_arg = arg;
     c->c_flags |= (CALLOUT_PENDING | CALLOUT_ACTIVE);
 
-    callouts::add_callout(c);
-    if (c == callouts::get_one()) {
-        callouts::mark_have_work();
-        queued_first = true;
+    // A callout whose handler is running stays where it is, so that
+    // callout_drain() only ever has to look at a single base.
+    if (cb->running != c) {
+        c->c_cpu = cpu;
     }
+    auto target = callouts::bases[c->c_cpu];
+    bool wake = callouts::insert(target, c);
 
-    callouts::unlock();
+    cb->lock.unlock();
+    if (to != cb) {
+        to->lock.unlock();
+    }
 
-    if (queued_first)
-        callouts::wake_dispatcher();
+    if (wake) {
+        target->dispatcher.wake();
+    }
 
     return result;
 }
 
-// callout_stop() and callout_drain()
-int _callout_stop_safe_locked(struct callout *c, int is_drain)
+int _callout_stop_safe(struct callout *c, int is_drain)
 {
     int result = 0;
 
-    trace_callout_stop(c, c->c_flags, is_drain);
-
-    if ((is_drain) &&
-        (sched::thread::current() != callouts::_callout_dispatcher) &&
-            (callout_pending(c) ||
-             (callout_active(c) && !callout_completed(c))) ) {
-
-        // Wait for callout
-        callout_set_waiter(c, sched::thread::current());
-        callouts::mark_have_work();
-        callouts::wake_dispatcher();
-
-        trace_callout_stop_wait(c);
-
-        sched::thread::wait_until(callouts::_callout_mutex, [&] {
-            return (c->c_flags & CALLOUT_COMPLETED);
-        });
-
-        result = 1;
-    }
-
-    callouts::remove_callout(c);
-
-    // Clear flags
-    c->c_flags &= ~(CALLOUT_ACTIVE | CALLOUT_PENDING | CALLOUT_COMPLETED);
+    auto cb = callouts::lock(c);
+    result = _callout_stop_safe_locked(cb, c, is_drain);
+    cb->lock.unlock();
 
     return (result);
 }
 
-int _callout_stop_safe(struct callout *c, int is_drain)
+// Whether the handler was called and has returned, and the callout wasn't
+// stopped or reset since, which clear CALLOUT_COMPLETED.
+int callout_completed(struct callout *c)
 {
-    int result = 0;
-
-    callouts::lock();
-    result = _callout_stop_safe_locked(c, is_drain);
-    callouts::unlock();
+    auto cb = callouts::lock(c);
+    int completed = (c->c_flags & CALLOUT_COMPLETED) && cb->running != c;
+    cb->lock.unlock();
 
-    return (result);
+    return completed;
 }
 
 void callout_init(struct callout *c, int mpsafe)
 {
-    bzero(c, sizeof *c);
     assert(mpsafe != 0);
+    new (c) callout();
+    c->c_cpu = sched::cpu::current()->id;
 
     trace_callout_init(c);
 }
@@ -322,9 +377,12 @@ void callout_init_mtx(struct callout *c, struct mtx *mtx, int flags)
 
 void init_callouts(void)
 {
-    // Start the callout thread
-    callouts::_callout_dispatcher = new sched::thread(_callout_thread,
-            sched::thread::attr().name("callout"));
-    callouts::_callout_dispatcher->start();
+    // Create all the bases before any dispatcher can look at them
+    for (auto c : sched::cpus) {
+        callouts::bases.push_back(new callout_base(c));
+    }
+    // Start the callout threads
+    for (auto cb : callouts::bases) {
+        cb->dispatcher.start();
+    }
 }
-
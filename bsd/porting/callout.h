@@ -50,7 +50,7 @@ void init_callouts(void);
 #define	CALLOUT_PENDING		0x0004 /* callout is waiting for timeout */
 #define	CALLOUT_MPSAFE		0x0008 /* callout handler is mp safe */
 #define	CALLOUT_RETURNUNLOCKED	0x0010 /* handler returns with mtx unlocked */
-#define	CALLOUT_COMPLETED	0x0020 /* callout thread finished */
+#define	CALLOUT_COMPLETED	0x0020 /* handler called, see callout_completed() */
 
 struct lock_object;
 
@@ -61,7 +61,7 @@ void	callout_init(struct callout *, int);
 void callout_init_mtx(struct callout *c, struct mtx *lock, int flags);
 void callout_init_rw(struct callout *c, struct rwlock *rw, int flags);
 #define	callout_pending(c)	((c)->c_flags & CALLOUT_PENDING)
-#define callout_completed(c)  ((c)->c_flags & CALLOUT_COMPLETED)
+int	callout_completed(struct callout *);
 int	callout_reset_on(struct callout *, u64, void (*)(void *), void *, int);
 #define	callout_reset(c, on_tick, fn, arg)				\
     callout_reset_on((c), (on_tick), (fn), (arg), 0)
@@ -7,6 +7,10 @@
 
 #include <osv/sched.hh>
 #include <bsd/porting/netport.h>
+#ifdef __x86_64__
+#include "cpuid.hh"
+#include "processor.hh"
+#endif
 
 extern "C" int get_cpuid(void)
 {
@@ -21,3 +25,26 @@ extern "C" uint64_t get_cyclecount(void)
 {
     return get_ticks();
 }
+
+#ifdef __x86_64__
+/*
+ * Instruction set extensions usable by the ZFS checksum code, see
+ * <sys/simd_x86.h>.
+ */
+extern "C" int zfs_sse2_available(void)
+{
+    // part of the x86_64 baseline
+    return 1;
+}
+
+extern "C" int zfs_ssse3_available(void)
+{
+    return processor::features().ssse3;
+}
+
+extern "C" int zfs_shani_available(void)
+{
+    auto& f = processor::features();
+    return f.sha && f.ssse3 && f.sse4_1;
+}
+#endif /* __x86_64__ */
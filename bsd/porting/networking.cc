@@ -139,4 +139,52 @@ int ifup(std::string if_name)
     error = ifioctl(NULL, SIOCSIFFLAGS, (caddr_t)&ifr, NULL);
     return (error);
 }
+
+static int if_set_capabilities(std::string if_name, int caps, bool on)
+{
+    int error;
+    struct bsd_ifreq ifr;
+
+    if (if_name.empty()) {
+        return (EINVAL);
+    }
+
+    bzero(&ifr, sizeof(struct bsd_ifreq));
+    strncpy(ifr.ifr_name, if_name.c_str(), IFNAMSIZ);
+    error = ifioctl(NULL, SIOCGIFCAP, (caddr_t)&ifr, NULL);
+    if (error) {
+        return (error);
+    }
+
+    /*
+     * Only what is in ifr_reqcap, the interface's capabilities, may be
+     * asked for: ifr_curcap also has flags such as IFCAP_HWSTATS, which
+     * would make ifioctl() reject the whole request with EINVAL.
+     */
+    if (on) {
+        if (caps & ~ifr.ifr_reqcap) {
+            return (EOPNOTSUPP);
+        }
+        ifr.ifr_reqcap &= ifr.ifr_curcap | caps;
+    } else {
+        ifr.ifr_reqcap &= ifr.ifr_curcap & ~caps;
+    }
+    error = ifioctl(NULL, SIOCSIFCAP, (caddr_t)&ifr, NULL);
+    return (error);
+}
+
+int if_set_csum_offload(std::string if_name, bool on)
+{
+    return if_set_capabilities(if_name, IFCAP_TXCSUM | IFCAP_RXCSUM, on);
+}
+
+int if_set_tso(std::string if_name, bool on)
+{
+    return if_set_capabilities(if_name, IFCAP_TSO4, on);
+}
+
+int if_set_gso(std::string if_name, bool on)
+{
+    return if_set_capabilities(if_name, IFCAP_GSO4, on);
+}
 }
@@ -20,6 +20,12 @@ namespace osv {
     int start_if(std::string if_name, std::string ip_addr,
         std::string mask_addr);
     int ifup(std::string if_name);
+    /* Turns the interface's IPv4 checksum offload on or off */
+    int if_set_csum_offload(std::string if_name, bool on);
+    /* Turns the interface's IPv4 TCP segmentation offload on or off */
+    int if_set_tso(std::string if_name, bool on);
+    /* Turns segmenting TCP in software, when there is no TSO, on or off */
+    int if_set_gso(std::string if_name, bool on);
 }
 
 #endif /* __NETWORKING_H__ */
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <osv/sched.hh>
+#include <osv/mutex.h>
+#include <osv/waitqueue.hh>
+#include <osv/mempool.hh>
+#include <osv/printf.hh>
+#include <osv/trace.hh>
+
+#include "pcpu_taskqueue.h"
+
+TRACEPOINT(trace_pcpu_taskqueue_enqueue, "tq=%x task=%x cpu=%d", pcpu_taskqueue*, task*, unsigned);
+TRACEPOINT(trace_pcpu_taskqueue_run, "tq=%x task=%x cpu=%d stolen=%d", pcpu_taskqueue*, task*, unsigned, bool);
+TRACEPOINT(trace_pcpu_taskqueue_run_ret, "");
+
+namespace {
+
+struct cpu_queue {
+    cpu_queue() { STAILQ_INIT(&tasks); }
+    mutex lock;
+    waitqueue wq;
+    STAILQ_HEAD(, task) tasks;
+    // Read without the lock by stealers, as a hint
+    std::atomic<unsigned> length { 0 };
+    std::atomic<unsigned> idle { 0 };
+    // An idle worker was woken up to steal from other CPUs
+    bool kick = false;
+} __attribute__((aligned(64)));
+
+}
+
+struct pcpu_taskqueue {
+    std::string name;
+    std::vector<cpu_queue*> queues;
+    std::vector<sched::thread*> threads;
+    std::atomic<unsigned> idle { 0 };
+    std::atomic<bool> active { true };
+};
+
+static __thread pcpu_taskqueue* current_taskqueue;
+
+static task* pop(cpu_queue& q)
+{
+    auto t = STAILQ_FIRST(&q.tasks);
+    if (t) {
+        STAILQ_REMOVE_HEAD(&q.tasks, ta_link);
+        q.length.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return t;
+}
+
+// Take a task from another CPU whose workers are all busy. Never blocks on
+// a queue lock: if the victim is contended it is busy dispatching, and
+// will likely have an idle worker of its own soon.
+static task* steal(pcpu_taskqueue* tq, unsigned cpu)
+{
+    auto n = tq->queues.size();
+    for (unsigned i = 1; i < n; i++) {
+        auto& q = *tq->queues[(cpu + i) % n];
+        if (!q.length.load(std::memory_order_relaxed) ||
+            q.idle.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        if (!q.lock.try_lock()) {
+            continue;
+        }
+        auto t = pop(q);
+        q.lock.unlock();
+        if (t) {
+            return t;
+        }
+    }
+    return nullptr;
+}
+
+// Wake an idle worker on some other CPU so that it steals work from @cpu.
+static void kick(pcpu_taskqueue* tq, unsigned cpu)
+{
+    auto n = tq->queues.size();
+    for (unsigned i = 1; i < n; i++) {
+        auto& q = *tq->queues[(cpu + i) % n];
+        if (!q.idle.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        WITH_LOCK(q.lock) {
+            if (q.idle.load(std::memory_order_relaxed)) {
+                q.kick = true;
+                q.wq.wake_one(q.lock);
+                return;
+            }
+        }
+    }
+}
+
+static void run(pcpu_taskqueue* tq, task* t, unsigned cpu, bool stolen)
+{
+    int pending = t->ta_pending;
+    t->ta_pending = 0;
+    trace_pcpu_taskqueue_run(tq, t, cpu, stolen);
+    t->ta_func(t->ta_context, pending);
+    trace_pcpu_taskqueue_run_ret();
+}
+
+static void worker(pcpu_taskqueue* tq, unsigned cpu)
+{
+    thread_mark_emergency();
+    current_taskqueue = tq;
+
+    auto& q = *tq->queues[cpu];
+    for (;;) {
+        task* t = nullptr;
+        WITH_LOCK(q.lock) {
+            while (!q.length.load(std::memory_order_relaxed) && !q.kick &&
+                   tq->active.load(std::memory_order_relaxed)) {
+                q.idle.fetch_add(1, std::memory_order_relaxed);
+                tq->idle.fetch_add(1, std::memory_order_relaxed);
+                q.wq.wait(q.lock);
+                tq->idle.fetch_sub(1, std::memory_order_relaxed);
+                q.idle.fetch_sub(1, std::memory_order_relaxed);
+            }
+            q.kick = false;
+            if (!q.length.load(std::memory_order_relaxed) &&
+                !tq->active.load(std::memory_order_relaxed)) {
+                return;
+            }
+            t = pop(q);
+        }
+        if (t) {
+            run(tq, t, cpu, false);
+        } else if ((t = steal(tq, cpu))) {
+            run(tq, t, cpu, true);
+        }
+    }
+}
+
+pcpu_taskqueue* pcpu_taskqueue_create(const char* name, int nthreads)
+{
+    auto tq = new pcpu_taskqueue;
+    tq->name = name;
+    for (unsigned i = 0; i < sched::cpus.size(); i++) {
+        tq->queues.push_back(new cpu_queue);
+    }
+    // Workers may steal from any queue, so only start them once all exist
+    for (auto c : sched::cpus) {
+        for (int i = 0; i < std::max(nthreads, 1); i++) {
+            unsigned id = c->id;
+            auto t = new sched::thread([=] { worker(tq, id); },
+                sched::thread::attr().pin(c).name(osv::sprintf("%s%d", name, id)));
+            tq->threads.push_back(t);
+            t->start();
+        }
+    }
+    return tq;
+}
+
+void pcpu_taskqueue_free(pcpu_taskqueue* tq)
+{
+    tq->active.store(false);
+    for (auto q : tq->queues) {
+        WITH_LOCK(q->lock) {
+            q->wq.wake_all(q->lock);
+        }
+    }
+    for (auto t : tq->threads) {
+        t->join();
+        delete t;
+    }
+    for (auto q : tq->queues) {
+        assert(STAILQ_EMPTY(&q->tasks));
+        delete q;
+    }
+    delete tq;
+}
+
+void pcpu_taskqueue_enqueue(pcpu_taskqueue* tq, task* t, int cpu)
+{
+    unsigned c = cpu < 0 ? sched::cpu::current()->id : unsigned(cpu) % tq->queues.size();
+    auto& q = *tq->queues[c];
+    bool busy;
+
+    trace_pcpu_taskqueue_enqueue(tq, t, c);
+    WITH_LOCK(q.lock) {
+        assert(!t->ta_pending);
+        t->ta_pending = 1;
+        if (t->ta_priority) {
+            STAILQ_INSERT_HEAD(&q.tasks, t, ta_link);
+        } else {
+            STAILQ_INSERT_TAIL(&q.tasks, t, ta_link);
+        }
+        q.length.fetch_add(1, std::memory_order_relaxed);
+        busy = !q.idle.load(std::memory_order_relaxed);
+        if (!busy) {
+            q.wq.wake_one(q.lock);
+        }
+    }
+    if (busy && tq->idle.load(std::memory_order_relaxed)) {
+        kick(tq, c);
+    }
+}
+
+int pcpu_taskqueue_member(pcpu_taskqueue* tq, struct thread* td)
+{
+    if (td == reinterpret_cast<struct thread*>(sched::thread::current())) {
+        return current_taskqueue == tq;
+    }
+    for (auto t : tq->threads) {
+        if (reinterpret_cast<struct thread*>(t) == td) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int pcpu_taskqueue_curcpu(void)
+{
+    return sched::cpu::current()->id;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef _OSV_BSD_PCPU_TASKQUEUE_H
+#define _OSV_BSD_PCPU_TASKQUEUE_H
+
+#include <sys/cdefs.h>
+#include <sys/_task.h>
+
+/*
+ * A taskqueue with one queue, and a set of worker threads pinned to it, per
+ * CPU. Tasks run on the CPU they were queued on unless that CPU's workers
+ * are all busy, in which case an idle worker elsewhere steals them.
+ *
+ * Tasks are struct task, as for taskqueue(9); ta_priority != 0 queues at
+ * the front. A task must not be queued again before it started running.
+ */
+struct pcpu_taskqueue;
+struct thread;
+
+__BEGIN_DECLS
+struct pcpu_taskqueue *pcpu_taskqueue_create(const char *name, int nthreads);
+void pcpu_taskqueue_free(struct pcpu_taskqueue *tq);
+/* cpu < 0 queues on the current CPU */
+void pcpu_taskqueue_enqueue(struct pcpu_taskqueue *tq, struct task *task,
+    int cpu);
+int pcpu_taskqueue_member(struct pcpu_taskqueue *tq, struct thread *td);
+int pcpu_taskqueue_curcpu(void);
+__END_DECLS
+
+#endif
@@ -48,6 +48,8 @@ public:
 
     void wakeup_one(void* chan);
 
+    void wakeup_one_cpu(void* chan, unsigned cpu);
+
 private:
     static synch_port* _instance;
 
@@ -159,7 +161,29 @@ void synch_port::wakeup_one(void* chan)
     mutex_lock(&_lock);
     auto ppp = _evlist.equal_range(chan);
     auto it = ppp.first;
-    if (it != _evlist.end()) {
+    if (it != ppp.second) {
+        synch_thread* wait = (*it).second;
+        _evlist.erase(it);
+        trace_synch_wakeup_one_waking(chan, wait->_thread);
+        wait->_thread->wake_with([&] { wait->_awake = true; });
+    }
+    mutex_unlock(&_lock);
+}
+
+void synch_port::wakeup_one_cpu(void* chan, unsigned cpu)
+{
+    trace_synch_wakeup_one(chan);
+
+    mutex_lock(&_lock);
+    auto ppp = _evlist.equal_range(chan);
+    auto it = ppp.first;
+    for (auto i = ppp.first; i != ppp.second; ++i) {
+        if ((*i).second->_thread->tcpu()->id == cpu) {
+            it = i;
+            break;
+        }
+    }
+    if (it != ppp.second) {
         synch_thread* wait = (*it).second;
         _evlist.erase(it);
         trace_synch_wakeup_one_waking(chan, wait->_thread);
@@ -193,3 +217,8 @@ extern "C" void wakeup_one(void* chan)
 {
     synch_port::instance()->wakeup_one(chan);
 }
+
+extern "C" void wakeup_one_cpu(void* chan, unsigned cpu)
+{
+    synch_port::instance()->wakeup_one_cpu(chan, cpu);
+}
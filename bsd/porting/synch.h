@@ -26,6 +26,9 @@ void bsd_pause(const char *wmesg, int timo);
 void wakeup(void* chan);
 
 void wakeup_one(void* chan);
+
+/* wakeup_one(), preferring a thread sleeping on the given CPU */
+void wakeup_one_cpu(void* chan, unsigned cpu);
 __END_DECLS
 
 #endif
@@ -7,68 +7,341 @@
 
 #include <stdint.h>
 #include <assert.h>
+#include <algorithm>
+#include <vector>
 #include <machine/param.h>
 #include <bsd/porting/netport.h>
 #include <bsd/porting/uma_stub.h>
 #include <osv/preempt-lock.hh>
+#include <osv/mempool.hh>
+#include <osv/percpu-worker.hh>
 
-void* uma_zone::cache::alloc()
+typedef uma_zone::magazine magazine;
+
+// All zones, for the shrinker to go through
+static mutex zones_lock;
+static std::vector<uma_zone_t> zones;
+
+uma_zone::cache::~cache()
+{
+    delete loaded;
+    delete previous;
+}
+
+uma_zone::depot::~depot()
+{
+    for (auto list : { full, empty }) {
+        while (list) {
+            auto m = list;
+            list = m->next;
+            delete m;
+        }
+    }
+}
+
+static size_t zone_item_size(uma_zone_t zone)
+{
+    auto size = zone->uz_size;
+    if (zone->uz_flags & UMA_ZONE_REFCNT) {
+        size += UMA_ITEM_HDR_LEN;
+    }
+    return size;
+}
+
+// Frees an item that isn't cached anymore back to malloc
+static void zone_item_release(uma_zone_t zone, void* item)
+{
+    /*
+     * Because alloc_page is faster than our malloc in the current implementation,
+     * (if it ever change, we should revisit), it is worth it to take an alternate
+     * path if our size + refcnt_size is exactly a page
+     */
+    if (zone_item_size(zone) == PAGE_SIZE) {
+        memory::free_page(item);
+    } else {
+        free(item);
+    }
+
+    zone->uz_items.fetch_sub(1);
+    if (zone->uz_sleepers.load()) {
+        WITH_LOCK(zone->uz_lock) {
+            zone->uz_wq.wake_all(zone->uz_lock);
+        }
+    }
+}
+
+static void zone_item_free(uma_zone_t zone, void* item)
 {
-    if (len && !CONF_debug_memory) {
-        return a[--len];
+    if (zone->uz_fini) {
+        zone->uz_fini(item, zone->uz_size);
     }
-    return nullptr;
+    zone_item_release(zone, item);
 }
 
-bool uma_zone::cache::free(void* obj)
+static size_t depot_drain(uma_zone_t zone, size_t target);
+static void cache_flush();
+PCPU_WORKERITEM(uma_cache_flusher, cache_flush);
+
+// Accounts for a new item against the zone's limit, waiting for one to
+// be freed if the caller may sleep.
+static bool zone_item_reserve(uma_zone_t zone, int flags)
 {
-    if (len < max_size && !CONF_debug_memory) {
-        a[len++] = obj;
+    if (!zone->uz_max) {
+        zone->uz_items.fetch_add(1, std::memory_order_relaxed);
         return true;
     }
-    return false;
+    for (;;) {
+        int n = zone->uz_items.load();
+        if (n < zone->uz_max) {
+            if (zone->uz_items.compare_exchange_weak(n, n + 1)) {
+                return true;
+            }
+            continue;
+        }
+        // Items cached in the depot count against the limit too
+        if (depot_drain(zone, SIZE_MAX)) {
+            continue;
+        }
+        if (flags & M_NOWAIT) {
+            return false;
+        }
+        WITH_LOCK(zone->uz_lock) {
+            zone->uz_sleepers.fetch_add(1);
+            // The rest may be sitting in the CPUs' magazines, which only
+            // their own CPU may empty
+            for (auto cpu : sched::cpus) {
+                uma_cache_flusher.signal(cpu);
+            }
+            while (zone->uz_items.load() >= zone->uz_max) {
+                zone->uz_wq.wait(zone->uz_lock);
+            }
+            zone->uz_sleepers.fetch_sub(1);
+        }
+    }
 }
 
-void * uma_zalloc_arg(uma_zone_t zone, void *udata, int flags)
+static void* zone_item_alloc(uma_zone_t zone, int flags)
 {
-    void * ptr;
+    if (!zone_item_reserve(zone, flags)) {
+        return nullptr;
+    }
 
-    WITH_LOCK(preempt_lock) {
-        ptr = (*zone->percpu_cache)->alloc();
+    void* ptr;
+    if (zone_item_size(zone) == PAGE_SIZE) {
+        ptr = memory::alloc_page();
+    } else {
+        ptr = malloc(zone_item_size(zone));
     }
 
-    if (!ptr) {
-        auto size = zone->uz_size;
-        if (zone->uz_flags & UMA_ZONE_REFCNT) {
-            size += UMA_ITEM_HDR_LEN;
+    bzero(ptr, zone->uz_size);
+
+    // Call init
+    if (zone->uz_init != NULL) {
+        if (zone->uz_init(ptr, zone->uz_size, flags) != 0) {
+            zone_item_release(zone, ptr);
+            return (NULL);
         }
+    }
+    return ptr;
+}
 
-        /*
-         * Because alloc_page is faster than our malloc in the current implementation,
-         * (if it ever change, we should revisit), it is worth it to take an alternate
-         * path if our size + refcnt_size is exactly a page
-         */
-        if (size == PAGE_SIZE) {
-            ptr = memory::alloc_page();
-        } else {
-            ptr = malloc(size);
+// Takes a cached item, swapping our empty magazines for a full one from
+// the depot if need be. Called with preemption disabled.
+static void* cache_alloc(uma_zone_t zone, uma_zone::cache* c)
+{
+    if (CONF_debug_memory) {
+        return nullptr;
+    }
+    if (c->loaded && !c->loaded->empty()) {
+        return c->loaded->items[--c->loaded->len];
+    }
+    if (c->previous && !c->previous->empty()) {
+        std::swap(c->loaded, c->previous);
+        return c->loaded->items[--c->loaded->len];
+    }
+
+    auto& d = zone->uz_depot;
+    magazine* m = nullptr;
+    WITH_LOCK(d.lock) {
+        if (d.full) {
+            m = d.full;
+            d.full = m->next;
+            d.nfull--;
+            if (c->previous) {
+                c->previous->next = d.empty;
+                d.empty = c->previous;
+            }
         }
+    }
+    if (!m) {
+        return nullptr;
+    }
+    c->previous = c->loaded;
+    c->loaded = m;
+    return m->items[--m->len];
+}
 
-        bzero(ptr, zone->uz_size);
+// Caches a freed item, swapping our full magazines for an empty one from
+// the depot if need be. Called with preemption disabled; returns false if
+// the depot has no empty magazine to give.
+static bool cache_free(uma_zone_t zone, uma_zone::cache* c, void* item)
+{
+    if (CONF_debug_memory) {
+        return false;
+    }
+    if (c->loaded && !c->loaded->full()) {
+        c->loaded->items[c->loaded->len++] = item;
+        return true;
+    }
+    if (c->previous && !c->previous->full()) {
+        std::swap(c->loaded, c->previous);
+        c->loaded->items[c->loaded->len++] = item;
+        return true;
+    }
+
+    auto& d = zone->uz_depot;
+    magazine* m = nullptr;
+    WITH_LOCK(d.lock) {
+        if (d.empty) {
+            m = d.empty;
+            d.empty = m->next;
+            if (c->previous) {
+                c->previous->next = d.full;
+                d.full = c->previous;
+                d.nfull++;
+            }
+        }
+    }
+    if (!m) {
+        return false;
+    }
+    c->previous = c->loaded;
+    c->loaded = m;
+    m->items[m->len++] = item;
+    return true;
+}
+
+// Returns the items of the depot's full magazines, up to @target bytes'
+// worth of them, to malloc.
+static size_t depot_drain(uma_zone_t zone, size_t target)
+{
+    auto& d = zone->uz_depot;
+    size_t released = 0;
+
+    while (released < target) {
+        magazine* m = nullptr;
+        WITH_LOCK(d.lock) {
+            if (d.full) {
+                m = d.full;
+                d.full = m->next;
+                d.nfull--;
+            }
+        }
+        if (!m) {
+            break;
+        }
+        for (unsigned i = 0; i < m->len; i++) {
+            zone_item_free(zone, m->items[i]);
+        }
+        released += m->len * zone_item_size(zone) + sizeof(*m);
+        delete m;
+    }
+
+    // Empty magazines are only worth keeping while there are full ones
+    // to exchange them with
+    magazine* empty = nullptr;
+    WITH_LOCK(d.lock) {
+        if (!d.full) {
+            empty = d.empty;
+            d.empty = nullptr;
+        }
+    }
+    while (empty) {
+        auto m = empty;
+        empty = m->next;
+        released += sizeof(*m);
+        delete m;
+    }
+    return released;
+}
+
+// Frees the items of the current CPU's magazines of every zone somebody
+// waits on, as cached items still count against the zone's limit.
+static void cache_flush()
+{
+    WITH_LOCK(zones_lock) {
+        for (auto zone : zones) {
+            if (!zone->uz_sleepers.load(std::memory_order_relaxed)) {
+                continue;
+            }
+            magazine* ms[2];
+            WITH_LOCK(preempt_lock) {
+                auto c = (*zone->percpu_cache).get();
+                ms[0] = c->loaded;
+                ms[1] = c->previous;
+                c->loaded = c->previous = nullptr;
+            }
+            for (auto m : ms) {
+                if (m) {
+                    for (unsigned i = 0; i < m->len; i++) {
+                        zone_item_free(zone, m->items[i]);
+                    }
+                    delete m;
+                }
+            }
+        }
+    }
+}
+
+class uma_shrinker : public memory::shrinker {
+public:
+    uma_shrinker() : shrinker("UMA") {}
+    size_t request_memory(size_t s, bool hard);
+};
 
-        // Call init
-        if (zone->uz_init != NULL) {
-            if (zone->uz_init(ptr, zone->uz_size, flags) != 0) {
-                free(ptr);
-                return (NULL);
+size_t uma_shrinker::request_memory(size_t s, bool hard)
+{
+    size_t ret = 0;
+    WITH_LOCK(zones_lock) {
+        for (auto zone : zones) {
+            ret += depot_drain(zone, hard ? SIZE_MAX : s - std::min(s, ret));
+            if (!hard && ret >= s) {
+                break;
             }
         }
     }
+    return ret;
+}
+
+static void zone_register(uma_zone_t zone)
+{
+    static uma_shrinker* shrinker = new uma_shrinker;
+    (void)shrinker;
+
+    WITH_LOCK(zones_lock) {
+        zones.push_back(zone);
+    }
+}
+
+void * uma_zalloc_arg(uma_zone_t zone, void *udata, int flags)
+{
+    void * ptr;
+
+    WITH_LOCK(preempt_lock) {
+        ptr = cache_alloc(zone, (*zone->percpu_cache).get());
+    }
+
+    if (!ptr) {
+        ptr = zone_item_alloc(zone, flags);
+        if (!ptr) {
+            return (NULL);
+        }
+    }
 
     // Call ctor
     if (zone->uz_ctor != NULL) {
         if (zone->uz_ctor(ptr, zone->uz_size, udata, flags) != 0) {
-            free(ptr);
+            zone_item_free(zone, ptr);
             return (NULL);
         }
     }
@@ -99,25 +372,33 @@ void uma_zfree_arg(uma_zone_t zone, void *item, void *udata)
         zone->uz_dtor(item, zone->uz_size, udata);
     }
 
-    WITH_LOCK(preempt_lock) {
-        if ((*zone->percpu_cache)->free(item)) {
-            return;
-        }
+    // Someone is waiting for the zone to go below its limit, so this item
+    // can't be kept cached
+    if (zone->uz_sleepers.load(std::memory_order_relaxed)) {
+        zone_item_free(zone, item);
+        return;
     }
 
-    if (zone->uz_fini) {
-        zone->uz_fini(item, zone->uz_size);
+    for (;;) {
+        WITH_LOCK(preempt_lock) {
+            if (cache_free(zone, (*zone->percpu_cache).get(), item)) {
+                return;
+            }
+        }
+        if (CONF_debug_memory) {
+            break;
+        }
+        // Out of empty magazines; add one to the depot and retry, we may
+        // be on another CPU by now anyway.
+        auto m = new magazine;
+        auto& d = zone->uz_depot;
+        WITH_LOCK(d.lock) {
+            m->next = d.empty;
+            d.empty = m;
+        }
     }
 
-    auto effective_size = zone->uz_size;
-    if (zone->uz_flags)
-        effective_size += UMA_ITEM_HDR_LEN;
-
-    if (effective_size == PAGE_SIZE) {
-       memory::free_page(item);
-    } else {
-       free(item);
-    }
+    zone_item_free(zone, item);
 }
 
 void uma_zfree(uma_zone_t zone, void *item)
@@ -127,7 +408,7 @@ void uma_zfree(uma_zone_t zone, void *item)
 
 void zone_drain_wait(uma_zone_t zone, int waitok)
 {
-    /* Do nothing here */
+    depot_drain(zone, SIZE_MAX);
 }
 
 void zone_drain(uma_zone_t zone)
@@ -137,6 +418,7 @@ void zone_drain(uma_zone_t zone)
 
 int uma_zone_set_max(uma_zone_t zone, int nitems)
 {
+    zone->uz_max = nitems;
     return (nitems);
 }
 
@@ -160,6 +442,8 @@ uma_zone_t uma_zcreate(const char *name, size_t size, uma_ctor ctor,
     args.keg = NULL;
     */
 
+    zone_register(z);
+
     return (z);
 }
 
@@ -177,6 +461,8 @@ uma_zone_t uma_zsecond_create(char *name, uma_ctor ctor, uma_dtor dtor,
     z->master = master;
     z->uz_flags = master->uz_flags;
 
+    zone_register(z);
+
     return (z);
 }
 
@@ -188,12 +474,12 @@ void uma_zone_set_allocf(uma_zone_t zone, uma_alloc allocf)
 
 int uma_zone_exhausted(uma_zone_t zone)
 {
-    return 0;
+    return uma_zone_exhausted_nolock(zone);
 }
 
 int uma_zone_exhausted_nolock(uma_zone_t zone)
 {
-    return 0;
+    return zone->uz_max && zone->uz_items.load(std::memory_order_relaxed) >= zone->uz_max;
 }
 
 u_int32_t *uma_find_refcnt(uma_zone_t zone, void *item)
@@ -204,5 +490,24 @@ u_int32_t *uma_find_refcnt(uma_zone_t zone, void *item)
 
 void uma_zdestroy(uma_zone_t zone)
 {
+    WITH_LOCK(zones_lock) {
+        zones.erase(std::find(zones.begin(), zones.end(), zone));
+    }
+
+    // The zone must not be in use anymore, so other CPUs' caches are
+    // safe to empty from here.
+    for (auto cpu : sched::cpus) {
+        auto c = zone->percpu_cache.for_cpu(cpu)->get();
+        for (auto m : { c->loaded, c->previous }) {
+            if (m) {
+                for (unsigned i = 0; i < m->len; i++) {
+                    zone_item_free(zone, m->items[i]);
+                }
+                m->len = 0;
+            }
+        }
+    }
+    depot_drain(zone, SIZE_MAX);
+
     delete zone;
 }
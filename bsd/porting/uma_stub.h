@@ -158,21 +158,48 @@ struct uma_zone;
 
 #ifdef __cplusplus
 
+#include <atomic>
 #include <osv/percpu.hh>
+#include <osv/mutex.h>
+#include <osv/spinlock.h>
+#include <osv/waitqueue.hh>
 
+/*
+ * Freed items are kept, constructed but not fini()ed, in per-CPU
+ * magazines. Each CPU has two of them so that alternating allocations
+ * and frees don't bounce on a magazine boundary; when both are empty
+ * (or full) a whole magazine is exchanged with the zone's depot, which
+ * is how items freed on one CPU make their way to another.
+ */
 struct uma_zone {
     const char  *uz_name;   /* Text name of the zone */
 
+    struct magazine {
+        static constexpr unsigned max_size = 128;
+        unsigned len = 0;
+        magazine* next = nullptr;
+        void* items[max_size];
+        bool empty() const { return len == 0; }
+        bool full() const { return len == max_size; }
+    };
+
     struct cache {
-        static constexpr size_t max_size = 1000;
-        size_t len = 0;
-        void* a[max_size];
-        void* alloc();
-        bool free(void* obj);
+        magazine* loaded = nullptr;
+        magazine* previous = nullptr;
+        ~cache();
     };
 
     dynamic_percpu_indirect<cache> percpu_cache;
 
+    // Full and empty magazines not loaded on any CPU
+    struct depot {
+        spinlock_t lock;
+        magazine* full = nullptr;
+        magazine* empty = nullptr;
+        unsigned nfull = 0;
+        ~depot();
+    } uz_depot;
+
     uma_ctor    uz_ctor;    /* Constructor for each allocation */
     uma_dtor    uz_dtor;    /* Destructor */
     uma_init    uz_init;    /* Initializer for each item */
@@ -181,6 +208,14 @@ struct uma_zone {
     u_int32_t   uz_flags;   /* Flags inherited from kegs */
     u_int32_t   uz_size;    /* Size inherited from kegs */
 
+    /* Items allocated from malloc, whether in use or cached, and their limit */
+    std::atomic<int> uz_items { 0 };
+    int uz_max = 0;
+    /* M_WAITOK allocators waiting for uz_items to drop below uz_max */
+    std::atomic<int> uz_sleepers { 0 };
+    mutex uz_lock;
+    waitqueue uz_wq;
+
     /* zones can be nested (and called with multiple ctor?) */
     struct uma_zone* master;
 
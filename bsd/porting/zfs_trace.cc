@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#include <osv/trace.hh>
+#include "zfs_trace.h"
+
+TRACEPOINT(trace_zfs_vdev_queue, "vdev=%x class=%d queued=%d active=%d", uint64_t, int, int, int);
+TRACEPOINT(trace_zfs_vdev_queue_issue, "vdev=%x class=%d offset=%d size=%d aggregated=%d", uint64_t, int, uint64_t, uint64_t, int);
+TRACEPOINT(trace_zfs_zio_dispatch, "zio=%x type=%d taskq=%d cpu=%d", void*, int, int, int);
+// stage is the ZIO_STAGE_* bit; the time between a stage and its _ret is
+// the time spent in that pipeline stage.
+TRACEPOINT(trace_zfs_zio_stage, "zio=%x stage=%x", void*, int);
+TRACEPOINT(trace_zfs_zio_stage_ret, "zio=%x stage=%x rv=%d", void*, int, int);
+
+const bool *zfs_trace_vdev_queue_active = trace_zfs_vdev_queue.active_flag();
+const bool *zfs_trace_vdev_queue_issue_active = trace_zfs_vdev_queue_issue.active_flag();
+const bool *zfs_trace_zio_dispatch_active = trace_zfs_zio_dispatch.active_flag();
+const bool *zfs_trace_zio_stage_active = trace_zfs_zio_stage.active_flag();
+const bool *zfs_trace_zio_stage_ret_active = trace_zfs_zio_stage_ret.active_flag();
+
+void __zfs_trace_vdev_queue(uint64_t guid, int cls, int queued, int active)
+{
+    trace_zfs_vdev_queue(guid, cls, queued, active);
+}
+
+void __zfs_trace_vdev_queue_issue(uint64_t guid, int cls, uint64_t offset,
+    uint64_t size, int aggregated)
+{
+    trace_zfs_vdev_queue_issue(guid, cls, offset, size, aggregated);
+}
+
+void __zfs_trace_zio_dispatch(void *zio, int type, int taskq, int cpu)
+{
+    trace_zfs_zio_dispatch(zio, type, taskq, cpu);
+}
+
+void __zfs_trace_zio_stage(void *zio, int stage)
+{
+    trace_zfs_zio_stage(zio, stage);
+}
+
+void __zfs_trace_zio_stage_ret(void *zio, int stage, int rv)
+{
+    trace_zfs_zio_stage_ret(zio, stage, rv);
+}
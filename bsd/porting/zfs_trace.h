@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef _OSV_BSD_ZFS_TRACE_H
+#define _OSV_BSD_ZFS_TRACE_H
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <stdbool.h>
+
+/*
+ * Tracepoints can only be defined from C++, so the ZFS code calls these
+ * wrappers instead.  Each tests its tracepoint's active flag inline and
+ * only calls out of line when it is set, so a disabled tracepoint costs
+ * a load and a branch, as close as C gets to a patched call site.
+ */
+__BEGIN_DECLS
+extern const bool *zfs_trace_vdev_queue_active;
+extern const bool *zfs_trace_vdev_queue_issue_active;
+extern const bool *zfs_trace_zio_dispatch_active;
+extern const bool *zfs_trace_zio_stage_active;
+extern const bool *zfs_trace_zio_stage_ret_active;
+
+void __zfs_trace_vdev_queue(uint64_t guid, int cls, int queued, int active);
+void __zfs_trace_vdev_queue_issue(uint64_t guid, int cls, uint64_t offset,
+    uint64_t size, int aggregated);
+void __zfs_trace_zio_dispatch(void *zio, int type, int taskq, int cpu);
+void __zfs_trace_zio_stage(void *zio, int stage);
+void __zfs_trace_zio_stage_ret(void *zio, int stage, int rv);
+__END_DECLS
+
+static inline void
+zfs_trace_vdev_queue(uint64_t guid, int cls, int queued, int active)
+{
+	if (__builtin_expect(*zfs_trace_vdev_queue_active, 0))
+		__zfs_trace_vdev_queue(guid, cls, queued, active);
+}
+
+static inline void
+zfs_trace_vdev_queue_issue(uint64_t guid, int cls, uint64_t offset,
+    uint64_t size, int aggregated)
+{
+	if (__builtin_expect(*zfs_trace_vdev_queue_issue_active, 0))
+		__zfs_trace_vdev_queue_issue(guid, cls, offset, size, aggregated);
+}
+
+static inline void
+zfs_trace_zio_dispatch(void *zio, int type, int taskq, int cpu)
+{
+	if (__builtin_expect(*zfs_trace_zio_dispatch_active, 0))
+		__zfs_trace_zio_dispatch(zio, type, taskq, cpu);
+}
+
+static inline void
+zfs_trace_zio_stage(void *zio, int stage)
+{
+	if (__builtin_expect(*zfs_trace_zio_stage_active, 0))
+		__zfs_trace_zio_stage(zio, stage);
+}
+
+static inline void
+zfs_trace_zio_stage_ret(void *zio, int stage, int rv)
+{
+	if (__builtin_expect(*zfs_trace_zio_stage_ret_active, 0))
+		__zfs_trace_zio_stage_ret(zio, stage, rv);
+}
+
+#endif
@@ -35,6 +35,7 @@
 #include <sys/queue.h>
 #include <sys/taskqueue.h>
 #include <sys/taskq.h>
+#include <bsd/porting/pcpu_taskqueue.h>
 
 static uma_zone_t taskq_zone;
 
@@ -70,11 +71,24 @@ taskq_create(const char *name, int nthreads, pri_t pri, int minalloc __unused2,
 	tq = kmem_alloc(sizeof(*tq), KM_SLEEP);
 	tq->tq_queue = taskqueue_create(name, M_WAITOK, taskqueue_thread_enqueue,
 	    &tq->tq_queue);
+	tq->tq_pcpu = NULL;
 	(void) taskqueue_start_threads(&tq->tq_queue, nthreads, pri, "%s", name);
 
 	return ((taskq_t *)tq);
 }
 
+taskq_t *
+taskq_create_pcpu(const char *name, int nthreads)
+{
+	taskq_t *tq;
+
+	tq = kmem_alloc(sizeof(*tq), KM_SLEEP);
+	tq->tq_queue = NULL;
+	tq->tq_pcpu = pcpu_taskqueue_create(name, nthreads);
+
+	return ((taskq_t *)tq);
+}
+
 taskq_t *
 taskq_create_proc(const char *name, int nthreads, pri_t pri, int minalloc,
     int maxalloc, proc_t *proc __unused2, uint_t flags)
@@ -87,7 +101,10 @@ void
 taskq_destroy(taskq_t *tq)
 {
 
-	taskqueue_free(tq->tq_queue);
+	if (tq->tq_pcpu != NULL)
+		pcpu_taskqueue_free(tq->tq_pcpu);
+	else
+		taskqueue_free(tq->tq_queue);
 	kmem_free(tq, sizeof(*tq));
 }
 
@@ -95,9 +112,28 @@ int
 taskq_member(taskq_t *tq, kthread_t *thread)
 {
 
+	if (tq->tq_pcpu != NULL)
+		return (pcpu_taskqueue_member(tq->tq_pcpu, thread));
 	return (taskqueue_member(tq->tq_queue, thread));
 }
 
+int
+taskq_curcpu(void)
+{
+
+	return (pcpu_taskqueue_curcpu());
+}
+
+static void
+taskq_enqueue(taskq_t *tq, struct task *task, int cpu)
+{
+
+	if (tq->tq_pcpu != NULL)
+		pcpu_taskqueue_enqueue(tq->tq_pcpu, task, cpu);
+	else
+		taskqueue_enqueue(tq->tq_queue, task);
+}
+
 static void
 taskq_run(void *arg, int pending __unused2)
 {
@@ -132,7 +168,7 @@ taskq_dispatch(taskq_t *tq, task_func_t func, void *arg, uint_t flags)
 	task->ost_arg = arg;
 
 	TASK_INIT(&task->ost_task, prio, taskq_run, task);
-	taskqueue_enqueue(tq->tq_queue, &task->ost_task);
+	taskq_enqueue(tq, &task->ost_task, TASKQ_ANYCPU);
 
 	return ((taskqid_t)(void *)task);
 }
@@ -151,6 +187,19 @@ taskqid_t
 taskq_dispatch_safe(taskq_t *tq, task_func_t func, void *arg, u_int flags,
     struct ostask *task)
 {
+
+	return (taskq_dispatch_safe_cpu(tq, func, arg, flags, task,
+	    TASKQ_ANYCPU));
+}
+
+/*
+ * Like taskq_dispatch_safe(), but for per-CPU taskqs also choose the CPU
+ * the task should run on.  Other taskqs ignore cpu.
+ */
+taskqid_t
+taskq_dispatch_safe_cpu(taskq_t *tq, task_func_t func, void *arg, u_int flags,
+    struct ostask *task, int cpu)
+{
 	int prio;
 
 	/* 
@@ -163,7 +212,7 @@ taskq_dispatch_safe(taskq_t *tq, task_func_t func, void *arg, u_int flags,
 	task->ost_arg = arg;
 
 	TASK_INIT(&task->ost_task, prio, taskq_run_safe, task);
-	taskqueue_enqueue(tq->tq_queue, &task->ost_task);
+	taskq_enqueue(tq, &task->ost_task, cpu);
 
 	return ((taskqid_t)(void *)task);
 }
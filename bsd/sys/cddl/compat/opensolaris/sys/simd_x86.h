@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef _COMPAT_OPENSOLARIS_SYS_SIMD_X86_H
+#define	_COMPAT_OPENSOLARIS_SYS_SIMD_X86_H
+
+#include <sys/cdefs.h>
+
+/*
+ * Instruction set extensions the vectorized checksum code may use, as
+ * detected by the OSv CPUID code (see bsd/porting/cpu.cc).  All of them
+ * may be used from any thread: the FPU state is saved on interrupts and
+ * preemption.  That state is saved with fxsave, so AVX, whose upper
+ * register halves it doesn't cover, is not offered.
+ */
+__BEGIN_DECLS
+int zfs_sse2_available(void);
+int zfs_ssse3_available(void);
+int zfs_shani_available(void);
+__END_DECLS
+
+#endif	/* _COMPAT_OPENSOLARIS_SYS_SIMD_X86_H */
@@ -40,4 +40,13 @@ struct ostask {
 taskqid_t taskq_dispatch_safe(taskq_t *tq, task_func_t func, void *arg,
     u_int flags, struct ostask *task);
 
+/*
+ * A taskq with nthreads workers per CPU.  Tasks are run on the CPU they are
+ * dispatched to, unless it is busy and another CPU is idle.
+ */
+taskq_t *taskq_create_pcpu(const char *name, int nthreads);
+taskqid_t taskq_dispatch_safe_cpu(taskq_t *tq, task_func_t func, void *arg,
+    u_int flags, struct ostask *task, int cpu);
+int taskq_curcpu(void);
+
 #endif	/* _OPENSOLARIS_SYS_TASKQ_H_ */
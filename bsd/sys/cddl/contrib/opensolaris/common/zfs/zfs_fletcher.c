@@ -130,6 +130,7 @@
 #include <sys/byteorder.h>
 #include <sys/zio.h>
 #include <sys/spa.h>
+#include <zfs_fletcher.h>
 
 void
 fletcher_2_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
@@ -165,8 +166,8 @@ fletcher_2_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	ZIO_SET_CHECKSUM(zcp, a0, a1, b0, b1);
 }
 
-void
-fletcher_4_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+static void
+fletcher_4_scalar_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
 {
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
@@ -182,8 +183,8 @@ fletcher_4_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
 }
 
-void
-fletcher_4_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+static void
+fletcher_4_scalar_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
 {
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
@@ -244,3 +245,76 @@ fletcher_4_incremental_byteswap(const void *buf, uint64_t size,
 
 	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
 }
+
+static const fletcher_4_ops_t fletcher_4_scalar_ops = {
+	.compute_native = fletcher_4_scalar_native,
+	.compute_byteswap = fletcher_4_scalar_byteswap,
+	.valid = NULL,
+	.name = "scalar",
+};
+
+/*
+ * Architectures with vectorized implementations define this list; the
+ * weak reference resolves to NULL everywhere else.
+ */
+#pragma weak fletcher_4_arch_impls
+
+static const fletcher_4_ops_t *fletcher_4_selected = &fletcher_4_scalar_ops;
+
+int
+fletcher_4_impl_count(void)
+{
+	int n = 1;
+
+	if (fletcher_4_arch_impls != NULL) {
+		while (fletcher_4_arch_impls[n - 1] != NULL)
+			n++;
+	}
+	return (n);
+}
+
+const fletcher_4_ops_t *
+fletcher_4_impl(int i)
+{
+	ASSERT(i >= 0 && i < fletcher_4_impl_count());
+	if (i == 0)
+		return (&fletcher_4_scalar_ops);
+	return (fletcher_4_arch_impls[i - 1]);
+}
+
+const fletcher_4_ops_t *
+fletcher_4_impl_selected(void)
+{
+	return (fletcher_4_selected);
+}
+
+/*
+ * Called once at boot, before any checksum is computed: use the last, i.e.
+ * fastest, implementation the cpu supports.
+ */
+void
+fletcher_4_init(void)
+{
+	int n = fletcher_4_impl_count();
+
+	for (int i = n - 1; i > 0; i--) {
+		const fletcher_4_ops_t *ops = fletcher_4_impl(i);
+
+		if (ops->valid == NULL || ops->valid()) {
+			fletcher_4_selected = ops;
+			break;
+		}
+	}
+}
+
+void
+fletcher_4_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	fletcher_4_selected->compute_native(buf, size, zcp);
+}
+
+void
+fletcher_4_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	fletcher_4_selected->compute_byteswap(buf, size, zcp);
+}
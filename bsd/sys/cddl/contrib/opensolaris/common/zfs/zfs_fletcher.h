@@ -46,6 +46,26 @@ void fletcher_4_incremental_native(const void *, uint64_t,
 void fletcher_4_incremental_byteswap(const void *, uint64_t,
     zio_cksum_t *);
 
+/*
+ * fletcher_4_native() and fletcher_4_byteswap() use the fastest of the
+ * implementations below that the cpu supports, picked by fletcher_4_init().
+ * Implementation 0 is the portable scalar one; the others come from
+ * fletcher_4_arch_impls, slowest first, if the architecture provides any.
+ */
+typedef struct fletcher_4_ops {
+	void (*compute_native)(const void *, uint64_t, zio_cksum_t *);
+	void (*compute_byteswap)(const void *, uint64_t, zio_cksum_t *);
+	boolean_t (*valid)(void);
+	const char *name;
+} fletcher_4_ops_t;
+
+extern const fletcher_4_ops_t *const fletcher_4_arch_impls[];
+
+void fletcher_4_init(void);
+int fletcher_4_impl_count(void);
+const fletcher_4_ops_t *fletcher_4_impl(int);
+const fletcher_4_ops_t *fletcher_4_impl_selected(void);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+/*
+ * Vectorized fletcher-4 for x86_64.
+ *
+ * Fletcher-4 is a serial computation, but it can be split into N
+ * interleaved streams: stream i accumulates words i, N + i, 2N + i, ...
+ * in its own set of 64-bit (a, b, c, d) sums, which fit N to a vector
+ * register each.  Once the whole buffer has been consumed, the scalar
+ * result is a linear combination of the per-stream sums (see
+ * fletcher_4_fini2()); as every operation is done modulo 2^64 the result
+ * is bit for bit the one of the scalar loop.
+ *
+ * There is no AVX2 version: OSv saves the FPU state with fxsave, which
+ * doesn't cover the upper halves of the ymm registers.
+ *
+ * Any trailing words that don't fill a vector are added with the scalar
+ * incremental code.
+ */
+
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/byteorder.h>
+#include <sys/zio.h>
+#include <sys/spa.h>
+#include <sys/simd_x86.h>
+#include <zfs_fletcher.h>
+
+#include <immintrin.h>
+
+/*
+ * Scalar result of 2 interleaved streams.
+ */
+static void
+fletcher_4_fini2(const uint64_t *a, const uint64_t *b, const uint64_t *c,
+    const uint64_t *d, zio_cksum_t *zcp)
+{
+	uint64_t A, B, C, D;
+
+	A = a[0] + a[1];
+	B = 2 * b[0] + 2 * b[1] - a[1];
+	C = 4 * c[0] - b[0] + 4 * c[1] - 3 * b[1];
+	D = 8 * d[0] - 4 * c[0] + 8 * d[1] - 8 * c[1] + b[1];
+
+	ZIO_SET_CHECKSUM(zcp, A, B, C, D);
+}
+
+static void
+fletcher_4_tail_native(const void *buf, uint64_t size, uint64_t done,
+    zio_cksum_t *zcp)
+{
+	if (done < size)
+		fletcher_4_incremental_native((const char *)buf + done,
+		    size - done, zcp);
+}
+
+static void
+fletcher_4_tail_byteswap(const void *buf, uint64_t size, uint64_t done,
+    zio_cksum_t *zcp)
+{
+	if (done < size)
+		fletcher_4_incremental_byteswap((const char *)buf + done,
+		    size - done, zcp);
+}
+
+/*
+ * SSE2: 2 streams of 64-bit sums, each 16-byte load feeds both streams
+ * twice.
+ */
+#define	FLETCHER_4_SSE2_STEP(v)						\
+do {									\
+	a = _mm_add_epi64(a, (v));					\
+	b = _mm_add_epi64(b, a);					\
+	c = _mm_add_epi64(c, b);					\
+	d = _mm_add_epi64(d, c);					\
+} while (0)
+
+#define	FLETCHER_4_SSE2_FINI(zcp)					\
+do {									\
+	uint64_t sa[2], sb[2], sc[2], sd[2];				\
+									\
+	_mm_storeu_si128((__m128i *)sa, a);				\
+	_mm_storeu_si128((__m128i *)sb, b);				\
+	_mm_storeu_si128((__m128i *)sc, c);				\
+	_mm_storeu_si128((__m128i *)sd, d);				\
+	fletcher_4_fini2(sa, sb, sc, sd, (zcp));			\
+} while (0)
+
+static inline __m128i
+bswap32_sse2(__m128i v)
+{
+	__m128i t;
+
+	/* swap the 16-bit halves, then the bytes within them */
+	t = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+	return (_mm_or_si128(_mm_slli_epi16(t, 8), _mm_srli_epi16(t, 8)));
+}
+
+static void
+fletcher_4_sse2_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	const __m128i *ip = buf;
+	const __m128i *ipend = ip + size / sizeof (__m128i);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero, b = zero, c = zero, d = zero;
+
+	for (; ip < ipend; ip++) {
+		__m128i v = _mm_loadu_si128(ip);
+
+		FLETCHER_4_SSE2_STEP(_mm_unpacklo_epi32(v, zero));
+		FLETCHER_4_SSE2_STEP(_mm_unpackhi_epi32(v, zero));
+	}
+
+	FLETCHER_4_SSE2_FINI(zcp);
+	fletcher_4_tail_native(buf, size, P2ALIGN(size, sizeof (__m128i)),
+	    zcp);
+}
+
+static void
+fletcher_4_sse2_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	const __m128i *ip = buf;
+	const __m128i *ipend = ip + size / sizeof (__m128i);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero, b = zero, c = zero, d = zero;
+
+	for (; ip < ipend; ip++) {
+		__m128i v = bswap32_sse2(_mm_loadu_si128(ip));
+
+		FLETCHER_4_SSE2_STEP(_mm_unpacklo_epi32(v, zero));
+		FLETCHER_4_SSE2_STEP(_mm_unpackhi_epi32(v, zero));
+	}
+
+	FLETCHER_4_SSE2_FINI(zcp);
+	fletcher_4_tail_byteswap(buf, size, P2ALIGN(size, sizeof (__m128i)),
+	    zcp);
+}
+
+static boolean_t
+fletcher_4_sse2_valid(void)
+{
+	return (zfs_sse2_available());
+}
+
+static const fletcher_4_ops_t fletcher_4_sse2_ops = {
+	.compute_native = fletcher_4_sse2_native,
+	.compute_byteswap = fletcher_4_sse2_byteswap,
+	.valid = fletcher_4_sse2_valid,
+	.name = "sse2",
+};
+
+/*
+ * SSSE3: same as SSE2, but the byte swap is a single pshufb.
+ */
+static void __attribute__((target("ssse3")))
+fletcher_4_ssse3_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	const __m128i *ip = buf;
+	const __m128i *ipend = ip + size / sizeof (__m128i);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+	    4, 5, 6, 7, 0, 1, 2, 3);
+	__m128i a = zero, b = zero, c = zero, d = zero;
+
+	for (; ip < ipend; ip++) {
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128(ip), mask);
+
+		FLETCHER_4_SSE2_STEP(_mm_unpacklo_epi32(v, zero));
+		FLETCHER_4_SSE2_STEP(_mm_unpackhi_epi32(v, zero));
+	}
+
+	FLETCHER_4_SSE2_FINI(zcp);
+	fletcher_4_tail_byteswap(buf, size, P2ALIGN(size, sizeof (__m128i)),
+	    zcp);
+}
+
+static boolean_t
+fletcher_4_ssse3_valid(void)
+{
+	return (zfs_ssse3_available());
+}
+
+static const fletcher_4_ops_t fletcher_4_ssse3_ops = {
+	.compute_native = fletcher_4_sse2_native,
+	.compute_byteswap = fletcher_4_ssse3_byteswap,
+	.valid = fletcher_4_ssse3_valid,
+	.name = "ssse3",
+};
+
+const fletcher_4_ops_t *const fletcher_4_arch_impls[] = {
+	&fletcher_4_sse2_ops,
+	&fletcher_4_ssse3_ops,
+	NULL
+};
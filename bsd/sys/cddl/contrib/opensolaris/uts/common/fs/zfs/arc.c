@@ -130,6 +130,7 @@
 #endif
 #include <sys/callb.h>
 #include <sys/kstat.h>
+#include <sys/zio_compress.h>
 #include <zfs_fletcher.h>
 #include <sys/sdt.h>
 
@@ -201,6 +202,21 @@ SYSCTL_UQUAD(_vfs_zfs, OID_AUTO, arc_max, CTLFLAG_RDTUN, &zfs_arc_max, 0,
 SYSCTL_UQUAD(_vfs_zfs, OID_AUTO, arc_min, CTLFLAG_RDTUN, &zfs_arc_min, 0,
     "Minimum ARC size");
 
+/*
+ * With compressed ARC enabled, compressed blocks are read from disk in
+ * their on-disk form, which is kept in the header.  The decompressed
+ * buffer only lives while the block is referenced: once the last
+ * reference goes, it is freed and the header stays in the MRU or MFU
+ * state with just the compressed copy, so that a cached block costs its
+ * physical size.  A hit on such a header decompresses the copy again.
+ * Evicting the header drops the copy, and the header becomes a plain
+ * ghost.
+ */
+int zfs_compressed_arc_enabled = 0;
+TUNABLE_INT("vfs.zfs.compressed_arc_enabled", &zfs_compressed_arc_enabled);
+SYSCTL_INT(_vfs_zfs, OID_AUTO, compressed_arc_enabled, CTLFLAG_RW,
+    &zfs_compressed_arc_enabled, 0, "Keep compressed blocks in the ARC");
+
 /*
  * Note that buffers can be in one of 6 states:
  *	ARC_anon	- anonymous (discussed below)
@@ -303,6 +319,9 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_hdr_size;
 	kstat_named_t arcstat_data_size;
 	kstat_named_t arcstat_other_size;
+	kstat_named_t arcstat_compressed_size;
+	kstat_named_t arcstat_uncompressed_size;
+	kstat_named_t arcstat_compressed_hits;
 	kstat_named_t arcstat_l2_hits;
 	kstat_named_t arcstat_l2_misses;
 	kstat_named_t arcstat_l2_feeds;
@@ -373,6 +392,9 @@ static arc_stats_t arc_stats = {
 	{ "hdr_size",			KSTAT_DATA_UINT64 },
 	{ "data_size",			KSTAT_DATA_UINT64 },
 	{ "other_size",			KSTAT_DATA_UINT64 },
+	{ "compressed_size",		KSTAT_DATA_UINT64 },
+	{ "uncompressed_size",		KSTAT_DATA_UINT64 },
+	{ "compressed_hits",		KSTAT_DATA_UINT64 },
 	{ "l2_hits",			KSTAT_DATA_UINT64 },
 	{ "l2_misses",			KSTAT_DATA_UINT64 },
 	{ "l2_feeds",			KSTAT_DATA_UINT64 },
@@ -534,6 +556,11 @@ struct arc_buf_hdr {
 	l2arc_buf_hdr_t		*b_l2hdr;
 	list_node_t		b_l2node;
 
+	/* on-disk copy of the block, protected by hash lock */
+	void			*b_cdata;
+	uint32_t		b_psize;
+	enum zio_compress	b_compress;
+
 	uint32_t         b_mmaped;
 };
 
@@ -1219,7 +1246,8 @@ add_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 			ASSERT3P(ab->b_buf, ==, NULL);
 			delta = ab->b_size;
 		}
-		ASSERT(delta > 0);
+		/* a block only cached compressed has no data in the lists */
+		ASSERT(delta > 0 || ab->b_cdata != NULL);
 		ASSERT3U(*size, >=, delta);
 		atomic_add_64(size, -delta);
 		mutex_exit(lock);
@@ -1405,6 +1433,58 @@ arc_space_return(uint64_t space, arc_space_type_t type)
 	atomic_add_64(&arc_size, -space);
 }
 
+/*
+ * Set up hdr to keep the on-disk form of bp, if it is worth it.  On
+ * success the caller reads the block raw into hdr->b_cdata and
+ * arc_read_done() decompresses it into the hdr's buffer.
+ */
+static boolean_t
+arc_cdata_alloc(arc_buf_hdr_t *hdr, const blkptr_t *bp)
+{
+	uint64_t psize = BP_GET_PSIZE(bp);
+
+	ASSERT(HDR_IO_IN_PROGRESS(hdr));
+	ASSERT(hdr->b_cdata == NULL);
+
+	if (!zfs_compressed_arc_enabled ||
+	    BP_GET_COMPRESS(bp) == ZIO_COMPRESS_OFF ||
+	    psize >= hdr->b_size || BP_IS_GANG(bp) || BP_GET_DEDUP(bp) ||
+	    BP_SHOULD_BYTESWAP(bp))
+		return (B_FALSE);
+
+	hdr->b_cdata = zio_buf_alloc(psize);
+	hdr->b_psize = psize;
+	hdr->b_compress = BP_GET_COMPRESS(bp);
+	ARCSTAT_INCR(arcstat_compressed_size, psize);
+	ARCSTAT_INCR(arcstat_uncompressed_size, hdr->b_size);
+	atomic_add_64(&arc_size, psize);
+	return (B_TRUE);
+}
+
+static void
+arc_cdata_free(arc_buf_hdr_t *hdr)
+{
+	if (hdr->b_cdata == NULL)
+		return;
+
+	zio_buf_free(hdr->b_cdata, hdr->b_psize);
+	ARCSTAT_INCR(arcstat_compressed_size, -hdr->b_psize);
+	ARCSTAT_INCR(arcstat_uncompressed_size, -hdr->b_size);
+	ASSERT(arc_size >= hdr->b_psize);
+	atomic_add_64(&arc_size, -hdr->b_psize);
+	hdr->b_cdata = NULL;
+	hdr->b_psize = 0;
+	hdr->b_compress = ZIO_COMPRESS_OFF;
+}
+
+static int
+arc_cdata_decompress(arc_buf_hdr_t *hdr, arc_buf_t *buf)
+{
+	ASSERT(hdr->b_cdata != NULL);
+	return (zio_decompress_data(hdr->b_compress, hdr->b_cdata,
+	    buf->b_data, hdr->b_psize, hdr->b_size));
+}
+
 void *
 arc_data_buf_alloc(uint64_t size)
 {
@@ -1512,7 +1592,9 @@ arc_buf_accessed(const uint64_t hashkey[4])
 	if (!hdr)
 		return;
 
-	if (hdr->b_state != arc_anon) {
+	/* a block only cached compressed is not mapped */
+	if (hdr->b_state != arc_anon &&
+	    (hdr->b_datacnt > 0 || GHOST_STATE(hdr->b_state))) {
 		add_reference(hdr, hash_lock, "accessed");
 		arc_access(hdr, hash_lock);
 		remove_reference(hdr, hash_lock, "accessed");
@@ -1754,6 +1836,7 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 			arc_buf_destroy(hdr->b_buf, FALSE, TRUE);
 		}
 	}
+	arc_cdata_free(hdr);
 	if (hdr->b_freeze_cksum != NULL) {
 		kmem_free(hdr->b_freeze_cksum, sizeof (zio_cksum_t));
 		hdr->b_freeze_cksum = NULL;
@@ -1769,6 +1852,91 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 	kmem_cache_free(hdr_cache, hdr);
 }
 
+/*
+ * Free the decompressed buffers of a block that has its compressed copy,
+ * now that nobody references it.  The header stays where it is, with
+ * only the copy, until arc_cdata_restore() or eviction.  Buffers with a
+ * user callback go to the eviction list, as in arc_evict().  A block that
+ * is mapped into an application, being written to the L2ARC or whose
+ * buffer is busy keeps its data.
+ */
+static void
+arc_cdata_release(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
+{
+	ASSERT(MUTEX_HELD(hash_lock));
+
+	if (hdr->b_cdata == NULL || hdr->b_mmaped ||
+	    !refcount_is_zero(&hdr->b_refcnt) ||
+	    (hdr->b_state != arc_mru && hdr->b_state != arc_mfu) ||
+	    HDR_IO_IN_PROGRESS(hdr) || HDR_L2_WRITING(hdr))
+		return;
+
+	while (hdr->b_buf) {
+		arc_buf_t *buf = hdr->b_buf;
+
+		if (!mutex_tryenter(&buf->b_evict_lock))
+			return;
+		if (buf->b_efunc) {
+			mutex_enter(&arc_eviction_mtx);
+			arc_buf_destroy(buf, FALSE, FALSE);
+			hdr->b_buf = buf->b_next;
+			buf->b_hdr = &arc_eviction_hdr;
+			buf->b_next = arc_eviction_list;
+			arc_eviction_list = buf;
+			mutex_exit(&arc_eviction_mtx);
+			mutex_exit(&buf->b_evict_lock);
+		} else {
+			mutex_exit(&buf->b_evict_lock);
+			arc_buf_destroy(buf, FALSE, TRUE);
+		}
+	}
+	hdr->b_flags &= ~ARC_BUF_AVAILABLE;
+}
+
+/*
+ * Give a block that is only cached compressed its decompressed buffer
+ * back, for a hit on it.  Returns B_FALSE if hdr is not such a block; if
+ * the copy can't be decompressed, hdr also becomes a ghost.
+ */
+static boolean_t
+arc_cdata_restore(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
+{
+	arc_buf_t *buf;
+
+	ASSERT(MUTEX_HELD(hash_lock));
+
+	if (hdr->b_cdata == NULL || GHOST_STATE(hdr->b_state))
+		return (B_FALSE);
+	ASSERT(hdr->b_state == arc_mru || hdr->b_state == arc_mfu);
+	ASSERT0(hdr->b_datacnt);
+	ASSERT3P(hdr->b_buf, ==, NULL);
+
+	/* off the list, or arc_get_data_buf() could evict it */
+	add_reference(hdr, hash_lock, "restore");
+	buf = kmem_cache_alloc(buf_cache, KM_PUSHPAGE);
+	buf->b_hdr = hdr;
+	buf->b_data = NULL;
+	buf->b_efunc = NULL;
+	buf->b_private = NULL;
+	buf->b_next = NULL;
+	hdr->b_buf = buf;
+	hdr->b_datacnt = 1;
+	arc_get_data_buf(buf);
+	if (arc_cdata_decompress(hdr, buf) != 0) {
+		(void) remove_reference(hdr, hash_lock, "restore");
+		arc_buf_destroy(buf, FALSE, TRUE);
+		arc_change_state(hdr->b_state == arc_mru ?
+		    arc_mru_ghost : arc_mfu_ghost, hdr, hash_lock);
+		arc_cdata_free(hdr);
+		return (B_FALSE);
+	}
+	arc_cksum_compute(buf, B_FALSE);
+	hdr->b_flags |= ARC_BUF_AVAILABLE;
+	(void) remove_reference(hdr, hash_lock, "restore");
+	ARCSTAT_BUMP(arcstat_compressed_hits);
+	return (B_TRUE);
+}
+
 void
 arc_buf_free(arc_buf_t *buf, void *tag)
 {
@@ -1793,6 +1961,7 @@ arc_buf_free(arc_buf_t *buf, void *tag)
 			ASSERT(buf->b_efunc == NULL);
 			hdr->b_flags |= ARC_BUF_AVAILABLE;
 		}
+		arc_cdata_release(hdr, hash_lock);
 		mutex_exit(hash_lock);
 	} else if (HDR_IO_IN_PROGRESS(hdr)) {
 		int destroy_hdr;
@@ -1846,6 +2015,7 @@ arc_buf_remove_ref(arc_buf_t *buf, void* tag)
 	}
 	ASSERT(no_callback || hdr->b_datacnt > 1 ||
 	    refcount_is_zero(&hdr->b_refcnt));
+	arc_cdata_release(hdr, hash_lock);
 	mutex_exit(hash_lock);
 	return (no_callback);
 }
@@ -1934,7 +2104,7 @@ evict_start:
 		have_lock = MUTEX_HELD(hash_lock);
 		if (have_lock || mutex_tryenter(hash_lock)) {
 			ASSERT0(refcount_count(&ab->b_refcnt));
-			ASSERT(ab->b_datacnt > 0);
+			ASSERT(ab->b_datacnt > 0 || ab->b_cdata != NULL);
 			while (ab->b_buf) {
 				arc_buf_t *buf = ab->b_buf;
 				if (!mutex_tryenter(&buf->b_evict_lock)) {
@@ -1987,6 +2157,11 @@ evict_start:
 				ab->b_flags |= ARC_IN_HASH_TABLE;
 				ab->b_flags &= ~ARC_BUF_AVAILABLE;
 				DTRACE_PROBE1(arc__evict, arc_buf_hdr_t *, ab);
+				/* ghosts keep no data, compressed or not */
+				if (ab->b_cdata != NULL) {
+					bytes_evicted += ab->b_psize;
+					arc_cdata_free(ab);
+				}
 			}
 			if (!have_lock)
 				mutex_exit(hash_lock);
@@ -2170,6 +2345,52 @@ evict_start:
 		    (longlong_t)bytes_deleted, state);
 }
 
+/*
+ * Evict the blocks of state that are only cached compressed, oldest
+ * first, until the specified number of bytes has been freed.  They add
+ * nothing to the list sizes that drive arc_evict(), so arc_sized_adjust()
+ * calls this when the cache is still over its target after it.
+ */
+static int64_t
+arc_evict_compressed(arc_state_t *state, int64_t bytes)
+{
+	arc_state_t *evicted_state;
+	arc_buf_hdr_t *ab, *ab_prev;
+	kmutex_t *hash_lock, *lock;
+	list_t *list;
+	int64_t bytes_freed = 0;
+	int i;
+
+	ASSERT(state == arc_mru || state == arc_mfu);
+	evicted_state = (state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
+
+	for (i = 0; i < ARC_BUFC_NUMLISTS && bytes_freed < bytes; i++) {
+		list = &state->arcs_lists[i];
+		lock = ARCS_LOCK(state, i);
+
+		mutex_enter(lock);
+		for (ab = list_tail(list); ab && bytes_freed < bytes;
+		    ab = ab_prev) {
+			ab_prev = list_prev(list, ab);
+			/* markers have no data and a zero spa */
+			if (ab->b_cdata == NULL || ab->b_datacnt != 0 ||
+			    ab->b_spa == 0)
+				continue;
+			hash_lock = HDR_LOCK(ab);
+			if (MUTEX_HELD(hash_lock) || !mutex_tryenter(hash_lock))
+				continue;
+			if (ab->b_cdata != NULL && ab->b_datacnt == 0) {
+				bytes_freed += ab->b_psize;
+				arc_change_state(evicted_state, ab, hash_lock);
+				arc_cdata_free(ab);
+			}
+			mutex_exit(hash_lock);
+		}
+		mutex_exit(lock);
+	}
+	return (bytes_freed);
+}
+
 size_t
 arc_sized_adjust(int64_t to_reclaim)
 {
@@ -2244,6 +2465,21 @@ arc_sized_adjust(int64_t to_reclaim)
 		arc_evict_ghost(arc_mfu_ghost, 0, delta);
 	}
 
+	/*
+	 * Blocks only cached compressed are not in the list sizes the
+	 * passes above go by.  Evict them if that was not enough.
+	 */
+	adjustment = MAX((int64_t)(arc_size - arc_c), to_reclaim);
+
+	if (adjustment > 0 && ARCSTAT(arcstat_compressed_size) > 0) {
+		freed = arc_evict_compressed(arc_mru, adjustment);
+		if (freed < adjustment)
+			freed += arc_evict_compressed(arc_mfu,
+			    adjustment - freed);
+		if (to_reclaim > 0)
+			to_reclaim -= freed;
+	}
+
 	return old_to_reclaim - to_reclaim;
 }
 
@@ -2945,6 +3181,14 @@ arc_read_done(zio_t *zio)
 	if (l2arc_noprefetch && (hdr->b_flags & ARC_PREFETCH))
 		hdr->b_flags &= ~ARC_L2CACHE;
 
+	/* the block was read raw into the compressed copy, expand it */
+	if (hdr->b_cdata != NULL) {
+		if (zio->io_error == 0 && arc_cdata_decompress(hdr, buf) != 0)
+			zio->io_error = EIO;
+		if (zio->io_error != 0)
+			arc_cdata_free(hdr);
+	}
+
 	/* byteswap if necessary */
 	callback_list = hdr->b_acb;
 	ASSERT(callback_list != NULL);
@@ -3010,6 +3254,7 @@ arc_read_done(zio_t *zio)
 	cv_broadcast(&hdr->b_cv);
 
 	if (hash_lock) {
+		arc_cdata_release(hdr, hash_lock);
 		mutex_exit(hash_lock);
 	} else {
 		/*
@@ -3103,7 +3348,10 @@ arc_read_nolock(zio_t *pio, spa_t *spa, const blkptr_t *bp,
 top:
 	hdr = buf_hash_find(guid, BP_IDENTITY(bp), BP_PHYSICAL_BIRTH(bp),
 	    &hash_lock);
-	if (hdr && hdr->b_datacnt > 0) {
+	/* a prefetch hit on a compressed block leaves it compressed */
+	if (hdr && (hdr->b_datacnt > 0 ||
+	    (hdr->b_cdata != NULL && !GHOST_STATE(hdr->b_state) &&
+	    (done == NULL || arc_cdata_restore(hdr, hash_lock))))) {
 
 		*arc_flags |= ARC_CACHED;
 
@@ -3339,8 +3587,14 @@ top:
 			}
 		}
 
-		rzio = zio_read(pio, spa, bp, buf->b_data, size,
-		    arc_read_done, buf, priority, zio_flags, zb);
+		if (arc_cdata_alloc(hdr, bp)) {
+			rzio = zio_read(pio, spa, bp, hdr->b_cdata,
+			    hdr->b_psize, arc_read_done, buf, priority,
+			    zio_flags | ZIO_FLAG_RAW, zb);
+		} else {
+			rzio = zio_read(pio, spa, bp, buf->b_data, size,
+			    arc_read_done, buf, priority, zio_flags, zb);
+		}
 
 		if (*arc_flags & ARC_WAIT)
 			return (zio_wait(rzio));
@@ -3542,6 +3796,7 @@ arc_release(arc_buf_t *buf, void *tag)
 		nhdr->b_arc_access = 0;
 		nhdr->b_flags = flags & ARC_L2_WRITING;
 		nhdr->b_l2hdr = NULL;
+		nhdr->b_cdata = NULL;
 		nhdr->b_datacnt = 1;
 		nhdr->b_freeze_cksum = NULL;
 		(void) refcount_add(&nhdr->b_refcnt, tag);
@@ -3556,6 +3811,7 @@ arc_release(arc_buf_t *buf, void *tag)
 		if (hdr->b_state != arc_anon)
 			arc_change_state(arc_anon, hdr, hash_lock);
 		hdr->b_arc_access = 0;
+		arc_cdata_free(hdr);
 		if (hash_lock)
 			mutex_exit(hash_lock);
 
@@ -4315,6 +4571,9 @@ l2arc_write_eligible(uint64_t spa_guid, arc_buf_hdr_t *ab)
 		ARCSTAT_BUMP(arcstat_l2_write_not_cacheable);
 		return (B_FALSE);
 	}
+	/* only cached compressed, there is no data to write */
+	if (ab->b_buf == NULL)
+		return (B_FALSE);
 
 	return (B_TRUE);
 }
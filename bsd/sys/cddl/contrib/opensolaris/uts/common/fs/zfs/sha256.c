@@ -24,14 +24,15 @@
  */
 #include <sys/zfs_context.h>
 #include <sys/zio.h>
+#include <sys/zio_checksum.h>
 #ifdef _KERNEL
 #include <crypto/sha2/sha2.h>
 #else
 #include <sha256.h>
 #endif
 
-void
-zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
+static void
+zio_checksum_SHA256_generic(const void *buf, uint64_t size, zio_cksum_t *zcp)
 {
 	SHA256_CTX ctx;
 	zio_cksum_t tmp;
@@ -52,3 +53,107 @@ zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	zcp->zc_word[2] = BE_64(tmp.zc_word[2]);
 	zcp->zc_word[3] = BE_64(tmp.zc_word[3]);
 }
+
+static const zio_sha256_ops_t zio_sha256_generic_ops = {
+	.compute = zio_checksum_SHA256_generic,
+	.valid = NULL,
+	.name = "generic",
+};
+
+/*
+ * Architectures with accelerated implementations define this list; the
+ * weak reference resolves to NULL everywhere else.
+ */
+#pragma weak zio_sha256_arch_impls
+
+static const zio_sha256_ops_t *zio_sha256_selected = &zio_sha256_generic_ops;
+
+int
+zio_sha256_impl_count(void)
+{
+	int n = 1;
+
+	if (zio_sha256_arch_impls != NULL) {
+		while (zio_sha256_arch_impls[n - 1] != NULL)
+			n++;
+	}
+	return (n);
+}
+
+const zio_sha256_ops_t *
+zio_sha256_impl(int i)
+{
+	ASSERT(i >= 0 && i < zio_sha256_impl_count());
+	if (i == 0)
+		return (&zio_sha256_generic_ops);
+	return (zio_sha256_arch_impls[i - 1]);
+}
+
+const zio_sha256_ops_t *
+zio_sha256_impl_selected(void)
+{
+	return (zio_sha256_selected);
+}
+
+/*
+ * Called once at boot, before any checksum is computed: use the last, i.e.
+ * fastest, implementation the cpu supports.
+ */
+void
+zio_checksum_SHA256_init(void)
+{
+	int n = zio_sha256_impl_count();
+
+	for (int i = n - 1; i > 0; i--) {
+		const zio_sha256_ops_t *ops = zio_sha256_impl(i);
+
+		if (ops->valid == NULL || ops->valid()) {
+			zio_sha256_selected = ops;
+			break;
+		}
+	}
+}
+
+/*
+ * SHA-256 of buf, using a block transform provided by an accelerated
+ * implementation; the message padding is done here.  The result has the
+ * same layout as zio_checksum_SHA256_generic()'s.
+ */
+void
+zio_checksum_SHA256_transform(zio_sha256_transform_t *transform,
+    const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	uint32_t H[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	uint8_t pad[2 * SHA256_BLOCK_LENGTH];
+	uint64_t nblocks = size / SHA256_BLOCK_LENGTH;
+	uint64_t rest = size % SHA256_BLOCK_LENGTH;
+	uint64_t padlen, bits = size << 3;
+	int i;
+
+	transform(H, buf, nblocks);
+
+	/*
+	 * The message is followed by a 1 bit, zeroes, and its length in bits
+	 * as a big endian 64-bit number, up to a block boundary.
+	 */
+	padlen = (rest < SHA256_BLOCK_LENGTH - 8) ?
+	    SHA256_BLOCK_LENGTH : 2 * SHA256_BLOCK_LENGTH;
+	bcopy((const char *)buf + nblocks * SHA256_BLOCK_LENGTH, pad, rest);
+	pad[rest] = 0x80;
+	bzero(pad + rest + 1, padlen - rest - 1 - 8);
+	for (i = 0; i < 8; i++)
+		pad[padlen - 1 - i] = bits >> (8 * i);
+	transform(H, pad, padlen / SHA256_BLOCK_LENGTH);
+
+	for (i = 0; i < 4; i++)
+		zcp->zc_word[i] = ((uint64_t)H[2 * i] << 32) | H[2 * i + 1];
+}
+
+void
+zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	zio_sha256_selected->compute(buf, size, zcp);
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+/*
+ * SHA-256 block transform using the x86 SHA extensions (SHA-NI).
+ *
+ * The state is kept in two registers in the order sha256rnds2 wants it,
+ * ABEF and CDGH; each sha256rnds2 does two rounds, and the message
+ * schedule is computed four words at a time with sha256msg1/sha256msg2.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/zio.h>
+#include <sys/zio_checksum.h>
+#include <sys/simd_x86.h>
+
+#include <immintrin.h>
+
+static const uint32_t sha256_k[64] __attribute__((aligned(16))) = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void __attribute__((target("sha,ssse3,sse4.1")))
+sha256_shani_transform(uint32_t *state, const void *blocks, uint64_t nblocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+	    0x0405060700010203ULL);
+	const __m128i *ip = blocks;
+	__m128i state0, state1, abef, cdgh, msg[4], t;
+	int i;
+
+	/* a b c d, e f g h -> a b e f, c d g h (highest word first) */
+	t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]),
+	    0xb1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]),
+	    0x1b);
+	state0 = _mm_alignr_epi8(t, state1, 8);
+	state1 = _mm_blend_epi16(state1, t, 0xf0);
+
+	for (; nblocks > 0; nblocks--, ip += 4) {
+		abef = state0;
+		cdgh = state1;
+
+		for (i = 0; i < 4; i++)
+			msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(ip + i),
+			    bswap);
+
+		/* 16 groups of 4 rounds */
+		for (i = 0; i < 16; i++) {
+			__m128i w = msg[i & 3];
+
+			t = _mm_add_epi32(w, _mm_load_si128(
+			    (const __m128i *)&sha256_k[4 * i]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, t);
+			t = _mm_shuffle_epi32(t, 0x0e);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, t);
+
+			/* W[4i+16..4i+19] replaces W[4i..4i+3] */
+			if (i < 12) {
+				__m128i w1 = msg[(i + 1) & 3];
+				__m128i w2 = msg[(i + 2) & 3];
+				__m128i w3 = msg[(i + 3) & 3];
+
+				w = _mm_sha256msg1_epu32(w, w1);
+				w = _mm_add_epi32(w, _mm_alignr_epi8(w3, w2, 4));
+				msg[i & 3] = _mm_sha256msg2_epu32(w, w3);
+			}
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+	}
+
+	/* back to a b c d, e f g h */
+	t = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	state0 = _mm_blend_epi16(t, state1, 0xf0);
+	state1 = _mm_alignr_epi8(state1, t, 8);
+	_mm_storeu_si128((__m128i *)&state[0], state0);
+	_mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+static void
+zio_checksum_SHA256_shani(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	zio_checksum_SHA256_transform(sha256_shani_transform, buf, size, zcp);
+}
+
+static boolean_t
+zio_sha256_shani_valid(void)
+{
+	return (zfs_shani_available());
+}
+
+static const zio_sha256_ops_t zio_sha256_shani_ops = {
+	.compute = zio_checksum_SHA256_shani,
+	.valid = zio_sha256_shani_valid,
+	.name = "shani",
+};
+
+const zio_sha256_ops_t *const zio_sha256_arch_impls[] = {
+	&zio_sha256_shani_ops,
+	NULL
+};
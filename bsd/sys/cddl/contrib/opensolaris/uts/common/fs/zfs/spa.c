@@ -84,6 +84,7 @@ typedef enum zti_modes {
 	ZTI_MODE_FIXED,			/* value is # of threads (min 1) */
 	ZTI_MODE_ONLINE_PERCENT,	/* value is % of online CPUs */
 	ZTI_MODE_BATCH,			/* cpu-intensive; value is ignored */
+	ZTI_MODE_PERCPU,		/* value is # of threads per CPU */
 	ZTI_MODE_NULL,			/* don't create a taskq */
 	ZTI_NMODES
 } zti_modes_t;
@@ -91,6 +92,7 @@ typedef enum zti_modes {
 #define	ZTI_P(n, q)	{ ZTI_MODE_FIXED, (n), (q) }
 #define	ZTI_PCT(n)	{ ZTI_MODE_ONLINE_PERCENT, (n), 1 }
 #define	ZTI_BATCH	{ ZTI_MODE_BATCH, 0, 1 }
+#define	ZTI_PCPU(n)	{ ZTI_MODE_PERCPU, (n), 1 }
 #define	ZTI_NULL	{ ZTI_MODE_NULL, 0, 0 }
 
 #define	ZTI_N(n)	ZTI_P(n, 1)
@@ -122,12 +124,20 @@ static const char *const zio_taskq_types[ZIO_TASKQ_TYPES] = {
  * The different taskq priorities are to handle the different contexts (issue
  * and interrupt) and then to reserve threads for ZIO_PRIORITY_NOW I/Os that
  * need to be handled with minimum delay.
+ *
+ * The stages that do the bulk of the CPU work -- compression and checksum
+ * generation when issuing writes, checksum verification and decompression
+ * when reads complete -- run on ZTI_PCPU(#) taskqs: # threads pinned to
+ * each CPU, fed by a queue per CPU.  A zio is dispatched to the CPU it last
+ * ran on, so its data stays in that CPU's cache, and idle CPUs steal from
+ * busy ones.  Write completion mostly runs callbacks which may block, so it
+ * keeps its large fixed pool.
  */
 const zio_taskq_info_t zio_taskqs[ZIO_TYPES][ZIO_TASKQ_TYPES] = {
 	/* ISSUE	ISSUE_HIGH	INTR		INTR_HIGH */
 	{ ZTI_ONE,	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* NULL */
-	{ ZTI_N(8),	ZTI_NULL,	ZTI_BATCH,	ZTI_NULL }, /* READ */
-	{ ZTI_BATCH,	ZTI_N(5),	ZTI_N(16),	ZTI_N(5) }, /* WRITE */
+	{ ZTI_N(8),	ZTI_NULL,	ZTI_PCPU(1),	ZTI_NULL }, /* READ */
+	{ ZTI_PCPU(1),	ZTI_N(5),	ZTI_N(16),	ZTI_N(5) }, /* WRITE */
 	{ ZTI_P(4, 8),	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* FREE */
 	{ ZTI_ONE,	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* CLAIM */
 	{ ZTI_ONE,	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* IOCTL */
@@ -867,6 +877,10 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 			flags |= TASKQ_THREADS_CPU_PCT;
 			break;
 
+		case ZTI_MODE_PERCPU:
+			ASSERT3U(value, >=, 1);
+			break;
+
 		default:
 			panic("unrecognized mode for %s_%s taskq (%u:%u) in "
 			    "spa_activate()",
@@ -882,6 +896,19 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 			    zio_type_name[t], zio_taskq_types[q]);
 		}
 
+#ifdef _KERNEL
+		if (mode == ZTI_MODE_PERCPU) {
+			tq = taskq_create_pcpu(name, value);
+			tqs->stqs_taskq[i] = tq;
+			continue;
+		}
+#else
+		if (mode == ZTI_MODE_PERCPU) {
+			flags |= TASKQ_THREADS_CPU_PCT;
+			value *= 100;
+		}
+#endif
+
 #ifdef SYSDC
 		if (zio_taskq_sysdc && spa->spa_proc != &p0) {
 			if (batch)
@@ -924,11 +951,12 @@ spa_taskqs_fini(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
  * Dispatch a task to the appropriate taskq for the ZFS I/O type and priority.
  * Note that a type may have multiple discrete taskqs to avoid lock contention
  * on the taskq itself. In that case we choose which taskq at random by using
- * the low bits of gethrtime().
+ * the low bits of gethrtime().  Per-CPU taskqs run the task on cpu, or the
+ * current CPU for TASKQ_ANYCPU.
  */
 void
 spa_taskq_dispatch_ent(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
-    task_func_t *func, void *arg, uint_t flags, void *task)
+    task_func_t *func, void *arg, uint_t flags, void *task, int cpu)
 {
 	spa_taskqs_t *tqs = &spa->spa_zio_taskq[t][q];
 	taskq_t *tq;
@@ -943,7 +971,8 @@ spa_taskq_dispatch_ent(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
 	}
 
 #ifdef _KERNEL
-	(void) taskq_dispatch_safe(tq, func, arg, flags, (struct ostask *)task);
+	(void) taskq_dispatch_safe_cpu(tq, func, arg, flags,
+	    (struct ostask *)task, cpu);
 #else
 	(void) taskq_dispatch(tq, func, arg, flags);
 #endif
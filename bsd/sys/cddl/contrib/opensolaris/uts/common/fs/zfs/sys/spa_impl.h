@@ -248,7 +248,7 @@ struct spa {
 extern const char *spa_config_path;
 
 extern void spa_taskq_dispatch_ent(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
-	task_func_t *func, void *arg, uint_t flags, void *ent);
+	task_func_t *func, void *arg, uint_t flags, void *ent, int cpu);
 
 #ifdef	__cplusplus
 }
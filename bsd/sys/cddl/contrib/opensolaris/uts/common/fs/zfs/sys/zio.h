@@ -139,6 +139,19 @@ enum zio_compress {
 #define	ZIO_PRIORITY_DDT_PREFETCH	(zio_priority_table[11])
 #define	ZIO_PRIORITY_TABLE_SIZE		12
 
+/*
+ * Scheduling classes of the vdev queue; see vdev_queue.c.  Every queued i/o
+ * is assigned one from its type, priority and flags.
+ */
+typedef enum zio_queue_class {
+	ZIO_QUEUE_SYNC_READ,
+	ZIO_QUEUE_SYNC_WRITE,
+	ZIO_QUEUE_ASYNC_READ,
+	ZIO_QUEUE_ASYNC_WRITE,
+	ZIO_QUEUE_SCRUB,
+	ZIO_QUEUE_NUM_CLASSES
+} zio_queue_class_t;
+
 #define	ZIO_PIPELINE_CONTINUE		0x100
 #define	ZIO_PIPELINE_STOP		0x101
 
@@ -407,10 +420,10 @@ struct zio {
 	const zio_vsd_ops_t *io_vsd_ops;
 
 	uint64_t	io_offset;
-	uint64_t	io_deadline;
+	hrtime_t	io_timestamp;
+	avl_node_t	io_queue_node;
 	avl_node_t	io_offset_node;
-	avl_node_t	io_deadline_node;
-	avl_tree_t	*io_vdev_tree;
+	zio_queue_class_t io_queue_class;
 
 	/* Internal pipeline state */
 	enum zio_flag	io_flags;
@@ -429,6 +442,7 @@ struct zio {
 	zio_gang_node_t	*io_gang_tree;
 	void		*io_executor;
 	void		*io_waiter;
+	int		io_cpu;		/* CPU the pipeline last ran on */
 	kmutex_t	io_lock;
 	kcondvar_t	io_cv;
 
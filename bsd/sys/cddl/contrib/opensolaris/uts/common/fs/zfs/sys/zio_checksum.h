@@ -63,6 +63,30 @@ extern zio_checksum_info_t zio_checksum_table[ZIO_CHECKSUM_FUNCTIONS];
  */
 extern zio_checksum_t zio_checksum_SHA256;
 
+/*
+ * SHA-256 implementations.  zio_checksum_SHA256() uses the fastest one the
+ * cpu supports, picked by zio_checksum_SHA256_init().  Implementation 0 is
+ * the portable one; the others come from zio_sha256_arch_impls, slowest
+ * first, if the architecture provides any.
+ */
+typedef void zio_sha256_transform_t(uint32_t *state, const void *blocks,
+    uint64_t nblocks);
+
+typedef struct zio_sha256_ops {
+	zio_checksum_t	*compute;
+	boolean_t	(*valid)(void);
+	const char	*name;
+} zio_sha256_ops_t;
+
+extern const zio_sha256_ops_t *const zio_sha256_arch_impls[];
+
+extern void zio_checksum_SHA256_init(void);
+extern int zio_sha256_impl_count(void);
+extern const zio_sha256_ops_t *zio_sha256_impl(int);
+extern const zio_sha256_ops_t *zio_sha256_impl_selected(void);
+extern void zio_checksum_SHA256_transform(zio_sha256_transform_t *,
+    const void *, uint64_t, zio_cksum_t *);
+
 extern void zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
     void *data, uint64_t size);
 extern int zio_checksum_error(zio_t *zio, zio_bad_cksum_t *out);
@@ -25,26 +25,119 @@
 
 #include <sys/zfs_context.h>
 #include <sys/vdev_impl.h>
+#include <sys/spa.h>
+#include <sys/dsl_pool.h>
 #include <sys/zio.h>
 #include <sys/avl.h>
+#include <bsd/porting/zfs_trace.h>
 
 /*
- * These tunables are for performance analysis.
+ * ZFS I/O Scheduler
+ * ---------------
+ *
+ * ZFS issues I/O operations to leaf vdevs to satisfy and complete zios.  The
+ * I/O scheduler determines when and in what order those operations are
+ * issued.  The I/O scheduler divides operations into five I/O classes
+ * prioritized in the following order: sync read, sync write, async read,
+ * async write, and scrub/resilver.  Each queue defines the minimum and
+ * maximum number of concurrent operations that may be issued to the device.
+ * In addition, the device has an aggregate maximum.  Note that the sum of the
+ * per-queue minimums must not exceed the aggregate maximum, and if the
+ * aggregate maximum is equal to or greater than the sum of the per-queue
+ * maximums, the per-queue minimum has no effect.
+ *
+ * For many physical devices, throughput increases with the number of
+ * concurrent operations, but latency typically suffers.  Further, physical
+ * devices typically have a limit at which more concurrent operations have no
+ * effect on throughput or can actually cause it to decrease.
+ *
+ * The scheduler selects the next operation to issue by first looking for an
+ * I/O class whose minimum has not been satisfied.  Once all are satisfied and
+ * the aggregate maximum has not been hit, the scheduler looks for classes
+ * whose maximum has not been satisfied.  Iteration through the I/O classes is
+ * done in the order specified above.  No further operations are issued if
+ * the aggregate maximum number of concurrent operations has been hit or if
+ * there are no operations queued for an I/O class that has not hit its
+ * maximum.  Every time an I/O is queued or an operation completes, the I/O
+ * scheduler looks for new operations to issue.
+ *
+ * The class of an i/o is derived from its type, its ZIO_PRIORITY_* value and
+ * its scrub/resilver flags (see vdev_queue_class()).  Sync i/os are issued
+ * in the order they were queued, async i/os in LBA order, continuing from
+ * the end of the last i/o issued to the device.
+ *
+ * The number of concurrent async writes is not static: it is scaled by the
+ * amount of dirty data in the pool, i.e. the space reserved or waiting to be
+ * written in the open and syncing txgs, relative to the pool's write limit
+ * (see dsl_pool_tempreserve_space()).  With little dirty data, only
+ * zfs_vdev_async_write_min_active writes are issued at once so that they
+ * interfere as little as possible with reads; as dirty data grows towards
+ * the write limit the count ramps up linearly to
+ * zfs_vdev_async_write_max_active, so the txg can be written out before
+ * writers get throttled:
+ *
+ *        |              o---------| <-- zfs_vdev_async_write_max_active
+ *   ^    |             /^         |
+ *   |    |            / |         |
+ * active |           /  |         |
+ *  I/O   |          /   |         |
+ * count  |         /    |         |
+ *        |        /     |         |
+ *        |-------o      |         | <-- zfs_vdev_async_write_min_active
+ *       0|_______^______|_________|
+ *        0%      |      |       100% of write limit
+ *                |      |
+ *                |      `-- zfs_vdev_async_write_active_max_dirty_percent
+ *                `--------- zfs_vdev_async_write_active_min_dirty_percent
+ *
+ * Adjacent i/os queued to the device, whatever their class, are aggregated
+ * into a single larger operation as long as they are of the same type and
+ * flavor and the result doesn't exceed zfs_vdev_aggregation_limit.
  */
+
 /*
- * zfs_vdev_max_pending is the maximum number of i/os concurrently
- * pending to each device.  zfs_vdev_min_pending is the initial number
- * of i/os pending to each device (before it starts ramping up to
- * max_pending).
+ * The maximum number of i/os active to each device.  Ideally, this will be >=
+ * the sum of each queue's max_active.  It must be at least the sum of each
+ * queue's min_active.
  */
-int zfs_vdev_max_pending = 10;
-int zfs_vdev_min_pending = 4;
+int zfs_vdev_max_active = 1000;
 
-/* deadline = pri + ddi_get_lbolt64() >> time_shift) */
-int zfs_vdev_time_shift = 6;
+/*
+ * Per-queue limits on the number of i/os active to each device.  If the
+ * sum of the queue's max_active is < zfs_vdev_max_active, then the
+ * min_active comes into play.  We will send min_active from each queue,
+ * and then select from queues in the order defined by zio_queue_class_t.
+ *
+ * In general, smaller max_active's will lead to lower latency of synchronous
+ * operations.  Larger max_active's may lead to higher overall throughput,
+ * depending on underlying storage.
+ *
+ * The ratio of the queues' max_actives determines the balance of performance
+ * between reads, writes, and scrubs.  E.g., increasing
+ * zfs_vdev_scrub_max_active will cause the scrub or resilver to complete
+ * more quickly, but reads and writes to have higher latency and lower
+ * throughput.
+ */
+int zfs_vdev_sync_read_min_active = 10;
+int zfs_vdev_sync_read_max_active = 10;
+int zfs_vdev_sync_write_min_active = 10;
+int zfs_vdev_sync_write_max_active = 10;
+int zfs_vdev_async_read_min_active = 1;
+int zfs_vdev_async_read_max_active = 3;
+int zfs_vdev_async_write_min_active = 1;
+int zfs_vdev_async_write_max_active = 10;
+int zfs_vdev_scrub_min_active = 1;
+int zfs_vdev_scrub_max_active = 2;
 
-/* exponential I/O issue ramp-up rate */
-int zfs_vdev_ramp_rate = 2;
+/*
+ * When the pool has less than zfs_vdev_async_write_active_min_dirty_percent
+ * dirty data, use zfs_vdev_async_write_min_active.  When it has more than
+ * zfs_vdev_async_write_active_max_dirty_percent, use
+ * zfs_vdev_async_write_max_active. The value is linearly interpolated
+ * between min and max.
+ */
+int zfs_vdev_async_write_active_min_dirty_percent = 30;
+int zfs_vdev_async_write_active_max_dirty_percent = 60;
 
 /*
  * To reduce IOPs, we aggregate small adjacent I/Os into one large I/O.
@@ -56,20 +149,56 @@ int zfs_vdev_aggregation_limit = SPA_MAXBLOCKSIZE;
 int zfs_vdev_read_gap_limit = 32 << 10;
 int zfs_vdev_write_gap_limit = 4 << 10;
 
+extern uint64_t zfs_write_limit_override;
+
 SYSCTL_DECL(_vfs_zfs_vdev);
-TUNABLE_INT("vfs.zfs.vdev.max_pending", &zfs_vdev_max_pending);
-SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, max_pending, CTLFLAG_RW,
-    &zfs_vdev_max_pending, 0, "Maximum I/O requests pending on each device");
-TUNABLE_INT("vfs.zfs.vdev.min_pending", &zfs_vdev_min_pending);
-SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, min_pending, CTLFLAG_RW,
-    &zfs_vdev_min_pending, 0,
-    "Initial number of I/O requests pending to each device");
-TUNABLE_INT("vfs.zfs.vdev.time_shift", &zfs_vdev_time_shift);
-SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, time_shift, CTLFLAG_RW,
-    &zfs_vdev_time_shift, 0, "Used for calculating I/O request deadline");
-TUNABLE_INT("vfs.zfs.vdev.ramp_rate", &zfs_vdev_ramp_rate);
-SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, ramp_rate, CTLFLAG_RW,
-    &zfs_vdev_ramp_rate, 0, "Exponential I/O issue ramp-up rate");
+TUNABLE_INT("vfs.zfs.vdev.max_active", &zfs_vdev_max_active);
+SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, max_active, CTLFLAG_RW,
+    &zfs_vdev_max_active, 0,
+    "The maximum number of i/os of all types active for each device.");
+
+#define	ZFS_VDEV_QUEUE_KNOB_MIN(name)					\
+TUNABLE_INT("vfs.zfs.vdev." #name "_min_active",			\
+    &zfs_vdev_ ## name ## _min_active);					\
+SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, name ## _min_active, CTLFLAG_RW,	\
+    &zfs_vdev_ ## name ## _min_active, 0,				\
+    "Initial number of I/O requests of type " #name			\
+    " active for each device")
+
+#define	ZFS_VDEV_QUEUE_KNOB_MAX(name)					\
+TUNABLE_INT("vfs.zfs.vdev." #name "_max_active",			\
+    &zfs_vdev_ ## name ## _max_active);					\
+SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, name ## _max_active, CTLFLAG_RW,	\
+    &zfs_vdev_ ## name ## _max_active, 0,				\
+    "Maximum number of I/O requests of type " #name			\
+    " active for each device")
+
+ZFS_VDEV_QUEUE_KNOB_MIN(sync_read);
+ZFS_VDEV_QUEUE_KNOB_MAX(sync_read);
+ZFS_VDEV_QUEUE_KNOB_MIN(sync_write);
+ZFS_VDEV_QUEUE_KNOB_MAX(sync_write);
+ZFS_VDEV_QUEUE_KNOB_MIN(async_read);
+ZFS_VDEV_QUEUE_KNOB_MAX(async_read);
+ZFS_VDEV_QUEUE_KNOB_MIN(async_write);
+ZFS_VDEV_QUEUE_KNOB_MAX(async_write);
+ZFS_VDEV_QUEUE_KNOB_MIN(scrub);
+ZFS_VDEV_QUEUE_KNOB_MAX(scrub);
+
+#undef ZFS_VDEV_QUEUE_KNOB_MIN
+#undef ZFS_VDEV_QUEUE_KNOB_MAX
+
+TUNABLE_INT("vfs.zfs.vdev.async_write_active_min_dirty_percent",
+    &zfs_vdev_async_write_active_min_dirty_percent);
+SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, async_write_active_min_dirty_percent,
+    CTLFLAG_RW, &zfs_vdev_async_write_active_min_dirty_percent, 0,
+    "Dirty data percentage of the write limit below which the minimum "
+    "number of async writes is issued");
+TUNABLE_INT("vfs.zfs.vdev.async_write_active_max_dirty_percent",
+    &zfs_vdev_async_write_active_max_dirty_percent);
+SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, async_write_active_max_dirty_percent,
+    CTLFLAG_RW, &zfs_vdev_async_write_active_max_dirty_percent, 0,
+    "Dirty data percentage of the write limit above which the maximum "
+    "number of async writes is issued");
 TUNABLE_INT("vfs.zfs.vdev.aggregation_limit", &zfs_vdev_aggregation_limit);
 SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, aggregation_limit, CTLFLAG_RW,
     &zfs_vdev_aggregation_limit, 0,
@@ -87,16 +216,11 @@ SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, write_gap_limit, CTLFLAG_RW,
  * Virtual device vector for disk I/O scheduling.
  */
 int
-vdev_queue_deadline_compare(const void *x1, const void *x2)
+vdev_queue_offset_compare(const void *x1, const void *x2)
 {
 	const zio_t *z1 = x1;
 	const zio_t *z2 = x2;
 
-	if (z1->io_deadline < z2->io_deadline)
-		return (-1);
-	if (z1->io_deadline > z2->io_deadline)
-		return (1);
-
 	if (z1->io_offset < z2->io_offset)
 		return (-1);
 	if (z1->io_offset > z2->io_offset)
@@ -111,14 +235,14 @@ vdev_queue_deadline_compare(const void *x1, const void *x2)
 }
 
 int
-vdev_queue_offset_compare(const void *x1, const void *x2)
+vdev_queue_timestamp_compare(const void *x1, const void *x2)
 {
 	const zio_t *z1 = x1;
 	const zio_t *z2 = x2;
 
-	if (z1->io_offset < z2->io_offset)
+	if (z1->io_timestamp < z2->io_timestamp)
 		return (-1);
-	if (z1->io_offset > z2->io_offset)
+	if (z1->io_timestamp > z2->io_timestamp)
 		return (1);
 
 	if (z1 < z2)
@@ -129,24 +253,42 @@ vdev_queue_offset_compare(const void *x1, const void *x2)
 	return (0);
 }
 
+/*
+ * The synchronous i/o queues are FIFO rather than LBA ordered.  This
+ * provides more consistent latency for these i/os, and they tend to not be
+ * tightly clustered anyway so there is little to no throughput loss.
+ */
+static boolean_t
+vdev_queue_class_is_fifo(zio_queue_class_t c)
+{
+	return (c == ZIO_QUEUE_SYNC_READ || c == ZIO_QUEUE_SYNC_WRITE);
+}
+
 void
 vdev_queue_init(vdev_t *vd)
 {
 	vdev_queue_t *vq = &vd->vdev_queue;
 
 	mutex_init(&vq->vq_lock, NULL, MUTEX_DEFAULT, NULL);
+	vq->vq_vdev = vd;
+	vq->vq_last_offset = 0;
 
-	avl_create(&vq->vq_deadline_tree, vdev_queue_deadline_compare,
-	    sizeof (zio_t), offsetof(struct zio, io_deadline_node));
+	avl_create(&vq->vq_active_tree, vdev_queue_offset_compare,
+	    sizeof (zio_t), offsetof(struct zio, io_queue_node));
 
-	avl_create(&vq->vq_read_tree, vdev_queue_offset_compare,
+	avl_create(&vq->vq_read_offset_tree, vdev_queue_offset_compare,
 	    sizeof (zio_t), offsetof(struct zio, io_offset_node));
 
-	avl_create(&vq->vq_write_tree, vdev_queue_offset_compare,
+	avl_create(&vq->vq_write_offset_tree, vdev_queue_offset_compare,
 	    sizeof (zio_t), offsetof(struct zio, io_offset_node));
 
-	avl_create(&vq->vq_pending_tree, vdev_queue_offset_compare,
-	    sizeof (zio_t), offsetof(struct zio, io_offset_node));
+	for (int c = 0; c < ZIO_QUEUE_NUM_CLASSES; c++) {
+		vq->vq_class[c].vqc_active = 0;
+		avl_create(&vq->vq_class[c].vqc_queued_tree,
+		    vdev_queue_class_is_fifo(c) ? vdev_queue_timestamp_compare :
+		    vdev_queue_offset_compare,
+		    sizeof (zio_t), offsetof(struct zio, io_queue_node));
+	}
 }
 
 void
@@ -154,26 +296,93 @@ vdev_queue_fini(vdev_t *vd)
 {
 	vdev_queue_t *vq = &vd->vdev_queue;
 
-	avl_destroy(&vq->vq_deadline_tree);
-	avl_destroy(&vq->vq_read_tree);
-	avl_destroy(&vq->vq_write_tree);
-	avl_destroy(&vq->vq_pending_tree);
+	for (int c = 0; c < ZIO_QUEUE_NUM_CLASSES; c++)
+		avl_destroy(&vq->vq_class[c].vqc_queued_tree);
+	avl_destroy(&vq->vq_active_tree);
+	avl_destroy(&vq->vq_read_offset_tree);
+	avl_destroy(&vq->vq_write_offset_tree);
 
 	mutex_destroy(&vq->vq_lock);
 }
 
+static zio_queue_class_t
+vdev_queue_class(zio_t *zio)
+{
+	if (zio->io_type == ZIO_TYPE_READ) {
+		if ((zio->io_flags & (ZIO_FLAG_SCRUB | ZIO_FLAG_RESILVER)) ||
+		    zio->io_priority >= ZIO_PRIORITY_RESILVER)
+			return (ZIO_QUEUE_SCRUB);
+		if (zio->io_priority <= ZIO_PRIORITY_CACHE_FILL)
+			return (ZIO_QUEUE_SYNC_READ);
+		return (ZIO_QUEUE_ASYNC_READ);
+	}
+
+	ASSERT(zio->io_type == ZIO_TYPE_WRITE);
+	if (zio->io_priority <= ZIO_PRIORITY_LOG_WRITE)
+		return (ZIO_QUEUE_SYNC_WRITE);
+	return (ZIO_QUEUE_ASYNC_WRITE);
+}
+
+static avl_tree_t *
+vdev_queue_type_tree(vdev_queue_t *vq, zio_type_t t)
+{
+	ASSERT(t == ZIO_TYPE_READ || t == ZIO_TYPE_WRITE);
+	if (t == ZIO_TYPE_READ)
+		return (&vq->vq_read_offset_tree);
+	return (&vq->vq_write_offset_tree);
+}
+
+static void
+vdev_queue_trace(vdev_queue_t *vq, zio_queue_class_t c)
+{
+	zfs_trace_vdev_queue(vq->vq_vdev->vdev_guid, c,
+	    avl_numnodes(&vq->vq_class[c].vqc_queued_tree),
+	    vq->vq_class[c].vqc_active);
+}
+
 static void
 vdev_queue_io_add(vdev_queue_t *vq, zio_t *zio)
 {
-	avl_add(&vq->vq_deadline_tree, zio);
-	avl_add(zio->io_vdev_tree, zio);
+	zio_queue_class_t c = zio->io_queue_class;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+	avl_add(&vq->vq_class[c].vqc_queued_tree, zio);
+	avl_add(vdev_queue_type_tree(vq, zio->io_type), zio);
+	vdev_queue_trace(vq, c);
 }
 
 static void
 vdev_queue_io_remove(vdev_queue_t *vq, zio_t *zio)
 {
-	avl_remove(&vq->vq_deadline_tree, zio);
-	avl_remove(zio->io_vdev_tree, zio);
+	zio_queue_class_t c = zio->io_queue_class;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+	avl_remove(&vq->vq_class[c].vqc_queued_tree, zio);
+	avl_remove(vdev_queue_type_tree(vq, zio->io_type), zio);
+	vdev_queue_trace(vq, c);
+}
+
+static void
+vdev_queue_pending_add(vdev_queue_t *vq, zio_t *zio)
+{
+	zio_queue_class_t c = zio->io_queue_class;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+	vq->vq_class[c].vqc_active++;
+	avl_add(&vq->vq_active_tree, zio);
+	vdev_queue_trace(vq, c);
+}
+
+static void
+vdev_queue_pending_remove(vdev_queue_t *vq, zio_t *zio)
+{
+	zio_queue_class_t c = zio->io_queue_class;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+	ASSERT(vq->vq_class[c].vqc_active > 0);
+	vq->vq_class[c].vqc_active--;
+	avl_remove(&vq->vq_active_tree, zio);
+	vdev_queue_trace(vq, c);
 }
 
 static void
@@ -189,6 +398,139 @@ vdev_queue_agg_io_done(zio_t *aio)
 	zio_buf_free(aio->io_data, aio->io_size);
 }
 
+static int
+vdev_queue_class_min_active(zio_queue_class_t c)
+{
+	switch (c) {
+	case ZIO_QUEUE_SYNC_READ:
+		return (zfs_vdev_sync_read_min_active);
+	case ZIO_QUEUE_SYNC_WRITE:
+		return (zfs_vdev_sync_write_min_active);
+	case ZIO_QUEUE_ASYNC_READ:
+		return (zfs_vdev_async_read_min_active);
+	case ZIO_QUEUE_ASYNC_WRITE:
+		return (zfs_vdev_async_write_min_active);
+	case ZIO_QUEUE_SCRUB:
+		return (zfs_vdev_scrub_min_active);
+	default:
+		panic("invalid queue class %u", c);
+		return (0);
+	}
+}
+
+/*
+ * Number of async writes allowed at once for the current amount of dirty
+ * data in the pool, see the comment at the top of the file.
+ */
+static int
+vdev_queue_max_async_writes(spa_t *spa)
+{
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	uint64_t write_limit, dirty, min_bytes, max_bytes;
+	int writes;
+
+	/*
+	 * Before the pool is loaded there is no write throttle to keep
+	 * pace with; push the config and label writes out quickly.
+	 */
+	if (dp == NULL)
+		return (zfs_vdev_async_write_max_active);
+
+	write_limit = zfs_write_limit_override ?
+	    zfs_write_limit_override : dp->dp_write_limit;
+	if (write_limit == 0)
+		return (zfs_vdev_async_write_max_active);
+
+	/*
+	 * These are read without dp_lock, a slightly stale value only
+	 * shifts the interpolation a bit.
+	 */
+	dirty = 0;
+	for (int t = 0; t < TXG_SIZE; t++)
+		dirty += dp->dp_space_towrite[t] + dp->dp_tempreserved[t];
+
+	min_bytes = write_limit *
+	    zfs_vdev_async_write_active_min_dirty_percent / 100;
+	max_bytes = write_limit *
+	    zfs_vdev_async_write_active_max_dirty_percent / 100;
+
+	if (dirty < min_bytes)
+		return (zfs_vdev_async_write_min_active);
+	if (dirty > max_bytes || max_bytes <= min_bytes)
+		return (zfs_vdev_async_write_max_active);
+
+	/*
+	 * linear interpolation:
+	 * slope = (max_writes - min_writes) / (max_bytes - min_bytes)
+	 * move right by min_bytes
+	 * move up by min_writes
+	 */
+	writes = (dirty - min_bytes) *
+	    (zfs_vdev_async_write_max_active -
+	    zfs_vdev_async_write_min_active) /
+	    (max_bytes - min_bytes) +
+	    zfs_vdev_async_write_min_active;
+	ASSERT3U(writes, >=, zfs_vdev_async_write_min_active);
+	ASSERT3U(writes, <=, zfs_vdev_async_write_max_active);
+	return (writes);
+}
+
+static int
+vdev_queue_class_max_active(spa_t *spa, zio_queue_class_t c)
+{
+	switch (c) {
+	case ZIO_QUEUE_SYNC_READ:
+		return (zfs_vdev_sync_read_max_active);
+	case ZIO_QUEUE_SYNC_WRITE:
+		return (zfs_vdev_sync_write_max_active);
+	case ZIO_QUEUE_ASYNC_READ:
+		return (zfs_vdev_async_read_max_active);
+	case ZIO_QUEUE_ASYNC_WRITE:
+		return (vdev_queue_max_async_writes(spa));
+	case ZIO_QUEUE_SCRUB:
+		return (zfs_vdev_scrub_max_active);
+	default:
+		panic("invalid queue class %u", c);
+		return (0);
+	}
+}
+
+/*
+ * Return the i/o class to issue from, or ZIO_QUEUE_NUM_CLASSES if
+ * there is no eligible class.
+ */
+static zio_queue_class_t
+vdev_queue_class_to_issue(vdev_queue_t *vq)
+{
+	spa_t *spa = vq->vq_vdev->vdev_spa;
+	zio_queue_class_t c;
+
+	if (avl_numnodes(&vq->vq_active_tree) >= zfs_vdev_max_active)
+		return (ZIO_QUEUE_NUM_CLASSES);
+
+	/* find a queue that has not reached its minimum # outstanding i/os */
+	for (c = 0; c < ZIO_QUEUE_NUM_CLASSES; c++) {
+		if (avl_numnodes(&vq->vq_class[c].vqc_queued_tree) > 0 &&
+		    vq->vq_class[c].vqc_active <
+		    vdev_queue_class_min_active(c))
+			return (c);
+	}
+
+	/*
+	 * If we haven't found a queue, look for one that hasn't reached its
+	 * maximum # outstanding i/os.
+	 */
+	for (c = 0; c < ZIO_QUEUE_NUM_CLASSES; c++) {
+		if (avl_numnodes(&vq->vq_class[c].vqc_queued_tree) > 0 &&
+		    vq->vq_class[c].vqc_active <
+		    vdev_queue_class_max_active(spa, c))
+			return (c);
+	}
+
+	/* No eligible queued i/os */
+	return (ZIO_QUEUE_NUM_CLASSES);
+}
+
 /*
  * Compute the range spanned by two i/os, which is the endpoint of the last
  * (lio->io_offset + lio->io_size) minus start of the first (fio->io_offset).
@@ -198,172 +540,217 @@ vdev_queue_agg_io_done(zio_t *aio)
 #define	IO_SPAN(fio, lio) ((lio)->io_offset + (lio)->io_size - (fio)->io_offset)
 #define	IO_GAP(fio, lio) (-IO_SPAN(lio, fio))
 
+/*
+ * Try to build an aggregate i/o around zio out of the queued i/os of the
+ * same type, whatever their class.  Returns NULL if there is nothing to
+ * aggregate zio with.
+ */
 static zio_t *
-vdev_queue_io_to_issue(vdev_queue_t *vq, uint64_t pending_limit)
+vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 {
 	zio_t *fio, *lio, *aio, *dio, *nio, *mio;
 	avl_tree_t *t;
 	int flags;
 	uint64_t maxspan = zfs_vdev_aggregation_limit;
 	uint64_t maxgap;
+	uint64_t size;
 	int stretch;
 
-again:
 	ASSERT(MUTEX_HELD(&vq->vq_lock));
 
-	if (avl_numnodes(&vq->vq_pending_tree) >= pending_limit ||
-	    avl_numnodes(&vq->vq_deadline_tree) == 0)
+	flags = zio->io_flags & ZIO_FLAG_AGG_INHERIT;
+	if (flags & ZIO_FLAG_DONT_AGGREGATE)
 		return (NULL);
 
-	fio = lio = avl_first(&vq->vq_deadline_tree);
-
-	t = fio->io_vdev_tree;
-	flags = fio->io_flags & ZIO_FLAG_AGG_INHERIT;
-	maxgap = (t == &vq->vq_read_tree) ? zfs_vdev_read_gap_limit : 0;
+	fio = lio = zio;
+	t = vdev_queue_type_tree(vq, zio->io_type);
+	maxgap = (zio->io_type == ZIO_TYPE_READ) ? zfs_vdev_read_gap_limit : 0;
 
-	if (!(flags & ZIO_FLAG_DONT_AGGREGATE)) {
-		/*
-		 * We can aggregate I/Os that are sufficiently adjacent and of
-		 * the same flavor, as expressed by the AGG_INHERIT flags.
-		 * The latter requirement is necessary so that certain
-		 * attributes of the I/O, such as whether it's a normal I/O
-		 * or a scrub/resilver, can be preserved in the aggregate.
-		 * We can include optional I/Os, but don't allow them
-		 * to begin a range as they add no benefit in that situation.
-		 */
+	/*
+	 * We can aggregate I/Os that are sufficiently adjacent and of
+	 * the same flavor, as expressed by the AGG_INHERIT flags.
+	 * The latter requirement is necessary so that certain
+	 * attributes of the I/O, such as whether it's a normal I/O
+	 * or a scrub/resilver, can be preserved in the aggregate.
+	 * We can include optional I/Os, but don't allow them
+	 * to begin a range as they add no benefit in that situation.
+	 */
 
-		/*
-		 * We keep track of the last non-optional I/O.
-		 */
-		mio = (fio->io_flags & ZIO_FLAG_OPTIONAL) ? NULL : fio;
+	/*
+	 * We keep track of the last non-optional I/O.
+	 */
+	mio = (fio->io_flags & ZIO_FLAG_OPTIONAL) ? NULL : fio;
 
-		/*
-		 * Walk backwards through sufficiently contiguous I/Os
-		 * recording the last non-option I/O.
-		 */
-		while ((dio = AVL_PREV(t, fio)) != NULL &&
-		    (dio->io_flags & ZIO_FLAG_AGG_INHERIT) == flags &&
-		    IO_SPAN(dio, lio) <= maxspan &&
-		    IO_GAP(dio, fio) <= maxgap) {
-			fio = dio;
-			if (mio == NULL && !(fio->io_flags & ZIO_FLAG_OPTIONAL))
-				mio = fio;
-		}
+	/*
+	 * Walk backwards through sufficiently contiguous I/Os
+	 * recording the last non-option I/O.
+	 */
+	while ((dio = AVL_PREV(t, fio)) != NULL &&
+	    (dio->io_flags & ZIO_FLAG_AGG_INHERIT) == flags &&
+	    IO_SPAN(dio, lio) <= maxspan &&
+	    IO_GAP(dio, fio) <= maxgap) {
+		fio = dio;
+		if (mio == NULL && !(fio->io_flags & ZIO_FLAG_OPTIONAL))
+			mio = fio;
+	}
 
-		/*
-		 * Skip any initial optional I/Os.
-		 */
-		while ((fio->io_flags & ZIO_FLAG_OPTIONAL) && fio != lio) {
-			fio = AVL_NEXT(t, fio);
-			ASSERT(fio != NULL);
-		}
+	/*
+	 * Skip any initial optional I/Os.
+	 */
+	while ((fio->io_flags & ZIO_FLAG_OPTIONAL) && fio != lio) {
+		fio = AVL_NEXT(t, fio);
+		ASSERT(fio != NULL);
+	}
 
-		/*
-		 * Walk forward through sufficiently contiguous I/Os.
-		 */
-		while ((dio = AVL_NEXT(t, lio)) != NULL &&
-		    (dio->io_flags & ZIO_FLAG_AGG_INHERIT) == flags &&
-		    IO_SPAN(fio, dio) <= maxspan &&
-		    IO_GAP(lio, dio) <= maxgap) {
-			lio = dio;
-			if (!(lio->io_flags & ZIO_FLAG_OPTIONAL))
-				mio = lio;
-		}
+	/*
+	 * Walk forward through sufficiently contiguous I/Os.
+	 */
+	while ((dio = AVL_NEXT(t, lio)) != NULL &&
+	    (dio->io_flags & ZIO_FLAG_AGG_INHERIT) == flags &&
+	    IO_SPAN(fio, dio) <= maxspan &&
+	    IO_GAP(lio, dio) <= maxgap) {
+		lio = dio;
+		if (!(lio->io_flags & ZIO_FLAG_OPTIONAL))
+			mio = lio;
+	}
 
-		/*
-		 * Now that we've established the range of the I/O aggregation
-		 * we must decide what to do with trailing optional I/Os.
-		 * For reads, there's nothing to do. While we are unable to
-		 * aggregate further, it's possible that a trailing optional
-		 * I/O would allow the underlying device to aggregate with
-		 * subsequent I/Os. We must therefore determine if the next
-		 * non-optional I/O is close enough to make aggregation
-		 * worthwhile.
-		 */
-		stretch = B_FALSE;
-		if (t != &vq->vq_read_tree && mio != NULL) {
-			nio = lio;
-			while ((dio = AVL_NEXT(t, nio)) != NULL &&
-			    IO_GAP(nio, dio) == 0 &&
-			    IO_GAP(mio, dio) <= zfs_vdev_write_gap_limit) {
-				nio = dio;
-				if (!(nio->io_flags & ZIO_FLAG_OPTIONAL)) {
-					stretch = B_TRUE;
-					break;
-				}
+	/*
+	 * Now that we've established the range of the I/O aggregation
+	 * we must decide what to do with trailing optional I/Os.
+	 * For reads, there's nothing to do. While we are unable to
+	 * aggregate further, it's possible that a trailing optional
+	 * I/O would allow the underlying device to aggregate with
+	 * subsequent I/Os. We must therefore determine if the next
+	 * non-optional I/O is close enough to make aggregation
+	 * worthwhile.
+	 */
+	stretch = B_FALSE;
+	if (zio->io_type == ZIO_TYPE_WRITE && mio != NULL) {
+		nio = lio;
+		while ((dio = AVL_NEXT(t, nio)) != NULL &&
+		    IO_GAP(nio, dio) == 0 &&
+		    IO_GAP(mio, dio) <= zfs_vdev_write_gap_limit) {
+			nio = dio;
+			if (!(nio->io_flags & ZIO_FLAG_OPTIONAL)) {
+				stretch = B_TRUE;
+				break;
 			}
 		}
+	}
 
-		if (stretch) {
-			/* This may be a no-op. */
-			VERIFY((dio = AVL_NEXT(t, lio)) != NULL);
-			dio->io_flags &= ~ZIO_FLAG_OPTIONAL;
-		} else {
-			while (lio != mio && lio != fio) {
-				ASSERT(lio->io_flags & ZIO_FLAG_OPTIONAL);
-				lio = AVL_PREV(t, lio);
-				ASSERT(lio != NULL);
-			}
+	if (stretch) {
+		/* This may be a no-op. */
+		VERIFY((dio = AVL_NEXT(t, lio)) != NULL);
+		dio->io_flags &= ~ZIO_FLAG_OPTIONAL;
+	} else {
+		while (lio != mio && lio != fio) {
+			ASSERT(lio->io_flags & ZIO_FLAG_OPTIONAL);
+			lio = AVL_PREV(t, lio);
+			ASSERT(lio != NULL);
 		}
 	}
 
-	if (fio != lio) {
-		uint64_t size = IO_SPAN(fio, lio);
-		ASSERT(size <= zfs_vdev_aggregation_limit);
-
-		aio = zio_vdev_delegated_io(fio->io_vd, fio->io_offset,
-		    zio_buf_alloc(size), size, fio->io_type, ZIO_PRIORITY_AGG,
-		    flags | ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE,
-		    vdev_queue_agg_io_done, NULL);
-
-		nio = fio;
-		do {
-			dio = nio;
-			nio = AVL_NEXT(t, dio);
-			ASSERT(dio->io_type == aio->io_type);
-			ASSERT(dio->io_vdev_tree == t);
-
-			if (dio->io_flags & ZIO_FLAG_NODATA) {
-				ASSERT(dio->io_type == ZIO_TYPE_WRITE);
-				bzero((char *)aio->io_data + (dio->io_offset -
-				    aio->io_offset), dio->io_size);
-			} else if (dio->io_type == ZIO_TYPE_WRITE) {
-				bcopy(dio->io_data, (char *)aio->io_data +
-				    (dio->io_offset - aio->io_offset),
-				    dio->io_size);
-			}
+	if (fio == lio)
+		return (NULL);
 
-			zio_add_child(dio, aio);
-			vdev_queue_io_remove(vq, dio);
-			zio_vdev_io_bypass(dio);
-			zio_execute(dio);
-		} while (dio != lio);
+	size = IO_SPAN(fio, lio);
+	ASSERT(size <= zfs_vdev_aggregation_limit);
+
+	aio = zio_vdev_delegated_io(fio->io_vd, fio->io_offset,
+	    zio_buf_alloc(size), size, fio->io_type, ZIO_PRIORITY_AGG,
+	    flags | ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE,
+	    vdev_queue_agg_io_done, NULL);
+	aio->io_queue_class = zio->io_queue_class;
+	aio->io_timestamp = fio->io_timestamp;
+
+	nio = fio;
+	do {
+		dio = nio;
+		nio = AVL_NEXT(t, dio);
+		ASSERT(dio->io_type == aio->io_type);
+
+		if (dio->io_flags & ZIO_FLAG_NODATA) {
+			ASSERT(dio->io_type == ZIO_TYPE_WRITE);
+			bzero((char *)aio->io_data + (dio->io_offset -
+			    aio->io_offset), dio->io_size);
+		} else if (dio->io_type == ZIO_TYPE_WRITE) {
+			bcopy(dio->io_data, (char *)aio->io_data +
+			    (dio->io_offset - aio->io_offset),
+			    dio->io_size);
+		}
 
-		avl_add(&vq->vq_pending_tree, aio);
+		zio_add_child(dio, aio);
+		vdev_queue_io_remove(vq, dio);
+		zio_vdev_io_bypass(dio);
+		zio_execute(dio);
+	} while (dio != lio);
 
-		return (aio);
-	}
+	return (aio);
+}
 
-	ASSERT(fio->io_vdev_tree == t);
-	vdev_queue_io_remove(vq, fio);
+static zio_t *
+vdev_queue_io_to_issue(vdev_queue_t *vq)
+{
+	zio_t *zio, *aio;
+	zio_queue_class_t c;
+	avl_tree_t *tree;
+	zio_t search;
+	avl_index_t idx;
+
+again:
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+
+	c = vdev_queue_class_to_issue(vq);
+	if (c == ZIO_QUEUE_NUM_CLASSES) {
+		/* No eligible queued i/os */
+		return (NULL);
+	}
 
 	/*
-	 * If the I/O is or was optional and therefore has no data, we need to
-	 * simply discard it. We need to drop the vdev queue's lock to avoid a
-	 * deadlock that we could encounter since this I/O will complete
-	 * immediately.
+	 * For LBA-ordered queues (async / scrub), issue the i/o which follows
+	 * the most recently issued i/o in LBA (offset) order.
+	 *
+	 * For FIFO queues (sync), issue the i/o with the lowest timestamp.
 	 */
-	if (fio->io_flags & ZIO_FLAG_NODATA) {
-		mutex_exit(&vq->vq_lock);
-		zio_vdev_io_bypass(fio);
-		zio_execute(fio);
-		mutex_enter(&vq->vq_lock);
-		goto again;
+	tree = &vq->vq_class[c].vqc_queued_tree;
+	if (vdev_queue_class_is_fifo(c)) {
+		zio = avl_first(tree);
+	} else {
+		search.io_offset = vq->vq_last_offset + 1;
+		VERIFY3P(avl_find(tree, &search, &idx), ==, NULL);
+		zio = avl_nearest(tree, idx, AVL_AFTER);
+		if (zio == NULL)
+			zio = avl_first(tree);
 	}
+	ASSERT3U(zio->io_queue_class, ==, c);
 
-	avl_add(&vq->vq_pending_tree, fio);
+	aio = vdev_queue_aggregate(vq, zio);
+	if (aio != NULL) {
+		zio = aio;
+	} else {
+		vdev_queue_io_remove(vq, zio);
 
-	return (fio);
+		/*
+		 * If the I/O is or was optional and therefore has no data, we
+		 * need to simply discard it. We need to drop the vdev queue's
+		 * lock to avoid a deadlock that we could encounter since this
+		 * I/O will complete immediately.
+		 */
+		if (zio->io_flags & ZIO_FLAG_NODATA) {
+			mutex_exit(&vq->vq_lock);
+			zio_vdev_io_bypass(zio);
+			zio_execute(zio);
+			mutex_enter(&vq->vq_lock);
+			goto again;
+		}
+	}
+
+	vdev_queue_pending_add(vq, zio);
+	vq->vq_last_offset = zio->io_offset;
+	zfs_trace_vdev_queue_issue(vq->vq_vdev->vdev_guid, c, zio->io_offset,
+	    zio->io_size, aio != NULL);
+
+	return (zio);
 }
 
 zio_t *
@@ -378,21 +765,12 @@ vdev_queue_io(zio_t *zio)
 		return (zio);
 
 	zio->io_flags |= ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE;
-
-	if (zio->io_type == ZIO_TYPE_READ)
-		zio->io_vdev_tree = &vq->vq_read_tree;
-	else
-		zio->io_vdev_tree = &vq->vq_write_tree;
+	zio->io_queue_class = vdev_queue_class(zio);
 
 	mutex_enter(&vq->vq_lock);
-
-	zio->io_deadline = (ddi_get_lbolt64() >> zfs_vdev_time_shift) +
-	    zio->io_priority;
-
+	zio->io_timestamp = gethrtime();
 	vdev_queue_io_add(vq, zio);
-
-	nio = vdev_queue_io_to_issue(vq, zfs_vdev_min_pending);
-
+	nio = vdev_queue_io_to_issue(vq);
 	mutex_exit(&vq->vq_lock);
 
 	if (nio == NULL)
@@ -410,15 +788,13 @@ void
 vdev_queue_io_done(zio_t *zio)
 {
 	vdev_queue_t *vq = &zio->io_vd->vdev_queue;
+	zio_t *nio;
 
 	mutex_enter(&vq->vq_lock);
 
-	avl_remove(&vq->vq_pending_tree, zio);
+	vdev_queue_pending_remove(vq, zio);
 
-	for (int i = 0; i < zfs_vdev_ramp_rate; i++) {
-		zio_t *nio = vdev_queue_io_to_issue(vq, zfs_vdev_max_pending);
-		if (nio == NULL)
-			break;
+	while ((nio = vdev_queue_io_to_issue(vq)) != NULL) {
 		mutex_exit(&vq->vq_lock);
 		if (nio->io_done == vdev_queue_agg_io_done) {
 			zio_nowait(nio);
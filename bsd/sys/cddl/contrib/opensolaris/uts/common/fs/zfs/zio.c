@@ -35,6 +35,8 @@
 #include <sys/dmu_objset.h>
 #include <sys/arc.h>
 #include <sys/ddt.h>
+#include <zfs_fletcher.h>
+#include <bsd/porting/zfs_trace.h>
 
 SYSCTL_DECL(_vfs_zfs);
 SYSCTL_NODE(_vfs_zfs, OID_AUTO, zio, CTLFLAG_RW, 0, "ZFS ZIO");
@@ -131,6 +133,11 @@ void
 zio_init(void)
 {
 	size_t c;
+
+	/* pick the checksum implementations best suited to this cpu */
+	fletcher_4_init();
+	zio_checksum_SHA256_init();
+
 	zio_cache = kmem_cache_create("zio_cache",
 	    sizeof (zio_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 	zio_link_cache = kmem_cache_create("zio_link_cache",
@@ -1168,8 +1175,9 @@ zio_taskq_dispatch(zio_t *zio, enum zio_taskq_type q, boolean_t cutinline)
 		q++;
 
 	ASSERT3U(q, <, ZIO_TASKQ_TYPES);
+	zfs_trace_zio_dispatch(zio, t, q, zio->io_cpu);
 	spa_taskq_dispatch_ent(spa, t, q, (task_func_t *)zio_execute, zio,
-	    flags, &zio->io_tqent);
+	    flags, &zio->io_tqent, zio->io_cpu);
 }
 
 static boolean_t
@@ -1223,6 +1231,13 @@ void
 zio_execute(zio_t *zio)
 {
 	zio->io_executor = curthread;
+#ifdef _KERNEL
+	/*
+	 * Later stages of this zio, including its completion, are dispatched
+	 * back to this CPU.
+	 */
+	zio->io_cpu = taskq_curcpu();
+#endif
 
 	while (zio->io_stage < ZIO_STAGE_DONE) {
 		enum zio_stage pipeline = zio->io_pipeline;
@@ -1257,7 +1272,10 @@ zio_execute(zio_t *zio)
 		}
 
 		zio->io_stage = stage;
+		zfs_trace_zio_stage(zio, stage);
 		rv = zio_pipeline[highbit(stage) - 1](zio);
+		/* zio may be gone already, only its address is traced */
+		zfs_trace_zio_stage_ret(zio, stage, rv);
 
 		if (rv == ZIO_PIPELINE_STOP)
 			return;
@@ -3049,7 +3067,7 @@ zio_done(zio_t *zio)
 			 */
 			spa_taskq_dispatch_ent(spa, ZIO_TYPE_CLAIM,
 			    ZIO_TASKQ_ISSUE, (task_func_t *)zio_reexecute, zio,
-			    TQ_SLEEP, &zio->io_tqent);
+			    TQ_SLEEP, &zio->io_tqent, TASKQ_ANYCPU);
 		}
 		return (ZIO_PIPELINE_STOP);
 	}
@@ -37,8 +37,10 @@ extern "C" {
 #define	TASKQ_NAMELEN	31
 
 struct taskqueue;
+struct pcpu_taskqueue;
 struct taskq {
 	struct taskqueue	*tq_queue;
+	struct pcpu_taskqueue	*tq_pcpu;	/* see taskq_create_pcpu() */
 };
 
 typedef struct taskq taskq_t;
@@ -66,6 +68,11 @@ struct proc;
 #define	TQ_NOALLOC	0x04	/* cannot allocate memory; may fail */
 #define	TQ_FRONT	0x08	/* Put task at the front of the queue */
 
+/*
+ * taskq_dispatch_safe_cpu() cpu argument for the current CPU.
+ */
+#define	TASKQ_ANYCPU	(-1)
+
 #ifdef _KERNEL
 
 extern taskq_t *system_taskq;
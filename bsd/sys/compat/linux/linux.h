@@ -89,6 +89,7 @@ typedef struct {
 #define	LINUX_SO_NO_CHECK	11
 #define	LINUX_SO_PRIORITY	12
 #define	LINUX_SO_LINGER		13
+#define	LINUX_SO_REUSEPORT	15
 #define	LINUX_SO_PEERCRED	17
 #define	LINUX_SO_RCVLOWAT	18
 #define	LINUX_SO_SNDLOWAT	19
@@ -96,7 +97,11 @@ typedef struct {
 #define	LINUX_SO_SNDTIMEO	21
 #define	LINUX_SO_TIMESTAMP	29
 #define	LINUX_SO_ACCEPTCONN	30
+#define	LINUX_SO_BUSY_POLL	46
+#define	LINUX_SO_ZEROCOPY	60
 
+#define	LINUX_IP_RECVERR		11
+#define	LINUX_IPV6_RECVERR		25
 #define	LINUX_IP_MULTICAST_IF		32
 #define	LINUX_IP_MULTICAST_TTL		33
 #define	LINUX_IP_MULTICAST_LOOP		34
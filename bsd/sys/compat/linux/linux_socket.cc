@@ -295,6 +295,8 @@ linux_to_bsd_so_sockopt(int opt)
 		return (SO_DEBUG);
 	case LINUX_SO_REUSEADDR:
 		return (SO_REUSEADDR);
+	case LINUX_SO_REUSEPORT:
+		return (SO_REUSEPORT);
 	case LINUX_SO_TYPE:
 		return (SO_TYPE);
 	case LINUX_SO_ERROR:
@@ -325,6 +327,10 @@ linux_to_bsd_so_sockopt(int opt)
 		return (SO_TIMESTAMP);
 	case LINUX_SO_ACCEPTCONN:
 		return (SO_ACCEPTCONN);
+	case LINUX_SO_BUSY_POLL:
+		return (SO_BUSY_POLL);
+	case LINUX_SO_ZEROCOPY:
+		return (SO_ZEROCOPY);
 	}
 	return (-1);
 }
@@ -352,6 +358,8 @@ linux_to_bsd_msg_flags(int flags)
 		ret_flags |= MSG_WAITALL;
 	if (flags & LINUX_MSG_NOSIGNAL)
 		ret_flags |= MSG_NOSIGNAL;
+	if (flags & LINUX_MSG_ZEROCOPY)
+		ret_flags |= MSG_ZEROCOPY;
 #if 0 /* not handled */
 	if (flags & LINUX_MSG_PROXY)
 		;
@@ -1009,6 +1017,49 @@ struct linux_recvmsg_args {
 	int flags;
 };
 
+/*
+ * recvmsg(MSG_ERRQUEUE): the only errors queued are MSG_ZEROCOPY
+ * completions, each returned as an IP_RECVERR (or IPV6_RECVERR) control
+ * message, a sock_extended_err followed by an empty offender address.
+ */
+static int
+linux_recv_errqueue(int s, struct msghdr *msg, ssize_t* bytes)
+{
+	struct so_zerocopy_done done;
+	int error, family;
+
+	error = kern_recverr(s, &done, &family);
+	if (error)
+		return (error);
+
+	bool ipv6 = family == AF_INET6;
+	struct {
+		struct l_sock_extended_err ee;
+		char offender[28];
+	} data = {};
+	size_t len = sizeof(data.ee) + (ipv6 ? 28 : 16);
+	data.ee.ee_origin = LINUX_SO_EE_ORIGIN_ZEROCOPY;
+	data.ee.ee_code = done.copied ? LINUX_SO_EE_CODE_ZEROCOPY_COPIED : 0;
+	data.ee.ee_info = done.lo;
+	data.ee.ee_data = done.hi;
+
+	msg->msg_flags = LINUX_MSG_ERRQUEUE;
+	msg->msg_namelen = 0;
+	if (msg->msg_control == NULL || msg->msg_controllen < CMSG_LEN(len)) {
+		msg->msg_flags |= LINUX_MSG_CTRUNC;
+		msg->msg_controllen = 0;
+	} else {
+		struct cmsghdr *cm = (struct cmsghdr *)msg->msg_control;
+		cm->cmsg_len = CMSG_LEN(len);
+		cm->cmsg_level = ipv6 ? IPPROTO_IPV6 : IPPROTO_IP;
+		cm->cmsg_type = ipv6 ? LINUX_IPV6_RECVERR : LINUX_IP_RECVERR;
+		memcpy(CMSG_DATA(cm), &data, len);
+		msg->msg_controllen = CMSG_LEN(len);
+	}
+	*bytes = 0;
+	return (0);
+}
+
 /* FIXME: OSv - flags are ignored, the flags
  * inside the msghdr are used instead */
 int
@@ -1023,6 +1074,9 @@ linux_recvmsg(int s, struct msghdr *msg, int flags, ssize_t* bytes)
 	int error, i, fd, fds, *fdp;
 #endif
 	int error;
+	if (flags & LINUX_MSG_ERRQUEUE)
+		return (linux_recv_errqueue(s, msg, bytes));
+
 	error = linux_to_bsd_msghdr(msg);
 	if (error)
 		return (error);
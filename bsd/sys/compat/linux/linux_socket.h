@@ -48,6 +48,7 @@
 #define LINUX_MSG_RST		0x1000
 #define LINUX_MSG_ERRQUEUE	0x2000
 #define LINUX_MSG_NOSIGNAL	0x4000
+#define LINUX_MSG_ZEROCOPY	0x4000000
 #define LINUX_MSG_CMSG_CLOEXEC	0x40000000
 
 /* Socket-level control message types */
@@ -110,6 +111,21 @@
 #define	LINUX_SOCK_CLOEXEC	LINUX_O_CLOEXEC
 #define	LINUX_SOCK_NONBLOCK	LINUX_O_NONBLOCK
 
+/* Error queue messages, IP_RECVERR or IPV6_RECVERR control data */
+
+#define	LINUX_SO_EE_ORIGIN_ZEROCOPY		5
+#define	LINUX_SO_EE_CODE_ZEROCOPY_COPIED	1
+
+struct l_sock_extended_err {
+	uint32_t	ee_errno;
+	uint8_t		ee_origin;
+	uint8_t		ee_type;
+	uint8_t		ee_code;
+	uint8_t		ee_pad;
+	uint32_t	ee_info;
+	uint32_t	ee_data;
+};
+
 struct l_ucred {
 	uint32_t	pid;
 	uint32_t	uid;
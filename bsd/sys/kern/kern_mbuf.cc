@@ -29,6 +29,7 @@
 #include <bsd/porting/uma_stub.h>
 #include <machine/param.h>
 #include <bsd/sys/sys/mbuf.h>
+#include <bsd/sys/sys/libkern.h>
 #include <sys/errno.h>
 
 #include <sys/cdefs.h>
@@ -94,23 +95,32 @@ tunable_mbinit(void *dummy)
 {
 
     int maxusers = 16;
+    /*
+     * The zone limits are enforced by uma, so size them by the amount of
+     * memory, as newer FreeBSD does: up to half of it may hold mbufs.
+     */
+    long maxmbufmem = physmem * PAGE_SIZE / 2;
 
 	/* This has to be done before VM init. */
 	TUNABLE_INT_FETCH("kern.ipc.nmbclusters", &nmbclusters);
 	if (nmbclusters == 0)
-		nmbclusters = 1024 + maxusers * 64;
+		nmbclusters = imax(1024 + maxusers * 64,
+		    maxmbufmem / MCLBYTES / 4);
 
 	TUNABLE_INT_FETCH("kern.ipc.nmbjumbop", &nmbjumbop);
 	if (nmbjumbop == 0)
-		nmbjumbop = nmbclusters / 2;
+		nmbjumbop = imax(nmbclusters / 2,
+		    maxmbufmem / MJUMPAGESIZE / 4);
 
 	TUNABLE_INT_FETCH("kern.ipc.nmbjumbo9", &nmbjumbo9);
 	if (nmbjumbo9 == 0)
-		nmbjumbo9 = nmbclusters / 4;
+		nmbjumbo9 = imax(nmbclusters / 4,
+		    maxmbufmem / MJUM9BYTES / 6);
 
 	TUNABLE_INT_FETCH("kern.ipc.nmbjumbo16", &nmbjumbo16);
 	if (nmbjumbo16 == 0)
-		nmbjumbo16 = nmbclusters / 8;
+		nmbjumbo16 = imax(nmbclusters / 8,
+		    maxmbufmem / MJUM16BYTES / 6);
 }
 SYSINIT(tunable_mbinit, SI_SUB_TUNABLES, SI_ORDER_MIDDLE, tunable_mbinit, NULL);
 
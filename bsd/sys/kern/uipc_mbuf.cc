@@ -35,6 +35,7 @@
 #include <bsd/porting/uma_stub.h>
 #include <bsd/sys/sys/mbuf.h>
 #include <machine/atomic.h>
+#include <machine/in_cksum.h>
 
 int	max_linkhdr;
 int	max_protohdr;
@@ -77,7 +78,9 @@ SYSCTL_INT(_kern_ipc, OID_AUTO, m_defragrandomfailures, CTLFLAG_RW,
  * best) and return a pointer to the top of the allocated chain.  If an
  * existing mbuf chain is provided, then we will append the new chain
  * to the existing one but still return the top of the newly allocated
- * chain.
+ * chain.  With M_BIGCL, use 16K clusters for as much of the length as
+ * they fill.  With M_DATASUM, leave room for M_CSUMTABSIZE() at the start
+ * of each cluster.
  */
 struct mbuf *
 m_getm2(struct mbuf *m, int len, int how, short type, int flags)
@@ -87,7 +90,7 @@ m_getm2(struct mbuf *m, int len, int how, short type, int flags)
 	KASSERT(len >= 0, ("%s: len is < 0", __func__));
 
 	/* Validate flags. */
-	flags &= (M_PKTHDR | M_EOR);
+	flags &= (M_PKTHDR | M_EOR | M_BIGCL | M_DATASUM);
 
 	/* Packet header mbuf must be first in chain. */
 	if ((flags & M_PKTHDR) && m != NULL)
@@ -95,7 +98,10 @@ m_getm2(struct mbuf *m, int len, int how, short type, int flags)
 
 	/* Loop and append maximum sized mbufs to the chain tail. */
 	while (len > 0) {
-		if (len > MCLBYTES)
+		if ((flags & M_BIGCL) && len >= MJUM16BYTES)
+			mb = m_getjcl(how, type, (flags & M_PKTHDR),
+			    MJUM16BYTES);
+		else if (len > MCLBYTES)
 			mb = m_getjcl(how, type, (flags & M_PKTHDR),
 			    MJUMPAGESIZE);
 		else if (len >= MINCLSIZE)
@@ -113,8 +119,12 @@ m_getm2(struct mbuf *m, int len, int how, short type, int flags)
 		}
 
 		/* Book keeping. */
-		len -= (mb->m_hdr.mh_flags & M_EXT) ? mb->M_dat.MH.MH_dat.MH_ext.ext_size :
-			((mb->m_hdr.mh_flags & M_PKTHDR) ? MHLEN : MLEN);
+		if (mb->m_hdr.mh_flags & M_EXT) {
+			len -= mb->M_dat.MH.MH_dat.MH_ext.ext_size;
+			if (flags & M_DATASUM)
+				len += M_CSUMTABSIZE(mb->M_dat.MH.MH_dat.MH_ext.ext_size);
+		} else
+			len -= (mb->m_hdr.mh_flags & M_PKTHDR) ? MHLEN : MLEN;
 		if (mtail != NULL)
 			mtail->m_hdr.mh_next = mb;
 		else
@@ -561,6 +571,13 @@ m_copym(struct mbuf *m, int off0, int len, int wait)
 		if (m->m_hdr.mh_flags & M_EXT) {
 			n->m_hdr.mh_data = m->m_hdr.mh_data + off;
 			mb_dupcl(n, m);
+			/* The data stays where it is, and so does its sum */
+			if (m->m_hdr.mh_flags & M_DATASUM) {
+				n->m_hdr.mh_flags |= M_DATASUM;
+				n->m_hdr.mh_csum = m->m_hdr.mh_csum;
+				n->m_hdr.mh_csumstart = m->m_hdr.mh_csumstart;
+				n->m_hdr.mh_csumlen = m->m_hdr.mh_csumlen;
+			}
 		} else
 			bcopy(mtod(m, caddr_t)+off, mtod(n, caddr_t),
 			    (u_int)n->m_hdr.mh_len);
@@ -1264,6 +1281,7 @@ m_copyback(struct mbuf *m0, int off, int len, c_caddr_t cp)
 			    M_TRAILINGSPACE(m));
 		}
 		mlen = bsd_min (m->m_hdr.mh_len - off, len);
+		m->m_hdr.mh_flags &= ~M_DATASUM;
 		bcopy(cp, off + mtod(m, caddr_t), (u_int)mlen);
 		cp += mlen;
 		len -= mlen;
@@ -1676,8 +1694,72 @@ nospace:
 
 #endif
 
+/*
+ * uiomove() len bytes from uio to cp, and return the sum of the words they
+ * make from cp on, as in_cksum_copy().
+ */
+static u_short
+m_uiomove_cksum(caddr_t cp, int len, struct uio *uio)
+{
+	u_int sum = 0, part;
+	int done = 0;
+
+	KASSERT(uio->uio_rw == UIO_WRITE, ("%s: not a write", __func__));
+	while (len > 0 && uio->uio_resid) {
+		struct iovec *iov = uio->uio_iov;
+		int cnt = bsd_min(iov->iov_len, len);
+		if (cnt == 0) {
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+			continue;
+		}
+		part = in_cksum_copy(iov->iov_base, cp + done, cnt);
+		if (done & 1)
+			part = ((part & 0xff) << 8) | (part >> 8);
+		sum = in_addword(sum, part);
+
+		iov->iov_base = (char *)iov->iov_base + cnt;
+		iov->iov_len -= cnt;
+		uio->uio_resid -= cnt;
+		uio->uio_offset += cnt;
+		done += cnt;
+		len -= cnt;
+	}
+	return (sum);
+}
+
+/*
+ * Copies length bytes of uio into mb, and leaves their sum in it.  A
+ * cluster also gets the running sums, in the room at its start that
+ * m_uiotombuf() skipped (see M_CSUMCHUNK).
+ */
+static void
+m_uiomove_datasum(struct mbuf *mb, int length, struct uio *uio)
+{
+	caddr_t cp = mtod(mb, caddr_t);
+	u_int16_t *run = NULL;
+	u_int16_t sum = 0;
+	int done, cnt;
+
+	if (mb->m_hdr.mh_flags & M_EXT)
+		run = (u_int16_t *)mb->M_dat.MH.MH_dat.MH_ext.ext_buf;
+	/* Every chunk starts at an even offset, so the sums just add up */
+	for (done = 0; done < length; done += cnt) {
+		cnt = bsd_min(length - done, M_CSUMCHUNK);
+		sum = in_addword(sum, m_uiomove_cksum(cp + done, cnt, uio));
+		if (run != NULL && cnt == M_CSUMCHUNK)
+			*run++ = sum;
+	}
+	mb->m_hdr.mh_csum = sum;
+	mb->m_hdr.mh_csumstart = (uintptr_t)cp;
+	mb->m_hdr.mh_csumlen = length;
+	mb->m_hdr.mh_flags |= M_DATASUM;
+}
+
 /*
  * Copy the contents of uio into a properly sized mbuf chain.
+ * With M_DATASUM in flags, also leave the sum of each mbuf's data in it,
+ * for in_cksum_skip().  With M_BIGCL, copy it into 16K clusters.
  */
 struct mbuf *
 m_uiotombuf(struct uio *uio, int how, int len, int align, int min_size,
@@ -1715,12 +1797,19 @@ m_uiotombuf(struct uio *uio, int how, int len, int align, int min_size,
 
 	/* Fill all mbufs with uio data and update header information. */
 	for (mb = m; mb != NULL; mb = mb->m_hdr.mh_next) {
+		if ((flags & M_DATASUM) && (mb->m_hdr.mh_flags & M_EXT))
+			mb->m_hdr.mh_data +=
+			    M_CSUMTABSIZE(mb->M_dat.MH.MH_dat.MH_ext.ext_size);
 		length = bsd_min(M_TRAILINGSPACE(mb), total - progress);
 
-		error = uiomove(mtod(mb, void *), length, uio);
-		if (error) {
-			m_freem(m);
-			return (NULL);
+		if ((flags & M_DATASUM) && length <= 0xffff) {
+			m_uiomove_datasum(mb, length, uio);
+		} else {
+			error = uiomove(mtod(mb, void *), length, uio);
+			if (error) {
+				m_freem(m);
+				return (NULL);
+			}
 		}
 
 		mb->m_hdr.mh_len = length;
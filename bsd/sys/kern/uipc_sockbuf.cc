@@ -45,6 +45,7 @@
 #include <bsd/sys/sys/socket.h>
 #include <bsd/sys/sys/socketvar.h>
 #include <bsd/sys/sys/libkern.h>
+#include <bsd/sys/net/if_var.h>
 
 /*
  * Function pointer set by the AIO routines so that the socket buffer code
@@ -138,11 +139,62 @@ void sockbuf_iolock::unlock(mutex& mtx)
 	_wq.wake_all(mtx);
 }
 
+/*
+ * Busy polling: instead of sleeping until the interface interrupts and its
+ * receive thread wakes us up, process what the interface receives ourselves
+ * for up to so_busy_poll microseconds, hoping for our data to show up.
+ *
+ * The socket lock is dropped meanwhile, as the packets we process may be
+ * for other connections, whose locks are ordered before ours.  The net
+ * channel may thus go away under us, but not before an RCU grace period.
+ * Returns true if the caller should recheck its condition instead of
+ * sleeping.
+ */
+template<typename Clock>
+static bool sb_busy_poll(socket* so, struct sockbuf *sb,
+    boost::optional<std::chrono::time_point<Clock>> timeout)
+{
+	auto ifp = so->so_nc->intf();
+	if (!ifp || !ifp->if_rxpoll) {
+		return false;
+	}
+	auto until = Clock::now() + std::chrono::microseconds(so->so_busy_poll);
+	if (timeout && *timeout < until) {
+		until = *timeout;
+	}
+	auto cc = sb->sb_cc;
+	bool ready = false;
+	so->so_nc_busy = true;
+	DROP_LOCK(SOCK_MTX_REF(so)) {
+		do {
+			ifp->if_rxpoll(ifp);
+			WITH_LOCK(osv::rcu_read_lock) {
+				auto nc = so->so_nc;
+				ready = !nc || !nc->empty();
+			}
+			// Unlocked peeks, the caller rechecks everything
+			ready = ready || sb->sb_cc != cc || so->so_error ||
+			    (sb->sb_state & SBS_CANTRCVMORE);
+		} while (!ready && Clock::now() < until);
+	}
+	so->so_nc_busy = false;
+	so->so_nc_wq.wake_all(SOCK_MTX_REF(so));
+	return ready;
+}
+
 template<typename Clock>
 int sbwait_tmo(socket* so, struct sockbuf *sb, boost::optional<std::chrono::time_point<Clock>> timeout)
 {
 	SOCK_LOCK_ASSERT(so);
 
+	if (sb == &so->so_rcv && so->so_busy_poll && so->so_nc &&
+	    !so->so_nc_busy && sb_busy_poll(so, sb, timeout)) {
+		if (so->so_nc) {
+			so->so_nc->process_queue();
+		}
+		return 0;
+	}
+
 	sb->sb_flags |= SB_WAIT;
 	sched::timer tmr(*sched::thread::current());
 	if (timeout) {
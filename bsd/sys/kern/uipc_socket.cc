@@ -106,12 +106,18 @@
 #include <osv/poll.h>
 #include <sys/epoll.h>
 #include <osv/debug.h>
+#include <osv/sched.hh>
+#include <osv/async.hh>
+#include <osv/mmu.hh>
+#include <osv/rcu.hh>
 #include <cinttypes>
 
 #include <bsd/porting/netport.h>
 #include <bsd/porting/uma_stub.h>
 #include <bsd/porting/sync_stub.h>
 #include <bsd/porting/synch.h>
+#include <bsd/net.hh>
+#include <machine/atomic.h>
 
 #include <bsd/sys/sys/libkern.h>
 #include <bsd/sys/sys/param.h>
@@ -123,6 +129,7 @@
 #include <bsd/sys/sys/socket.h>
 #include <bsd/sys/sys/socketvar.h>
 #include <bsd/sys/net/route.h>
+#include <bsd/sys/netinet/in.h>
 
 #include <bsd/sys/net/vnet.h>
 
@@ -133,7 +140,7 @@ static int	soreceive_rcvoob(struct socket *so, struct uio *uio,
 
 so_gen_t	so_gencnt;	/* generation count for sockets */
 
-int	maxsockets = 256;
+int	maxsockets = 0;
 
 MALLOC_DEFINE(M_SONAME, "soname", "socket name");
 MALLOC_DEFINE(M_PCB, "pcb", "protocol control block");
@@ -155,6 +162,14 @@ static int numopensockets;
 SYSCTL_INT(_kern_ipc, OID_AUTO, numopensockets, CTLFLAG_RD,
     &numopensockets, 0, "Number of open sockets");
 
+int	net_busy_poll = 0;
+SYSCTL_INT(_kern_ipc, OID_AUTO, busy_poll, CTLFLAG_RW,
+    &net_busy_poll, 0, "Default busy poll time of new sockets, in usecs");
+
+static int zerocopy_min = 16384;
+SYSCTL_INT(_kern_ipc, OID_AUTO, zerocopy_min, CTLFLAG_RW,
+    &zerocopy_min, 0, "Smallest MSG_ZEROCOPY send not copied anyway");
+
 /*
  * accept_mtx locks down per-socket fields relating to accept queues.  See
  * socketvar.h for an annotation of the protected fields of struct socket.
@@ -215,8 +230,10 @@ init_maxsockets(void *ignored)
     mtx_init(&accept_mtx, "accept", NULL, MTX_DEF);
     mtx_init(&so_global_mtx, "so_global", NULL, MTX_DEF);
 
+	/* The socket and pcb zones are limited to this */
 	TUNABLE_INT_FETCH("kern.ipc.maxsockets", &maxsockets);
-	maxsockets = 0x2000;
+	if (maxsockets == 0)
+		maxsockets = imax(0x2000, nmbclusters);
 }
 SYSINIT(param, SI_SUB_TUNABLES, SI_ORDER_ANY, init_maxsockets, NULL);
 
@@ -244,6 +261,7 @@ soalloc(struct vnet *vnet)
 		return (NULL);
 	uipc_d("soalloc() so=%" PRIx64, (uint64_t)so);
 	TAILQ_INIT(&so->so_aiojobq);
+	so->so_busy_poll = net_busy_poll;
 	mtx_lock(&so_global_mtx);
 	so->so_gencnt = ++so_gencnt;
 	++numopensockets;
@@ -279,7 +297,14 @@ sodealloc(struct socket *so)
 		do_setopt_accept_filter(so, NULL);
 # endif
 #endif
-	delete so;
+	/*
+	 * in_pcblbgroup_pick() may still look at a listener under
+	 * rcu_read_lock after it left its load balancing group.
+	 */
+	if (so->so_options & SO_ACCEPTCONN)
+		osv::rcu_defer([](struct socket *so) { delete so; }, so);
+	else
+		delete so;
 }
 
 /*
@@ -310,7 +335,6 @@ socreate(int dom, struct socket **aso, int type, int proto,
 		return (ENOBUFS);
 
 	TAILQ_INIT(&so->so_incomp);
-	TAILQ_INIT(&so->so_comp);
 	so->so_type = type;
 	if ((prp->pr_domain->dom_family == PF_INET) ||
 	    (prp->pr_domain->dom_family == PF_INET6) ||
@@ -344,6 +368,75 @@ SYSCTL_INT(_regression, OID_AUTO, sonewconn_earlytest, CTLFLAG_RW,
     &regression_sonewconn_earlytest, 0, "Perform early sonewconn limit test");
 #endif
 
+/*
+ * Queues so, whose connection just completed, for accept() on head, on
+ * this CPU's queue.  Returns the CPU, to wake an accept() sleeping there.
+ */
+static unsigned
+socomp_insert(struct socket *head, struct socket *so)
+{
+	unsigned cpu = sched::cpu::current()->id % head->so_ncomp;
+	struct so_compq *q = &head->so_comp[cpu];
+
+	mtx_lock(&q->mtx);
+	TAILQ_INSERT_TAIL(&q->q, so, so_list);
+	so->so_compcpu = cpu;
+	so->so_qstate |= SQ_COMP;
+	head->so_qlen++;
+	mtx_unlock(&q->mtx);
+	return (cpu);
+}
+
+/*
+ * Wakes an accept() sleeping on head, preferably on cpu, once a connection
+ * is queued.  A sleeper counts itself in so_acceptwaiters under
+ * ACCEPT_LOCK() before it checks so_qlen for the last time, so either it
+ * sees the new connection, or we see it and, by taking ACCEPT_LOCK(), wait
+ * until it is asleep.
+ */
+static void
+socomp_wakeup(struct socket *head, unsigned cpu)
+{
+
+	if (head->so_acceptwaiters == 0)
+		return;
+	ACCEPT_LOCK();
+	ACCEPT_UNLOCK();
+	wakeup_one_cpu(&head->so_timeo, cpu);
+}
+
+/*
+ * Takes the complete connection accept() on cpu gets next off its queue:
+ * the oldest on that CPU's queue, or if there is none, on the next CPU's
+ * that has one.  The socket keeps SQ_COMP, so that sofree() leaves it
+ * alone, until the caller clears it together with so_head.
+ */
+struct socket *
+socomp_dequeue(struct socket *head, unsigned cpu)
+{
+	struct so_compq *q;
+	struct socket *so;
+	u_int i;
+
+	for (i = 0; i < head->so_ncomp && head->so_qlen != 0; i++) {
+		q = &head->so_comp[(cpu + i) % head->so_ncomp];
+		if (TAILQ_EMPTY(&q->q))
+			continue;
+		mtx_lock(&q->mtx);
+		so = TAILQ_FIRST(&q->q);
+		if (so != NULL) {
+			KASSERT(so->so_qstate & SQ_COMP,
+			    ("socomp_dequeue: so not SQ_COMP"));
+			TAILQ_REMOVE(&q->q, so, so_list);
+			head->so_qlen--;
+		}
+		mtx_unlock(&q->mtx);
+		if (so != NULL)
+			return (so);
+	}
+	return (NULL);
+}
+
 /*
  * When an attempt at a new connection is noted on a socket which accepts
  * connections, sonewconn is called.  If the connection is possible (subject
@@ -358,12 +451,11 @@ sonewconn(struct socket *head, int connstatus)
 {
 	struct socket *so;
 	int over;
+	unsigned cpu;
 
 	uipc_d("sonewconn() head=%" PRIx64, (uint64_t)head);
 
-	ACCEPT_LOCK();
 	over = (head->so_qlen > 3 * head->so_qlimit / 2);
-	ACCEPT_UNLOCK();
 #ifdef REGRESSION
 	if (regression_sonewconn_earlytest && over)
 #else
@@ -397,39 +489,36 @@ sonewconn(struct socket *head, int connstatus)
 	so->so_rcv.sb_flags |= head->so_rcv.sb_flags & SB_AUTOSIZE;
 	so->so_snd.sb_flags |= head->so_snd.sb_flags & SB_AUTOSIZE;
 	so->so_state |= connstatus;
-	ACCEPT_LOCK();
-	if (connstatus) {
-		TAILQ_INSERT_TAIL(&head->so_comp, so, so_list);
-		so->so_qstate |= SQ_COMP;
-		head->so_qlen++;
-	} else {
-		/*
-		 * Keep removing sockets from the head until there's room for
-		 * us to insert on the tail.  In pre-locking revisions, this
-		 * was a simple if(), but as we could be racing with other
-		 * threads and soabort() requires dropping locks, we must
-		 * loop waiting for the condition to be true.
-		 */
-		while (head->so_incqlen > head->so_qlimit) {
-			struct socket *sp;
-			sp = TAILQ_FIRST(&head->so_incomp);
-			TAILQ_REMOVE(&head->so_incomp, sp, so_list);
-			head->so_incqlen--;
-			sp->so_qstate &= ~SQ_INCOMP;
-			sp->so_head = NULL;
-			ACCEPT_UNLOCK();
-			soabort(sp);
-			ACCEPT_LOCK();
-		}
-		TAILQ_INSERT_TAIL(&head->so_incomp, so, so_list);
-		so->so_qstate |= SQ_INCOMP;
-		head->so_incqlen++;
-	}
-	ACCEPT_UNLOCK();
 	if (connstatus) {
+		/* Straight to this CPU's queue, no ACCEPT_LOCK() needed */
+		cpu = socomp_insert(head, so);
 		sorwakeup(head);
-		wakeup_one(&head->so_timeo);
+		socomp_wakeup(head, cpu);
+		return (so);
 	}
+	ACCEPT_LOCK();
+	/*
+	 * Keep removing sockets from the head until there's room for
+	 * us to insert on the tail.  In pre-locking revisions, this
+	 * was a simple if(), but as we could be racing with other
+	 * threads and soabort() requires dropping locks, we must
+	 * loop waiting for the condition to be true.
+	 */
+	while (head->so_incqlen > head->so_qlimit) {
+		struct socket *sp;
+		sp = TAILQ_FIRST(&head->so_incomp);
+		TAILQ_REMOVE(&head->so_incomp, sp, so_list);
+		head->so_incqlen--;
+		sp->so_qstate &= ~SQ_INCOMP;
+		sp->so_head = NULL;
+		ACCEPT_UNLOCK();
+		soabort(sp);
+		ACCEPT_LOCK();
+	}
+	TAILQ_INSERT_TAIL(&head->so_incomp, so, so_list);
+	so->so_qstate |= SQ_INCOMP;
+	head->so_incqlen++;
+	ACCEPT_UNLOCK();
 	return (so);
 }
 
@@ -461,6 +550,7 @@ solisten(struct socket *so, int backlog, struct thread *td)
 {
 	int error;
 
+	so->so_cpu = sched::cpu::current()->id;
 	CURVNET_SET(so->so_vnet);
 	error = (*so->so_proto->pr_usrreqs->pru_listen)(so, backlog, td);
 	CURVNET_RESTORE();
@@ -487,6 +577,18 @@ solisten_proto(struct socket *so, int backlog)
 
 	backlog = somaxconn;
 	so->so_qlimit = backlog;
+	/*
+	 * Nothing looks at so_comp before SO_ACCEPTCONN is set, so it
+	 * needs no ACCEPT_LOCK() here.
+	 */
+	if (!so->so_comp) {
+		so->so_ncomp = sched::cpus.size();
+		so->so_comp.reset(new so_compq[so->so_ncomp]);
+		for (u_int i = 0; i < so->so_ncomp; i++) {
+			mtx_init(&so->so_comp[i].mtx, "so_comp", NULL, MTX_DEF);
+			TAILQ_INIT(&so->so_comp[i].q);
+		}
+	}
 	so->so_options |= SO_ACCEPTCONN;
 }
 
@@ -546,7 +648,7 @@ sofree(struct socket *so)
 	    ("sofree: so_head == NULL, but still SQ_COMP(%d) or SQ_INCOMP(%d)",
 	    so->so_qstate & SQ_COMP, so->so_qstate & SQ_INCOMP));
 	if (so->so_options & SO_ACCEPTCONN) {
-		KASSERT((TAILQ_EMPTY(&so->so_comp)), ("sofree: so_comp populated"));
+		KASSERT(so->so_qlen == 0, ("sofree: so_comp populated"));
 		KASSERT((TAILQ_EMPTY(&so->so_incomp)), ("sofree: so_incomp populated"));
 	}
 	SOCK_UNLOCK(so);
@@ -641,9 +743,7 @@ drop:
 			soabort(sp);
 			ACCEPT_LOCK();
 		}
-		while ((sp = TAILQ_FIRST(&so->so_comp)) != NULL) {
-			TAILQ_REMOVE(&so->so_comp, sp, so_list);
-			so->so_qlen--;
+		while ((sp = socomp_dequeue(so, 0)) != NULL) {
 			sp->so_qstate &= ~SQ_COMP;
 			sp->so_head = NULL;
 			ACCEPT_UNLOCK();
@@ -924,6 +1024,141 @@ out:
 	return (error);
 }
 
+/*
+ * A MSG_ZEROCOPY send.  The mbufs pointing into the caller's pages share
+ * refcnt, which counts them and the sender, as the external reference
+ * count.  Whoever drops it to zero queues the completion.
+ */
+struct sozerocopy {
+	u_int		 refcnt;
+	struct socket	*so;
+	uint32_t	 id;
+	bool		 copied;
+};
+
+/*
+ * Queues the completion of send id on the error queue, merged with the
+ * previous one if they follow each other.
+ */
+static void
+sozerocopy_record(struct socket *so, uint32_t id, bool copied)
+{
+	SOCK_LOCK_ASSERT(so);
+	auto& q = so->so_errqueue;
+	if (!q.empty() && q.back().hi + 1 == id && q.back().copied == copied)
+		q.back().hi = id;
+	else
+		q.push_back({id, id, copied});
+	poll_wake(so->fp, POLLERR);
+}
+
+static void
+sozerocopy_done(struct sozerocopy *zc)
+{
+	struct socket *so = zc->so;
+
+	ACCEPT_LOCK();
+	SOCK_LOCK(so);
+	sozerocopy_record(so, zc->id, zc->copied);
+	delete zc;
+	sorele(so);
+}
+
+/*
+ * The external free routine of the mbufs.  It may run with the locks of
+ * a driver or of the peer socket held, so the socket is only locked later,
+ * by the worker thread.
+ */
+static void
+sozerocopy_free(void *arg1, void *arg2)
+{
+	auto zc = static_cast<struct sozerocopy *>(arg1);
+
+	async::run_later([zc] { sozerocopy_done(zc); });
+}
+
+/*
+ * Starts a MSG_ZEROCOPY send, if the socket allows them.  Small sends, and
+ * data outside of the linear map, whose pages the driver could not find,
+ * are copied as usual, but still get their completion, flagged copied.
+ */
+static struct sozerocopy *
+sozerocopy_start(struct socket *so, struct uio *uio, int flags, int atomic)
+{
+	SOCK_LOCK_ASSERT(so);
+	if (!(flags & MSG_ZEROCOPY) || !so->so_zerocopy || uio == NULL || atomic)
+		return (NULL);
+	bool copied = uio->uio_resid < zerocopy_min;
+	for (int i = 0; i < uio->uio_iovcnt && !copied; i++) {
+		struct iovec *iov = &uio->uio_iov[i];
+		if (iov->iov_len && !mmu::is_linear_mapped(iov->iov_base, iov->iov_len))
+			copied = true;
+	}
+	return (new sozerocopy{1, so, so->so_zerocopy_next++, copied});
+}
+
+/*
+ * Like m_uiotombuf(), but the mbufs point into the caller's pages, up to
+ * len bytes of them.
+ */
+static struct mbuf *
+sozerocopy_mbufs(struct sozerocopy *zc, struct uio *uio, long len)
+{
+	struct mbuf *top = NULL, **mp = &top;
+
+	while (len > 0 && uio->uio_resid > 0) {
+		struct iovec *iov = uio->uio_iov;
+		if (iov->iov_len == 0) {
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+			continue;
+		}
+		int n = MIN(MIN((size_t)len, iov->iov_len), (size_t)INT_MAX);
+		struct mbuf *m = m_get(M_WAITOK, MT_DATA);
+		atomic_add_int(&zc->refcnt, 1);
+		m->M_dat.MH.MH_dat.MH_ext.ext_buf = static_cast<caddr_t>(iov->iov_base);
+		m->M_dat.MH.MH_dat.MH_ext.ext_size = n;
+		m->M_dat.MH.MH_dat.MH_ext.ext_free = sozerocopy_free;
+		m->M_dat.MH.MH_dat.MH_ext.ext_arg1 = zc;
+		m->M_dat.MH.MH_dat.MH_ext.ext_arg2 = NULL;
+		m->M_dat.MH.MH_dat.MH_ext.ext_type = EXT_EXTREF;
+		m->M_dat.MH.MH_dat.MH_ext.ref_cnt = &zc->refcnt;
+		m->m_hdr.mh_flags |= M_EXT | M_RDONLY;
+		m->m_hdr.mh_data = m->M_dat.MH.MH_dat.MH_ext.ext_buf;
+		m->m_hdr.mh_len = n;
+		*mp = m;
+		mp = &m->m_hdr.mh_next;
+		iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+		iov->iov_len -= n;
+		uio->uio_resid -= n;
+		uio->uio_offset += n;
+		len -= n;
+	}
+	return (top);
+}
+
+/*
+ * Ends a MSG_ZEROCOPY send, as the sender.  A send that sent nothing gives
+ * its id back; sblock still keeps the other senders out.
+ */
+static void
+sozerocopy_end(struct socket *so, struct sozerocopy *zc, bool sent)
+{
+	SOCK_LOCK_ASSERT(so);
+	if (zc->refcnt == 1) {
+		if (sent)
+			sozerocopy_record(so, zc->id, zc->copied);
+		else
+			so->so_zerocopy_next--;
+		delete zc;
+		return;
+	}
+	/* The completion holds a reference to the socket */
+	soref(so);
+	if (atomic_fetchadd_int(&zc->refcnt, -1) == 1)
+		sozerocopy_free(zc, NULL);
+}
+
 /*
  * Send on a socket.  If send must go all at once and message is larger than
  * send buffering, then hard error.  Lock against other senders.  If must go
@@ -945,6 +1180,8 @@ sosend_generic(struct socket *so, struct bsd_sockaddr *addr, struct uio *uio,
 	ssize_t resid;
 	int clen = 0, error, dontroute;
 	int atomic = sosendallatonce(so) || top;
+	struct sozerocopy *zc = NULL;
+	ssize_t zc_resid = 0;
 
 	if (uio != NULL)
 		resid = uio->uio_resid;
@@ -975,6 +1212,9 @@ sosend_generic(struct socket *so, struct bsd_sockaddr *addr, struct uio *uio,
 	error = sblock(so, &so->so_snd, SBLOCKWAIT(flags));
 	if (error)
 		goto out;
+	zc = sozerocopy_start(so, uio, flags, atomic);
+	if (zc != NULL)
+		zc_resid = uio->uio_resid;
 
 restart:
 	flush_net_channel(so);
@@ -1035,6 +1275,10 @@ restart:
 				resid = 0;
 				if (flags & MSG_EOR)
 					top->m_hdr.mh_flags |= M_EOR;
+			} else if (zc != NULL && !zc->copied) {
+				top = sozerocopy_mbufs(zc, uio, space);
+				space -= resid - uio->uio_resid;
+				resid = uio->uio_resid;
 			} else {
 				/*
 				 * Copy the data from userland into a mbuf
@@ -1044,7 +1288,9 @@ restart:
 				top = m_uiotombuf(uio, M_WAITOK, space,
 				    (atomic ? max_hdr : 0), MCLBYTES,
 				    (atomic ? M_PKTHDR : 0) |
-				    ((flags & MSG_EOR) ? M_EOR : 0));
+				    ((flags & MSG_EOR) ? M_EOR : 0) |
+				    ((so->so_snd.sb_flags & SB_DATASUM) ? M_DATASUM : 0) |
+				    ((so->so_snd.sb_flags & SB_BIGCL) ? M_BIGCL : 0));
 				if (top == NULL) {
 					error = EFAULT; /* only possible error */
 					goto release;
@@ -1094,6 +1340,8 @@ restart:
 	} while (resid);
 
 release:
+	if (zc != NULL)
+		sozerocopy_end(so, zc, uio->uio_resid != zc_resid);
 	sbunlock(so, &so->so_snd);
 out:
 	SOCK_UNLOCK(so);
@@ -1187,6 +1435,20 @@ sockbuf_pushsync(socket* so, struct sockbuf *sb, struct mbuf *nextrecord)
 }
 
 
+/*
+ * Takes the oldest MSG_ZEROCOPY completion off the error queue.
+ */
+int
+soreceive_errqueue(struct socket *so, struct so_zerocopy_done *done)
+{
+	SCOPE_LOCK(SOCK_MTX_REF(so));
+	if (so->so_errqueue.empty())
+		return (EWOULDBLOCK);
+	*done = so->so_errqueue.front();
+	so->so_errqueue.pop_front();
+	return (0);
+}
+
 /*
  * Implement receive operations on a socket.  We depend on the way that
  * records are added to the sockbuf by sbappend.  In particular, each record
@@ -2236,6 +2498,33 @@ sosetopt(struct socket *so, struct sockopt *sopt)
 			so->so_user_cookie = val32;
 			break;
 
+		case SO_BUSY_POLL:
+			error = sooptcopyin(sopt, &optval, sizeof optval,
+					    sizeof optval);
+			if (error)
+				goto bad;
+			if (optval < 0) {
+				error = EINVAL;
+				goto bad;
+			}
+			so->so_busy_poll = optval;
+			break;
+
+		case SO_ZEROCOPY:
+			error = sooptcopyin(sopt, &optval, sizeof optval,
+					    sizeof optval);
+			if (error)
+				goto bad;
+			if (so->so_type != SOCK_STREAM ||
+			    so->so_proto->pr_protocol != IPPROTO_TCP) {
+				error = EOPNOTSUPP;
+				goto bad;
+			}
+			SOCK_LOCK(so);
+			so->so_zerocopy = optval != 0;
+			SOCK_UNLOCK(so);
+			break;
+
 		case SO_SNDBUF:
 		case SO_RCVBUF:
 		case SO_SNDLOWAT:
@@ -2478,6 +2767,14 @@ integer:
 			optval = so->so_incqlen;
 			goto integer;
 
+		case SO_BUSY_POLL:
+			optval = so->so_busy_poll;
+			goto integer;
+
+		case SO_ZEROCOPY:
+			optval = so->so_zerocopy;
+			goto integer;
+
 		default:
 			error = ENOPROTOOPT;
 			break;
@@ -2654,6 +2951,9 @@ sopoll_generic_locked(struct socket *so, int events)
 		if (so->so_oobmark || (so->so_rcv.sb_state & SBS_RCVATMARK))
 			revents |= events & (POLLPRI | POLLRDBAND);
 
+	if (!so->so_errqueue.empty())
+		revents |= POLLERR;
+
 	if ((events & POLLINIGNEOF) == 0) {
 		if (so->so_rcv.sb_state & SBS_CANTRCVMORE) {
 			revents |= events & (POLLIN | POLLRDNORM);
@@ -2858,8 +3158,8 @@ sysctl_somaxconn(SYSCTL_HANDLER_ARGS)
  * made and awaiting user acceptance.  As a protocol is preparing incoming
  * connections, it creates a socket structure queued on so_incomp by calling
  * sonewconn().  When the connection is established, soisconnected() is
- * called, and transfers the socket structure to so_comp, making it available
- * to accept().
+ * called, and transfers the socket structure to so_comp, on the queue of the
+ * CPU it is called on, making it available to accept().
  *
  * If a socket is closed with sockets on either so_incomp or so_comp, these
  * sockets are dropped.
@@ -2882,6 +3182,7 @@ soisconnected(struct socket *so)
 {
 	struct socket *head;	
 	int ret;
+	unsigned cpu;
 
 restart:
 	SOCK_UNLOCK(so);
@@ -2896,12 +3197,10 @@ restart:
 			TAILQ_REMOVE(&head->so_incomp, so, so_list);
 			head->so_incqlen--;
 			so->so_qstate &= ~SQ_INCOMP;
-			TAILQ_INSERT_TAIL(&head->so_comp, so, so_list);
-			head->so_qlen++;
-			so->so_qstate |= SQ_COMP;
+			cpu = socomp_insert(head, so);
 			ACCEPT_UNLOCK();
 			sorwakeup(head);
-			wakeup_one(&head->so_timeo);
+			socomp_wakeup(head, cpu);
 		} else {
 			ACCEPT_UNLOCK();
 			soupcall_set(so, SO_RCV,
@@ -3069,8 +3368,15 @@ void
 so_listeners_apply_all(struct socket *so, void (*func)(struct socket *, void *), void *arg)
 {
 	
-	TAILQ_FOREACH(so, &so->so_comp, so_list)
-		func(so, arg);
+	struct socket *sp;
+	u_int i;
+
+	for (i = 0; i < so->so_ncomp; i++) {
+		mtx_lock(&so->so_comp[i].mtx);
+		TAILQ_FOREACH(sp, &so->so_comp[i].q, so_list)
+			func(sp, arg);
+		mtx_unlock(&so->so_comp[i].mtx);
+	}
 }
 
 struct sockbuf *
@@ -46,8 +46,10 @@
 #include <bsd/porting/synch.h>
 #include <osv/file.h>
 #include <osv/socket.hh>
+#include <osv/sched.hh>
 
 #include <bsd/sys/sys/mbuf.h>
+#include <bsd/sys/sys/domain.h>
 #include <bsd/sys/sys/protosw.h>
 #include <bsd/sys/sys/socket.h>
 #include <bsd/sys/sys/socketvar.h>
@@ -210,6 +212,7 @@ kern_accept(int s, struct bsd_sockaddr *name,
 	int fd;
 	u_int fflag;
 	int tmp;
+	unsigned cpu;
 
 	if ((name) && (*namelen < 0)) {
 			return (EINVAL);
@@ -223,49 +226,66 @@ kern_accept(int s, struct bsd_sockaddr *name,
 		error = EINVAL;
 		goto done;
 	}
-	ACCEPT_LOCK();
-	if ((head->so_state & SS_NBIO) && TAILQ_EMPTY(&head->so_comp)) {
-		ACCEPT_UNLOCK();
-		error = EWOULDBLOCK;
-		goto noconnection;
-	}
-	while (TAILQ_EMPTY(&head->so_comp) && head->so_error == 0) {
-		if (head->so_rcv.sb_state & SBS_CANTRCVMORE) {
-			head->so_error = ECONNABORTED;
-			break;
+	/* Steer this listener's new connections here, if it has a choice */
+	head->so_cpu = sched::cpu::current()->id;
+	/*
+	 * Preferably one whose handshake completed on this CPU.  Taking a
+	 * queued connection needs only its queue's lock; ACCEPT_LOCK() is
+	 * for waiting for one.
+	 */
+	cpu = sched::cpu::current()->id;
+	so = socomp_dequeue(head, cpu);
+	if (so == NULL) {
+		ACCEPT_LOCK();
+		while ((so = socomp_dequeue(head, cpu)) == NULL &&
+		    head->so_error == 0) {
+			if (head->so_state & SS_NBIO) {
+				ACCEPT_UNLOCK();
+				error = EWOULDBLOCK;
+				goto noconnection;
+			}
+			if (head->so_rcv.sb_state & SBS_CANTRCVMORE) {
+				head->so_error = ECONNABORTED;
+				break;
+			}
+			/* see socomp_wakeup() */
+			head->so_acceptwaiters++;
+			if (head->so_qlen != 0) {
+				head->so_acceptwaiters--;
+				continue;
+			}
+			error = msleep(&head->so_timeo, &accept_mtx, 0, "accept", 0);
+			head->so_acceptwaiters--;
+			if (error) {
+				ACCEPT_UNLOCK();
+				goto noconnection;
+			}
 		}
-		error = msleep(&head->so_timeo, &accept_mtx, 0, "accept", 0);
-		if (error) {
+		if (so == NULL) {
+			error = head->so_error;
+			head->so_error = 0;
 			ACCEPT_UNLOCK();
 			goto noconnection;
 		}
-	}
-	if (head->so_error) {
-		error = head->so_error;
-		head->so_error = 0;
 		ACCEPT_UNLOCK();
-		goto noconnection;
 	}
-	so = TAILQ_FIRST(&head->so_comp);
 	KASSERT(!(so->so_qstate & SQ_INCOMP), ("accept1: so SQ_INCOMP"));
 	KASSERT(so->so_qstate & SQ_COMP, ("accept1: so not SQ_COMP"));
 
 	/*
 	 * Before changing the flags on the socket, we have to bump the
 	 * reference count.  Otherwise, if the protocol calls sofree(),
-	 * the socket will be released due to a zero refcount.
+	 * the socket will be released due to a zero refcount.  Until then,
+	 * SQ_COMP keeps sofree() off it.
 	 */
 	SOCK_LOCK(so);			/* soref() and so_state update */
 	soref(so);			/* file descriptor reference */
 
-	TAILQ_REMOVE(&head->so_comp, so, so_list);
-	head->so_qlen--;
-	so->so_state |= (head->so_state & SS_NBIO);
 	so->so_qstate &= ~SQ_COMP;
+	so->so_state |= (head->so_state & SS_NBIO);
 	so->so_head = NULL;
 
 	SOCK_UNLOCK(so);
-	ACCEPT_UNLOCK();
 
 	/* FIXME: OSv - Implement... select/poll */
 #if 0
@@ -652,6 +672,27 @@ out:
 	return (error);
 }
 
+/*
+ * Takes the oldest MSG_ZEROCOPY completion off the socket's error queue,
+ * and tells the family of the socket, which the caller reports it as.
+ */
+int
+kern_recverr(int s, struct so_zerocopy_done *done, int *family)
+{
+	struct file *fp;
+	struct socket *so;
+	int error;
+
+	error = getsock_cap(s, &fp, NULL);
+	if (error)
+		return (error);
+	so = (socket*)file_data(fp);
+	*family = so->so_proto->pr_domain->dom_family;
+	error = soreceive_errqueue(so, done);
+	fdrop(fp);
+	return (error);
+}
+
 static int
 recvit(int s, struct msghdr *mp, void *namelenp, ssize_t* bytes)
 {
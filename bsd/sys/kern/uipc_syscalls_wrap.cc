@@ -5,12 +5,28 @@
 
 #include <bsd/uipc_syscalls.h>
 #include <osv/debug.h>
+#include <osv/file.h>
 #include "libc/af_local.h"
 
 #include "libc/internal/libc.h"
 
 #define sock_d(...)		tprintf_d("socket-api", __VA_ARGS__);
 
+/*
+ * Whether fd is handled by the BSD stack rather than af_local.cc. This only
+ * peeks at the fd table entry, without taking a reference, so TCP and UDP
+ * calls are left with the single lookup their BSD handler does anyway; a
+ * bad fd is left to the BSD path to report.
+ */
+static bool is_bsd_socket(int fd)
+{
+	filetype_t type;
+
+	if (fget_type(fd, &type))
+		return true;
+	return type == DTYPE_SOCKET;
+}
+
 extern "C"
 int socketpair(int domain, int type, int protocol, int sv[2])
 {
@@ -39,7 +55,10 @@ int getsockname(int sockfd, struct bsd_sockaddr *addr, socklen_t *addrlen)
 
 	sock_d("getsockname(sockfd=%d, ...)", sockfd);
 
-	error = linux_getsockname(sockfd, addr, addrlen);
+	if (is_bsd_socket(sockfd))
+		error = linux_getsockname(sockfd, addr, addrlen);
+	else
+		error = getsockname_af_local(sockfd, addr, addrlen);
 	if (error) {
 		sock_d("getsockname() failed, errno=%d", error);
 		errno = error;
@@ -56,7 +75,10 @@ int getpeername(int sockfd, struct bsd_sockaddr *addr, socklen_t *addrlen)
 
 	sock_d("getpeername(sockfd=%d, ...)", sockfd);
 
-	error = linux_getpeername(sockfd, addr, addrlen);
+	if (is_bsd_socket(sockfd))
+		error = linux_getpeername(sockfd, addr, addrlen);
+	else
+		error = getpeername_af_local(sockfd, addr, addrlen);
 	if (error) {
 		sock_d("getpeername() failed, errno=%d", error);
 		errno = error;
@@ -73,7 +95,10 @@ int accept4(int fd, struct bsd_sockaddr *__restrict addr, socklen_t *__restrict
 
 	sock_d("accept4(fd=%d, ..., flg=%d)", fd, flg);
 
-	error = linux_accept4(fd, addr, len, &fd2, flg);
+	if (is_bsd_socket(fd))
+		error = linux_accept4(fd, addr, len, &fd2, flg);
+	else
+		error = accept_af_local(fd, addr, len, flg, &fd2);
 	if (error) {
 		sock_d("accept4() failed, errno=%d", error);
 		errno = error;
@@ -90,7 +115,10 @@ int accept(int fd, struct bsd_sockaddr *__restrict addr, socklen_t *__restrict l
 
 	sock_d("accept(fd=%d, ...)", fd);
 
-	error = linux_accept(fd, addr, len, &fd2);
+	if (is_bsd_socket(fd))
+		error = linux_accept(fd, addr, len, &fd2);
+	else
+		error = accept_af_local(fd, addr, len, 0, &fd2);
 	if (error) {
 		sock_d("accept() failed, errno=%d", error);
 		errno = error;
@@ -107,7 +135,10 @@ int bind(int fd, const struct bsd_sockaddr *addr, socklen_t len)
 
 	sock_d("bind(fd=%d, ...)", fd);
 
-	error = linux_bind(fd, (void *)addr, len);
+	if (is_bsd_socket(fd))
+		error = linux_bind(fd, (void *)addr, len);
+	else
+		error = bind_af_local(fd, addr, len);
 	if (error) {
 		sock_d("bind() failed, errno=%d", error);
 		errno = error;
@@ -124,7 +155,10 @@ int connect(int fd, const struct bsd_sockaddr *addr, socklen_t len)
 
 	sock_d("connect(fd=%d, ...)", fd);
 
-	error = linux_connect(fd, (void *)addr, len);
+	if (is_bsd_socket(fd))
+		error = linux_connect(fd, (void *)addr, len);
+	else
+		error = connect_af_local(fd, addr, len);
 	if (error) {
 		sock_d("connect() failed, errno=%d", error);
 		errno = error;
@@ -141,7 +175,10 @@ int listen(int fd, int backlog)
 
 	sock_d("listen(fd=%d, backlog=%d)", fd, backlog);
 
-	error = linux_listen(fd, backlog);
+	if (is_bsd_socket(fd))
+		error = linux_listen(fd, backlog);
+	else
+		error = listen_af_local(fd, backlog);
 	if (error) {
 		sock_d("listen() failed, errno=%d", error);
 		errno = error;
@@ -161,7 +198,10 @@ ssize_t recvfrom(int fd, void *__restrict buf, size_t len, int flags,
 	sock_d("recvfrom(fd=%d, buf=<uninit>, len=%d, flags=0x%x, ...)", fd,
 		len, flags);
 
-	error = linux_recvfrom(fd, (caddr_t)buf, len, flags, addr, alen, &bytes);
+	if (is_bsd_socket(fd))
+		error = linux_recvfrom(fd, (caddr_t)buf, len, flags, addr, alen, &bytes);
+	else
+		error = recvfrom_af_local(fd, buf, len, flags, addr, alen, &bytes);
 	if (error) {
 		sock_d("recvfrom() failed, errno=%d", error);
 		errno = error;
@@ -179,7 +219,10 @@ ssize_t recv(int fd, void *buf, size_t len, int flags)
 
 	sock_d("recv(fd=%d, buf=<uninit>, len=%d, flags=0x%x)", fd, len, flags);
 
-	error = linux_recv(fd, (caddr_t)buf, len, flags, &bytes);
+	if (is_bsd_socket(fd))
+		error = linux_recv(fd, (caddr_t)buf, len, flags, &bytes);
+	else
+		error = recvfrom_af_local(fd, buf, len, flags, NULL, NULL, &bytes);
 	if (error) {
 		sock_d("recv() failed, errno=%d", error);
 		errno = error;
@@ -197,7 +240,10 @@ ssize_t recvmsg(int fd, struct msghdr *msg, int flags)
 
 	sock_d("recvmsg(fd=%d, msg=..., flags=0x%x)", fd, flags);
 
-	error = linux_recvmsg(fd, msg, flags, &bytes);
+	if (is_bsd_socket(fd))
+		error = linux_recvmsg(fd, msg, flags, &bytes);
+	else
+		error = recvmsg_af_local(fd, msg, flags, &bytes);
 	if (error) {
 		sock_d("recvmsg() failed, errno=%d", error);
 		errno = error;
@@ -216,8 +262,11 @@ ssize_t sendto(int fd, const void *buf, size_t len, int flags,
 
 	sock_d("sendto(fd=%d, buf=..., len=%d, flags=0x%x, ...", fd, len, flags);
 
-	error = linux_sendto(fd, (caddr_t)buf, len, flags, (caddr_t)addr,
-			   alen, &bytes);
+	if (is_bsd_socket(fd))
+		error = linux_sendto(fd, (caddr_t)buf, len, flags,
+			   (caddr_t)addr, alen, &bytes);
+	else
+		error = sendto_af_local(fd, buf, len, flags, addr, alen, &bytes);
 	if (error) {
 		sock_d("sendto() failed, errno=%d", error);
 		errno = error;
@@ -235,7 +284,10 @@ ssize_t send(int fd, const void *buf, size_t len, int flags)
 
 	sock_d("send(fd=%d, buf=..., len=%d, flags=0x%x)", fd, len, flags)
 
-	error = linux_send(fd, (caddr_t)buf, len, flags, &bytes);
+	if (is_bsd_socket(fd))
+		error = linux_send(fd, (caddr_t)buf, len, flags, &bytes);
+	else
+		error = sendto_af_local(fd, buf, len, flags, NULL, 0, &bytes);
 	if (error) {
 		sock_d("send() failed, errno=%d", error);
 		errno = error;
@@ -253,7 +305,10 @@ ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
 
 	sock_d("sendmsg(fd=%d, msg=..., flags=0x%x)", fd, flags)
 
-	error = linux_sendmsg(fd, (struct msghdr *)msg, flags, &bytes);
+	if (is_bsd_socket(fd))
+		error = linux_sendmsg(fd, (struct msghdr *)msg, flags, &bytes);
+	else
+		error = sendmsg_af_local(fd, msg, flags, &bytes);
 	if (error) {
 		sock_d("sendmsg() failed, errno=%d", error);
 		errno = error;
@@ -271,7 +326,10 @@ int getsockopt(int fd, int level, int optname, void *__restrict optval,
 
 	sock_d("getsockopt(fd=%d, level=%d, optname=%d)", fd, level, optname);
 
-	error = linux_getsockopt(fd, level, optname, optval, optlen);
+	if (is_bsd_socket(fd))
+		error = linux_getsockopt(fd, level, optname, optval, optlen);
+	else
+		error = getsockopt_af_local(fd, level, optname, optval, optlen);
 	if (error) {
 		sock_d("getsockopt() failed, errno=%d", error);
 		errno = error;
@@ -289,7 +347,10 @@ int setsockopt(int fd, int level, int optname, const void *optval, socklen_t opt
 	sock_d("setsockopt(fd=%d, level=%d, optname=%d, (*(int)optval)=%d, optlen=%d)",
 		fd, level, optname, *(int *)optval, optlen);
 
-	error = linux_setsockopt(fd, level, optname, (caddr_t)optval, optlen);
+	if (is_bsd_socket(fd))
+		error = linux_setsockopt(fd, level, optname, (caddr_t)optval, optlen);
+	else
+		error = setsockopt_af_local(fd, level, optname, optval, optlen);
 	if (error) {
 		sock_d("setsockopt() failed, errno=%d", error);
 		errno = error;
@@ -306,13 +367,10 @@ int shutdown(int fd, int how)
 
 	sock_d("shutdown(fd=%d, how=%d)", fd, how);
 
-	// Try first if it's a AF_LOCAL socket (af_local.cc), and if not
-	// fall back to network sockets. TODO: do this more cleanly.
-	error = shutdown_af_local(fd, how);
-	if (error != ENOTSOCK) {
-	    return error;
-	}
-	error = linux_shutdown(fd, how);
+	if (is_bsd_socket(fd))
+		error = linux_shutdown(fd, how);
+	else
+		error = shutdown_af_local(fd, how);
 	if (error) {
 		sock_d("shutdown() failed, errno=%d", error);
 		errno = error;
@@ -329,6 +387,9 @@ int socket(int domain, int type, int protocol)
 
 	sock_d("socket(domain=%d, type=%d, protocol=%d)", domain, type, protocol);
 
+	if (domain == AF_LOCAL)
+		return socket_af_local(type, protocol);
+
 	error = linux_socket(domain, type, protocol, &s);
 	if (error) {
 		sock_d("socket() failed, errno=%d", error);
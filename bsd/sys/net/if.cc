@@ -1942,7 +1942,11 @@ ifhwioctl(u_long cmd, struct ifnet *ifp, caddr_t data, struct thread *td)
 			return (EOPNOTSUPP);
 		if (ifr->ifr_reqcap & ~ifp->if_capabilities)
 			return (EINVAL);
-		error = (*ifp->if_ioctl)(ifp, cmd, data);
+		/* GSO is above the driver, which only hears of the rest */
+		ifp->if_capenable ^= (ifr->ifr_reqcap ^ ifp->if_capenable) &
+		    IFCAP_GSO4;
+		if ((ifr->ifr_reqcap ^ ifp->if_capenable) & ifp->if_capabilities)
+			error = (*ifp->if_ioctl)(ifp, cmd, data);
 		if (error == 0)
 			getmicrotime(&ifp->if_lastchange);
 		break;
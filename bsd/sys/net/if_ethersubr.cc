@@ -898,6 +898,9 @@ ether_ifattach(struct ifnet *ifp, const u_int8_t *lla)
 	ifp->if_mtu = ETHERMTU;
 	ifp->if_output = ether_output;
 	ifp->if_input = ether_input;
+	/* Without TSO, IPv4 segments TCP in software instead */
+	ifp->if_capabilities |= IFCAP_GSO4;
+	ifp->if_capenable |= IFCAP_GSO4;
 	ifp->if_resolvemulti = ether_resolvemulti;
 	if (ifp->if_baudrate == 0)
 		ifp->if_baudrate = IF_Mbps(10);		/* just a default */
@@ -177,6 +177,11 @@ struct ifnet {
 	 * get the interface info and statistics including the one gathered by HW
 	 */
 	void (*if_getinfo)(struct ifnet *, struct if_data *);
+	/*
+	 * process whatever the device has received so far in the caller's
+	 * context, without waiting for an interrupt (busy polling); optional
+	 */
+	void (*if_rxpoll)(struct ifnet *);
 	classifier if_classifier;
 
 	struct	vnet *if_home_vnet;	/* where this ifnet originates from */
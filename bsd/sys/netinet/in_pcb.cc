@@ -81,11 +81,20 @@
 #include <bsd/sys/netipsec/key.h>
 #endif /* IPSEC */
 
+#include <machine/atomic.h>
+
 #include <osv/trace.hh>
+#include <osv/sched.hh>
+#include <osv/rcu.hh>
+#include <osv/preempt-lock.hh>
 
 TRACEPOINT(trace_inpcb_ref, "inp=%x", struct inpcb *);
 TRACEPOINT(trace_inpcb_rele, "inp=%x", struct inpcb *);
 TRACEPOINT(trace_inpcb_free, "inp=%x", struct inpcb *);
+TRACEPOINT(trace_inpcb_bucket_wait, "pcbinfo=%x bucket=%x",
+    struct inpcbinfo *, struct inpcbbucket *);
+TRACEPOINT(trace_inpcb_lookup_retry, "pcbinfo=%x lport=%d fport=%d",
+    struct inpcbinfo *, u_short, u_short);
 
 static struct callout	ipport_tick_callout;
 
@@ -119,6 +128,8 @@ static VNET_DEFINE(int, ipport_tcplastcount);
 #define	V_ipport_tcplastcount		VNET(ipport_tcplastcount)
 
 static void	in_pcbremlists(struct inpcb *inp);
+static void	in_pcbremhash(struct inpcb *inp);
+static void	in_pcblbgroup_remove(struct inpcb *inp);
 #ifdef INET
 static struct inpcb	*in_pcblookup_hash_locked(struct inpcbinfo *pcbinfo,
 			    struct in_addr faddr, u_int fport_arg,
@@ -197,6 +208,48 @@ SYSCTL_VNET_INT(_net_inet_ip_portrange, OID_AUTO, randomtime, CTLFLAG_RW,
  * functions often modify hash chains or addresses in pcbs.
  */
 
+/*
+ * LIST_INSERT_HEAD() for the lists lookups walk under rcu_read_lock: the
+ * element is linked in before a reader can reach it.  LIST_REMOVE() is
+ * safe as it is, as it leaves the element pointing into its list.
+ */
+#define	INP_LIST_INSERT_HEAD_RCU(head, elm, field) do {			\
+	if (((elm)->field.le_next = LIST_FIRST((head))) != NULL)	\
+		LIST_FIRST((head))->field.le_prev = &(elm)->field.le_next; \
+	(elm)->field.le_prev = &LIST_FIRST((head));			\
+	atomic_store_rel_ptr((volatile u_long *)&LIST_FIRST((head)),	\
+	    (u_long)(elm));						\
+} while (0)
+
+static void
+in_pcbbucket_lock(struct inpcbinfo *pcbinfo, struct inpcbbucket *ib)
+{
+
+	if (!mutex_trylock(&ib->ib_lock)) {
+		trace_inpcb_bucket_wait(pcbinfo, ib);
+		mutex_lock(&ib->ib_lock);
+	}
+}
+
+static void
+in_pcbbucket_unlock(struct inpcbbucket *ib)
+{
+
+	mutex_unlock(&ib->ib_lock);
+}
+
+static struct inpcbbucket *
+in_pcbinitbuckets(u_long mask)
+{
+	struct inpcbbucket *ib;
+	u_long i;
+
+	ib = new inpcbbucket[mask + 1];
+	for (i = 0; i <= mask; i++)
+		ib[i].ib_seq = 0;
+	return (ib);
+}
+
 /*
  * Initialize an inpcbinfo -- we should be able to reduce the number of
  * arguments in time.
@@ -218,8 +271,13 @@ in_pcbinfo_init(struct inpcbinfo *pcbinfo, const char *name,
 	pcbinfo->ipi_count = 0;
 	pcbinfo->ipi_hashbase = (inpcbhead *)hashinit(hash_nelements, 0,
 	    &pcbinfo->ipi_hashmask);
+	pcbinfo->ipi_hashbuckets = in_pcbinitbuckets(pcbinfo->ipi_hashmask);
 	pcbinfo->ipi_porthashbase = (inpcbporthead *)hashinit(porthash_nelements, 0,
 	    &pcbinfo->ipi_porthashmask);
+	pcbinfo->ipi_porthashbuckets =
+	    in_pcbinitbuckets(pcbinfo->ipi_porthashmask);
+	pcbinfo->ipi_lbgrouphashbase = (inpcblbgrouphead *)hashinit(
+	    porthash_nelements, 0, &pcbinfo->ipi_lbgrouphashmask);
 #ifdef PCBGROUP
 	in_pcbgroup_init(pcbinfo, hashfields, hash_nelements);
 #endif
@@ -240,11 +298,17 @@ in_pcbinfo_destroy(struct inpcbinfo *pcbinfo)
 	    ("%s: ipi_count = %u", __func__, pcbinfo->ipi_count));
 
 	hashdestroy(pcbinfo->ipi_hashbase, 0, pcbinfo->ipi_hashmask);
+	delete[] pcbinfo->ipi_hashbuckets;
 	hashdestroy(pcbinfo->ipi_porthashbase, 0,
 	    pcbinfo->ipi_porthashmask);
+	delete[] pcbinfo->ipi_porthashbuckets;
+	hashdestroy(pcbinfo->ipi_lbgrouphashbase, 0,
+	    pcbinfo->ipi_lbgrouphashmask);
 #ifdef PCBGROUP
 	in_pcbgroup_destroy(pcbinfo);
 #endif
+	/* Let the inpcbs waiting for a grace period go back to the zone */
+	osv::rcu_flush();
 	uma_zdestroy(pcbinfo->ipi_zone);
 	INP_HASH_LOCK_DESTROY(pcbinfo);
 	INP_INFO_LOCK_DESTROY(pcbinfo);
@@ -440,8 +504,10 @@ in_pcb_lport(struct inpcb *inp, struct in_addr *laddrp, u_short *lportp,
 		else
 #endif
 #ifdef INET
-			tmpinp = in_pcblookup_local(pcbinfo, laddr,
-			    lport, lookupflags, cred);
+			WITH_LOCK(osv::rcu_read_lock) {
+				tmpinp = in_pcblookup_local(pcbinfo, laddr,
+				    lport, lookupflags, cred);
+			}
 #endif
 	} while (tmpinp != NULL);
 
@@ -545,8 +611,11 @@ in_pcbbind_setup(struct inpcb *inp, struct bsd_sockaddr *nam, in_addr_t *laddrp,
 			if (!IN_MULTICAST(ntohl(sin->sin_addr.s_addr)) &&
 			    priv_check_cred(inp->inp_cred,
 			    PRIV_NETINET_REUSEPORT, 0) != 0) {
-				t = in_pcblookup_local(pcbinfo, sin->sin_addr,
-				    lport, INPLOOKUP_WILDCARD, cred);
+				WITH_LOCK(osv::rcu_read_lock) {
+					t = in_pcblookup_local(pcbinfo,
+					    sin->sin_addr, lport,
+					    INPLOOKUP_WILDCARD, cred);
+				}
 	/*
 	 * XXX
 	 * This entire block sorely needs a rewrite.
@@ -564,39 +633,51 @@ in_pcbbind_setup(struct inpcb *inp, struct bsd_sockaddr *nam, in_addr_t *laddrp,
 					return (EADDRINUSE);
 #endif
 			}
-			t = in_pcblookup_local(pcbinfo, sin->sin_addr,
-			    lport, lookupflags, cred);
-			if (t && (t->inp_flags & INP_TIMEWAIT)) {
-				/*
-				 * XXXRW: If an incpb has had its timewait
-				 * state recycled, we treat the address as
-				 * being in use (for now).  This is better
-				 * than a panic, but not desirable.
-				 */
-				/*
-				 * Linux allows a SO_REUSEADDR socket to be
-				 * bound to an existing TIME_WAIT socket
-				 * if SO_REUSEADDR is set on the new socket.
-				 *
-				 * Allow for that in addition to the BSD
-				 * SO_REUSEPORT semantics.
-				 */
-				tw = intotw(t);
-				if (tw == NULL ||
-				    ((reuseport & tw->tw_so_options) == 0)
-				     && (so->so_options & SO_REUSEADDR) == 0)
-					return (EADDRINUSE);
-			} else if (t && (reuseport == 0 ||
-			    (t->inp_flags2 & INP_REUSEPORT) == 0)) {
+			/*
+			 * t may be on its way out, but stays around until
+			 * we leave rcu_read_lock, and so does its tcptw.
+			 */
+			WITH_LOCK(osv::rcu_read_lock) {
+				t = in_pcblookup_local(pcbinfo, sin->sin_addr,
+				    lport, lookupflags, cred);
+				if (t && (t->inp_flags & INP_TIMEWAIT)) {
+					/*
+					 * XXXRW: If an incpb has had its
+					 * timewait state recycled, we treat
+					 * the address as being in use (for
+					 * now).  This is better than a panic,
+					 * but not desirable.
+					 */
+					/*
+					 * Linux allows a SO_REUSEADDR socket
+					 * to be bound to an existing
+					 * TIME_WAIT socket if SO_REUSEADDR is
+					 * set on the new socket.
+					 *
+					 * Allow for that in addition to the
+					 * BSD SO_REUSEPORT semantics.
+					 */
+					tw = intotw(t);
+					if (tw == NULL ||
+					    ((reuseport &
+					      tw->tw_so_options) == 0) &&
+					    (so->so_options &
+					     SO_REUSEADDR) == 0)
+						return (EADDRINUSE);
+				} else if (t && (reuseport == 0 ||
+				    (t->inp_flags2 & INP_REUSEPORT) == 0)) {
 #ifdef INET6
-				if (ntohl(sin->sin_addr.s_addr) !=
-				    INADDR_ANY ||
-				    ntohl(t->inp_laddr.s_addr) !=
-				    INADDR_ANY ||
-				    (inp->inp_vflag & INP_IPV6PROTO) == 0 ||
-				    (t->inp_vflag & INP_IPV6PROTO) == 0)
+					if (ntohl(sin->sin_addr.s_addr) !=
+					    INADDR_ANY ||
+					    ntohl(t->inp_laddr.s_addr) !=
+					    INADDR_ANY ||
+					    (inp->inp_vflag &
+					     INP_IPV6PROTO) == 0 ||
+					    (t->inp_vflag &
+					     INP_IPV6PROTO) == 0)
 #endif
-				return (EADDRINUSE);
+					return (EADDRINUSE);
+				}
 			}
 		}
 	}
@@ -902,8 +983,11 @@ in_pcbconnect_setup(struct inpcb *inp, struct bsd_sockaddr *nam,
 		if (error)
 			return (error);
 	}
-	oinp = in_pcblookup_hash_locked(inp->inp_pcbinfo, faddr, fport,
-	    laddr, lport, 0, NULL);
+	/* Callers only check *oinpp against NULL */
+	WITH_LOCK(osv::rcu_read_lock) {
+		oinp = in_pcblookup_hash_locked(inp->inp_pcbinfo, faddr,
+		    fport, laddr, lport, 0, NULL);
+	}
 	if (oinp != NULL) {
 		if (oinpp != NULL)
 			*oinpp = oinp;
@@ -979,6 +1063,25 @@ in_pcbref(struct inpcb *inp)
 	refcount_acquire(&inp->inp_refcount);
 }
 
+/*
+ * in_pcbref() for an inpcb found in the hash under rcu_read_lock, which may
+ * have lost its last reference already, and only be waiting for the grace
+ * period to be freed.  Returns whether a reference was taken.
+ */
+static bool
+in_pcbref_rcu(struct inpcb *inp)
+{
+	u_int old;
+
+	do {
+		old = inp->inp_refcount;
+		if (old == 0)
+			return (false);
+	} while (!atomic_cmpset_int(&inp->inp_refcount, old, old + 1));
+	trace_inpcb_ref(inp);
+	return (true);
+}
+
 /*
  * Drop a refcount on an inpcb elevated using in_pcbref(); because a call to
  * in_pcbfree() may have been made between in_pcbref() and in_pcbrele(), we
@@ -1019,7 +1122,10 @@ in_pcbrele_locked(struct inpcb *inp)
 
 	INP_UNLOCK(inp);
 	pcbinfo = inp->inp_pcbinfo;
-	uma_zfree(pcbinfo->ipi_zone, inp);
+	/* Lookups may still be looking at it, see in_pcblookup_hash() */
+	osv::rcu_defer([pcbinfo](struct inpcb *inp) {
+		uma_zfree(pcbinfo->ipi_zone, inp);
+	}, inp);
 	return (1);
 }
 
@@ -1107,17 +1213,7 @@ in_pcbdrop(struct inpcb *inp)
 	 */
 	inp->inp_flags |= INP_DROPPED;
 	if (inp->inp_flags & INP_INHASHLIST) {
-		struct inpcbport *phd = inp->inp_phd;
-
-		INP_HASH_WLOCK(inp->inp_pcbinfo);
-		LIST_REMOVE(inp, inp_hash);
-		LIST_REMOVE(inp, inp_portlist);
-		if (LIST_FIRST(&phd->phd_pcblist) == NULL) {
-			LIST_REMOVE(phd, phd_hash);
-			free(phd);
-		}
-		INP_HASH_WUNLOCK(inp->inp_pcbinfo);
-		inp->inp_flags &= ~INP_INHASHLIST;
+		in_pcbremhash(inp);
 #ifdef PCBGROUP
 		in_pcbgroup_remove(inp);
 #endif
@@ -1249,7 +1345,9 @@ in_pcbpurgeif0(struct inpcbinfo *pcbinfo, struct ifnet *ifp)
 
 /*
  * Lookup a PCB based on the local address and port.  Caller must hold the
- * hash lock.  No inpcb locks or references are acquired.
+ * hash lock, and rcu_read_lock for as long as it looks at the PCB returned,
+ * which may be leaving the hash meanwhile.  No inpcb locks or references are
+ * acquired.
  */
 #define INP_LOOKUP_MAPPED_PCB_COST	3
 struct inpcb *
@@ -1505,10 +1603,204 @@ found:
 }
 #endif /* PCBGROUP */
 
+/*
+ * Load balance groups: TCP sockets listening with SO_REUSEPORT set on the
+ * same local address and port. Each incoming connection is given to one
+ * of them, chosen by hashing its 4-tuple.
+ */
+static struct inpcblbgroup *
+in_pcblbgroup_alloc(struct inpcblbgrouphead *hdr, struct in_addr laddr,
+    u_short lport, u_int size)
+{
+	struct inpcblbgroup *grp;
+
+	grp = (struct inpcblbgroup *)malloc(sizeof(*grp) +
+	    size * sizeof(struct inpcb *));
+	if (grp == NULL)
+		return (NULL);
+	grp->il_laddr = laddr;
+	grp->il_lport = lport;
+	grp->il_inpsiz = size;
+	grp->il_inpcnt = 0;
+	return (grp);
+}
+
+static void
+in_pcblbgroup_free(struct inpcblbgroup *grp)
+{
+
+	LIST_REMOVE(grp, il_list);
+	osv::rcu_defer([](struct inpcblbgroup *grp) { free(grp); }, grp);
+}
+
+static struct inpcblbgroup *
+in_pcblbgroup_resize(struct inpcblbgrouphead *hdr,
+    struct inpcblbgroup *old_grp, u_int size)
+{
+	struct inpcblbgroup *grp;
+	u_int i;
+
+	grp = in_pcblbgroup_alloc(hdr, old_grp->il_laddr, old_grp->il_lport,
+	    size);
+	if (grp == NULL)
+		return (NULL);
+	for (i = 0; i < old_grp->il_inpcnt; ++i)
+		grp->il_inp[i] = old_grp->il_inp[i];
+	grp->il_inpcnt = old_grp->il_inpcnt;
+	INP_LIST_INSERT_HEAD_RCU(hdr, grp, il_list);
+	in_pcblbgroup_free(old_grp);
+	return (grp);
+}
+
+/*
+ * Add a listening socket with SO_REUSEPORT set to the group of its local
+ * address and port, creating the group if it is the first.
+ */
+int
+in_pcblbgroup_insert(struct inpcb *inp)
+{
+	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
+	struct inpcblbgrouphead *hdr;
+	struct inpcblbgroup *grp;
+
+	INP_LOCK_ASSERT(inp);
+	INP_HASH_WLOCK_ASSERT(pcbinfo);
+
+	if (inp->inp_flags2 & INP_INLBGROUP)
+		return (0);
+
+	hdr = &pcbinfo->ipi_lbgrouphashbase[
+	    INP_PCBPORTHASH(inp->inp_lport, pcbinfo->ipi_lbgrouphashmask)];
+	LIST_FOREACH(grp, hdr, il_list) {
+		if (grp->il_lport == inp->inp_lport &&
+		    grp->il_laddr.s_addr == inp->inp_laddr.s_addr)
+			break;
+	}
+	if (grp == NULL) {
+		grp = in_pcblbgroup_alloc(hdr, inp->inp_laddr, inp->inp_lport,
+		    INPCBLBGROUP_SIZMIN);
+		if (grp == NULL)
+			return (ENOBUFS);
+		grp->il_inp[0] = inp;
+		grp->il_inpcnt = 1;
+		INP_LIST_INSERT_HEAD_RCU(hdr, grp, il_list);
+	} else {
+		if (grp->il_inpcnt == grp->il_inpsiz) {
+			grp = in_pcblbgroup_resize(hdr, grp,
+			    grp->il_inpsiz * 2);
+			if (grp == NULL)
+				return (ENOBUFS);
+		}
+		/* Lookups read the count, then the listeners below it */
+		grp->il_inp[grp->il_inpcnt] = inp;
+		atomic_store_rel_int(&grp->il_inpcnt, grp->il_inpcnt + 1);
+	}
+	inp->inp_flags2 |= INP_INLBGROUP;
+	return (0);
+}
+
+static void
+in_pcblbgroup_remove(struct inpcb *inp)
+{
+	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
+	struct inpcblbgrouphead *hdr;
+	struct inpcblbgroup *grp;
+	u_int i;
+
+	INP_HASH_WLOCK_ASSERT(pcbinfo);
+
+	if ((inp->inp_flags2 & INP_INLBGROUP) == 0)
+		return;
+	inp->inp_flags2 &= ~INP_INLBGROUP;
+
+	hdr = &pcbinfo->ipi_lbgrouphashbase[
+	    INP_PCBPORTHASH(inp->inp_lport, pcbinfo->ipi_lbgrouphashmask)];
+	LIST_FOREACH(grp, hdr, il_list) {
+		for (i = 0; i < grp->il_inpcnt; ++i) {
+			if (grp->il_inp[i] != inp)
+				continue;
+			if (grp->il_inpcnt == 1) {
+				in_pcblbgroup_free(grp);
+			} else {
+				grp->il_inp[i] =
+				    grp->il_inp[grp->il_inpcnt - 1];
+				atomic_store_rel_int(&grp->il_inpcnt,
+				    grp->il_inpcnt - 1);
+				if (grp->il_inpsiz > INPCBLBGROUP_SIZMIN &&
+				    grp->il_inpcnt <= grp->il_inpsiz / 4) {
+					/* Shrinking is optional */
+					in_pcblbgroup_resize(hdr, grp,
+					    grp->il_inpsiz / 2);
+				}
+			}
+			return;
+		}
+	}
+}
+
+/*
+ * Choose the listener of @grp a new connection goes to. The 4-tuple hash
+ * spreads connections evenly, but a listener whose owner last accepted
+ * on the CPU we're receiving on is preferred, as long as it keeps up with
+ * its connections as well as the hashed one does: the connection is then
+ * set up, accepted and served on the same CPU.
+ *
+ * This runs under rcu_read_lock, without the locks of the listeners, one of
+ * which may be leaving the group and losing its socket. The socket itself
+ * stays valid: listening sockets are freed after a grace period, see
+ * sodealloc().
+ */
+static struct inpcb *
+in_pcblbgroup_pick(struct inpcblbgroup *grp, struct in_addr faddr,
+    u_short fport, u_short lport)
+{
+	struct inpcb *inp, *hashed;
+	struct socket *so, *hashed_so;
+	u_int hash, cpu, i, n;
+
+	n = atomic_load_acq_int(&grp->il_inpcnt);
+	hash = INP_PCBHASH(faddr.s_addr, lport, fport, ~0UL);
+	hashed = grp->il_inp[hash % n];
+	hashed_so = hashed->inp_socket;
+	if (hashed_so == NULL)
+		return (hashed);
+	cpu = sched::cpu::current()->id;
+	if (hashed_so->so_cpu == cpu)
+		return (hashed);
+	for (i = 1; i < n; i++) {
+		inp = grp->il_inp[(hash + i) % n];
+		so = inp->inp_socket;
+		if (so != NULL && so->so_cpu == cpu) {
+			if (so->so_qlen <= hashed_so->so_qlen)
+				return (inp);
+			break;
+		}
+	}
+	return (hashed);
+}
+
+static struct inpcb *
+in_pcblookup_lbgroup(struct inpcbinfo *pcbinfo, struct in_addr faddr,
+    u_short fport, struct in_addr laddr, u_short lport)
+{
+	struct inpcblbgrouphead *hdr;
+	struct inpcblbgroup *grp;
+
+	hdr = &pcbinfo->ipi_lbgrouphashbase[
+	    INP_PCBPORTHASH(lport, pcbinfo->ipi_lbgrouphashmask)];
+	LIST_FOREACH(grp, hdr, il_list) {
+		if (grp->il_lport == lport &&
+		    grp->il_laddr.s_addr == laddr.s_addr)
+			return (in_pcblbgroup_pick(grp, faddr, fport, lport));
+	}
+	return (NULL);
+}
+
 /*
  * Lookup PCB in hash list, using pcbinfo tables.  This variation assumes
- * that the caller has locked the hash list, and will not perform any further
+ * that the caller holds rcu_read_lock, and will not perform any further
  * locking or reference operations on either the hash list or the connection.
+ * A PCB moving between chains may make it miss, see in_pcblookup_hash().
  */
 static struct inpcb *
 in_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct in_addr faddr,
@@ -1522,8 +1814,6 @@ in_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 	KASSERT((lookupflags & ~(INPLOOKUP_WILDCARD)) == 0,
 	    ("%s: invalid lookup flags %d", __func__, lookupflags));
 
-	INP_HASH_LOCK_ASSERT(pcbinfo);
-
 	/*
 	 * First look for an exact match.
 	 */
@@ -1561,8 +1851,24 @@ in_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 		struct inpcb *local_wild_mapped = NULL;
 #endif
 		struct inpcb *jail_wild = NULL;
+		struct in_addr anyaddr;
 		int injail;
 
+		/*
+		 * SO_REUSEPORT listeners share the port: a group bound to
+		 * the address comes first, then one bound to INADDR_ANY,
+		 * and only then plain listeners.
+		 */
+		tmpinp = in_pcblookup_lbgroup(pcbinfo, faddr, fport, laddr,
+		    lport);
+		if (tmpinp != NULL)
+			return (tmpinp);
+		anyaddr.s_addr = INADDR_ANY;
+		tmpinp = in_pcblookup_lbgroup(pcbinfo, faddr, fport, anyaddr,
+		    lport);
+		if (tmpinp != NULL)
+			return (tmpinp);
+
 		/*
 		 * Order of socket selection - we always prefer jails.
 		 *      1. jailed, non-wild.
@@ -1626,31 +1932,54 @@ in_pcblookup_hash_locked(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 }
 
 /*
- * Lookup PCB in hash list, using pcbinfo tables.  This variation locks the
- * hash list lock, and will return the inpcb locked (i.e., requires
- * INPLOOKUP_LOCKPCB).
+ * Lookup PCB in hash list, using pcbinfo tables.  This variation walks the
+ * chains under rcu_read_lock, without any shared lock, and will return the
+ * inpcb locked (i.e., requires INPLOOKUP_LOCKPCB).
+ *
+ * A PCB moving to another chain, when it connects, may take a lookup
+ * walking its old chain along, past the PCBs after it there.  The chains'
+ * sequence counts show a move happened meanwhile, and the lookup is then
+ * done again.  A PCB found may also be on its way out, having lost its last
+ * reference: it is then as if it had not been found.
  */
 static struct inpcb *
 in_pcblookup_hash(struct inpcbinfo *pcbinfo, struct in_addr faddr,
     u_int fport, struct in_addr laddr, u_int lport, int lookupflags,
     struct ifnet *ifp)
 {
+	struct inpcbbucket *exact, *wild;
 	struct inpcb *inp;
+	u_int exact_seq, wild_seq;
+
+	if ((lookupflags & INPLOOKUP_LOCKPCB) == 0)
+		panic("%s: locking bug", __func__);
 
-	INP_HASH_RLOCK(pcbinfo);
-	inp = in_pcblookup_hash_locked(pcbinfo, faddr, fport, laddr, lport,
-	    (lookupflags & ~(INPLOOKUP_LOCKPCB)), ifp);
+	exact = &pcbinfo->ipi_hashbuckets[INP_PCBHASH(faddr.s_addr, lport,
+	    fport, pcbinfo->ipi_hashmask)];
+	wild = &pcbinfo->ipi_hashbuckets[INP_PCBHASH(INADDR_ANY, lport, 0,
+	    pcbinfo->ipi_hashmask)];
+	WITH_LOCK(osv::rcu_read_lock) {
+		for (;;) {
+			exact_seq = atomic_load_acq_int(&exact->ib_seq);
+			wild_seq = atomic_load_acq_int(&wild->ib_seq);
+			inp = in_pcblookup_hash_locked(pcbinfo, faddr, fport,
+			    laddr, lport, (lookupflags & ~(INPLOOKUP_LOCKPCB)),
+			    ifp);
+			if (((exact_seq | wild_seq) & 1) == 0 &&
+			    atomic_load_acq_int(&exact->ib_seq) == exact_seq &&
+			    atomic_load_acq_int(&wild->ib_seq) == wild_seq)
+				break;
+			trace_inpcb_lookup_retry(pcbinfo, ntohs(lport),
+			    ntohs(fport));
+		}
+		if (inp != NULL && !in_pcbref_rcu(inp))
+			inp = NULL;
+	}
 	if (inp != NULL) {
-		in_pcbref(inp);
-		INP_HASH_RUNLOCK(pcbinfo);
-		if (lookupflags & INPLOOKUP_LOCKPCB) {
-			INP_LOCK(inp);
-			if (in_pcbrele_locked(inp))
-				return (NULL);
-		} else
-			panic("%s: locking bug", __func__);
-	} else
-		INP_HASH_RUNLOCK(pcbinfo);
+		INP_LOCK(inp);
+		if (in_pcbrele_locked(inp))
+			return (NULL);
+	}
 	return (inp);
 }
 
@@ -1728,9 +2057,10 @@ in_pcbinshash_internal(struct inpcb *inp, int do_pcbgroup_update)
 	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
 	struct inpcbport *phd;
 	u_int32_t hashkey_faddr;
+	u_int hashidx, portidx;
 
 	INP_LOCK_ASSERT(inp);
-	INP_HASH_LOCK_ASSERT(pcbinfo);
+	INP_HASH_WLOCK_ASSERT(pcbinfo);
 
 	KASSERT((inp->inp_flags & INP_INHASHLIST) == 0,
 	    ("in_pcbinshash: INP_INHASHLIST"));
@@ -1742,15 +2072,17 @@ in_pcbinshash_internal(struct inpcb *inp, int do_pcbgroup_update)
 #endif /* INET6 */
 	hashkey_faddr = inp->inp_faddr.s_addr;
 
-	pcbhash = &pcbinfo->ipi_hashbase[INP_PCBHASH(hashkey_faddr,
-		 inp->inp_lport, inp->inp_fport, pcbinfo->ipi_hashmask)];
+	hashidx = INP_PCBHASH(hashkey_faddr, inp->inp_lport, inp->inp_fport,
+	    pcbinfo->ipi_hashmask);
+	pcbhash = &pcbinfo->ipi_hashbase[hashidx];
 
-	pcbporthash = &pcbinfo->ipi_porthashbase[
-	    INP_PCBPORTHASH(inp->inp_lport, pcbinfo->ipi_porthashmask)];
+	portidx = INP_PCBPORTHASH(inp->inp_lport, pcbinfo->ipi_porthashmask);
+	pcbporthash = &pcbinfo->ipi_porthashbase[portidx];
 
 	/*
 	 * Go through port list and look for a head for this lport.
 	 */
+	in_pcbbucket_lock(pcbinfo, &pcbinfo->ipi_porthashbuckets[portidx]);
 	LIST_FOREACH(phd, pcbporthash, phd_hash) {
 		if (phd->phd_port == inp->inp_lport)
 			break;
@@ -1761,15 +2093,22 @@ in_pcbinshash_internal(struct inpcb *inp, int do_pcbgroup_update)
 	if (phd == NULL) {
 		phd = (inpcbport *)malloc(sizeof(struct inpcbport));
 		if (phd == NULL) {
+			in_pcbbucket_unlock(
+			    &pcbinfo->ipi_porthashbuckets[portidx]);
 			return (ENOBUFS); /* XXX */
 		}
 		phd->phd_port = inp->inp_lport;
 		LIST_INIT(&phd->phd_pcblist);
-		LIST_INSERT_HEAD(pcbporthash, phd, phd_hash);
+		INP_LIST_INSERT_HEAD_RCU(pcbporthash, phd, phd_hash);
 	}
 	inp->inp_phd = phd;
-	LIST_INSERT_HEAD(&phd->phd_pcblist, inp, inp_portlist);
-	LIST_INSERT_HEAD(pcbhash, inp, inp_hash);
+	INP_LIST_INSERT_HEAD_RCU(&phd->phd_pcblist, inp, inp_portlist);
+	in_pcbbucket_unlock(&pcbinfo->ipi_porthashbuckets[portidx]);
+
+	in_pcbbucket_lock(pcbinfo, &pcbinfo->ipi_hashbuckets[hashidx]);
+	inp->inp_hashidx = hashidx;
+	INP_LIST_INSERT_HEAD_RCU(pcbhash, inp, inp_hash);
+	in_pcbbucket_unlock(&pcbinfo->ipi_hashbuckets[hashidx]);
 	inp->inp_flags |= INP_INHASHLIST;
 #ifdef PCBGROUP
 	if (do_pcbgroup_update)
@@ -1808,13 +2147,19 @@ in_pcbinshash_nopcbgroup(struct inpcb *inp)
  * changed. NOTE: This does not handle the case of the lport changing (the
  * hashed port list would have to be updated as well), so the lport must
  * not change after in_pcbinshash() has been called.
+ *
+ * Lookups walking the old chain may follow the PCB to the new one, so the
+ * sequence counts of both buckets are odd while it moves, with preemption
+ * disabled so that a lookup spinning on them never waits for us.
  */
 void
 in_pcbrehash_mbuf(struct inpcb *inp, struct mbuf *m)
 {
 	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
 	struct inpcbhead *head;
+	struct inpcbbucket *from, *to;
 	u_int32_t hashkey_faddr;
+	u_int hashidx;
 
 	INP_LOCK_ASSERT(inp);
 	INP_HASH_WLOCK_ASSERT(pcbinfo);
@@ -1829,11 +2174,32 @@ in_pcbrehash_mbuf(struct inpcb *inp, struct mbuf *m)
 #endif /* INET6 */
 	hashkey_faddr = inp->inp_faddr.s_addr;
 
-	head = &pcbinfo->ipi_hashbase[INP_PCBHASH(hashkey_faddr,
-		inp->inp_lport, inp->inp_fport, pcbinfo->ipi_hashmask)];
-
-	LIST_REMOVE(inp, inp_hash);
-	LIST_INSERT_HEAD(head, inp, inp_hash);
+	hashidx = INP_PCBHASH(hashkey_faddr, inp->inp_lport, inp->inp_fport,
+	    pcbinfo->ipi_hashmask);
+	head = &pcbinfo->ipi_hashbase[hashidx];
+
+	if (hashidx != inp->inp_hashidx) {
+		from = &pcbinfo->ipi_hashbuckets[inp->inp_hashidx];
+		to = &pcbinfo->ipi_hashbuckets[hashidx];
+		if (from < to) {
+			in_pcbbucket_lock(pcbinfo, from);
+			in_pcbbucket_lock(pcbinfo, to);
+		} else {
+			in_pcbbucket_lock(pcbinfo, to);
+			in_pcbbucket_lock(pcbinfo, from);
+		}
+		WITH_LOCK(preempt_lock) {
+			atomic_add_rel_int(&from->ib_seq, 1);
+			atomic_add_rel_int(&to->ib_seq, 1);
+			LIST_REMOVE(inp, inp_hash);
+			INP_LIST_INSERT_HEAD_RCU(head, inp, inp_hash);
+			atomic_add_rel_int(&from->ib_seq, 1);
+			atomic_add_rel_int(&to->ib_seq, 1);
+		}
+		inp->inp_hashidx = hashidx;
+		in_pcbbucket_unlock(to);
+		in_pcbbucket_unlock(from);
+	}
 
 #ifdef PCBGROUP
 	if (m != NULL)
@@ -1850,6 +2216,43 @@ in_pcbrehash(struct inpcb *inp)
 	in_pcbrehash_mbuf(inp, NULL);
 }
 
+/*
+ * Remove PCB from the hash lists.  This takes only the locks of its
+ * buckets, and ipi_hash_lock if it is in a load balance group.  Lookups
+ * walking the chains under rcu_read_lock may still reach it.
+ */
+static void
+in_pcbremhash(struct inpcb *inp)
+{
+	struct inpcbinfo *pcbinfo = inp->inp_pcbinfo;
+	struct inpcbport *phd = inp->inp_phd;
+	struct inpcbbucket *ib;
+
+	INP_LOCK_ASSERT(inp);
+
+	if (inp->inp_flags2 & INP_INLBGROUP) {
+		INP_HASH_WLOCK(pcbinfo);
+		in_pcblbgroup_remove(inp);
+		INP_HASH_WUNLOCK(pcbinfo);
+	}
+
+	ib = &pcbinfo->ipi_hashbuckets[inp->inp_hashidx];
+	in_pcbbucket_lock(pcbinfo, ib);
+	LIST_REMOVE(inp, inp_hash);
+	in_pcbbucket_unlock(ib);
+
+	ib = &pcbinfo->ipi_porthashbuckets[
+	    INP_PCBPORTHASH(inp->inp_lport, pcbinfo->ipi_porthashmask)];
+	in_pcbbucket_lock(pcbinfo, ib);
+	LIST_REMOVE(inp, inp_portlist);
+	if (LIST_FIRST(&phd->phd_pcblist) == NULL) {
+		LIST_REMOVE(phd, phd_hash);
+		osv::rcu_defer([](struct inpcbport *phd) { free(phd); }, phd);
+	}
+	in_pcbbucket_unlock(ib);
+	inp->inp_flags &= ~INP_INHASHLIST;
+}
+
 /*
  * Remove PCB from various lists.
  */
@@ -1862,19 +2265,8 @@ in_pcbremlists(struct inpcb *inp)
 	INP_LOCK_ASSERT(inp);
 
 	inp->inp_gencnt = ++pcbinfo->ipi_gencnt;
-	if (inp->inp_flags & INP_INHASHLIST) {
-		struct inpcbport *phd = inp->inp_phd;
-
-		INP_HASH_WLOCK(pcbinfo);
-		LIST_REMOVE(inp, inp_hash);
-		LIST_REMOVE(inp, inp_portlist);
-		if (LIST_FIRST(&phd->phd_pcblist) == NULL) {
-			LIST_REMOVE(phd, phd_hash);
-			free(phd);
-		}
-		INP_HASH_WUNLOCK(pcbinfo);
-		inp->inp_flags &= ~INP_INHASHLIST;
-	}
+	if (inp->inp_flags & INP_INHASHLIST)
+		in_pcbremhash(inp);
 	LIST_REMOVE(inp, inp_list);
 	pcbinfo->ipi_count--;
 #ifdef PCBGROUP
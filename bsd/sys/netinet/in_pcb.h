@@ -214,6 +214,7 @@ struct inpcb {
 	} inp_depend6;
 	LIST_ENTRY(inpcb) inp_portlist;	/* (i/p) */
 	struct	inpcbport *inp_phd;	/* (i/p) head of this list */
+	u_int	inp_hashidx;		/* (i/p) ipi_hashbase bucket of inp_hash */
 #define inp_zero_size offsetof(struct inpcb, inp_gencnt)
 	inp_gen_t	inp_gencnt;	/* (c) generation count */
 	struct llentry	*inp_lle;	/* cached L2 information */
@@ -273,18 +274,43 @@ struct inpcbport {
 	u_short phd_port;
 };
 
+/*
+ * A bucket of the connection or port hash.  The lock serializes changes to
+ * the bucket's chain, which lookups walk under rcu_read_lock only.  In the
+ * connection hash, ib_seq is odd while a pcb moves from one chain to
+ * another: a lookup walking the chain the pcb left may have followed it to
+ * the other one and missed the rest, so one that finds nothing while the
+ * count moved looks again.
+ */
+struct inpcbbucket {
+	mutex		ib_lock;
+	u_int		ib_seq;
+};
+
 /*-
  * Global data structure for each high-level protocol (UDP, TCP, ...) in both
  * IPv4 and IPv6.  Holds inpcb lists and information for managing them.
  *
  * Each pcbinfo is protected by two locks: ipi_lock and ipi_hash_lock,
  * the former covering mutable global fields (such as the global pcb list),
- * and the latter covering the hashed lookup tables.  The lock order is:
+ * and the latter covering the port reservations: binding a port, and the
+ * load balance groups.  The chains of the connection and port hashes have
+ * a lock per bucket, so that a pcb leaves them with only its own lock and
+ * those of its buckets, and they are read under rcu_read_lock: packets are
+ * demultiplexed without taking any shared lock, and inpcbs, port heads and
+ * load balance groups are freed after an RCU grace period.  The lock order
+ * is:
  *
  *    ipi_lock (before) inpcb locks (before) {ipi_hash_lock, pcbgroup locks}
+ *    (before) bucket locks
+ *
+ * A thread holds at most two bucket locks, of the connection hash, the one
+ * with the lower index first.  Raw IP keeps its own hash, under ipi_lock.
  *
  * Locking key:
  *
+ * (b) Written under the bucket lock and the inpcb lock, read under
+ *     rcu_read_lock
  * (c) Constant or nearly constant after initialisation
  * (g) Locked by ipi_lock
  * (h) Read using either ipi_hash_lock or inpcb lock; write requires both
@@ -339,14 +365,25 @@ struct inpcbinfo {
 	 * Global hash of inpcbs, hashed by local and foreign addresses and
 	 * port numbers.
 	 */
-	struct inpcbhead	*ipi_hashbase;		/* (h) */
-	u_long			 ipi_hashmask;		/* (h) */
+	struct inpcbhead	*ipi_hashbase;		/* (b) */
+	u_long			 ipi_hashmask;		/* (c) */
+	struct inpcbbucket	*ipi_hashbuckets;	/* (c) */
 
 	/*
-	 * Global hash of inpcbs, hashed by only local port number.
+	 * Global hash of inpcbs, hashed by only local port number.  Adding
+	 * to it also requires ipi_hash_lock, under which binding checks the
+	 * port is free.
 	 */
-	struct inpcbporthead	*ipi_porthashbase;	/* (h) */
-	u_long			 ipi_porthashmask;	/* (h) */
+	struct inpcbporthead	*ipi_porthashbase;	/* (b) */
+	u_long			 ipi_porthashmask;	/* (c) */
+	struct inpcbbucket	*ipi_porthashbuckets;	/* (c) */
+
+	/*
+	 * Load balance groups of SO_REUSEPORT listeners, hashed by local
+	 * port number.
+	 */
+	struct inpcblbgrouphead	*ipi_lbgrouphashbase;	/* (h) */
+	u_long			 ipi_lbgrouphashmask;	/* (h) */
 
 	/*
 	 * List of wildcard inpcbs for use with pcbgroups.  In the past, was
@@ -368,6 +405,25 @@ struct inpcbinfo {
 };
 
 #ifdef _KERNEL
+/*
+ * Load balance groups implement the Linux semantics of SO_REUSEPORT: all
+ * the TCP sockets listening on the same local address and port with the
+ * option set share the incoming connections, rather than only the last
+ * one bound getting them all.  Lookups read the groups under
+ * rcu_read_lock.
+ */
+struct inpcblbgroup {
+	LIST_ENTRY(inpcblbgroup) il_list;		/* (h) */
+	struct in_addr		 il_laddr;		/* (c) */
+	u_short			 il_lport;		/* (c) */
+	u_int			 il_inpsiz;		/* (h) size of il_inp[] */
+	u_int			 il_inpcnt;		/* (h) listeners in il_inp[] */
+	struct inpcb		*il_inp[];		/* (h) */
+};
+LIST_HEAD(inpcblbgrouphead, inpcblbgroup);
+
+#define	INPCBLBGROUP_SIZMIN	8
+
 /*
  * Connection groups hold sets of connections that have similar CPU/thread
  * affinity.  Each connection belongs to exactly one connection group.
@@ -529,6 +585,7 @@ void 	inp_4tuple_get(struct inpcb *inp, uint32_t *laddr, uint16_t *lp,
 #define	INP_PCBGROUPWILD	0x00000004 /* in pcbgroup wildcard list */
 #define	INP_REUSEPORT		0x00000008 /* SO_REUSEPORT option is set */
 #define	INP_FREED		0x00000010 /* inp itself is not valid */
+#define	INP_INLBGROUP		0x00000020 /* in a load balance group */
 
 /*
  * Flags passed to in_pcblookup*() functions.
@@ -618,6 +675,7 @@ void	in_pcbdrop(struct inpcb *);
 void	in_pcbfree(struct inpcb *);
 int	in_pcbinshash(struct inpcb *);
 int	in_pcbinshash_nopcbgroup(struct inpcb *);
+int	in_pcblbgroup_insert(struct inpcb *);
 struct inpcb *
 	in_pcblookup_local(struct inpcbinfo *,
 	    struct in_addr, u_short, int, struct ucred *);
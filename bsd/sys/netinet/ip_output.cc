@@ -57,6 +57,7 @@
 #include <bsd/sys/netinet/in_var.h>
 #include <bsd/sys/netinet/ip_var.h>
 #include <bsd/sys/netinet/ip_options.h>
+#include <bsd/sys/netinet/tcp.h>
 
 #ifdef IPSEC
 #include <netinet/ip_ipsec.h>
@@ -559,6 +560,34 @@ passout:
 		}
 	}
 
+	/*
+	 * A TSO packet for an interface that cannot segment it: do it here
+	 * (GSO), and send the segments as the fragments are sent below.
+	 */
+	if ((m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_TSO) &&
+	    !((ifp->if_capenable & IFCAP_TSO4) &&
+	      (ifp->if_hwassist & CSUM_TSO))) {
+		error = ip_gso(ip, &m, ifp->if_hwassist);
+		if (error)
+			goto bad;
+		for (; m; m = m0) {
+			m0 = m->m_hdr.mh_nextpkt;
+			m->m_hdr.mh_nextpkt = 0;
+			if (error == 0) {
+				if (!(flags & IP_FORWARDING) && ia) {
+					ia->ia_ifa.if_opackets++;
+					ia->ia_ifa.if_obytes +=
+					    m->M_dat.MH.MH_pkthdr.len;
+				}
+				m->m_hdr.mh_flags &= ~(M_PROTOFLAGS);
+				error = (*ifp->if_output)(ifp, m,
+				    (struct bsd_sockaddr *)dst, ro);
+			} else
+				m_freem(m);
+		}
+		goto done;
+	}
+
 	m->M_dat.MH.MH_pkthdr.csum_flags |= CSUM_IP;
 	sw_csum = m->M_dat.MH.MH_pkthdr.csum_flags & ~ifp->if_hwassist;
 	if (sw_csum & CSUM_DELAY_DATA) {
@@ -837,6 +866,105 @@ done:
 	return error;
 }
 
+/*
+ * Software TCP segmentation (GSO), for an interface without TSO.  Splits
+ * the TSO packet m_segs points to into segments of tso_segsz bytes, and
+ * on return m_segs points to them, linked by m_nextpkt, ready to send.
+ * Each segment gets a copy of the headers, with the lengths, sequence
+ * number, flags and checksums fixed up, and shares the data with the
+ * original packet.  The pseudo header is summed once for all of them.
+ *
+ * On error the packet and any segments are freed, and m_segs is NULL.
+ */
+int
+ip_gso(struct ip *ip, struct mbuf **m_segs, u_long if_hwassist_flags)
+{
+	struct mbuf *m0 = *m_segs;	/* the original packet */
+	struct mbuf *segs = NULL, **mnext = &segs;
+	struct tcphdr *th;
+	int hlen = ip->ip_hl << 2;
+	int hdrlen, off, len, nsegs;
+	int segsz = m0->M_dat.MH.MH_pkthdr.tso_segsz;
+	u_short phsum;
+
+	KASSERT(ip->ip_p == IPPROTO_TCP, ("%s: not TCP", __func__));
+	KASSERT(m0->m_hdr.mh_len >= hlen + (int)sizeof(struct tcphdr),
+	    ("%s: headers not contiguous", __func__));
+	th = (struct tcphdr *)((caddr_t)ip + hlen);
+	hdrlen = hlen + (th->th_off << 2);
+	if (m0->m_hdr.mh_len < hdrlen || hdrlen + max_linkhdr > MHLEN ||
+	    segsz <= 0) {
+		m_freem(m0);
+		*m_segs = NULL;
+		return (EINVAL);
+	}
+	phsum = in_pseudo(ip->ip_src.s_addr, ip->ip_dst.s_addr,
+	    htons(IPPROTO_TCP));
+
+	for (off = hdrlen, nsegs = 0; off < ip->ip_len; off += len, nsegs++) {
+		struct mbuf *m;
+		struct ip *mhip;
+		struct tcphdr *mth;
+		int sw_csum;
+
+		len = bsd_min(segsz, ip->ip_len - off);
+		MGETHDR(m, M_DONTWAIT, MT_DATA);
+		if (m == NULL)
+			goto nobufs;
+		m->m_hdr.mh_next = m_copym(m0, off, len, M_DONTWAIT);
+		if (m->m_hdr.mh_next == NULL) {
+			m_free(m);
+			goto nobufs;
+		}
+		m->m_hdr.mh_flags |= m0->m_hdr.mh_flags & (M_MCAST | M_FLOWID);
+		m->m_hdr.mh_data += max_linkhdr;
+		m->m_hdr.mh_len = hdrlen;
+		bcopy(ip, mtod(m, caddr_t), hdrlen);
+		m->M_dat.MH.MH_pkthdr.len = hdrlen + len;
+		m->M_dat.MH.MH_pkthdr.rcvif = NULL;
+		m->M_dat.MH.MH_pkthdr.flowid = m0->M_dat.MH.MH_pkthdr.flowid;
+		m->M_dat.MH.MH_pkthdr.csum_flags = CSUM_IP | CSUM_TCP;
+		m->M_dat.MH.MH_pkthdr.csum_data = offsetof(struct tcphdr, th_sum);
+		*mnext = m;
+		mnext = &m->m_hdr.mh_nextpkt;
+
+		mhip = mtod(m, struct ip *);
+		mth = (struct tcphdr *)((caddr_t)mhip + hlen);
+		mhip->ip_len = hdrlen + len;
+		mhip->ip_id = htons(ntohs(ip->ip_id) + nsegs);
+		mth->th_seq = htonl(ntohl(th->th_seq) + off - hdrlen);
+		if (off + len < ip->ip_len)
+			mth->th_flags &= ~(TH_FIN | TH_PUSH);
+		if (nsegs)
+			mth->th_flags &= ~TH_CWR;
+		mth->th_sum = in_addword(phsum, htons(hdrlen - hlen + len));
+
+		/* As ip_output() does for a packet it sends as it is */
+		sw_csum = m->M_dat.MH.MH_pkthdr.csum_flags & ~if_hwassist_flags;
+		if (sw_csum & CSUM_DELAY_DATA)
+			in_delayed_cksum(m);
+		m->M_dat.MH.MH_pkthdr.csum_flags &= if_hwassist_flags;
+		mhip->ip_len = htons(mhip->ip_len);
+		mhip->ip_off = htons(mhip->ip_off);
+		mhip->ip_sum = 0;
+		if (sw_csum & CSUM_DELAY_IP)
+			mhip->ip_sum = in_cksum(m, hlen);
+	}
+	m_freem(m0);
+	*m_segs = segs;
+	return (0);
+
+nobufs:
+	IPSTAT_INC(ips_odropped);
+	m_freem(m0);
+	for (struct mbuf *m = segs, *next; m != NULL; m = next) {
+		next = m->m_hdr.mh_nextpkt;
+		m_freem(m);
+	}
+	*m_segs = NULL;
+	return (ENOBUFS);
+}
+
 void
 in_delayed_cksum(struct mbuf *m)
 {
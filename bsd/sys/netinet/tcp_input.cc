@@ -108,6 +108,9 @@
 
 const int tcprexmtthresh = 3;
 
+TRACEPOINT(trace_tcp_info_wlock_wait, "thflags=%x", int);
+TRACEPOINT(trace_tcp_info_wlock_drop, "tp=%p", struct tcpcb *);
+
 VNET_DEFINE(struct tcpstat, tcpstat);
 SYSCTL_VNET_STRUCT(_net_inet_tcp, TCPCTL_STATS, stats, CTLFLAG_RW,
     &VNET_NAME(tcpstat), tcpstat,
@@ -217,6 +220,27 @@ static void inline	cc_ack_received(struct tcpcb *tp, struct tcphdr *th,
 static void inline	cc_conn_init(struct tcpcb *tp);
 static void inline	cc_post_recovery(struct tcpcb *tp, struct tcphdr *th);
 
+/*
+ * Whether a segment may tear the connection down or move it to TIME_WAIT,
+ * which needs the tcbinfo write lock: anything with a SYN or a RST, and
+ * anything before the connection is established or once we sent our FIN.
+ * Data, ACKs and the peer's FIN in ESTABLISHED and CLOSE_WAIT only change
+ * the connection, and need only the inpcb lock.  So does the ACK that
+ * completes a handshake in SYN_RECEIVED, unless a FIN is involved.
+ */
+static inline bool
+tcp_needs_info_wlock(struct tcpcb *tp, int thflags)
+{
+	int state = tp->get_state();
+
+	if ((thflags & (TH_SYN | TH_RST)) != 0)
+		return (true);
+	if (state == TCPS_SYN_RECEIVED)
+		return ((thflags & TH_FIN) != 0 ||
+		    (tp->t_flags & TF_NEEDFIN) != 0);
+	return (state != TCPS_ESTABLISHED && state != TCPS_CLOSE_WAIT);
+}
+
 /*
  * Kernel module interface for updating tcpstat.  The argument is an index
  * into tcpstat treated as an array of u_long.  While this encodes the
@@ -541,6 +565,7 @@ tcp_input(struct mbuf *m, int off0)
 	int tlen = 0, off;
 	int drop_hdrlen;
 	int thflags;
+	int bare_syn = 0;	/* SYN without ACK, FIN or RST */
 	int rstreason = 0;	/* For badport_bandlim accounting purposes */
 #ifdef TCP_SIGNATURE
 	uint8_t sig_checked = 0;
@@ -740,13 +765,24 @@ tcp_input(struct mbuf *m, int off0)
 
 	/*
 	 * Locate pcb for segment; if we're likely to add or remove a
-	 * connection then first acquire pcbinfo lock.  There are two cases
+	 * connection then first acquire pcbinfo lock.  There are a few cases
 	 * where we might discover later we need a write lock despite the
-	 * flags: ACKs moving a connection out of the syncache, and ACKs for
-	 * a connection in TIMEWAIT.
+	 * flags: ACKs moving a connection out of the syncache, ACKs for
+	 * a connection in TIMEWAIT, and FINs for a connection past
+	 * CLOSE_WAIT.  A FIN for an established connection only moves it to
+	 * CLOSE_WAIT, under the inpcb lock.
+	 *
+	 * A bare SYN is looked up without the lock: it is usually a new
+	 * connection attempt on a listen socket, and syncache_add() does not
+	 * touch the pcb lists.  If it is for anything else, the lock is
+	 * taken below as for those ACKs.
 	 */
-	if ((thflags & (TH_SYN | TH_FIN | TH_RST)) != 0) {
-		INP_INFO_WLOCK(&V_tcbinfo);
+	bare_syn = (thflags & (TH_SYN | TH_ACK | TH_FIN | TH_RST)) == TH_SYN;
+	if ((thflags & (TH_SYN | TH_RST)) != 0 && !bare_syn) {
+		if (INP_INFO_TRY_WLOCK(&V_tcbinfo) == 0) {
+			trace_tcp_info_wlock_wait(thflags);
+			INP_INFO_WLOCK(&V_tcbinfo);
+		}
 		ti_locked = TI_WLOCKED;
 	} else
 		ti_locked = TI_UNLOCKED;
@@ -931,6 +967,7 @@ relocked:
 	if (inp->inp_flags & INP_TIMEWAIT) {
 		if (ti_locked == TI_UNLOCKED) {
 			if (INP_INFO_TRY_WLOCK(&V_tcbinfo) == 0) {
+				trace_tcp_info_wlock_wait(thflags);
 				in_pcbref(inp);
 				INP_UNLOCK(inp);
 				INP_INFO_WLOCK(&V_tcbinfo);
@@ -975,15 +1012,18 @@ relocked:
 	 * inpcbinfo write lock but don't hold it.  In this case, attempt to
 	 * acquire using the same strategy as the TIMEWAIT case above.  If we
 	 * relock, we have to jump back to 'relocked' as the connection might
-	 * now be in TIMEWAIT.
+	 * now be in TIMEWAIT.  A bare SYN needs the lock anywhere but on a
+	 * listen socket.
 	 */
 #ifdef INVARIANTS
-	if ((thflags & (TH_SYN | TH_FIN | TH_RST)) != 0)
+	if ((thflags & (TH_SYN | TH_RST)) != 0 && !bare_syn)
 		INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
 #endif
-	if (tp->get_state() != TCPS_ESTABLISHED) {
+	if (tcp_needs_info_wlock(tp, thflags) &&
+	    !(bare_syn && tp->get_state() == TCPS_LISTEN)) {
 		if (ti_locked == TI_UNLOCKED) {
 			if (INP_INFO_TRY_WLOCK(&V_tcbinfo) == 0) {
+				trace_tcp_info_wlock_wait(thflags);
 				in_pcbref(inp);
 				INP_UNLOCK(inp);
 				INP_INFO_WLOCK(&V_tcbinfo);
@@ -1024,14 +1064,17 @@ relocked:
 	 * state) we look into the SYN cache if this is a new connection
 	 * attempt or the completion of a previous one.  Because listen
 	 * sockets are never in TCPS_ESTABLISHED, the V_tcbinfo lock will be
-	 * held in this case.
+	 * held in this case, unless the segment is a bare SYN.
 	 */
 	if (so->so_options & SO_ACCEPTCONN) {
 		struct in_conninfo inc;
 
 		KASSERT(tp->get_state() == TCPS_LISTEN, ("%s: so accepting but "
 		    "tp not listening", __func__));
-		INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+#ifdef INVARIANTS
+		if (!bare_syn)
+			INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+#endif
 
 		bzero(&inc, sizeof(inc));
 #ifdef INET6
@@ -1110,6 +1153,16 @@ relocked:
 			tp = intotcpcb(inp);
 			KASSERT(tp->get_state() == TCPS_SYN_RECEIVED,
 			    ("%s: ", __func__));
+			/*
+			 * The tcbinfo lock was needed to create the new
+			 * connection's pcb; unless there is a FIN, the rest
+			 * of the handshake goes on without it.
+			 */
+			if (ti_locked == TI_WLOCKED &&
+			    !tcp_needs_info_wlock(tp, thflags)) {
+				INP_INFO_WUNLOCK(&V_tcbinfo);
+				ti_locked = TI_UNLOCKED;
+			}
 #ifdef TCP_SIGNATURE
 			if (sig_checked == 0)  {
 				tcp_dooptions(&to, optp, optlen,
@@ -1337,10 +1390,19 @@ relocked:
 			    (void *)tcp_saveipgen, &tcp_savetcp, 0);
 #endif
 		tcp_dooptions(&to, optp, optlen, TO_SYN);
+		/*
+		 * A SYN|FIN, or a SYN that found an old connection in
+		 * TIMEWAIT, came here with the pcbinfo lock, which the
+		 * syncache does not need.
+		 */
+		if (ti_locked == TI_WLOCKED) {
+			INP_INFO_WUNLOCK(&V_tcbinfo);
+			ti_locked = TI_UNLOCKED;
+		}
 		syncache_add(&inc, &to, th, inp, &so, m);
 		/*
 		 * Entry added to syncache and mbuf consumed.
-		 * Everything already unlocked by syncache_add().
+		 * The listen socket already unlocked by syncache_add().
 		 */
 		INP_INFO_UNLOCK_ASSERT(&V_tcbinfo);
 		return;
@@ -1455,8 +1517,9 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, struct socket *so,
 	 * allow either a read lock or a write lock, as we may have acquired
 	 * a write lock due to a race.
 	 *
-	 * Require a global write lock for SYN/FIN/RST segments or
-	 * non-established connections; otherwise accept either a read or
+	 * Require a global write lock for SYN/RST segments or connections
+	 * neither established nor in CLOSE_WAIT, see tcp_needs_info_wlock();
+	 * otherwise accept either a read or
 	 * write lock, as we may have conservatively acquired a write lock in
 	 * certain cases in tcp_input() (is this still true?).  Currently we
 	 * will never enter with no lock, so we try to drop it quickly in the
@@ -1466,17 +1529,18 @@ tcp_do_segment(struct mbuf *m, struct tcphdr *th, struct socket *so,
 	 * if we fail, drop the packet.  FIXME: invert the lock order so we don't
 	 * have to drop packets.
 	 */
-	if (tp->get_state() != TCPS_ESTABLISHED && ti_locked == TI_UNLOCKED) {
+	if (tcp_needs_info_wlock(tp, thflags) &&
+	    ti_locked == TI_UNLOCKED) {
 		if (INP_INFO_TRY_WLOCK(&V_tcbinfo)) {
 			ti_locked = TI_WLOCKED;
 		} else {
+			trace_tcp_info_wlock_drop(tp);
 			goto drop;
 		}
 	}
-	if ((thflags & (TH_SYN | TH_FIN | TH_RST)) != 0 ||
-	    tp->get_state() != TCPS_ESTABLISHED) {
+	if (tcp_needs_info_wlock(tp, thflags)) {
 		KASSERT(ti_locked == TI_WLOCKED, ("%s ti_locked %d for "
-		    "SYN/FIN/RST/!EST", __func__, ti_locked));
+		    "SYN/RST/!EST", __func__, ti_locked));
 		INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
 	} else {
 #ifdef INVARIANTS
@@ -3556,6 +3620,28 @@ tcp_mss(struct tcpcb *tp, int offer)
 		if (bufsize > so->so_rcv.sb_hiwat)
 			(void)sbreserve_locked(&so->so_rcv, bufsize, so, NULL);
 	}
+	/*
+	 * Without checksum offload, sum the data as it is copied into the
+	 * send buffer, so ip_output() need not read it again.
+	 */
+	if (mtuflags & (CSUM_TCP | CSUM_TCP_IPV6))
+		so->so_snd.sb_flags &= ~SB_DATASUM;
+	else
+		so->so_snd.sb_flags |= SB_DATASUM;
+	/*
+	 * With TSO, tcp_output() sends up to 64K at a time.  Copy the data
+	 * into 16K clusters, so such a segment is a few mbufs rather than
+	 * dozens, and unless the buffer was sized on purpose, start it out
+	 * with room for two of them.
+	 */
+	if (mtuflags & CSUM_TSO) {
+		so->so_snd.sb_flags |= SB_BIGCL;
+		if ((so->so_snd.sb_flags & SB_AUTOSIZE) &&
+		    so->so_snd.sb_hiwat < 2 * IP_MAXPACKET)
+			(void)sbreserve_locked(&so->so_snd, 2 * IP_MAXPACKET,
+			    so, NULL);
+	} else
+		so->so_snd.sb_flags &= ~SB_BIGCL;
 	SOCK_UNLOCK(so);
 
 	/* Check the interface for TSO capabilities. */
@@ -3686,7 +3772,8 @@ static ipv4_tcp_conn_id tcp_connection_id(tcpcb* tp)
 void
 tcp_setup_net_channel(tcpcb* tp, struct ifnet* intf)
 {
-	auto nc = new net_channel([=] (mbuf *m) { tcp_net_channel_packet(tp, m); });
+	auto nc = new net_channel([=] (mbuf *m) { tcp_net_channel_packet(tp, m); },
+	    intf);
 	tp->nc = nc;
 	tp->nc_intf = intf;
 	intf->add_net_channel(nc, tcp_connection_id(tp));
@@ -288,6 +288,21 @@ tcp_lro_flush(struct lro_ctrl *lc, struct lro_entry *le)
 	SLIST_INSERT_HEAD(&lc->lro_free, le, next);
 }
 
+/*
+ * Flush all the segments being aggregated.  Drivers call this at the end
+ * of every receive batch, so no segment is held back longer than that.
+ */
+void
+tcp_lro_flush_all(struct lro_ctrl *lc)
+{
+	struct lro_entry *le;
+
+	while ((le = SLIST_FIRST(&lc->lro_active)) != NULL) {
+		SLIST_REMOVE_HEAD(&lc->lro_active, next);
+		tcp_lro_flush(lc, le);
+	}
+}
+
 #ifdef INET6
 static int
 tcp_lro_rx_ipv6(struct lro_ctrl *lc, struct mbuf *m, struct ip6_hdr *ip6,
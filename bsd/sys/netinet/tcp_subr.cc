@@ -1710,6 +1710,12 @@ tcp_maxmtu(struct in_conninfo *inc, int *flags)
 			if (ifp->if_capenable & IFCAP_TSO4 &&
 			    ifp->if_hwassist & CSUM_TSO)
 				*flags |= CSUM_TSO;
+			/* Else ip_output() segments it (GSO) */
+			else if (ifp->if_capenable & IFCAP_GSO4)
+				*flags |= CSUM_TSO;
+			if (ifp->if_capenable & IFCAP_TXCSUM &&
+			    ifp->if_hwassist & CSUM_TCP)
+				*flags |= CSUM_TCP;
 		}
 		RTFREE(sro.ro_rt);
 	}
@@ -1747,6 +1753,9 @@ tcp_maxmtu6(struct in_conninfo *inc, int *flags)
 			if (ifp->if_capenable & IFCAP_TSO6 &&
 			    ifp->if_hwassist & CSUM_TSO)
 				*flags |= CSUM_TSO;
+			if (ifp->if_capenable & IFCAP_TXCSUM_IPV6 &&
+			    ifp->if_hwassist & CSUM_TCP_IPV6)
+				*flags |= CSUM_TCP_IPV6;
 		}
 		RTFREE(sro6.ro_rt);
 	}
@@ -142,10 +142,6 @@ SYSCTL_VNET_UINT(_net_inet_tcp_syncache, OID_AUTO, cachelimit, CTLFLAG_RDTUN,
 	&VNET_NAME(tcp_syncache.cache_limit), 0,
 	"Overall entry limit for syncache");
 
-SYSCTL_VNET_UINT(_net_inet_tcp_syncache, OID_AUTO, count, CTLFLAG_RD,
-	&VNET_NAME(tcp_syncache.cache_count), 0,
-	"Current number of entries in syncache");
-
 SYSCTL_VNET_UINT(_net_inet_tcp_syncache, OID_AUTO, hashsize, CTLFLAG_RDTUN,
 	&VNET_NAME(tcp_syncache.hashsize), 0,
 	"Size of TCP syncache hashtable");
@@ -212,7 +208,6 @@ syncache_head::syncache_head()
 
 void syncache_init(void)
 {
-	V_tcp_syncache.cache_count = 0;
 	V_tcp_syncache.hashsize = TCP_SYNCACHE_HASHSIZE;
 	V_tcp_syncache.bucket_limit = TCP_SYNCACHE_BUCKETLIMIT;
 	V_tcp_syncache.rexmt_limit = SYNCACHE_MAXREXMTS;
@@ -265,8 +260,8 @@ syncache_destroy(void)
 				__func__, sch->sch_length));
 	}
 
-	KASSERT(V_tcp_syncache.cache_count == 0, ("%s: cache_count %d not 0",
-			__func__, V_tcp_syncache.cache_count));
+	KASSERT(syncache_pcbcount() == 0, ("%s: %d entries left",
+			__func__, syncache_pcbcount()));
 
 	/* Free the allocated global resources. */
 	uma_zdestroy(V_tcp_syncache.zone);
@@ -306,7 +301,6 @@ static void syncache_insert(struct syncache *sc, struct syncache_head *sch)
 
 	SCH_UNLOCK(sch);
 
-	V_tcp_syncache.cache_count++;
 	TCPSTAT_INC(tcps_sc_added);
 }
 
@@ -327,7 +321,6 @@ static void syncache_drop(struct syncache *sc, struct syncache_head *sch)
 		sc->sc_tu->tu_syncache_event(TOE_SC_DROP, sc->sc_toepcb);
 #endif		    
 	syncache_free(sc);
-	V_tcp_syncache.cache_count--;
 }
 
 /*
@@ -830,7 +823,6 @@ syncache_remove_and_free(struct syncache_head *sch, struct syncache *sc)
 	SCH_LOCK_ASSERT(sch);
 	TAILQ_REMOVE(&sch->sch_bucket, sc, sc_hash);
 	sch->sch_length--;
-	V_tcp_syncache.cache_count--;
 	SCH_UNLOCK(sch);
 	syncache_free(sc);
 }
@@ -1005,7 +997,11 @@ static void _syncache_add(struct in_conninfo *inc, struct tcpopt *to,
 #endif
 	struct syncache scs;
 
-	INP_INFO_WLOCK_ASSERT(&V_tcbinfo);
+	/*
+	 * Only the listen socket is locked: nothing here touches the pcb
+	 * lists, so a SYN does not need the pcbinfo lock.
+	 */
+	INP_INFO_UNLOCK_ASSERT(&V_tcbinfo);
 	INP_LOCK_ASSERT(inp); /* listen socket */
 	KASSERT((th->th_flags & (TH_RST|TH_ACK|TH_SYN)) == TH_SYN,
 		("%s: unexpected tcp flags", __func__));
@@ -1035,13 +1031,11 @@ static void _syncache_add(struct in_conninfo *inc, struct tcpopt *to,
 #ifdef MAC
 	if (mac_syncache_init(&maclabel) != 0) {
 		INP_UNLOCK(inp);
-		INP_INFO_WUNLOCK(&V_tcbinfo);
 		goto done;
 	} else
 	mac_syncache_create(maclabel, inp);
 #endif
 	INP_UNLOCK(inp);
-	INP_INFO_WUNLOCK(&V_tcbinfo);
 
 	/*
 	 * Remember the IP options, if any.
@@ -1462,7 +1456,6 @@ void tcp_offload_syncache_add(struct in_conninfo *inc, struct toeopt *toeo,
 	to.to_wscale = toeo->to_wscale;
 	to.to_flags = toeo->to_flags;
 
-	INP_INFO_WLOCK(&V_tcbinfo);
 	INP_LOCK(inp);
 
 	_syncache_add(inc, &to, th, inp, lsop, NULL, tu, toepcb);
@@ -123,13 +123,17 @@ struct syncache_head {
 	syncache_head();
 };
 
+/*
+ * The buckets count their own entries, see syncache_pcbcount(): a global
+ * count, written by every SYN and every completed handshake on any CPU,
+ * would share a cache line with the parameters here they all read.
+ */
 struct tcp_syncache {
 	struct	syncache_head *hashbase;
 	uma_zone_t zone;
 	u_int	hashsize;
 	u_int	hashmask;
 	u_int	bucket_limit;
-	u_int	cache_count;		/* XXX: unprotected */
 	u_int	cache_limit;
 	u_int	rexmt_limit;
 	u_int	hash_secret;
@@ -79,6 +79,8 @@
 
 #include <machine/in_cksum.h>
 
+#include <osv/rcu.hh>
+
 static VNET_DEFINE(uma_zone_t, tcptw_zone);
 #define	V_tcptw_zone			VNET(tcptw_zone)
 static int	maxtcptw;
@@ -485,7 +487,9 @@ tcp_twclose(struct tcptw *tw, int reuse)
 	TCPSTAT_INC(tcps_closed);
 	if (reuse)
 		return;
-	uma_zfree(V_tcptw_zone, tw);
+	/* A bind() may still be looking at it, see in_pcbbind_setup() */
+	osv::rcu_defer([](struct tcptw *tw) { uma_zfree(V_tcptw_zone, tw); },
+	    tw);
 }
 
 int
@@ -366,6 +366,8 @@ tcp_usr_listen(struct socket *so, int backlog, struct thread *td)
 	INP_HASH_WLOCK(&V_tcbinfo);
 	if (error == 0 && inp->inp_lport == 0)
 		error = in_pcbbind(inp, (struct bsd_sockaddr *)0, 0);
+	if (error == 0 && (inp->inp_flags2 & INP_REUSEPORT))
+		error = in_pcblbgroup_insert(inp);
 	INP_HASH_WUNLOCK(&V_tcbinfo);
 	if (error == 0) {
 		tp->set_state(TCPS_LISTEN);
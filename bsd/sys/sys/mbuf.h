@@ -77,12 +77,6 @@ struct mb_args {
 };
 #endif /* _KERNEL */
 
-#if defined(__LP64__)
-#define M_HDR_PAD    6
-#else
-#define M_HDR_PAD    2
-#endif
-
 /*
  * Header present at the beginning of every mbuf.
  */
@@ -93,7 +87,10 @@ struct m_hdr {
 	int		 mh_len;	/* amount of data in this mbuf */
 	int		 mh_flags;	/* flags; see below */
 	short		 mh_type;	/* type of data in this mbuf */
-	uint8_t          pad[M_HDR_PAD];/* word align                  */
+	/* The sum of some of the data, valid only if M_DATASUM is set */
+	u_int16_t	 mh_csum;	/* folded sum of the 16-bit words */
+	u_int16_t	 mh_csumstart;	/* low bits of the start address */
+	u_int16_t	 mh_csumlen;	/* bytes summed */
 };
 
 /*
@@ -192,6 +189,7 @@ struct mbuf {
 #define	M_PROTO7	0x00100000 /* protocol-specific */
 #define	M_PROTO8	0x00200000 /* protocol-specific */
 #define	M_FLOWID	0x00400000 /* deprecated: flowid is valid */
+#define	M_DATASUM	0x00800000 /* mh_csum is the sum of some of the data */
 #define	M_HASHTYPEBITS	0x0F000000 /* mask of bits holding flowid hash type */
 
 /*
@@ -202,6 +200,23 @@ struct mbuf {
 
 #define	M_NOTIFICATION	M_PROTO5    /* SCTP notification */
 
+/*
+ * Flag to m_getm2() and m_uiotombuf() only, never set on an mbuf: use
+ * 16K clusters while that much is left, rather than page-sized ones.
+ */
+#define	M_BIGCL		M_NOFREE
+
+/*
+ * A cluster that m_uiotombuf() fills with M_DATASUM starts with the
+ * running sum of its data at every M_CSUMCHUNK bytes, folded but not
+ * complemented, so that in_cksum_skip() can sum any part of it from two
+ * of them.  M_CSUMTABSIZE() is the room that takes for a cluster of size
+ * bytes; m_getm2() leaves it out of the length when passed M_DATASUM.
+ */
+#define	M_CSUMCHUNK	256
+#define	M_CSUMTABSIZE(size) \
+    (((size) / M_CSUMCHUNK * sizeof(u_int16_t) + 15) & ~15)
+
 /*
  * Flags to purge when crossing layers.
  */
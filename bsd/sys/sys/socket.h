@@ -114,6 +114,8 @@
 #define	SO_USER_COOKIE	0x1015		/* user cookie (dummynet etc.) */
 #define	SO_PROTOCOL	0x1016		/* get socket protocol (Linux name) */
 #define	SO_PROTOTYPE	SO_PROTOCOL	/* alias for SO_PROTOCOL (SunOS name) */
+#define	SO_BUSY_POLL	0x1017		/* usecs to busy poll for data (Linux) */
+#define	SO_ZEROCOPY	0x1018		/* allow MSG_ZEROCOPY sends (Linux) */
 #endif
 
 #if __BSD_VISIBLE
@@ -403,6 +405,7 @@ struct sockproto {
 #endif
 #if __BSD_VISIBLE
 #define	MSG_NOSIGNAL	0x20000		/* do not generate SIGPIPE on EOF */
+#define	MSG_ZEROCOPY	0x40000		/* send from the caller's pages (Linux) */
 #endif
 
 #if __BSD_VISIBLE
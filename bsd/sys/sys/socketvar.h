@@ -44,6 +44,10 @@
 #endif
 #include <osv/net_channel.hh>
 
+#include <atomic>
+#include <deque>
+#include <memory>
+
 struct vnet;
 
 /*
@@ -57,6 +61,29 @@ typedef	u_quad_t so_gen_t;
 struct socket;
 struct file;
 
+/*
+ * MSG_ZEROCOPY sends lo to hi, whose data the stack no longer refers to,
+ * as read from the error queue.  copied: it was copied after all.
+ */
+struct so_zerocopy_done {
+	uint32_t	lo;
+	uint32_t	hi;
+	bool		copied;
+};
+
+/*
+ * One of a listening socket's queues of complete connections.  There is one
+ * per CPU, holding the connections whose handshake completed there, so an
+ * accept() takes the ones its CPU handled while they are still in its cache,
+ * and only takes another CPU's when its own queue is empty.  Each queue has
+ * its own lock, so queueing a connection and taking one do not need
+ * ACCEPT_LOCK(); only an accept() that has to wait for one does.
+ */
+struct so_compq {
+	struct mtx mtx;
+	TAILQ_HEAD(, socket) q;			/* (q) */
+};
+
 /*-
  * Locking key to struct socket:
  * (a) constant after allocation, no locking required.
@@ -67,6 +94,7 @@ struct file;
  * (f) not locked since integer reads/writes are atomic.
  * (g) used only as a sleep/wakeup address, no value.
  * (h) locked by global mutex so_global_mtx.
+ * (q) locked by the lock of so_head's so_comp queue the socket is on.
  */
 struct socket {
 	mutex* so_mtx = nullptr;   /* provided by so_pcb */
@@ -84,7 +112,8 @@ struct socket {
  * Socket where accepts occur is so_head in all subsidiary sockets.
  * If so_head is 0, socket is not related to an accept.
  * For head socket so_incomp queues partially completed connections,
- * while so_comp is a queue of connections ready to be accepted.
+ * while so_comp has the queues, one per CPU, of connections ready to be
+ * accepted.
  * If a connection is aborted and it has so_head set, then
  * it has to be pulled out of either so_incomp or so_comp.
  * We allow connections to queue up based on current queue lengths
@@ -92,12 +121,19 @@ struct socket {
  */
 	struct	socket *so_head;	/* (e) back pointer to listen socket */
 	TAILQ_HEAD(, socket) so_incomp;	/* (e) queue of partial unaccepted connections */
-	TAILQ_HEAD(, socket) so_comp;	/* (e) queue of complete unaccepted connections */
-	TAILQ_ENTRY(socket) so_list;	/* (e) list of unaccepted connections */
-	u_short	so_qlen;		/* (e) number of unaccepted connections */
+	std::unique_ptr<so_compq[]> so_comp; /* (e) queues of complete unaccepted connections */
+	u_int	so_ncomp = 0;		/* (a) number of so_comp queues */
+	u_int	so_compcpu = 0;		/* (q) so_head's so_comp queue we are on */
+	TAILQ_ENTRY(socket) so_list;	/* (e/q) list of unaccepted connections */
+	std::atomic<u_short> so_qlen;	/* number of unaccepted connections,
+					   in all so_comp queues */
+	std::atomic<u_int> so_acceptwaiters; /* accept()s about to sleep or
+					   sleeping, see socomp_wakeup() */
 	u_short	so_incqlen;		/* (e) number of unaccepted incomplete
 					   connections */
 	u_short	so_qlimit;		/* (e) max number queued connections */
+	/* CPU listen() or accept() was last called on, see inpcblbgroup */
+	unsigned so_cpu = 0;
 	short	so_timeo;		/* (g) connection timeout */
 	u_short	so_error;		/* (f) error affecting connection */
 	u_long	so_oobmark;		/* (c) chars to oob mark */
@@ -124,6 +160,13 @@ struct socket {
 	net_channel* so_nc = nullptr;
 	// a net channel only supports one consumer, so let others wait on a waitqueue instead
 	bool so_nc_busy = false;
+	// usecs to busy poll the net channel's interface before sleeping (SO_BUSY_POLL)
+	int so_busy_poll = 0;
+	// MSG_ZEROCOPY sends are allowed (SO_ZEROCOPY), the id the next one
+	// gets, and the error queue of those the stack is done with (c)
+	bool so_zerocopy = false;
+	uint32_t so_zerocopy_next = 0;
+	std::deque<so_zerocopy_done> so_errqueue;
 	waitqueue so_nc_wq;
 	/* FIXME: this is done for poll,
 	 * make sure there's only 1 ref to a fp */
@@ -208,7 +251,7 @@ struct xsocket {
 /* can we read something from so? */
 #define	soreadabledata(so) \
     ((so)->so_rcv.sb_cc >= (u_int)(so)->so_rcv.sb_lowat || \
-	!TAILQ_EMPTY(&(so)->so_comp) || (so)->so_error)
+	(so)->so_qlen != 0 || (so)->so_error)
 #define	soreadable(so) \
 	(soreadabledata(so) || ((so)->so_rcv.sb_state & SBS_CANTRCVMORE))
 
@@ -338,6 +381,8 @@ void	solisten_proto(struct socket *so, int backlog);
 int	solisten_proto_check(struct socket *so);
 struct socket *
 	sonewconn(struct socket *head, int connstatus);
+struct socket *
+	socomp_dequeue(struct socket *head, unsigned cpu);
 
 
 int	sopoll(struct socket *so, int events, struct ucred *active_cred,
@@ -353,6 +398,7 @@ int	soreceive_stream(struct socket *so, struct bsd_sockaddr **paddr,
 int	soreceive_dgram(struct socket *so, struct bsd_sockaddr **paddr,
 	    struct uio *uio, struct mbuf **mp0, struct mbuf **controlp,
 	    int *flagsp);
+int	soreceive_errqueue(struct socket *so, struct so_zerocopy_done *done);
 int	soreceive_generic(struct socket *so, struct bsd_sockaddr **paddr,
 	    struct uio *uio, struct mbuf **mp0, struct mbuf **controlp,
 	    int *flagsp);
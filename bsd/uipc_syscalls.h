@@ -15,6 +15,8 @@
 
 __BEGIN_DECLS
 
+struct so_zerocopy_done;
+
 /* Private interface */
 int kern_bind(int fd, struct bsd_sockaddr *sa);
 int kern_accept(int s, struct bsd_sockaddr *name,
@@ -23,6 +25,7 @@ int kern_connect(int fd, struct bsd_sockaddr *sa);
 int kern_sendit(int s, struct msghdr *mp, int flags,
     struct mbuf *control, ssize_t *bytes);
 int kern_recvit(int s, struct msghdr *mp, struct mbuf **controlp, ssize_t* bytes);
+int kern_recverr(int s, struct so_zerocopy_done *done, int *family);
 int kern_setsockopt(int s, int level, int name, void *val, socklen_t valsize);
 int kern_getsockopt(int s, int level, int name, void *val, socklen_t *valsize);
 int kern_socketpair(int domain, int type, int protocol, int *rsv);
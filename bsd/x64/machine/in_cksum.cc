@@ -48,6 +48,8 @@
 #include <bsd/sys/netinet/ip.h>
 #include <machine/in_cksum.h>
 
+#include <emmintrin.h>
+
 /*
  * Checksum routine for Internet Protocol family headers
  *    (Portable Alpha version).
@@ -88,6 +90,92 @@ union q_util {
 	u_int64_t q;
 };
 
+static inline u_int
+in_cksum_fold(u_int64_t sum)
+{
+	union q_util q_util;
+	union l_util l_util;
+
+	REDUCE16;
+	return (sum);
+}
+
+static inline u_int
+in_cksum_swab(u_int sum)
+{
+	return (((sum & 0xff) << 8) | (sum >> 8));
+}
+
+/*
+ * Below this, the scalar loop is as fast as the vector one.
+ */
+#define	IN_CKSUM_SIMD_MIN	128
+
+/*
+ * Sums the 16-bit words of len bytes at buf with SSE2, 64 bytes at a time,
+ * and also copies them to dst if it is set.  Each 32-bit lane adds its
+ * two words per vector, so the lanes are flushed into the 64-bit sum every
+ * MB, well before they can overflow.  The words are counted from buf
+ * itself, not from an even address as in_cksumdata() does.
+ */
+template <bool copy>
+static inline u_int64_t
+in_cksum_sse2(const void *buf, void *dst, int len)
+{
+	const char *p = (const char *)buf;
+	char *d = (char *)dst;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i low = _mm_set1_epi32(0xffff);
+	u_int64_t sum = 0;
+
+	while (len >= 64) {
+		__m128i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+		int n = bsd_min(len / 64, 16384);
+		len -= n * 64;
+		for (; n; n--, p += 64, d += copy ? 64 : 0) {
+			__m128i v0 = _mm_loadu_si128((const __m128i *)p);
+			__m128i v1 = _mm_loadu_si128((const __m128i *)(p + 16));
+			__m128i v2 = _mm_loadu_si128((const __m128i *)(p + 32));
+			__m128i v3 = _mm_loadu_si128((const __m128i *)(p + 48));
+			if (copy) {
+				_mm_storeu_si128((__m128i *)d, v0);
+				_mm_storeu_si128((__m128i *)(d + 16), v1);
+				_mm_storeu_si128((__m128i *)(d + 32), v2);
+				_mm_storeu_si128((__m128i *)(d + 48), v3);
+			}
+			acc0 = _mm_add_epi32(acc0, _mm_add_epi32(
+			    _mm_and_si128(v0, low), _mm_srli_epi32(v0, 16)));
+			acc1 = _mm_add_epi32(acc1, _mm_add_epi32(
+			    _mm_and_si128(v1, low), _mm_srli_epi32(v1, 16)));
+			acc2 = _mm_add_epi32(acc2, _mm_add_epi32(
+			    _mm_and_si128(v2, low), _mm_srli_epi32(v2, 16)));
+			acc3 = _mm_add_epi32(acc3, _mm_add_epi32(
+			    _mm_and_si128(v3, low), _mm_srli_epi32(v3, 16)));
+		}
+		/* Widen the lanes to 64 bits before adding them up */
+		__m128i acc = _mm_add_epi64(
+		    _mm_add_epi64(_mm_unpacklo_epi32(acc0, zero), _mm_unpackhi_epi32(acc0, zero)),
+		    _mm_add_epi64(_mm_unpacklo_epi32(acc1, zero), _mm_unpackhi_epi32(acc1, zero)));
+		acc = _mm_add_epi64(acc,
+		    _mm_add_epi64(_mm_unpacklo_epi32(acc2, zero), _mm_unpackhi_epi32(acc2, zero)));
+		acc = _mm_add_epi64(acc,
+		    _mm_add_epi64(_mm_unpacklo_epi32(acc3, zero), _mm_unpackhi_epi32(acc3, zero)));
+		sum += (u_int64_t)_mm_cvtsi128_si64(acc) +
+		    (u_int64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+	}
+	if (copy) {
+		memcpy(d, p, len);
+	}
+	for (; len >= 2; len -= 2, p += 2) {
+		u_int16_t w;
+		memcpy(&w, p, 2);
+		sum += w;
+	}
+	if (len)
+		sum += *(const u_int8_t *)p;
+	return (sum);
+}
+
 static u_int64_t
 in_cksumdata(const void *buf, int len)
 {
@@ -103,6 +191,11 @@ in_cksumdata(const void *buf, int len)
 	     return sum;
 	}
 
+	if (len >= IN_CKSUM_SIMD_MIN) {
+		sum = in_cksum_fold(in_cksum_sse2<false>(lw, NULL, len));
+		return ((1 & (long) lw) ? in_cksum_swab(sum) : sum);
+	}
+
 	if ((offset = 3 & (long) lw) != 0) {
 		const u_int32_t *masks = in_masks + (offset << 2);
 		lw = (u_int32_t *) (((long) lw) - offset);
@@ -190,6 +283,82 @@ in_pseudo(u_int32_t a, u_int32_t b, u_int32_t c)
 	return (sum);
 }
 
+u_short
+in_cksum_copy(const void *src, void *dst, int len)
+{
+	return (in_cksum_fold(in_cksum_sse2<true>(src, dst, len)));
+}
+
+/*
+ * The running sum of the first off bytes of m's summed range, where off is
+ * a multiple of M_CSUMCHUNK or the whole range (see M_CSUMCHUNK).
+ */
+static u_int
+in_cksum_run(struct mbuf *m, int off)
+{
+	const u_int16_t *run;
+
+	if (off == 0)
+		return (0);
+	if (off == m->m_hdr.mh_csumlen)
+		return (m->m_hdr.mh_csum);
+	run = (const u_int16_t *)m->M_dat.MH.MH_dat.MH_ext.ext_buf;
+	return (run[off / M_CSUMCHUNK - 1]);
+}
+
+/*
+ * Sums len bytes at addr in m.  If m_uiotombuf() left the sum of a range
+ * of m's data that covers them (see M_DATASUM), this reuses it:
+ * - in a cluster, the whole chunks of the range that the bytes cover are
+ *   summed from the running sums, and only the bytes before and after
+ *   them, less than M_CSUMCHUNK each, are read;
+ * - otherwise, if the bytes are most of the range, the sum of the rest of
+ *   it is taken away from that of the range.
+ * The range starts at the address ending in mh_csumstart, before addr
+ * and less than 64K away from it.
+ */
+static u_int64_t
+in_cksum_mbuf(struct mbuf *m, caddr_t addr, int len)
+{
+	caddr_t start;
+	int head, tail, first, last;
+	u_int64_t sum;
+
+	if ((m->m_hdr.mh_flags & M_DATASUM) == 0)
+		return (in_cksumdata(addr, len));
+	head = (u_int16_t)((uintptr_t)addr - m->m_hdr.mh_csumstart);
+	tail = m->m_hdr.mh_csumlen - head - len;
+	if (tail < 0)
+		return (in_cksumdata(addr, len));
+	start = addr - head;
+	if (m->m_hdr.mh_flags & M_EXT) {
+		first = (head + M_CSUMCHUNK - 1) & ~(M_CSUMCHUNK - 1);
+		last = tail ? (head + len) & ~(M_CSUMCHUNK - 1) : head + len;
+		if (first < last) {
+			sum = in_cksum_run(m, last) +
+			    (0xffff - in_cksum_run(m, first));
+			sum = in_cksum_fold(sum);
+			if (1 & (long) start)
+				sum = in_cksum_swab(sum);
+			if (first > head)
+				sum += in_cksumdata(addr, first - head);
+			if (head + len > last)
+				sum += in_cksumdata(start + last, head + len - last);
+			return (sum);
+		}
+	}
+	if (head + tail > len)
+		return (in_cksumdata(addr, len));
+	sum = m->m_hdr.mh_csum;
+	if (1 & (long) start)
+		sum = in_cksum_swab(sum);
+	if (head)
+		sum += 0xffff - in_cksum_fold(in_cksumdata(start, head));
+	if (tail)
+		sum += 0xffff - in_cksum_fold(in_cksumdata(addr + len, tail));
+	return (sum);
+}
+
 u_short
 in_cksum_skip(struct mbuf *m, int len, int skip)
 {
@@ -220,9 +389,9 @@ skip_start:
 		if (len < mlen)
 			mlen = len;
 		if ((clen ^ (long) addr) & 1)
-		    sum += in_cksumdata(addr, mlen) << 8;
+		    sum += in_cksum_mbuf(m, addr, mlen) << 8;
 		else
-		    sum += in_cksumdata(addr, mlen);
+		    sum += in_cksum_mbuf(m, addr, mlen);
 
 		clen += mlen;
 		len -= mlen;
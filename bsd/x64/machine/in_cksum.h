@@ -80,6 +80,11 @@ u_int in_cksum_hdr(const struct ip *ip);
 u_short	in_addword(u_short sum, u_short b);
 u_short	in_pseudo(u_int sum, u_int b, u_int c);
 u_short	in_cksum_skip(struct mbuf *m, int len, int skip);
+/*
+ * Copies len bytes from src to dst, and returns the sum of their 16-bit
+ * words, counted from dst, folded but not complemented.
+ */
+u_short	in_cksum_copy(const void *src, void *dst, int len);
 
 __END_DECLS
 
@@ -230,6 +230,7 @@ else
 tests := tests/tst-pthread.so tests/tst-ramdisk.so
 tests += tests/tst-vblk.so tests/bench/bench.jar tests/reclaim/reclaim.jar
 tests += tests/tst-bsd-evh.so tests/misc-bsd-callout.so
+tests += tests/misc-bsd-callout-perf.so
 tests += tests/tst-bsd-kthread.so
 tests += tests/tst-bsd-taskqueue.so
 tests += tests/tst-fpu.so
@@ -254,6 +255,7 @@ tests += tests/tst-queue-mpsc.so
 tests += tests/tst-af-local.so
 tests += tests/tst-pipe.so
 tests += tests/tst-yield.so
+tests += tests/tst-affinity.so
 tests += tests/misc-ctxsw.so
 tests += tests/tst-readdir.so
 tests += tests/tst-read.so
@@ -267,6 +269,11 @@ tests += tests/tst-sleep.so
 tests += tests/tst-resolve.so
 tests += tests/tst-except.so
 tests += tests/misc-tcp-sendonly.so
+tests += tests/misc-tcp-rx.so
+tests += tests/misc-tcp-reuseport.so
+tests += tests/misc-tcp-pingpong.so
+tests += tests/misc-af-local.so
+tests += tests/misc-trace-export.so
 tests += tests/tst-tcp-nbwrite.so
 tests += tests/misc-tcp-hash-srv.so
 tests += tests/misc-loadbalance.so
@@ -289,6 +296,7 @@ tests += tests/tst-threadcomplete.so
 tests += tests/tst-timerfd.so
 tests += tests/tst-nway-merger.so
 tests += tests/tst-memmove.so
+tests += tests/tst-string.so
 tests += tests/tst-pthread-clock.so
 tests += tests/misc-procfs.so
 tests += tests/tst-chdir.so
@@ -301,8 +309,15 @@ tests += tests/tst-cxxlocale.so
 tests += tests/misc-tcp-close-without-reading.so
 tests += tests/tst-sigwait.so
 tests += tests/tst-sampler.so
+tests += tests/tst-numa.so
 tests += tests/misc-malloc.so
 tests += tests/misc-memcpy.so
+tests += tests/misc-string.so
+tests += tests/tst-in-cksum.so
+tests += tests/misc-tcp-cksum.so
+tests += tests/misc-tcp-bulk-send.so
+tests += tests/misc-tcp-zerocopy.so
+tests += tests/misc-tcp-conn-rate.so
 tests += tests/misc-free-perf.so
 tests += tests/tst-fallocate.so
 tests += tests/misc-printf.so
@@ -310,6 +325,7 @@ tests += tests/libstatic-thread-variable.so tests/tst-static-thread-variable.so
 tests/tst-static-thread-variable.so: tests/libstatic-thread-variable.so
 tests/tst-static-thread-variable.so: COMMON += -L./tests -lstatic-thread-variable
 tests += tests/misc-lock-perf.so
+tests += tests/misc-clock-perf.so
 endif
 
 ifeq ($(arch),aarch64)
@@ -470,6 +486,8 @@ bsd += bsd/porting/mmu.o
 bsd += bsd/porting/pcpu.o
 bsd += bsd/porting/bus_dma.o
 bsd += bsd/porting/kobj.o
+bsd += bsd/porting/zfs_trace.o
+bsd += bsd/porting/pcpu_taskqueue.o
 bsd += bsd/sys/netinet/if_ether.o  
 bsd += bsd/sys/compat/linux/linux_socket.o  
 bsd += bsd/sys/compat/linux/linux_ioctl.o  
@@ -670,9 +688,15 @@ zfs += bsd/sys/cddl/contrib/opensolaris/uts/common/fs/zfs/zrlock.o
 zfs += bsd/sys/cddl/contrib/opensolaris/uts/common/fs/zfs/zvol.o
 zfs += bsd/sys/cddl/contrib/opensolaris/uts/common/fs/zfs/lz4.o
 
+ifeq ($(arch),x64)
+zfs += bsd/sys/cddl/contrib/opensolaris/common/zfs/zfs_fletcher_x86.o
+zfs += bsd/sys/cddl/contrib/opensolaris/uts/common/fs/zfs/sha256_x86.o
+endif
+
 zfs-tests += tests/misc-zfs-disk.so
 zfs-tests += tests/misc-zfs-io.so
 zfs-tests += tests/misc-zfs-arc.so
+zfs-tests += tests/misc-zfs-checksum.so
 
 tests += tests/tst-zfs-mount.so
 
@@ -782,6 +806,7 @@ objects += arch/x64/ioapic.o
 objects += arch/x64/apic.o
 objects += arch/x64/apic-clock.o
 objects += arch/x64/cpuid.o
+objects += arch/x64/string-sse2.o
 objects += arch/x64/entry-xen.o
 objects += arch/x64/xen.o
 objects += arch/x64/xen_intr.o
@@ -799,6 +824,7 @@ objects += core/debug.o
 objects += core/rcu.o
 objects += core/pagecache.o
 objects += core/mempool.o
+objects += core/numa.o
 objects += core/alloctracker.o
 objects += core/printf.o
 
@@ -916,6 +942,26 @@ usr.img: bare.img usr.manifest cmdline
 		glibcbase=$(glibcbase) -D miscbase=$(miscbase)
 	$(call quiet, $(src)/scripts/imgedit.py setargs $@ "$(shell cat cmdline)", IMGEDIT $@)
 
+# An alternative to usr.img whose root is a read-only rofs image instead of
+# ZFS; the kernel is told to mount it with --rootfs=rofs. mkrofs.py lists the
+# files it packed in rofs.img.d; the targets below build them in the first
+# place, as they do for usr.img.
+rofs.img: scripts/mkrofs.py usr.manifest cmdline loader.img $(jni)
+	$(call quiet, $(src)/scripts/mkrofs.py -o $@ -d $@.d -m usr.manifest \
+		-D jdkbase=$(jdkbase) -D gccbase=$(gccbase) -D \
+		glibcbase=$(glibcbase) -D miscbase=$(miscbase), MKROFS $@)
+
+rofs-size = $(shell stat --printf %s rofs.img)
+
+usr-rofs.img: loader.img rofs.img cmdline
+	$(call quiet, dd if=loader.img of=usr-rofs.raw > /dev/null 2>&1, DD usr-rofs.raw loader.img)
+	$(call quiet, dd if=rofs.img of=usr-rofs.raw obs=$(zfs-start) seek=1 conv=notrunc > /dev/null 2>&1, \
+		DD usr-rofs.raw rofs.img)
+	$(call quiet, $(src)/scripts/imgedit.py setpartition usr-rofs.raw 2 $(zfs-start) $(rofs-size), IMGEDIT $@)
+	$(call quiet, $(src)/scripts/imgedit.py setargs usr-rofs.raw "--rootfs=rofs $(shell cat cmdline)", IMGEDIT $@)
+	$(call quiet, qemu-img convert -f raw -O $(img_format) usr-rofs.raw $@, QEMU-IMG CONVERT $@)
+	$(call very-quiet, rm -f usr-rofs.raw)
+
 osv.vmdk osv.vdi:
 	$(call quiet, echo Creating $@ as $(subst osv.,,$@))
 	$(call quiet, qemu-img convert -O $(subst osv.,,$@) usr.img $@)
@@ -32,6 +32,7 @@
 #include <osv/shrinker.h>
 #include <osv/defer.hh>
 #include "java/jvm_balloon.hh"
+#include <osv/numa.hh>
 
 TRACEPOINT(trace_memory_malloc, "buf=%p, len=%d, align=%d", void *, size_t,
            size_t);
@@ -161,12 +162,15 @@ static void garbage_collector_fn()
 //
 // The chief requirement is to be able to deduce the object size.
 //
-// Small object (< page size) are stored in pages.  The beginning of the page
-// contains a header with a pointer to a pool, consisting of all free objects
-// of that size.  Small objects are recognized by free() by the fact that
-// they are not aligned on a page boundary (since that is occupied by the
-// header).  The pool maintains a singly linked list of free objects, and adds
-// or frees pages as needed.
+// Small objects (up to pool::max_object_size) are stored in slabs.  The
+// beginning of the slab contains a header with a pointer to a pool,
+// consisting of all free objects of that size.  The pool maintains a singly
+// linked list of free objects, and adds or frees slabs as needed.  A slab is
+// a single page, except for objects too large for eight of them to fit in
+// one; their slabs span several pages and start on a pool::max_slab_size
+// boundary.  Pool objects are handed out in the mempool
+// and mempool_slab areas respectively, which tells free() how to find the
+// header.
 //
 // Large objects are rounded up to page size.  They have a page-sized header
 // in front that contains the page size.  The free list (free_page_ranges)
@@ -178,23 +182,43 @@ static void garbage_collector_fn()
 
 pool::pool(unsigned size)
     : _size(size)
+    , _slab_pages(compute_slab_pages(size))
     , _free()
 {
-    assert(size + sizeof(page_header) <= page_size);
+    assert(size + sizeof(page_header) <= _slab_pages * page_size);
 }
 
 pool::~pool()
 {
 }
 
-// FIXME: handle larger sizes better, while preserving alignment:
-const size_t pool::max_object_size = page_size / 2;
+const size_t pool::max_object_size = 32 * 1024;
 const size_t pool::min_object_size = sizeof(free_object);
+const size_t pool::max_slab_size = 256 * 1024;
 
 pool::page_header* pool::to_header(free_object* object)
 {
+    auto mask = page_size - 1;
+    if (mmu::get_mem_area(object) == mmu::mem_area::mempool_slab) {
+        mask = max_slab_size - 1;
+    }
     return reinterpret_cast<page_header*>(
-                 reinterpret_cast<std::uintptr_t>(object) & ~(page_size - 1));
+                 reinterpret_cast<std::uintptr_t>(object) & ~mask);
+}
+
+// A slab is the smallest power of two number of pages that holds at least
+// eight objects, so at most an object (and the header) is wasted, and the
+// slab size simply grows with the object size: a page up to 448 bytes,
+// then roughly size / 256 pages. The largest objects make do with fewer in
+// a pool::max_slab_size slab.
+unsigned pool::compute_slab_pages(size_t size)
+{
+    unsigned pages = 1;
+    while (pages * page_size < max_slab_size &&
+           (pages * page_size - sizeof(page_header)) / size < 8) {
+        pages *= 2;
+    }
+    return pages;
 }
 
 TRACEPOINT(trace_pool_alloc, "this=%p, obj=%p", void*, void*);
@@ -239,20 +263,31 @@ unsigned pool::get_size()
 
 static inline void* untracked_alloc_page();
 static inline void untracked_free_page(void *v);
+static void* untracked_alloc_slab(size_t size);
+static void untracked_free_slab(void* v, size_t size);
 
 void pool::add_page()
 {
     // FIXME: this function allocated a page and set it up but on rare cases
     // we may add this page to the free list of a different cpu, due to the
     // enablment of preemption
-    void* page = untracked_alloc_page();
+    void* page;
+    if (_slab_pages == 1) {
+        page = mmu::translate_mem_area(mmu::mem_area::main,
+                mmu::mem_area::mempool, untracked_alloc_page());
+    } else {
+        page = mmu::translate_mem_area(mmu::mem_area::main,
+                mmu::mem_area::mempool_slab,
+                untracked_alloc_slab(_slab_pages * page_size));
+    }
     WITH_LOCK(preempt_lock) {
         page_header* header = new (page) page_header;
         header->cpu_id = mempool_cpuid();
         header->owner = this;
         header->nalloc = 0;
         header->local_free = nullptr;
-        for (auto p = page + page_size - _size; p >= header + 1; p -= _size) {
+        auto end = page + _slab_pages * page_size;
+        for (auto p = end - _size; p >= header + 1; p -= _size) {
             auto obj = static_cast<free_object*>(p);
             obj->next = header->local_free;
             header->local_free = obj;
@@ -266,6 +301,17 @@ void pool::add_page()
     }
 }
 
+void pool::free_page(page_header* header)
+{
+    if (_slab_pages == 1) {
+        untracked_free_page(mmu::translate_mem_area(mmu::mem_area::mempool,
+                mmu::mem_area::main, header));
+    } else {
+        untracked_free_slab(mmu::translate_mem_area(mmu::mem_area::mempool_slab,
+                mmu::mem_area::main, header), _slab_pages * page_size);
+    }
+}
+
 inline bool pool::have_full_pages()
 {
     return !_free->empty() && _free->back().nalloc == 0;
@@ -282,7 +328,7 @@ void pool::free_same_cpu(free_object* obj, unsigned cpu_id)
             _free->erase(_free->iterator_to(*header));
         }
         DROP_LOCK(preempt_lock) {
-            untracked_free_page(header);
+            free_page(header);
         }
     } else {
         if (!header->local_free) {
@@ -335,6 +381,30 @@ pool* pool::from_object(void* object)
     return header->owner;
 }
 
+// malloc() size classes: 8 and 16 bytes, multiples of 16 up to 64, and from
+// there on four classes per power of two (80, 96, 112, 128, 160, ...), up to
+// pool::max_object_size. Rounding up to the next class wastes at most a fifth
+// of the object, instead of up to half of it with power of two classes. Only
+// the power of two classes keep their objects aligned to their size.
+constexpr size_t size_class_size(unsigned n)
+{
+    return n <= 4 ? (n ? 16 * n : 8) :
+        (size_t(1) << (6 + (n - 5) / 4)) + (size_t((n - 5) % 4 + 1) << (4 + (n - 5) / 4));
+}
+
+static inline unsigned size_class(size_t size)
+{
+    if (size <= 64) {
+        return size <= 8 ? 0 : (size + 15) >> 4;
+    }
+    unsigned lg = sizeof(size) * 8 - 1 - count_leading_zeros(size - 1);
+    return 5 + (lg - 6) * 4 + (((size - 1) >> (lg - 2)) & 3);
+}
+
+constexpr unsigned nr_size_classes = 41;
+static_assert(size_class_size(nr_size_classes - 1) == 32 * 1024,
+              "size classes must end at pool::max_object_size");
+
 class malloc_pool : public pool {
 public:
     malloc_pool();
@@ -342,7 +412,7 @@ private:
     static size_t compute_object_size(unsigned pos);
 };
 
-malloc_pool malloc_pools[ilog2_roundup_constexpr(page_size) + 1]
+malloc_pool malloc_pools[nr_size_classes]
     __attribute__((init_priority((int)init_prio::malloc_pools)));
 
 struct mark_smp_allocator_intialized {
@@ -376,11 +446,7 @@ malloc_pool::malloc_pool()
 
 size_t malloc_pool::compute_object_size(unsigned pos)
 {
-    size_t size = 1 << pos;
-    if (size > max_object_size) {
-        size = max_object_size;
-    }
-    return size;
+    return size_class_size(pos);
 }
 
 page_range::page_range(size_t _size)
@@ -404,6 +470,99 @@ bi::set<page_range,
                        &page_range::member_hook>
        > free_page_ranges __attribute__((init_priority((int)init_prio::fpranges)));
 
+// NUMA: free_page_ranges holds the free memory of all nodes, but no page
+// range crosses from one node's memory into another's (see setup_numa() and
+// merge()), so a node's free memory is simply the page ranges within its
+// memory ranges. The allocators look there first, then at the nearest other
+// nodes.
+
+static __thread int numa_node_override = -1;
+
+unsigned numa_node()
+{
+    if (numa_node_override >= 0) {
+        return numa_node_override;
+    }
+    return smp_allocator ? sched::cpu::current()->node : 0;
+}
+
+numa_node_scope::numa_node_scope(unsigned node)
+    : _saved(numa_node_override)
+{
+    numa_node_override = node;
+}
+
+numa_node_scope::~numa_node_scope()
+{
+    numa_node_override = _saved;
+}
+
+struct addr_key_cmp {
+    bool operator()(const page_range& fpr, const void* addr) const {
+        return &fpr < addr;
+    }
+    bool operator()(const void* addr, const page_range& fpr) const {
+        return addr < &fpr;
+    }
+};
+
+// Returns the first free page range for which @pred is true, trying the
+// memory of @node first, then that of the other nodes, nearest first.
+// Must be called with free_page_ranges_lock held.
+template <typename Pred>
+static page_range* find_page_range(unsigned node, Pred pred)
+{
+    if (numa::nr_nodes() > 1) {
+        auto nodes = numa::nearest_nodes(node);
+        for (unsigned n = 0; n < numa::nr_nodes(); n++) {
+            for (unsigned i = 0; i < numa::nr_memory_ranges(); i++) {
+                auto& r = numa::get_memory_range(i);
+                if (r.node != nodes[n]) {
+                    continue;
+                }
+                void* end = mmu::phys_to_virt(r.end);
+                auto it = free_page_ranges.lower_bound(mmu::phys_to_virt(r.start),
+                                                       addr_key_cmp());
+                for (; it != free_page_ranges.end() && &*it < end; ++it) {
+                    if (pred(*it)) {
+                        return &*it;
+                    }
+                }
+            }
+        }
+    }
+    // Without NUMA, and for any memory the firmware did not assign a node
+    for (auto& r : free_page_ranges) {
+        if (pred(r)) {
+            return &r;
+        }
+    }
+    return nullptr;
+}
+
+void setup_numa()
+{
+    WITH_LOCK(free_page_ranges_lock) {
+        for (unsigned i = 0; i < numa::nr_memory_ranges(); i++) {
+            auto& r = numa::get_memory_range(i);
+            for (auto boundary : { r.start, r.end }) {
+                char* v = static_cast<char*>(mmu::phys_to_virt(align_up(boundary, page_size)));
+                auto it = free_page_ranges.upper_bound(v, addr_key_cmp());
+                if (it == free_page_ranges.begin()) {
+                    continue;
+                }
+                auto range = &*std::prev(it);
+                char* start = reinterpret_cast<char*>(range);
+                if (v > start && v < start + range->size) {
+                    auto tail = new (v) page_range(start + range->size - v);
+                    range->size = v - start;
+                    free_page_ranges.insert(*tail);
+                }
+            }
+        }
+    }
+}
+
 // Our notion of free memory is "whatever is in the page ranges". Therefore it
 // starts at 0, and increases as we add page ranges.
 //
@@ -544,47 +703,81 @@ static void* malloc_large(size_t size, size_t alignment)
     size += offset;
     size = align_up(size, page_size);
 
+    auto shift = [=] (page_range& r) {
+        char *v = reinterpret_cast<char*>(&r);
+        auto expected_ret = v + r.size - size + page_size;
+        return expected_ret - align_down(expected_ret, alignment);
+    };
     while (true) {
         WITH_LOCK(free_page_ranges_lock) {
             reclaimer_thread.wait_for_minimum_memory();
 
-            for (auto i = free_page_ranges.begin(); i != free_page_ranges.end(); ++i) {
-                auto header = &*i;
-
+            auto header = find_page_range(numa_node(), [=] (page_range& r) {
+                return r.size >= size + shift(r);
+            });
+            if (header) {
                 char *v = reinterpret_cast<char*>(header);
-                auto expected_ret = v + header->size - size + page_size;
-                auto alignment_shift = expected_ret -
-                        align_down(expected_ret, alignment);
-
-                if (header->size >= size + alignment_shift) {
-                    if (alignment_shift) {
-                        // Leave "alignment_shift" bytes at the end of the
-                        // range free, so our allocation below is aligned.
-                        free_page_ranges.insert(*new(v + header->size -
-                                alignment_shift) page_range(alignment_shift));
-                        header->size -= alignment_shift;
-                    }
-                    page_range* ret_header;
-                    if (header->size == size) {
-                        free_page_ranges.erase(i);
-                        ret_header = header;
-                    } else {
-                        header->size -= size;
-                        ret_header = new (v + header->size) page_range(size);
-                    }
-                    on_alloc(size);
-                    void* obj = ret_header;
-                    obj += offset;
-                    trace_memory_malloc_large(obj, requested_size, size,
-                                              alignment);
-                    return obj;
+                auto alignment_shift = shift(*header);
+                if (alignment_shift) {
+                    // Leave "alignment_shift" bytes at the end of the
+                    // range free, so our allocation below is aligned.
+                    free_page_ranges.insert(*new(v + header->size -
+                            alignment_shift) page_range(alignment_shift));
+                    header->size -= alignment_shift;
                 }
+                page_range* ret_header;
+                if (header->size == size) {
+                    free_page_ranges.erase(free_page_ranges.iterator_to(*header));
+                    ret_header = header;
+                } else {
+                    header->size -= size;
+                    ret_header = new (v + header->size) page_range(size);
+                }
+                on_alloc(size);
+                void* obj = ret_header;
+                obj += offset;
+                trace_memory_malloc_large(obj, requested_size, size,
+                                          alignment);
+                return obj;
             }
             reclaimer_thread.wait_for_memory(size);
         }
     }
 }
 
+// Carves a multi-page slab for a pool out of free_page_ranges, or returns
+// nullptr if no range is large enough. Unlike malloc_large(), there is no
+// header in front, and the slab starts on a pool::max_slab_size boundary, so
+// pool::to_header() can find the pool's own header at the start of the slab.
+static void* alloc_slab_locked(size_t size, unsigned node)
+{
+    auto alignment = pool::max_slab_size;
+    auto shift = [=] (page_range& r) {
+        char *v = reinterpret_cast<char*>(&r);
+        auto expected_ret = v + r.size - size;
+        return expected_ret - align_down(expected_ret, alignment);
+    };
+    auto header = find_page_range(node, [=] (page_range& r) {
+        return r.size >= size + shift(r);
+    });
+    if (!header) {
+        return nullptr;
+    }
+    char *v = reinterpret_cast<char*>(header);
+    auto alignment_shift = shift(*header);
+    if (alignment_shift) {
+        free_page_ranges.insert(*new(v + header->size -
+                alignment_shift) page_range(alignment_shift));
+        header->size -= alignment_shift;
+    }
+    if (header->size == size) {
+        free_page_ranges.erase(free_page_ranges.iterator_to(*header));
+        return header;
+    }
+    header->size -= size;
+    return v + header->size;
+}
+
 void shrinker::deactivate_shrinker()
 {
     reclaimer_thread._active_shrinkers -= _enabled;
@@ -768,7 +961,7 @@ static page_range* merge(page_range* a, page_range* b)
     void* va = a;
     void* vb = b;
 
-    if (va + a->size == vb) {
+    if (va + a->size == vb && !numa::is_boundary(mmu::virt_to_phys(vb))) {
         a->size += b->size;
         free_page_ranges.erase(*b);
         return a;
@@ -847,18 +1040,19 @@ static void refill_page_buffer()
 
             auto& pbuf = *percpu_page_buffer;
             auto limit = (pbuf.max + 1) / 2;
+            // Refill from the memory of this cpu's own node
+            auto node = sched::cpu::current()->node;
 
             while (pbuf.nr < limit) {
-                auto it = free_page_ranges.begin();
-                if (it == free_page_ranges.end())
+                auto p = find_page_range(node, [] (page_range&) { return true; });
+                if (!p)
                     break;
-                auto p = &*it;
                 auto size = std::min(p->size, (limit - pbuf.nr) * page_size);
                 p->size -= size;
                 total_size += size;
                 void* pages = static_cast<void*>(p) + p->size;
                 if (!p->size) {
-                    free_page_ranges.erase(it);
+                    free_page_ranges.erase(free_page_ranges.iterator_to(*p));
                 }
                 while (size) {
                     pbuf.free[pbuf.nr++] = pages;
@@ -912,6 +1106,133 @@ static bool free_page_local(void* v)
     }
 }
 
+// Multi-page slabs are buffered per cpu as well, one buffer for each slab
+// size, so that pools refill and release them in batches instead of taking
+// free_page_ranges_lock for every slab.
+struct slab_buffer {
+    // slabs of 2, 4, ... pool::max_slab_size / page_size pages
+    static constexpr unsigned nr_orders = 6;
+    static constexpr size_t max_bytes = 512 * 1024;
+    struct buffer {
+        size_t nr = 0;
+        void* free[max_bytes / (2 * page_size)];
+    };
+    buffer buffers[nr_orders];
+
+    static unsigned order(size_t size) { return ilog2_roundup(size / page_size); }
+    static size_t max(unsigned order) { return max_bytes / (page_size << order); }
+};
+
+PERCPU(slab_buffer, percpu_slab_buffer);
+
+static void refill_slab_buffer(unsigned order)
+{
+    auto size = page_size << order;
+    WITH_LOCK(free_page_ranges_lock) {
+        reclaimer_thread.wait_for_minimum_memory();
+
+        size_t total_size = 0;
+        WITH_LOCK(preempt_lock) {
+            auto& sbuf = percpu_slab_buffer->buffers[order - 1];
+            auto limit = (slab_buffer::max(order) + 1) / 2;
+            auto node = sched::cpu::current()->node;
+
+            while (sbuf.nr < limit) {
+                auto slab = alloc_slab_locked(size, node);
+                if (!slab) {
+                    break;
+                }
+                sbuf.free[sbuf.nr++] = slab;
+                total_size += size;
+            }
+        }
+        if (!total_size) {
+            reclaimer_thread.wait_for_memory(size + pool::max_slab_size);
+            return;
+        }
+        on_alloc(total_size);
+    }
+}
+
+static void unfill_slab_buffer(unsigned order)
+{
+    auto size = page_size << order;
+    WITH_LOCK(free_page_ranges_lock) {
+        WITH_LOCK(preempt_lock) {
+            auto& sbuf = percpu_slab_buffer->buffers[order - 1];
+
+            while (sbuf.nr > slab_buffer::max(order) / 2) {
+                auto v = sbuf.free[--sbuf.nr];
+                auto pr = new (v) page_range(size);
+                free_page_range_locked(pr);
+            }
+        }
+    }
+}
+
+static void* alloc_slab_local(unsigned order)
+{
+    WITH_LOCK(preempt_lock) {
+        auto& sbuf = percpu_slab_buffer->buffers[order - 1];
+        if (!sbuf.nr) {
+            return nullptr;
+        }
+        return sbuf.free[--sbuf.nr];
+    }
+}
+
+static bool free_slab_local(void* v, unsigned order)
+{
+    WITH_LOCK(preempt_lock) {
+        auto& sbuf = percpu_slab_buffer->buffers[order - 1];
+        if (sbuf.nr == slab_buffer::max(order)) {
+            return false;
+        }
+        sbuf.free[sbuf.nr++] = v;
+        return true;
+    }
+}
+
+static void* early_alloc_slab(size_t size)
+{
+    while (true) {
+        WITH_LOCK(free_page_ranges_lock) {
+            reclaimer_thread.wait_for_minimum_memory();
+            auto slab = alloc_slab_locked(size, numa_node());
+            if (slab) {
+                on_alloc(size);
+                return slab;
+            }
+            reclaimer_thread.wait_for_memory(size + pool::max_slab_size);
+        }
+    }
+}
+
+static void* untracked_alloc_slab(size_t size)
+{
+    if (!smp_allocator) {
+        return early_alloc_slab(size);
+    }
+    auto order = slab_buffer::order(size);
+    assert(order >= 1 && order <= slab_buffer::nr_orders);
+    void* ret;
+    while (!(ret = alloc_slab_local(order))) {
+        refill_slab_buffer(order);
+    }
+    return ret;
+}
+
+static void untracked_free_slab(void* v, size_t size)
+{
+    if (!smp_allocator) {
+        return free_page_range(v, size);
+    }
+    auto order = slab_buffer::order(size);
+    while (!free_slab_local(v, order)) {
+        unfill_slab_buffer(order);
+    }
+}
+
 static void* early_alloc_page()
 {
     WITH_LOCK(free_page_ranges_lock) {
@@ -920,13 +1241,12 @@ static void* early_alloc_page()
             abort();
         }
 
-        auto begin = free_page_ranges.begin();
-        auto p = &*begin;
+        auto p = find_page_range(numa_node(), [] (page_range&) { return true; });
         p->size -= page_size;
         on_alloc(page_size);
         void* page = static_cast<void*>(p) + p->size;
         if (!p->size) {
-            free_page_ranges.erase(begin);
+            free_page_ranges.erase(free_page_ranges.iterator_to(*p));
         }
         return page;
     }
@@ -985,16 +1305,17 @@ void free_page(void* v)
 void* alloc_huge_page(size_t N)
 {
     WITH_LOCK(free_page_ranges_lock) {
-        for (auto i = free_page_ranges.begin(); i != free_page_ranges.end(); ++i) {
-            page_range *range = &*i;
-            if (range->size < N)
-                continue;
+        // Find the the beginning of the last aligned area in the given
+        // page range. This will be our return value:
+        auto aligned = [=] (page_range& r) -> intptr_t {
+            return ((intptr_t)&r + r.size - N) & ~(N-1);
+        };
+        page_range *range = find_page_range(numa_node(), [=] (page_range& r) {
+            return r.size >= N && aligned(r) >= (intptr_t)&r;
+        });
+        if (range) {
             intptr_t v = (intptr_t) range;
-            // Find the the beginning of the last aligned area in the given
-            // page range. This will be our return value:
-            intptr_t ret = (v+range->size-N) & ~(N-1);
-            if (ret<v)
-                continue;
+            intptr_t ret = aligned(*range);
             // endsize is the number of bytes in the page range *after* the
             // N bytes we will return. calculate it before changing header->size
             int endsize = v+range->size-ret-N;
@@ -1003,7 +1324,7 @@ void* alloc_huge_page(size_t N)
             size_t alloc_size;
             if (ret==v) {
                 alloc_size = range->size;
-                free_page_ranges.erase(i);
+                free_page_ranges.erase(free_page_ranges.iterator_to(*range));
             } else {
                 // Note that this is is done conditionally because we are
                 // operating page ranges. That is what is left on our page
@@ -1119,13 +1440,26 @@ static inline void* std_malloc(size_t size, size_t alignment)
         }
     }
 
-    if (size <= memory::pool::max_object_size && smp_allocator) {
+    unsigned n = memory::nr_size_classes;
+    if (size <= memory::pool::max_object_size && alignment <= mmu::page_size
+            && smp_allocator) {
         size = std::max(size, memory::pool::min_object_size);
-        unsigned n = ilog2_roundup(size);
+        if (alignment > MALLOC_ALIGNMENT) {
+            // Only the power of two classes are aligned to their size
+            size = size_t(1) << ilog2_roundup(size);
+        }
+        n = memory::size_class(size);
+        // Page sized objects are better served by alloc_page(), which has
+        // no slab header to make room for.
+        if (memory::size_class_size(n) == mmu::page_size) {
+            n = memory::nr_size_classes;
+        }
+    }
+
+    if (n < memory::nr_size_classes) {
         ret = memory::malloc_pools[n].alloc();
-        ret = translate_mem_area(mmu::mem_area::main, mmu::mem_area::mempool,
-                                 ret);
-        trace_memory_malloc_mempool(ret, requested_size, 1 << n, alignment);
+        trace_memory_malloc_mempool(ret, requested_size,
+                                    memory::size_class_size(n), alignment);
     } else if (size <= mmu::page_size) {
         ret = mmu::translate_mem_area(mmu::mem_area::main, mmu::mem_area::page,
                                        memory::alloc_page());
@@ -1156,8 +1490,7 @@ static size_t object_size(void *object)
     case mmu::mem_area::main:
         return memory::large_object_size(object);
     case mmu::mem_area::mempool:
-        object = mmu::translate_mem_area(mmu::mem_area::mempool,
-                                         mmu::mem_area::main, object);
+    case mmu::mem_area::mempool_slab:
         return memory::pool::from_object(object)->get_size();
     case mmu::mem_area::page:
         return mmu::page_size;
@@ -1200,8 +1533,7 @@ static inline void std_free(void* object)
     case mmu::mem_area::main:
          return memory::free_large(object);
     case mmu::mem_area::mempool:
-        object = mmu::translate_mem_area(mmu::mem_area::mempool,
-                                         mmu::mem_area::main, object);
+    case mmu::mem_area::mempool_slab:
         return memory::pool::from_object(object)->free(object);
     default:
         abort();
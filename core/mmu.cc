@@ -1574,8 +1574,13 @@ void file_vma::fault(uintptr_t addr, exception_frame *ef)
         size = page_size;
     }
 
-    populate_vma<account_opt::no>(this, (void*)addr, size,
-            mmu::is_page_fault_write(ef->get_error()));
+    try {
+        populate_vma<account_opt::no>(this, (void*)addr, size,
+                mmu::is_page_fault_write(ef->get_error()));
+    } catch (error& err) {
+        // the file system could not read the page in
+        vm_sigbus(addr, ef);
+    }
 }
 
 file_vma::~file_vma()
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#include <osv/numa.hh>
+#include <osv/debug.hh>
+#include <algorithm>
+#include <utility>
+
+namespace numa {
+
+// Plain arrays, so they are usable (as a single node) before constructors run
+static unsigned nodes = 1;
+static u32 domains[max_nodes];
+static bool have_domains;
+static memory_range ranges[max_memory_ranges];
+static unsigned nranges;
+static u8 distances[max_nodes][max_nodes];
+static unsigned nearest[max_nodes][max_nodes];
+
+unsigned node_for_domain(u32 domain)
+{
+    if (!have_domains) {
+        domains[0] = domain;
+        have_domains = true;
+        return 0;
+    }
+    for (unsigned i = 0; i < nodes; i++) {
+        if (domains[i] == domain) {
+            return i;
+        }
+    }
+    if (nodes == max_nodes) {
+        debug_early("numa: too many nodes, merging the rest into node 0\n");
+        return 0;
+    }
+    domains[nodes] = domain;
+    return nodes++;
+}
+
+void add_memory(u64 start, u64 size, unsigned node)
+{
+    if (nranges == max_memory_ranges) {
+        debug_early("numa: too many memory ranges, ignoring the rest\n");
+        return;
+    }
+    auto pos = std::find_if(ranges, ranges + nranges,
+            [=] (const memory_range& r) { return r.start > start; });
+    std::copy_backward(pos, ranges + nranges, ranges + nranges + 1);
+    *pos = memory_range{start, start + size, node};
+    ++nranges;
+}
+
+void set_domain_distance(u32 from, u32 to, unsigned distance)
+{
+    for (unsigned i = 0; i < nodes; i++) {
+        for (unsigned j = 0; j < nodes; j++) {
+            if (domains[i] == from && domains[j] == to) {
+                distances[i][j] = distance;
+            }
+        }
+    }
+}
+
+void commit_topology()
+{
+    for (unsigned i = 0; i < nodes; i++) {
+        for (unsigned j = 0; j < nodes; j++) {
+            if (!distances[i][j]) {
+                distances[i][j] = i == j ? local_distance : remote_distance;
+            }
+            nearest[i][j] = j;
+        }
+        // The node itself first, even if the firmware claims otherwise
+        auto rank = [=] (unsigned n) { return std::make_pair(n != i, distances[i][n]); };
+        std::stable_sort(nearest[i], nearest[i] + nodes, [=] (unsigned a, unsigned b) {
+            return rank(a) < rank(b);
+        });
+    }
+}
+
+unsigned nr_nodes()
+{
+    return nodes;
+}
+
+unsigned nr_memory_ranges()
+{
+    return nranges;
+}
+
+const memory_range& get_memory_range(unsigned i)
+{
+    return ranges[i];
+}
+
+unsigned distance(unsigned from, unsigned to)
+{
+    return distances[from][to];
+}
+
+const unsigned* nearest_nodes(unsigned node)
+{
+    return nearest[node];
+}
+
+unsigned phys_node(u64 pa)
+{
+    for (unsigned i = 0; i < nranges; i++) {
+        if (pa >= ranges[i].start && pa < ranges[i].end) {
+            return ranges[i].node;
+        }
+    }
+    return 0;
+}
+
+bool is_boundary(u64 pa)
+{
+    if (nodes == 1) {
+        return false;
+    }
+    for (unsigned i = 0; i < nranges; i++) {
+        if (pa == ranges[i].start || pa == ranges[i].end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
@@ -231,6 +231,18 @@ public:
     }
 };
 
+// A page of a read-only file system (rofs), which lends it to us for as
+// long as it is mapped: _release gives it back.
+class cached_page_ro : public cached_page {
+    std::function<void ()> _release;
+public:
+    cached_page_ro(hashkey key, void* page, std::function<void ()> release)
+        : cached_page(key, page), _release(std::move(release)) {}
+    ~cached_page_ro() {
+        _release();
+    }
+};
+
 class cached_page_arc;
 
 unsigned drop_read_cached_page(cached_page_arc* cp, bool flush = true);
@@ -295,6 +307,8 @@ constexpr unsigned lru_free_count = 20;
 
 std::unordered_multimap<arc_buf_t*, cached_page_arc*> cached_page_arc::arc_cache_map;
 static std::unordered_map<hashkey, cached_page_arc*> read_cache;
+// pages owned by read-only file systems (rofs), here while they are mapped
+static std::unordered_map<hashkey, cached_page_ro*> ro_cache;
 static std::unordered_map<hashkey, cached_page_write*> write_cache;
 static std::deque<cached_page_write*> write_lru;
 static mutex arc_lock; // protects against parallel eviction, parallel creation impossible due to vma_list_lock
@@ -328,12 +342,26 @@ void remove_read_mapping(cached_page_arc* cp, mmu::hw_ptep<0> ptep)
     }
 }
 
+void remove_read_mapping(cached_page_ro* cp, mmu::hw_ptep<0> ptep)
+{
+    trace_remove_mapping(nullptr, cp->addr(), ptep.release());
+    if (cp->unmap(ptep) == 0) {
+        ro_cache.erase(cp->key());
+        delete cp;
+    }
+}
+
 void remove_read_mapping(hashkey& key, mmu::hw_ptep<0> ptep)
 {
     SCOPE_LOCK(arc_lock);
     cached_page_arc* cp = find_in_cache(read_cache, key);
     if (cp) {
         remove_read_mapping(cp, ptep);
+        return;
+    }
+    cached_page_ro* rocp = find_in_cache(ro_cache, key);
+    if (rocp) {
+        remove_read_mapping(rocp, ptep);
     }
 }
 
@@ -359,6 +387,16 @@ void drop_read_cached_page(hashkey& key)
     cached_page_arc* cp = find_in_cache(read_cache, key);
     if (cp) {
         drop_read_cached_page(cp, true);
+        return;
+    }
+    cached_page_ro* rocp = find_in_cache(ro_cache, key);
+    if (rocp) {
+        trace_drop_read_cached_page(nullptr, rocp->addr());
+        if (rocp->flush() > 1) {
+            mmu::flush_tlb_all();
+        }
+        ro_cache.erase(rocp->key());
+        delete rocp;
     }
 }
 
@@ -380,6 +418,20 @@ void map_arc_buf(hashkey *key, arc_buf_t* ab, void *page)
     arc_share_buf(ab);
 }
 
+TRACEPOINT(trace_map_read_only_page, "page=%p", void*);
+void map_read_only_page(hashkey *key, void *page, std::function<void ()> release)
+{
+    trace_map_read_only_page(page);
+    SCOPE_LOCK(arc_lock);
+    if (find_in_cache(ro_cache, *key)) {
+        // mapped already, and so still the same page
+        release();
+        return;
+    }
+    ro_cache.emplace(*key, new cached_page_ro(*key, page, std::move(release)));
+}
+
+// 0 once the page is in the cache, -1 for a hole, or the error reading it
 static int create_read_cached_page(vfs_file* fp, hashkey& key)
 {
     return fp->get_arcbuf(&key, key.offset);
@@ -450,6 +502,7 @@ bool get(vfs_file* fp, off_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pt
         }
     } else if (!wcp) {
         // read fault and page is not in write cache yet, return one from ARC, mark it cow
+        int error;
         do {
             WITH_LOCK(arc_lock) {
                 cached_page_arc* cp = find_in_cache(read_cache, key);
@@ -457,9 +510,18 @@ bool get(vfs_file* fp, off_t offset, mmu::hw_ptep<0> ptep, mmu::pt_element<0> pt
                     add_read_mapping(cp, ptep);
                     return mmu::write_pte(cp->addr(), ptep, mmu::pte_mark_cow(pte, true));
                 }
+                cached_page_ro* rocp = find_in_cache(ro_cache, key);
+                if (rocp) {
+                    rocp->map(ptep);
+                    return mmu::write_pte(rocp->addr(), ptep, mmu::pte_mark_cow(pte, true));
+                }
             }
             // page is not in cache yet, create and try again
-        } while (create_read_cached_page(fp, key) != -1);
+        } while ((error = create_read_cached_page(fp, key)) == 0);
+        if (error != -1) {
+            // the faulting access gets a SIGBUS, see file_vma::fault()
+            throw make_error(error);
+        }
 
         // try to access a hole in a file, map by zero_page
         return mmu::write_pte(zero_page, ptep, mmu::pte_mark_cow(pte, true));
@@ -498,6 +560,12 @@ bool release(vfs_file* fp, void *addr, off_t offset, mmu::hw_ptep<0> ptep)
             remove_read_mapping(rcp, ptep);
             return false;
         }
+        cached_page_ro* rocp = find_in_cache(ro_cache, key);
+        if (rocp && rocp->addr() == addr) {
+            // page belongs to a read-only file system
+            remove_read_mapping(rocp, ptep);
+            return false;
+        }
     }
 
     // if a private page, caller will free it
@@ -6,6 +6,10 @@
  */
 
 #include <chrono>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
 
 #include <osv/migration-lock.hh>
 #include <osv/sched.hh>
@@ -15,6 +19,11 @@
 #include <osv/trace.hh>
 #include <osv/percpu.hh>
 #include <osv/sampler.hh>
+#include <osv/execinfo.hh>
+#include <osv/elf.hh>
+#include <osv/demangle.hh>
+#include "safe-ptr.hh"
+#include "exceptions.hh"
 
 namespace prof {
 
@@ -27,6 +36,128 @@ static config _config;
 static sched::thread_handle _controller;
 static mutex _control_lock;
 
+// The stacks sampled on one cpu, with how many times each was seen.
+//
+// Only the cpu's own timer interrupt adds to the table, so counting a
+// sample takes neither a lock nor an allocation; the table is allocated
+// when the sampler starts, and when it is full, new stacks are dropped.
+// A slot is claimed by filling in its frames and then publishing its
+// hash, so readers on other cpus can walk the table while it is in use.
+class stack_table {
+public:
+    static constexpr unsigned max_frames = 32;
+    struct slot {
+        std::atomic<u64> hash { 0 };  // 0 while unused
+        std::atomic<u64> hits { 0 };
+        unsigned len = 0;
+        void* pc[max_frames];
+    };
+
+    // Returns nullptr rather than throwing if the table doesn't fit in
+    // memory, as its size comes from the user.
+    static stack_table* make(unsigned size)
+    {
+        std::unique_ptr<slot[]> slots(new (std::nothrow) slot[size]);
+        if (!slots) {
+            return nullptr;
+        }
+        return new (std::nothrow) stack_table(size, std::move(slots));
+    }
+
+    void count(void** pc, unsigned len)
+    {
+        auto h = hash(pc, len);
+        // Linear probing, with a bounded search for stacks not seen yet
+        unsigned probes = std::min(_size, unsigned(max_probes));
+        for (unsigned i = 0; i < probes; i++) {
+            auto& s = _slots[(h + i) % _size];
+            auto sh = s.hash.load(std::memory_order_relaxed);
+            if (sh == h && s.len == len && std::equal(pc, pc + len, s.pc)) {
+                inc(s.hits);
+                return;
+            } else if (!sh) {
+                std::copy(pc, pc + len, s.pc);
+                s.len = len;
+                s.hits.store(1, std::memory_order_relaxed);
+                s.hash.store(h, std::memory_order_release);
+                return;
+            }
+        }
+        inc(_dropped);
+    }
+
+    template <typename Func>
+    void for_each(Func func) const
+    {
+        for (unsigned i = 0; i < _size; i++) {
+            auto& s = _slots[i];
+            if (s.hash.load(std::memory_order_acquire)) {
+                func(s.pc, s.len, s.hits.load(std::memory_order_relaxed));
+            }
+        }
+    }
+
+    u64 dropped() const
+    {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+private:
+    static constexpr unsigned max_probes = 16;
+
+    // Only the owning cpu writes, so no need for a locked instruction
+    static void inc(std::atomic<u64>& counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+    }
+
+    static u64 hash(void** pc, unsigned len)
+    {
+        u64 r = len;
+        for (unsigned i = 0; i < len; ++i) {
+            r = (r << 7) | (r >> (64 - 7));
+            r ^= reinterpret_cast<uintptr_t>(pc[i]);
+        }
+        return r | 1;
+    }
+
+    stack_table(unsigned size, std::unique_ptr<slot[]> slots)
+        : _size(size)
+        , _slots(std::move(slots))
+    {
+    }
+
+    unsigned _size;
+    std::unique_ptr<slot[]> _slots;
+    std::atomic<u64> _dropped { 0 };
+};
+
+// indexed by cpu id; empty unless config::max_stacks was set
+static std::vector<std::unique_ptr<stack_table>> _stacks;
+
+// Unwinds the code the timer interrupt stopped, rather than the sampler
+// itself, following frame pointers from the interrupt frame.
+static unsigned sample_stack(void** pc, unsigned max)
+{
+    struct frame {
+        frame* next;
+        void* pc;
+    };
+    auto ef = current_interrupt_frame;
+    if (ef) {
+        unsigned i = 0;
+        pc[i++] = reinterpret_cast<void*>(ef->rip);
+        auto fp = reinterpret_cast<frame*>(ef->rbp);
+        frame* next;
+        while (i < max && safe_load(&fp->next, next) && safe_load(&fp->pc, pc[i]) && pc[i]) {
+            fp = next;
+            ++i;
+        }
+        return i;
+    }
+    return backtrace_safe(pc, max);
+}
+
 class cpu_sampler : public sched::timer_base::client {
 private:
     sched::timer_base _timer;
@@ -47,6 +178,11 @@ public:
     void timer_fired()
     {
         trace_sampler_tick();
+        if (!_stacks.empty()) {
+            void* pc[stack_table::max_frames];
+            auto len = sample_stack(pc, stack_table::max_frames);
+            _stacks[sched::cpu::current()->id]->count(pc, len);
+        }
         rearm();
     }
 
@@ -133,12 +269,26 @@ bool start_sampler(config new_config) throw()
 
     debug("Starting sampler, period = %d ns\n", to_nanoseconds(new_config.period));
 
-    _controller.reset(*sched::thread::current());
-
     assert(_active_cpus == 0);
 
-    trace_sampler_tick.enable(true);
-    trace_sampler_tick.backtrace(true);
+    _stacks.clear();
+    if (new_config.max_stacks) {
+        _stacks.reserve(sched::cpus.size());
+        for (unsigned i = 0; i < sched::cpus.size(); i++) {
+            auto table = stack_table::make(new_config.max_stacks);
+            if (!table) {
+                debug("Sampler: no memory for %d stacks per cpu\n", new_config.max_stacks);
+                _stacks.clear();
+                return false;
+            }
+            _stacks.emplace_back(table);
+        }
+    } else {
+        trace_sampler_tick.enable(true);
+        trace_sampler_tick.backtrace(true);
+    }
+
+    _controller.reset(*sched::thread::current());
 
     _n_cpus = sched::cpus.size();
     _config = new_config;
@@ -176,11 +326,64 @@ void stop_sampler() throw()
     sched::thread::wait_until([] { return _active_cpus == 0; });
     _controller.clear();
 
-    trace_sampler_tick.backtrace(false);
-    trace_sampler_tick.enable(false);
+    if (_stacks.empty()) {
+        trace_sampler_tick.backtrace(false);
+        trace_sampler_tick.enable(false);
+    }
 
     _started = false;
     debug("Sampler stopped.\n");
 }
 
+static std::string frame_name(void* pc)
+{
+    auto ei = elf::get_program()->lookup_addr(pc);
+    if (!ei.sym) {
+        std::ostringstream os;
+        os << pc;
+        return os.str();
+    }
+    char buf[1024];
+    if (!osv::demangle(ei.sym, buf, sizeof(buf))) {
+        return ei.sym;
+    }
+    return buf;
+}
+
+std::string get_folded_stacks()
+{
+    SCOPE_LOCK(_control_lock);
+
+    // The same stack may have been sampled on several cpus
+    std::map<std::vector<void*>, u64> stacks;
+    u64 dropped = 0;
+    for (auto& table : _stacks) {
+        table->for_each([&] (void* const* pc, unsigned len, u64 hits) {
+            stacks[std::vector<void*>(pc, pc + len)] += hits;
+        });
+        dropped += table->dropped();
+    }
+
+    std::unordered_map<void*, std::string> names;
+    std::ostringstream os;
+    for (auto& s : stacks) {
+        auto& pc = s.first;
+        for (size_t i = pc.size(); i-- > 0;) {
+            // All but the innermost frame are return addresses, which may
+            // already belong to the next function
+            void* addr = static_cast<char*>(pc[i]) - (i ? 1 : 0);
+            auto it = names.find(addr);
+            if (it == names.end()) {
+                it = names.emplace(addr, frame_name(addr)).first;
+            }
+            os << it->second << (i ? ";" : "");
+        }
+        os << " " << s.second << "\n";
+    }
+    if (dropped) {
+        os << "[dropped] " << dropped << "\n";
+    }
+    return os.str();
+}
+
 }
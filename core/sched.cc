@@ -55,6 +55,7 @@ TRACEPOINT(trace_sched_wait, "");
 TRACEPOINT(trace_sched_wait_ret, "");
 TRACEPOINT(trace_sched_wake, "wake %p", thread*);
 TRACEPOINT(trace_sched_migrate, "thread=%p cpu=%d", thread*, unsigned);
+TRACEPOINT(trace_sched_set_affinity, "thread=%p cpus=%x", thread*, unsigned long);
 TRACEPOINT(trace_sched_queue, "thread=%p", thread*);
 TRACEPOINT(trace_sched_preempt, "");
 TRACEPOINT(trace_timer_set, "timer=%p time=%d", timer_base*, s64);
@@ -161,6 +162,7 @@ cpu::cpu(unsigned _id)
     , preemption_timer(*this)
     , idle_thread()
     , terminating_thread(nullptr)
+    , migrating_thread(nullptr)
     , c(cinitial)
     , renormalize_count(0)
 {
@@ -199,6 +201,7 @@ void cpu::reschedule_from_interrupt()
     assert(sched::exception_depth <= 1);
     need_reschedule = false;
     handle_incoming_wakeups();
+    send_migrating_thread();
 
     auto now = osv::clock::uptime::now();
     auto interval = now - running_since;
@@ -272,6 +275,7 @@ void cpu::reschedule_from_interrupt()
         p->_detached_state->_cpu->terminating_thread->destroy();
         p->_detached_state->_cpu->terminating_thread = nullptr;
     }
+    p->_detached_state->_cpu->send_migrating_thread();
 }
 
 void cpu::timer_fired()
@@ -347,6 +351,38 @@ void cpu::idle()
     }
 }
 
+// Picks the least loaded of the given CPUs
+static cpu* least_loaded(cpu_set allowed)
+{
+    cpu* best = nullptr;
+    for (auto i : allowed) {
+        if (i >= cpus.size()) {
+            break;
+        }
+        if (!best || cpus[i]->load() < best->load()) {
+            best = cpus[i];
+        }
+    }
+    return best;
+}
+
+// Sends migrating_thread to an allowed CPU once it has been switched out.
+// Called with interrupts disabled.
+void cpu::send_migrating_thread()
+{
+    auto t = migrating_thread;
+    if (!t || t == thread::current()) {
+        return;
+    }
+    migrating_thread = nullptr;
+    // If it was woken meanwhile, handle_incoming_wakeups() sends it instead
+    auto expected = thread::status::waiting;
+    if (t->_detached_state->st.compare_exchange_strong(expected,
+            thread::status::waking)) {
+        send_to(*t, least_loaded(t->_affinity));
+    }
+}
+
 void cpu::handle_incoming_wakeups()
 {
     cpu_set queues_with_wakes{incoming_wakeups_mask.fetch_clear()};
@@ -364,6 +400,12 @@ void cpu::handle_incoming_wakeups()
                     // Special case of current thread being woken before
                     // having a chance to be scheduled out.
                     t._detached_state->st.store(thread::status::running);
+                } else if (!t._affinity.test(id) && t._migration_lock_counter == 0) {
+                    // Its affinity was changed while it slept, or it was
+                    // woken while moving itself out, see
+                    // thread::set_affinity().
+                    t._runtime.update_after_sleep();
+                    send_to(t, least_loaded(t._affinity));
                 } else {
                     t._detached_state->st.store(thread::status::queued);
                     // Make sure the CPU-local runtime measure is suitably
@@ -396,6 +438,25 @@ unsigned cpu::load()
     return runqueue.size();
 }
 
+// Hands a thread in the waking state over to another CPU. Must be called
+// with interrupts disabled, on the CPU whose timers the thread's are on.
+void cpu::send_to(thread& t, cpu* target)
+{
+    trace_sched_migrate(&t, target->id);
+    t.suspend_timers();
+    t._detached_state->_cpu = target;
+    // Convert the CPU-local runtime measure to a globally meaningful
+    // measure
+    t._runtime.export_runtime();
+    t.remote_thread_local_var(::percpu_base) = target->percpu_base;
+    t.remote_thread_local_var(current_cpu) = target;
+    target->incoming_wakeups[id].push_back(t);
+    target->incoming_wakeups_mask.set(id);
+    // FIXME: avoid if the cpu is alive and if the priority does not
+    // FIXME: warrant an interruption
+    target->send_wakeup_ipi();
+}
+
 void cpu::load_balance()
 {
     notifier::fire();
@@ -406,8 +467,26 @@ void cpu::load_balance()
         if (runqueue.empty()) {
             continue;
         }
-        auto min = *std::min_element(cpus.begin(), cpus.end(),
-                [](cpu* c1, cpu* c2) { return c1->load() < c2->load(); });
+        // Move away threads whose affinity no longer includes this CPU
+        // (see thread::set_affinity()); we preempted them to get here.
+        WITH_LOCK(irq_lock) {
+            for (;;) {
+                auto i = std::find_if(runqueue.begin(), runqueue.end(),
+                        [this](thread& t) {
+                            return !t._affinity.test(id) && t._migration_lock_counter == 0;
+                        });
+                if (i == runqueue.end()) {
+                    break;
+                }
+                auto& mig = *i;
+                runqueue.erase(i);
+                assert(mig._detached_state->st.load() == thread::status::queued);
+                mig._detached_state->st.store(thread::status::waking);
+                send_to(mig, least_loaded(mig._affinity));
+            }
+        }
+        auto lighter = [](cpu* c1, cpu* c2) { return c1->load() < c2->load(); };
+        auto min = *std::min_element(cpus.begin(), cpus.end(), lighter);
         if (min == this) {
             continue;
         }
@@ -416,30 +495,36 @@ void cpu::load_balance()
         if (min->load() >= (load() - 1)) {
             continue;
         }
+        // A thread's memory is mostly on the NUMA node it has been running
+        // on, so prefer a cpu on this node, and only move the thread to
+        // another node if the imbalance is larger.
+        if (min->node != node) {
+            cpu* local = nullptr;
+            for (auto c : cpus) {
+                if (c->node == node && (!local || lighter(c, local))) {
+                    local = c;
+                }
+            }
+            if (local != this && local->load() < (load() - 1)) {
+                min = local;
+            } else if (min->load() >= (load() - 2)) {
+                continue;
+            }
+        }
         WITH_LOCK(irq_lock) {
             auto i = std::find_if(runqueue.rbegin(), runqueue.rend(),
-                    [](thread& t) { return t._migration_lock_counter == 0; });
+                    [min](thread& t) {
+                        return t._migration_lock_counter == 0 && t._affinity.test(min->id);
+                    });
             if (i == runqueue.rend()) {
                 continue;
             }
             auto& mig = *i;
-            trace_sched_migrate(&mig, min->id);
             runqueue.erase(std::prev(i.base()));  // i.base() returns off-by-one
             // we won't race with wake(), since we're not thread::waiting
             assert(mig._detached_state->st.load() == thread::status::queued);
             mig._detached_state->st.store(thread::status::waking);
-            mig.suspend_timers();
-            mig._detached_state->_cpu = min;
-            // Convert the CPU-local runtime measure to a globally meaningful
-            // measure
-            mig._runtime.export_runtime();
-            mig.remote_thread_local_var(::percpu_base) = min->percpu_base;
-            mig.remote_thread_local_var(current_cpu) = min;
-            min->incoming_wakeups[id].push_back(mig);
-            min->incoming_wakeups_mask.set(id);
-            // FIXME: avoid if the cpu is alive and if the priority does not
-            // FIXME: warrant an interruption
-            min->send_wakeup_ipi();
+            send_to(mig, min);
         }
     }
 }
@@ -490,6 +575,56 @@ void thread::yield()
     t->_detached_state->_cpu->reschedule_from_interrupt();
 }
 
+bool thread::set_affinity(const cpu_set& cpus)
+{
+    cpu_set allowed;
+    for (auto i : cpu_set(cpus)) {
+        if (i < sched::cpus.size()) {
+            allowed.set(i);
+        }
+    }
+    if (!allowed || _attr._pinned_cpu) {
+        return false;
+    }
+    if (this != current()) {
+        _affinity = allowed;
+        trace_sched_set_affinity(this, allowed.to_ulong());
+        return true;
+    }
+
+    WITH_LOCK(irq_lock) {
+        if (!allowed.test(tcpu()->id) && _migration_lock_counter) {
+            return false;
+        }
+        _affinity = allowed;
+        trace_sched_set_affinity(this, allowed.to_ulong());
+        // Go to sleep, and have the next thread to run on this CPU send us
+        // over to an allowed one once we are switched out. If we are woken
+        // before that, we stay here and try again.
+        while (!_affinity.test(tcpu()->id)) {
+            auto source = tcpu();
+            _detached_state->st.store(status::waiting);
+            source->migrating_thread = this;
+            source->reschedule_from_interrupt();
+            if (tcpu() == source && source->migrating_thread == this) {
+                source->migrating_thread = nullptr;
+            }
+        }
+    }
+    return true;
+}
+
+cpu_set thread::get_affinity() const
+{
+    cpu_set ret;
+    for (auto i : cpu_set(_affinity)) {
+        if (i < sched::cpus.size()) {
+            ret.set(i);
+        }
+    }
+    return ret;
+}
+
 void thread::set_priority(float priority)
 {
     _runtime.set_priority(priority);
@@ -669,6 +804,11 @@ thread::thread(std::function<void ()> func, attr attr, bool main)
 
     if (_attr._pinned_cpu) {
         ++_migration_lock_counter;
+        _affinity.set(_attr._pinned_cpu->id);
+    } else {
+        for (unsigned i = 0; i < max_cpus; i++) {
+            _affinity.set(i);
+        }
     }
 
     if (main) {
@@ -721,6 +861,9 @@ void thread::start()
     }
 
     _detached_state->_cpu = _attr._pinned_cpu ? _attr._pinned_cpu : current()->tcpu();
+    if (!_affinity.test(_detached_state->_cpu->id)) {
+        _detached_state->_cpu = least_loaded(_affinity);
+    }
     remote_thread_local_var(percpu_base) = _detached_state->_cpu->percpu_base;
     remote_thread_local_var(current_cpu) = _detached_state->_cpu;
     _detached_state->st.store(status::waiting);
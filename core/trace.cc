@@ -19,6 +19,13 @@
 #include <osv/execinfo.hh>
 #include <osv/percpu.hh>
 #include <osv/ilog2.hh>
+#include <unordered_set>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 using namespace std;
 
@@ -52,18 +59,28 @@ constexpr size_t trace_page_size = 4096;  // need not match arch page size
 
 // Having a struct is more complex than it need be for just per-vcpu buffers,
 // _but_ it is in line with later on having rotating buffers, thus wwhy not do it already
+//
+// Normally the buffer is a flight recorder, and new records overwrite the
+// oldest ones. While a streaming exporter is attached (_streaming), records
+// it has not consumed yet (from _read up to _last) are never overwritten:
+// a record which does not fit is dropped instead and counted in _lost. So
+// the exporter, running on another cpu, can copy records out without any
+// lock, as nobody writes to the bytes it reads.
 struct trace_buf {
     std::unique_ptr<char[]>
            _base;
     size_t _last;
     size_t _size;
+    size_t _read;
+    u64 _lost;
+    bool _streaming;
 
     trace_buf() :
-            _base(nullptr), _last(0), _size(0) {
+            _base(nullptr), _last(0), _size(0), _read(0), _lost(0), _streaming(false) {
     }
     trace_buf(size_t size) :
             _base(static_cast<char*>(aligned_alloc(sizeof(long), size))), _last(
-                    0), _size(size) {
+                    0), _size(size), _read(0), _lost(0), _streaming(false) {
         static_assert(is_power_of_two(trace_page_size), "just checking");
         assert(is_power_of_two(size) && "size must be power of two");
         assert((size & (trace_page_size - 1)) == 0 && "size must be multiple of trace_page_size");
@@ -86,20 +103,28 @@ struct trace_buf {
             // crossed page boundary
             pn = align_up(p, trace_page_size) + size;
         }
+        if (_streaming && pn - __atomic_load_n(&_read, __ATOMIC_ACQUIRE) > _size) {
+            ++_lost;
+            return nullptr;
+        }
         auto * tr0 = reinterpret_cast<trace_record*>(&_base.get()[index(p)]);
         auto * tr1 = reinterpret_cast<trace_record*>(&_base.get()[index(pn - size)]);
         // Put an "end-marker" on the record being written to signify this is yet incomplete.
         // Reader is only this vcpu or attached debugger -> no fence needed.
         tr1->tp = reinterpret_cast<tracepoint_base *>(-1);
+        tr1->size = size;
         if (tr0 != tr1) {
             // clear the prev word, do indicate padding at the end of the page
             tr0->tp = nullptr;
         }
         barrier();
-        _last = pn;
+        __atomic_store_n(&_last, pn, __ATOMIC_RELEASE);
         return tr1;
 
     }
+    trace_record* record_at(size_t p) const {
+        return reinterpret_cast<trace_record*>(&_base.get()[index(p)]);
+    }
 private:
     inline size_t index(size_t s) const {
         return s & (_size - 1);
@@ -332,6 +357,9 @@ trace_record* tracepoint_base::allocate_trace_record(size_t size)
         size += backtrace_len * sizeof(void*);
     }
     auto * tr = percpu_trace_buffer->allocate_trace_record(size);
+    if (!tr) {
+        return nullptr;
+    }
     tr->backtrace = bt;
     tr->thread = sched::thread::current();
     tr->thread_name = tr->thread->name_raw();
@@ -479,3 +507,304 @@ trace::set_event_state(tracepoint_base & tp, bool enable, bool backtrace)
     }
 }
 
+
+// Streaming export.
+//
+// The exporter thread periodically walks every cpu's trace_buf from where it
+// last stopped (_read) to the last complete record, copies the records out
+// unchanged, and only then advances _read to let the cpu reuse the space.
+// The stream is a header followed by chunks, each a type and a length:
+//
+//   header:     "OSVTRACE", u32 version, u32 backtrace length
+//   tracepoint: u64 key, then name, signature and format as u16-prefixed
+//               strings; precedes the first record of that tracepoint
+//   records:    u32 cpu, u32 padding, then raw trace_records
+//   lost:       u32 cpu, u32 padding, u64 records dropped on that cpu so far
+//
+// Chunk payloads are padded to 8 bytes. scripts/osv/trace.py reads it.
+namespace trace {
+
+namespace {
+
+class exporter {
+public:
+    explicit exporter(int fd);
+    void stop();
+    export_stats stats();
+private:
+    enum : u32 {
+        chunk_tracepoint = 1,
+        chunk_records = 2,
+        chunk_lost = 3,
+    };
+    static constexpr u32 version = 1;
+    static constexpr size_t flush_threshold = 256 * 1024;
+    void run();
+    size_t drain(sched::cpu* cpu);
+    void describe(tracepoint_base* tp);
+    void begin_chunk(u32 type);
+    void end_chunk();
+    void put(const void* data, size_t len);
+    void put_str(const char* str);
+    void flush();
+private:
+    int _fd;
+    bool _failed = false;
+    std::vector<char> _out;
+    size_t _chunk = 0;  // offset of the open chunk's header
+    std::unordered_set<tracepoint_base*> _known;
+    std::vector<u64> _lost;
+    std::atomic<bool> _stopping { false };
+    std::atomic<unsigned long> _records { 0 };
+    std::atomic<unsigned long> _lost_total { 0 };
+    std::atomic<unsigned long> _bytes { 0 };
+    std::unique_ptr<sched::thread> _thread;
+};
+
+exporter::exporter(int fd)
+    : _fd(fd)
+    , _lost(sched::cpus.size())
+{
+    ensure_log_initialized();
+    for (auto c : sched::cpus) {
+        auto tb = percpu_trace_buffer.for_cpu(c);
+        // Records logged before now stay where they are, for the debugger
+        tb->_read = __atomic_load_n(&tb->_last, __ATOMIC_ACQUIRE);
+        _lost[c->id] = tb->_lost;
+        __atomic_store_n(&tb->_streaming, true, __ATOMIC_RELEASE);
+    }
+    put("OSVTRACE", 8);
+    u32 header[] = { version, tracepoint_base::backtrace_len };
+    put(header, sizeof(header));
+    _thread.reset(new sched::thread([this] { run(); },
+            sched::thread::attr().name("trace-export")));
+    _thread->start();
+}
+
+void exporter::stop()
+{
+    _stopping.store(true, std::memory_order_relaxed);
+    _thread->wake();
+    _thread->join();
+    if (!_failed) {
+        for (auto c : sched::cpus) {
+            drain(c);
+            __atomic_store_n(&percpu_trace_buffer.for_cpu(c)->_streaming, false,
+                    __ATOMIC_RELEASE);
+        }
+        flush();
+    }
+    close(_fd);
+}
+
+void exporter::run()
+{
+    while (!_stopping.load(std::memory_order_relaxed) && !_failed) {
+        size_t copied = 0;
+        for (auto c : sched::cpus) {
+            copied += drain(c);
+            if (_out.size() >= flush_threshold) {
+                flush();
+            }
+        }
+        flush();
+        // At a million records a second, a cpu fills up its buffer in about
+        // 15ms, so poll often while records flow.
+        if (copied < flush_threshold) {
+            sched::thread::sleep(copied ? std::chrono::milliseconds(1)
+                                        : std::chrono::milliseconds(10));
+        }
+    }
+    if (_failed) {
+        // Let the buffers go back to overwriting old records
+        for (auto c : sched::cpus) {
+            __atomic_store_n(&percpu_trace_buffer.for_cpu(c)->_streaming, false,
+                    __ATOMIC_RELEASE);
+        }
+    }
+}
+
+size_t exporter::drain(sched::cpu* cpu)
+{
+    auto tb = percpu_trace_buffer.for_cpu(cpu);
+    auto lost = __atomic_load_n(&tb->_lost, __ATOMIC_RELAXED);
+    if (lost != _lost[cpu->id]) {
+        _lost_total += lost - _lost[cpu->id];
+        _lost[cpu->id] = lost;
+        begin_chunk(chunk_lost);
+        u32 cpu_id[] = { cpu->id, 0 };
+        put(cpu_id, sizeof(cpu_id));
+        put(&lost, sizeof(lost));
+        end_chunk();
+    }
+
+    auto end_marker = reinterpret_cast<tracepoint_base*>(-1);
+    size_t rd = tb->_read;
+    const size_t last = __atomic_load_n(&tb->_last, __ATOMIC_ACQUIRE);
+    size_t copied = 0;
+    bool open = false;
+    while (rd != last) {
+        auto tr = tb->record_at(rd);
+        auto tp = __atomic_load_n(&tr->tp, __ATOMIC_ACQUIRE);
+        if (!tp) {
+            // padding up to the end of the page
+            rd = align_up(rd + 1, trace_page_size);
+            continue;
+        }
+        if (tp == end_marker) {
+            // still being written; we'll get it next time
+            break;
+        }
+        if (!_known.count(tp)) {
+            if (open) {
+                end_chunk();
+                open = false;
+            }
+            describe(tp);
+        }
+        if (!open) {
+            begin_chunk(chunk_records);
+            u32 cpu_id[] = { cpu->id, 0 };
+            put(cpu_id, sizeof(cpu_id));
+            open = true;
+        }
+        put(tr, tr->size);
+        copied += tr->size;
+        rd += tr->size;
+        ++_records;
+    }
+    if (open) {
+        end_chunk();
+    }
+    __atomic_store_n(&tb->_read, rd, __ATOMIC_RELEASE);
+    return copied;
+}
+
+void exporter::describe(tracepoint_base* tp)
+{
+    _known.insert(tp);
+    begin_chunk(chunk_tracepoint);
+    u64 key = reinterpret_cast<uintptr_t>(tp);
+    put(&key, sizeof(key));
+    put_str(tp->name);
+    put_str(tp->sig);
+    put_str(tp->format);
+    end_chunk();
+}
+
+void exporter::begin_chunk(u32 type)
+{
+    _chunk = _out.size();
+    u32 header[] = { type, 0 };
+    put(header, sizeof(header));
+}
+
+void exporter::end_chunk()
+{
+    _out.resize(align_up(_out.size(), sizeof(u64)), 0);
+    u32 len = _out.size() - _chunk - 2 * sizeof(u32);
+    memcpy(&_out[_chunk + sizeof(u32)], &len, sizeof(len));
+}
+
+void exporter::put(const void* data, size_t len)
+{
+    auto p = static_cast<const char*>(data);
+    _out.insert(_out.end(), p, p + len);
+}
+
+void exporter::put_str(const char* str)
+{
+    u16 len = strlen(str);
+    put(&len, sizeof(len));
+    put(str, len);
+}
+
+void exporter::flush()
+{
+    size_t done = 0;
+    while (!_failed && done < _out.size()) {
+        auto r = ::write(_fd, _out.data() + done, _out.size() - done);
+        if (r < 0) {
+            debug("trace export stopped: %s\n", strerror(errno));
+            _failed = true;
+        } else {
+            done += r;
+        }
+    }
+    _bytes += done;
+    _out.clear();
+}
+
+export_stats exporter::stats()
+{
+    return export_stats{ _records.load(), _lost_total.load(), _bytes.load(),
+            std::chrono::duration_cast<std::chrono::nanoseconds>(_thread->thread_clock()) };
+}
+
+int open_target(const std::string& target)
+{
+    int fd;
+    if (target.compare(0, 4, "tcp:") == 0) {
+        auto colon = target.rfind(':');
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(atoi(target.c_str() + colon + 1));
+        if (colon == 3 || !inet_aton(target.substr(4, colon - 4).c_str(), &addr.sin_addr)) {
+            throw std::runtime_error("bad trace export address: " + target);
+        }
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        auto path = target.compare(0, 5, "file:") == 0 ? target.substr(5) : target;
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+    if (fd < 0) {
+        throw std::runtime_error("cannot export trace to " + target + ": " + strerror(errno));
+    }
+    return fd;
+}
+
+lockfree::mutex export_mutex;
+std::unique_ptr<exporter> the_exporter;
+export_stats last_export_stats;
+
+}
+
+void
+start_export(const std::string & target)
+{
+    WITH_LOCK(export_mutex) {
+        if (the_exporter) {
+            throw std::runtime_error("trace export already running");
+        }
+        the_exporter.reset(new exporter(open_target(target)));
+    }
+}
+
+void
+stop_export()
+{
+    WITH_LOCK(export_mutex) {
+        if (the_exporter) {
+            the_exporter->stop();
+            last_export_stats = the_exporter->stats();
+            the_exporter.reset();
+        }
+    }
+}
+
+export_stats
+get_export_stats()
+{
+    WITH_LOCK(export_mutex) {
+        if (the_exporter) {
+            return the_exporter->stats();
+        }
+        return last_export_stats;
+    }
+}
+
+}
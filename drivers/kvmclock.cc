@@ -19,6 +19,27 @@
 #include <mutex>
 #include <atomic>
 
+// When the host says the TSC is stable and synchronized between vcpus
+// (which KVM only does with an invariant host TSC), the system time is
+// read straight from the TSC, scaled with a multiplier and shift
+// precomputed from each cpu's pvclock parameters. This avoids the
+// pvclock's version retry loop and, because every cpu's parameters
+// describe the same line, the migration lock around it. The host bumps the
+// pvclock version when it changes the parameters (e.g., after live
+// migration), and the cpu then recomputes its own.
+struct tsc_params {
+    u32 version;  // of the pvclock they were computed from; odd while updating
+    u32 shift;
+    u64 mult;
+    u64 tsc_base;
+    u64 ns_base;
+};
+
+struct kvmclock_percpu {
+    pvclock_vcpu_time_info sys;
+    tsc_params tsc;
+} __attribute__((aligned(64)));
+
 class kvmclock : public pv_based_clock {
 public:
     kvmclock();
@@ -29,14 +50,17 @@ protected:
     virtual u64 system_time();
     virtual void init_on_cpu();
 private:
+    u64 tsc_system_time(kvmclock_percpu* c) __attribute__((no_instrument_function));
+    u64 update_tsc_params() __attribute__((no_instrument_function));
     static bool _new_kvmclock_msrs;
     pvclock_wall_clock* _wall;
-    static percpu<pvclock_vcpu_time_info> _sys;
+    static percpu<kvmclock_percpu> _percpu;
     pvclock _pvclock;
+    std::atomic<bool> _use_tsc;
 };
 
 bool kvmclock::_new_kvmclock_msrs = true;
-PERCPU(pvclock_vcpu_time_info, kvmclock::_sys);
+PERCPU(kvmclock_percpu, kvmclock::_percpu);
 
 static u8 get_pvclock_flags()
 {
@@ -49,6 +73,7 @@ static u8 get_pvclock_flags()
 
 kvmclock::kvmclock()
     : _pvclock(get_pvclock_flags())
+    , _use_tsc(processor::features().kvm_clocksource_stable)
 {
     auto wall_time_msr = (_new_kvmclock_msrs) ?
                          msr::KVM_WALL_CLOCK_NEW : msr::KVM_WALL_CLOCK;
@@ -61,8 +86,9 @@ void kvmclock::init_on_cpu()
 {
     auto system_time_msr = (_new_kvmclock_msrs) ?
                            msr::KVM_SYSTEM_TIME_NEW : msr::KVM_SYSTEM_TIME;
-    memset(&*_sys, 0, sizeof(*_sys));
-    processor::wrmsr(system_time_msr, mmu::virt_to_phys(&*_sys) | 1);
+    memset(&*_percpu, 0, sizeof(*_percpu));
+    _percpu->tsc.version = 1; // not computed yet
+    processor::wrmsr(system_time_msr, mmu::virt_to_phys(&_percpu->sys) | 1);
 }
 
 bool kvmclock::probe()
@@ -82,17 +108,84 @@ u64 kvmclock::wall_clock_boot()
     return _pvclock.wall_clock_boot(_wall);
 }
 
+u64 kvmclock::tsc_system_time(kvmclock_percpu* c)
+{
+    auto& p = c->tsc;
+    u32 v = p.version;
+    // The host has changed the parameters since we last computed ours
+    if (v != c->sys.version) {
+        return 0;
+    }
+    barrier();
+    processor::lfence();
+    u64 delta = processor::rdtsc() - p.tsc_base;
+    u64 t = p.ns_base + u64((unsigned __int128)delta * p.mult >> p.shift);
+    barrier();
+    // If we migrated, another cpu may have started updating them
+    if (p.version != v) {
+        return 0;
+    }
+    return t;
+}
+
+// Recomputes this cpu's TSC parameters, and returns the current time
+// according to them.
+u64 kvmclock::update_tsc_params()
+{
+    WITH_LOCK(migration_lock) {
+        auto c = &*_percpu;
+        auto& sys = c->sys;
+        auto& p = c->tsc;
+        u32 v;
+        do {
+            v = sys.version;
+            barrier();
+            if (!v) {
+                // The host hasn't filled it in yet
+                return _pvclock.system_time(&sys);
+            }
+            if (!(sys.flags & pvclock::TSC_STABLE_BIT)) {
+                // Not synchronized after all; stay with the pvclock
+                _use_tsc.store(false, std::memory_order_relaxed);
+                return _pvclock.system_time(&sys);
+            }
+            p.version = 1;
+            barrier();
+            // ns = ((tsc << tsc_shift) * mul) >> 32, as one multiplication
+            p.mult = sys.tsc_to_system_mul;
+            p.shift = 32 - sys.tsc_shift;
+            p.tsc_base = sys.tsc_timestamp;
+            p.ns_base = sys.system_time;
+            barrier();
+        } while ((v & 1) || v != sys.version);
+        p.version = v;
+        return tsc_system_time(c);
+    }
+}
+
 u64 kvmclock::system_time()
 {
+    if (_use_tsc.load(std::memory_order_relaxed)) {
+        // Reading another cpu's parameters, if we migrate after taking the
+        // address, is fine; they describe the same clock.
+        auto t = tsc_system_time(&*_percpu);
+        if (t) {
+            return t;
+        }
+        t = update_tsc_params();
+        if (t) {
+            return t;
+        }
+    }
     WITH_LOCK(migration_lock) {
-        auto sys = &*_sys;  // avoid recalculating address each access
+        auto sys = &_percpu->sys;  // avoid recalculating address each access
         return _pvclock.system_time(sys);
     }
 }
 
 u64 kvmclock::processor_to_nano(u64 ticks)
 {
-    return pvclock::processor_to_nano(&*_sys, ticks);
+    return pvclock::processor_to_nano(&_percpu->sys, ticks);
 }
 
 static __attribute__((constructor(init_prio::clock))) void setup_kvmclock()
@@ -41,6 +41,7 @@
 
 TRACEPOINT(trace_virtio_net_rx_packet, "if=%d, len=%d", int, int);
 TRACEPOINT(trace_virtio_net_rx_wake, "");
+TRACEPOINT(trace_virtio_net_rx_busy_poll, "");
 TRACEPOINT(trace_virtio_net_fill_rx_ring, "if=%d", int);
 TRACEPOINT(trace_virtio_net_fill_rx_ring_added, "if=%d, added=%d", int, int);
 TRACEPOINT(trace_virtio_net_tx_packet, "if=%d, len=%d", int, int);
@@ -87,6 +88,16 @@ static int if_ioctl(struct ifnet* ifp, u_long command, caddr_t data)
     case SIOCDELMULTI:
         net_d("SIOCDELMULTI");
         break;
+    case SIOCSIFCAP: {
+        net_d("SIOCSIFCAP");
+        /* Only TSO can be turned off, and on again if the host has it */
+        auto ifr = reinterpret_cast<struct bsd_ifreq*>(data);
+        int mask = (ifp->if_capenable ^ ifr->ifr_reqcap) & ifp->if_capabilities;
+        if (mask & IFCAP_TSO4) {
+            ifp->if_capenable ^= IFCAP_TSO4;
+        }
+        break;
+    }
     default:
         net_d("redirecting to ether_ioctl()...");
         error = ether_ioctl(ifp, command, data);
@@ -164,6 +175,13 @@ static void if_init(void* xsc)
     net_d("Virtio-net init");
 }
 
+static void if_rxpoll(struct ifnet* ifp)
+{
+    net* vnet = (net*)ifp->if_softc;
+
+    vnet->rx_busy_poll();
+}
+
 /**
  * Return all the statistics we have gathered.
  * @param ifp
@@ -253,26 +271,34 @@ net::net(pci::device& dev)
     _ifn->if_qflush = if_qflush;
     _ifn->if_init = if_init;
     _ifn->if_getinfo = if_getinfo;
+    _ifn->if_rxpoll = if_rxpoll;
     IFQ_SET_MAXLEN(&_ifn->if_snd, _txq.vqueue->size());
 
     _ifn->if_capabilities = 0;
 
     if (_csum) {
         _ifn->if_capabilities |= IFCAP_TXCSUM;
+        _ifn->if_hwassist = CSUM_TCP | CSUM_UDP;
         if (_host_tso4) {
             _ifn->if_capabilities |= IFCAP_TSO4;
-            _ifn->if_hwassist = CSUM_TCP | CSUM_UDP | CSUM_TSO;
+            _ifn->if_hwassist |= CSUM_TSO;
         }
     }
 
+    //
+    // LRO is done in software, and only merges segments whose checksum is
+    // known to be good, so it needs Rx checksum offload. With guest TSO the
+    // host may also hand us segments of up to 64K directly.
+    //
     if (_guest_csum) {
-        _ifn->if_capabilities |= IFCAP_RXCSUM;
-        if (_guest_tso4)
-            _ifn->if_capabilities |= IFCAP_LRO;
+        _ifn->if_capabilities |= IFCAP_RXCSUM | IFCAP_LRO;
     }
 
     _ifn->if_capenable = _ifn->if_capabilities | IFCAP_HWSTATS;
 
+    tcp_lro_init(&_rxq.lro);
+    _rxq.lro.ifp = _ifn;
+
     //Start the polling thread before attaching it to the Rx interrupt
     poll_task->start();
 
@@ -309,6 +335,7 @@ net::~net()
 
     ether_ifdetach(_ifn);
     if_free(_ifn);
+    tcp_lro_free(&_rxq.lro);
 }
 
 void net::read_config()
@@ -404,7 +431,6 @@ bool net::bad_rx_csum(struct mbuf* m, struct net_hdr* hdr)
 void net::receiver()
 {
     vring* vq = _rxq.vqueue;
-    std::vector<iovec> packet;
 
     while (1) {
 
@@ -412,91 +438,149 @@ void net::receiver()
         virtio_driver::wait_for_queue(vq, &vring::used_ring_not_empty);
         trace_virtio_net_rx_wake();
 
-        u32 len;
-        int nbufs;
-        u64 rx_drops = 0, rx_packets = 0, csum_ok = 0;
-        u64 csum_err = 0, rx_bytes = 0;
+        WITH_LOCK(_rxq.lock) {
+            rx_poll_locked();
+        }
+    }
+}
+
+void net::rx_busy_poll()
+{
+    // If the lock is taken, someone is already emptying the ring for us
+    if (_rxq.vqueue->used_ring_not_empty() && _rxq.lock.try_lock()) {
+        trace_virtio_net_rx_busy_poll();
+        rx_poll_locked();
+        _rxq.lock.unlock();
+    }
+}
+
+void net::rx_poll_locked()
+{
+    vring* vq = _rxq.vqueue;
+    auto& packet = _rxq.packet;
 
-        // use local header that we copy out of the mbuf since we're
-        // truncating it.
-        net_hdr_mrg_rxbuf* mhdr;
+    u32 len;
+    int nbufs;
+    u64 rx_drops = 0, rx_packets = 0, csum_ok = 0;
+    u64 csum_err = 0, rx_bytes = 0;
 
-        while (void* page = vq->get_buf_elem(&len)) {
+    // use local header that we copy out of the mbuf since we're
+    // truncating it.
+    net_hdr_mrg_rxbuf* mhdr;
 
-            // TODO: should get out of the loop
-            vq->get_buf_finalize();
+    while (void* page = vq->get_buf_elem(&len)) {
 
-            // Bad packet/buffer - discard and continue to the next one
-            if (len < _hdr_size + ETHER_HDR_LEN) {
-                rx_drops++;
-                memory::free_page(page);
+        // TODO: should get out of the loop
+        vq->get_buf_finalize();
 
-                continue;
-            }
+        // Bad packet/buffer - discard and continue to the next one
+        if (len < _hdr_size + ETHER_HDR_LEN) {
+            rx_drops++;
+            memory::free_page(page);
 
-            mhdr = static_cast<net_hdr_mrg_rxbuf*>(page);
+            continue;
+        }
 
-            if (!_mergeable_bufs) {
-                nbufs = 1;
-            } else {
-                nbufs = mhdr->num_buffers;
-            }
+        mhdr = static_cast<net_hdr_mrg_rxbuf*>(page);
+
+        if (!_mergeable_bufs) {
+            nbufs = 1;
+        } else {
+            nbufs = mhdr->num_buffers;
+        }
 
-            packet.push_back({page + _hdr_size, len - _hdr_size});
-
-            // Read the fragments
-            while (--nbufs > 0) {
-                page = vq->get_buf_elem(&len);
-                if (!page) {
-                    rx_drops++;
-                    for (auto&& v : packet) {
-                        free_buffer(v);
-                    }
-                    break;
+        packet.push_back({page + _hdr_size, len - _hdr_size});
+
+        // Read the fragments
+        while (--nbufs > 0) {
+            page = vq->get_buf_elem(&len);
+            if (!page) {
+                rx_drops++;
+                for (auto&& v : packet) {
+                    free_buffer(v);
                 }
-                packet.push_back({page, len});
-                vq->get_buf_finalize();
+                break;
             }
+            packet.push_back({page, len});
+            vq->get_buf_finalize();
+        }
 
-            auto m_head = packet_to_mbuf(packet);
-            packet.clear();
+        auto m_head = packet_to_mbuf(packet);
+        packet.clear();
 
-            if ((_ifn->if_capenable & IFCAP_RXCSUM) &&
-                (mhdr->hdr.flags &
-                 net_hdr::VIRTIO_NET_HDR_F_NEEDS_CSUM)) {
+        if (_ifn->if_capenable & IFCAP_RXCSUM) {
+            if (mhdr->hdr.flags &
+                net_hdr::VIRTIO_NET_HDR_F_NEEDS_CSUM) {
                 if (bad_rx_csum(m_head, &mhdr->hdr))
                     csum_err++;
                 else
                     csum_ok++;
-
+            } else if (mhdr->hdr.flags &
+                       net_hdr::VIRTIO_NET_HDR_F_DATA_VALID) {
+                m_head->M_dat.MH.MH_pkthdr.csum_flags |=
+                    CSUM_DATA_VALID | CSUM_PSEUDO_HDR;
+                m_head->M_dat.MH.MH_pkthdr.csum_data = 0xFFFF;
+                csum_ok++;
             }
+        }
 
-            rx_packets++;
-            rx_bytes += m_head->M_dat.MH.MH_pkthdr.len;
+        rx_packets++;
+        rx_bytes += m_head->M_dat.MH.MH_pkthdr.len;
 
-            bool fast_path = _ifn->if_classifier.post_packet(m_head);
-            if (!fast_path) {
-                (*_ifn->if_input)(_ifn, m_head);
-            }
+        rx_input(m_head);
 
-            trace_virtio_net_rx_packet(_ifn->if_index, rx_bytes);
+        trace_virtio_net_rx_packet(_ifn->if_index, rx_bytes);
 
-            // The interface may have been stopped while we were
-            // passing the packet up the network stack.
-            if ((_ifn->if_drv_flags & IFF_DRV_RUNNING) == 0)
-                break;
-        }
+        // The interface may have been stopped while we were
+        // passing the packet up the network stack.
+        if ((_ifn->if_drv_flags & IFF_DRV_RUNNING) == 0)
+            break;
+    }
+
+    // Don't hold back the segments of this batch any longer
+    tcp_lro_flush_all(&_rxq.lro);
 
-        if (vq->refill_ring_cond())
-            fill_rx_ring();
+    if (vq->refill_ring_cond())
+        fill_rx_ring();
+
+    // Update the stats
+    _rxq.stats.rx_drops      += rx_drops;
+    _rxq.stats.rx_packets    += rx_packets;
+    _rxq.stats.rx_csum       += csum_ok;
+    _rxq.stats.rx_csum_err   += csum_err;
+    _rxq.stats.rx_bytes      += rx_bytes;
+}
 
-        // Update the stats
-        _rxq.stats.rx_drops      += rx_drops;
-        _rxq.stats.rx_packets    += rx_packets;
-        _rxq.stats.rx_csum       += csum_ok;
-        _rxq.stats.rx_csum_err   += csum_err;
-        _rxq.stats.rx_bytes      += rx_bytes;
+void net::rx_input(mbuf* m)
+{
+    if (_ifn->if_classifier.post_packet(m)) {
+        return;
     }
+
+    //
+    // Only segments with a verified checksum may be merged, as the merged
+    // segment is passed up as verified.
+    //
+    if ((_ifn->if_capenable & IFCAP_LRO) && _rxq.lro.lro_cnt != 0) {
+        int error = TCP_LRO_CANNOT;
+        if (m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_DATA_VALID) {
+            error = tcp_lro_rx(&_rxq.lro, m, 0);
+            if (error == 0) {
+                return;
+            }
+        }
+        //
+        // A segment LRO can't take (e.g. a FIN, an out of order one, or one
+        // whose checksum wasn't verified) may belong to a flow that has
+        // segments held back: push them up first so that the stack still
+        // sees each flow in order.
+        //
+        if (error == TCP_LRO_CANNOT) {
+            tcp_lro_flush_all(&_rxq.lro);
+        }
+    }
+
+    (*_ifn->if_input)(_ifn, m);
 }
 
 mbuf* net::packet_to_mbuf(const std::vector<iovec>& packet)
@@ -597,6 +681,27 @@ inline int net::txq::xmit_prep(mbuf* m_head, void*& cooky)
         }
     }
 
+    //
+    // Each fragment takes a descriptor: copy a chain of many small ones
+    // into fewer, bigger mbufs. If there is no memory for that, send it
+    // as it is.
+    //
+    int frags = 0;
+    for (m = m_head; m != nullptr; m = m->m_hdr.mh_next) {
+        frags += m->m_hdr.mh_len != 0;
+    }
+    if (frags > max_tx_frags) {
+        m = m_collapse(m_head, M_NOWAIT, max_tx_frags);
+        if (m == nullptr) {
+            m = m_defrag(m_head, M_NOWAIT);
+        }
+        if (m != nullptr) {
+            m_head = m;
+            stats.tx_collapsed++;
+        }
+    }
+    req->mb = m_head;
+
     cooky = req;
     return 0;
 }
@@ -615,13 +720,21 @@ int net::txq::try_xmit_one_locked(net_req* req)
     vqueue->add_out_sg(static_cast<void*>(&req->mhdr),
                        sizeof(net_hdr_mrg_rxbuf));
 
+    //
+    // The header has a descriptor of its own. The fragments that follow
+    // each other in physical memory share one.
+    //
     for (m = m_head; m != NULL; m = m->m_hdr.mh_next) {
         int frag_len = m->m_hdr.mh_len;
 
         if (frag_len != 0) {
             net_d("Frag len=%d:", frag_len);
+            if (tx_bytes) {
+                vqueue->append_out_sg(m->m_hdr.mh_data, frag_len);
+            } else {
+                vqueue->add_out_sg(m->m_hdr.mh_data, frag_len);
+            }
             tx_bytes += frag_len;
-            vqueue->add_out_sg(m->m_hdr.mh_data, m->m_hdr.mh_len);
         }
     }
 
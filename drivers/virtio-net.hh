@@ -14,6 +14,9 @@
 #include <bsd/sys/net/if_var.h>
 #include <bsd/sys/net/if.h>
 #include <bsd/sys/sys/mbuf.h>
+#include <bsd/sys/netinet/in.h>
+#include <bsd/sys/netinet/tcp.h>
+#include <bsd/sys/netinet/tcp_lro.h>
 
 #include <osv/percpu_xmit.hh>
 
@@ -217,6 +220,12 @@ public:
     void wait_for_queue(vring* queue);
     bool bad_rx_csum(struct mbuf* m, struct net_hdr* hdr);
     void receiver();
+    /**
+     * Process the packets waiting in the Rx ring, if no one else already
+     * does: used by sockets busy polling the interface.
+     */
+    void rx_busy_poll();
+    void rx_input(mbuf* m);
     void fill_rx_ring();
     mbuf* packet_to_mbuf(const std::vector<iovec>& iovec);
     static void free_buffer_and_refcnt(void* buffer, void* refcnt);
@@ -245,6 +254,8 @@ public:
      */
     int xmit(mbuf* buff);
 private:
+    // Process the used Rx ring; called with _rxq.lock held
+    void rx_poll_locked();
 
     struct net_req {
         explicit net_req(mbuf *m) : mb(m) {
@@ -287,6 +298,7 @@ private:
         u64 tx_drops;   /* Number of dropped packets */
         u64 tx_csum;    /* CSUM offload requests */
         u64 tx_tso;     /* GSO/TSO packets */
+        u64 tx_collapsed; /* Chains copied into fewer mbufs */
         /* u64 tx_rescheduled; */ /* TODO when we implement xoff */
     };
 
@@ -297,6 +309,11 @@ private:
         vring* vqueue;
         sched::thread  poll_task;
         struct rxq_stats stats = { 0 };
+        // Aggregates the TCP segments of each poll batch (software LRO)
+        struct lro_ctrl lro;
+        // Serializes poll_task and busy polling threads on the ring
+        mutex lock;
+        std::vector<iovec> packet;
     };
 
     struct txq;
@@ -405,6 +422,12 @@ private:
         txq_stats stats = { 0 };
 
     private:
+        /**
+         * The most fragments xmit_prep() lets a packet have, to leave room
+         * on the ring for others. A 64K TSO segment of 2K clusters fits.
+         */
+        static constexpr int max_tx_frags = 64;
+
         /**
          * This is a private version of try_xmit_one_locked() that acually does
          * the work.
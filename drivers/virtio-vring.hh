@@ -205,6 +205,23 @@ class virtio_driver;
             add_sg(vaddr, len, vring_desc::VRING_DESC_F_READ);
         }
 
+        // As add_out_sg(), but extends the last element instead of adding
+        // one when the buffer follows it in physical memory
+        void append_out_sg(void* vaddr, u32 len)
+        {
+            mmu::virt_to_phys(vaddr, len, [this] (mmu::phys paddr, size_t len) {
+                if (!_sg_vec.empty()) {
+                    auto& last = _sg_vec.back();
+                    if (last._flags == vring_desc::VRING_DESC_F_READ &&
+                        last._paddr + last._len == paddr) {
+                        last._len += len;
+                        return;
+                    }
+                }
+                _sg_vec.emplace_back(paddr, len, vring_desc::VRING_DESC_F_READ);
+            });
+        }
+
         void add_in_sg(void* vaddr, u32 len)
         {
             add_sg(vaddr, len, vring_desc::VRING_DESC_F_WRITE);
@@ -224,7 +224,9 @@ void vmxnet3_rxqueue::init()
         rxr.clear_descs();
 
         for (unsigned idx = 0; idx < rxr.get_desc_num(); idx++) {
-            newbuf(i);
+            if (!newbuf(i)) {
+                panic("mbuf allocation failed");
+            }
         }
     }
 
@@ -242,7 +244,9 @@ void vmxnet3_rxqueue::discard(int rid, int idx)
     rxr.increment_fill();
 }
 
-void vmxnet3_rxqueue::newbuf(int rid)
+// Posts a new cluster at the ring's fill index. Fails when the cluster
+// zone is at its limit: the caller then reposts the old one with discard().
+bool vmxnet3_rxqueue::newbuf(int rid)
 {
     auto &rxr = cmd_rings[rid];
     auto idx = rxr.fill;
@@ -260,8 +264,7 @@ void vmxnet3_rxqueue::newbuf(int rid)
     }
     auto m = m_getjcl(M_NOWAIT, MT_DATA, flags, clsize);
     if (m == NULL) {
-        panic("mbuf allocation failed");
-        return;
+        return false;
     }
     if (btype == vmxnet3::VMXNET3_BTYPE_HEAD) {
         m->m_hdr.mh_len = m->M_dat.MH.MH_pkthdr.len = clsize;
@@ -278,6 +281,7 @@ void vmxnet3_rxqueue::newbuf(int rid)
     rxd->layout->gen = rxr.gen;
 
     rxr.increment_fill();
+    return true;
 }
 
 
@@ -340,6 +344,13 @@ vmxnet3::vmxnet3(pci::device &dev)
     _ifn->if_hwassist = CSUM_TCP | CSUM_UDP | CSUM_TSO;
     _ifn->if_capenable = _ifn->if_capabilities | IFCAP_HWSTATS;
 
+    // The device merges segments itself when the host lets it; whatever it
+    // didn't merge is aggregated in software.
+    for (auto &q : _rxq) {
+        tcp_lro_init(&q.lro);
+        q.lro.ifp = _ifn;
+    }
+
     get_mac_address(macaddr);
     ether_ifattach(_ifn, macaddr);
     _receive_task.start();
@@ -533,6 +544,7 @@ void vmxnet3::receive_work()
         do {
             rxq_eof(_rxq[0]);
         } while(rxq_avail(_rxq[0]));
+        tcp_lro_flush_all(&_rxq[0].lro);
     }
 }
 
@@ -750,7 +762,11 @@ void vmxnet3::rxq_eof(vmxnet3_rxqueue &rxq)
                 goto next;
             }
 
-            rxq.newbuf(rid);
+            if (!rxq.newbuf(rid)) {
+                _rxq_stats.rx_drops++;
+                rxq.discard(rid, idx);
+                goto next;
+            }
 
             m->M_dat.MH.MH_pkthdr.len = length;
             m->M_dat.MH.MH_pkthdr.rcvif = _ifn;
@@ -759,9 +775,20 @@ void vmxnet3::rxq_eof(vmxnet3_rxqueue &rxq)
             rxq.m_currpkt_head = rxq.m_currpkt_tail = m;
         } else {
             assert(rxd->layout->btype == VMXNET3_BTYPE_BODY);
-            assert(rxq.m_currpkt_head != nullptr);
 
-            rxq.newbuf(rid);
+            // The rest of a frame we started dropping
+            if (rxq.m_currpkt_head == nullptr) {
+                rxq.discard(rid, idx);
+                goto next;
+            }
+
+            if (!rxq.newbuf(rid)) {
+                _rxq_stats.rx_drops++;
+                rxq.discard(rid, idx);
+                m_freem(rxq.m_currpkt_head);
+                rxq.m_currpkt_head = rxq.m_currpkt_tail = nullptr;
+                goto next;
+            }
 
             m->m_hdr.mh_len = length;
             rxq.m_currpkt_head->M_dat.MH.MH_pkthdr.len += length;
@@ -824,9 +851,25 @@ void vmxnet3::rxq_input(vmxnet3_rxqueue &rxq, vmxnet3_rx_compdesc *rxcd,
     _rxq_stats.rx_packets++;
     _rxq_stats.rx_bytes += m->M_dat.MH.MH_pkthdr.len;
     bool fast_path = _ifn->if_classifier.post_packet(m);
-    if (!fast_path) {
-        (*_ifn->if_input)(_ifn, m);
+    if (fast_path) {
+        return;
+    }
+    // Only segments with a verified checksum may be merged
+    if ((_ifn->if_capenable & IFCAP_LRO) && rxq.lro.lro_cnt != 0) {
+        int error = TCP_LRO_CANNOT;
+        if (m->M_dat.MH.MH_pkthdr.csum_flags & CSUM_DATA_VALID) {
+            error = tcp_lro_rx(&rxq.lro, m, 0);
+            if (error == 0) {
+                return;
+            }
+        }
+        // Keep each flow in order: push up what LRO holds before a
+        // segment it couldn't take, or one with an unverified checksum.
+        if (error == TCP_LRO_CANNOT) {
+            tcp_lro_flush_all(&rxq.lro);
+        }
     }
+    (*_ifn->if_input)(_ifn, m);
 }
 
 void vmxnet3::get_mac_address(u_int8_t *macaddr)
@@ -12,6 +12,9 @@
 #include <bsd/sys/net/if_var.h>
 #include <bsd/sys/net/if.h>
 #include <bsd/sys/sys/mbuf.h>
+#include <bsd/sys/netinet/in.h>
+#include <bsd/sys/netinet/tcp.h>
+#include <bsd/sys/netinet/tcp_lro.h>
 
 #include "drivers/driver.hh"
 #include "drivers/vmxnet3-queues.hh"
@@ -67,7 +70,7 @@ public:
     void init();
     void set_intr_idx(unsigned idx) { layout->intr_idx = static_cast<u8>(idx); }
     void discard(int rid, int idx);
-    void newbuf(int rid);
+    bool newbuf(int rid);
 
     typedef vmxnet3_ring<vmxnet3_rx_desc, VMXNET3_MAX_RX_NDESC> cmdRingT;
     typedef vmxnet3_ring<vmxnet3_rx_compdesc, VMXNET3_MAX_RX_NCOMPDESC> compRingT;
@@ -78,6 +81,9 @@ public:
 
     struct mbuf *m_currpkt_head = nullptr;
     struct mbuf *m_currpkt_tail = nullptr;
+
+    // Aggregates the TCP segments of each receive batch (software LRO)
+    struct lro_ctrl lro;
 };
 
 class vmxnet3 : public hw_driver {
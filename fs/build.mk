@@ -25,3 +25,6 @@ fs +=	devfs/devfs_vnops.o \
 	devfs/device.o
 
 fs +=	procfs/procfs_vnops.o
+
+fs +=	rofs/rofs_vfsops.o \
+	rofs/rofs_vnops.o
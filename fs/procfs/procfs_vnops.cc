@@ -20,6 +20,7 @@
 #include <libgen.h>
 #include <osv/mempool.hh>
 #include <osv/printf.hh>
+#include <osv/sampler.hh>
 
 #include <sys/resource.h>
 
@@ -338,6 +339,9 @@ procfs_mount(mount* mp, char *dev, int flags, void* data)
     auto* root = new proc_dir_node(vp->v_ino);
     root->add("self", self);
     root->add("0", self); // our standard pid
+#ifndef AARCH64_PORT_STUB
+    root->add("profile", inode_count++, prof::get_folded_stacks);
+#endif /* !AARCH64_PORT_STUB */
 
     vp->v_data = static_cast<void*>(root);
 
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef ROFS_HH_
+#define ROFS_HH_
+
+// rofs is a read-only file system whose image is generated at build time by
+// scripts/mkrofs.py. The on-disk layout is:
+//
+//   page 0           super block
+//   (8-byte aligned) inode table, directory entries, block table, names
+//   (page aligned)   file data
+//
+// File data is split in rofs_block_size blocks. Each block is stored either
+// verbatim, at a page aligned offset, or LZ4 compressed (in the framing used
+// by ZFS: a big-endian 32-bit length followed by the LZ4 block) and packed.
+// The whole index is loaded at mount time; data blocks are read, and
+// decompressed if needed, on first access and then kept in pages owned by the
+// mount, which are mapped directly into the address space on mmap(). Pages
+// neither read nor mapped are given back when memory runs low.
+//
+// All on-disk integers are little endian.
+
+#include <osv/vnode.h>
+#include <osv/mount.h>
+#include <osv/device.h>
+#include <osv/mutex.h>
+
+#include <cstdint>
+#include <vector>
+#include <boost/intrusive/list.hpp>
+
+#define ROFS_MAGIC              "OSVROFS1"
+#define ROFS_VERSION            1
+
+#define ROFS_BLOCK_COMPRESSED   0x1
+
+constexpr uint32_t rofs_block_size = 4096;
+
+struct rofs_super_block {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t inode_count;
+    uint64_t inodes_offset;
+    uint64_t dirent_count;
+    uint64_t dirents_offset;
+    uint64_t block_count;
+    uint64_t blocks_offset;
+    uint64_t names_size;
+    uint64_t names_offset;
+} __attribute__((packed));
+
+// Inode number is the index in the inode table, the root directory is 0.
+// For directories data_index/data_count select a range of the directory
+// entry table, for regular files a range of the block table.
+struct rofs_inode {
+    uint64_t mode;
+    uint64_t size;
+    uint64_t data_index;
+    uint64_t data_count;
+} __attribute__((packed));
+
+struct rofs_dirent {
+    uint64_t ino;
+    uint32_t name_offset;
+    uint32_t name_len;
+} __attribute__((packed));
+
+struct rofs_block {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t flags;
+} __attribute__((packed));
+
+struct rofs_info;
+
+// A data block brought in. While referenced, by a reader or by the page cache
+// for as long as it is mapped, the page stays; once not, it goes on an LRU
+// list the shrinker frees from. A page still mapped when its file system is
+// unmounted is freed with its last mapping, and has no info by then.
+struct rofs_page {
+    rofs_page(void* addr, rofs_info* info, uint64_t index)
+        : addr(addr), info(info), index(index) {}
+    void* addr;
+    rofs_info* info;
+    uint64_t index;
+    unsigned refs = 1;
+    boost::intrusive::list_member_hook<> lru_link;
+};
+
+struct rofs_info {
+    struct device* dev;
+    struct rofs_super_block sb;
+    std::vector<rofs_inode> inodes;
+    std::vector<rofs_dirent> dirents;
+    std::vector<rofs_block> blocks;
+    std::vector<char> names;
+    // Data blocks already brought in, indexed by block table index.
+    // Protected by rofs_lock, see rofs_vnops.cc.
+    std::vector<rofs_page*> pages;
+    // statistics
+    uint64_t blocks_read = 0;
+    uint64_t blocks_decompressed = 0;
+};
+
+static inline rofs_info* rofs_info_of(struct mount* mp)
+{
+    return static_cast<rofs_info*>(mp->m_data);
+}
+
+int rofs_read_data(struct device* dev, uint64_t offset, size_t size, void* buf);
+void rofs_init_blocks(rofs_info* info);
+int rofs_get_block(rofs_info* info, uint64_t index, rofs_page** page);
+void rofs_put_block(rofs_page* page);
+void rofs_release_blocks(rofs_info* info);
+
+#endif /* ROFS_HH_ */
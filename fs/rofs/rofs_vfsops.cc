@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/statvfs.h>
+#include <errno.h>
+#include <string.h>
+
+#include <osv/debug.h>
+#include <osv/uio.h>
+#include <osv/mmu.hh>
+#include <osv/mempool.hh>
+#include <osv/pagealloc.hh>
+#include <osv/align.hh>
+#include <osv/trace.hh>
+
+#include "rofs.hh"
+
+extern struct vnops rofs_vnops;
+
+TRACEPOINT(trace_rofs_mount, "dev=%s inodes=%d blocks=%d", const char*, unsigned long, unsigned long);
+
+// Reads an arbitrary byte range of the image. The device only accepts
+// page aligned I/O, so read the enclosing pages into a bounce buffer
+// unless the caller's range is already aligned.
+int rofs_read_data(struct device* dev, uint64_t offset, size_t size, void* buf)
+{
+    uint64_t start = align_down(offset, uint64_t(mmu::page_size));
+    uint64_t end = align_up(offset + size, uint64_t(mmu::page_size));
+    bool aligned = start == offset && end == offset + size;
+    void* bounce = aligned ? buf : memory::alloc_phys_contiguous_aligned(end - start, mmu::page_size);
+
+    iovec iov { bounce, size_t(end - start) };
+    uio data { &iov, 1, off_t(start), ssize_t(end - start), UIO_READ };
+    int error = device_read(dev, &data, 0);
+    if (!error && data.uio_resid) {
+        error = EIO;
+    }
+    if (!aligned) {
+        if (!error) {
+            memcpy(buf, static_cast<char*>(bounce) + (offset - start), size);
+        }
+        memory::free_phys_contiguous_aligned(bounce);
+    }
+    return error;
+}
+
+template <typename T>
+static int rofs_read_table(rofs_info* info, uint64_t offset, uint64_t count,
+                           std::vector<T>& table)
+{
+    table.resize(count);
+    if (!count) {
+        return 0;
+    }
+    return rofs_read_data(info->dev, offset, count * sizeof(T), table.data());
+}
+
+static int rofs_mount(struct mount* mp, char* dev, int flags, void* data)
+{
+    if (!mp->m_dev) {
+        return ENODEV;
+    }
+
+    std::unique_ptr<rofs_info> info(new rofs_info);
+    info->dev = mp->m_dev;
+
+    int error = rofs_read_data(info->dev, 0, sizeof(info->sb), &info->sb);
+    if (error) {
+        return error;
+    }
+    auto& sb = info->sb;
+    if (memcmp(sb.magic, ROFS_MAGIC, sizeof(sb.magic)) ||
+        sb.version != ROFS_VERSION ||
+        sb.block_size != rofs_block_size ||
+        sb.inode_count == 0) {
+        debugf("rofs: %s does not contain a valid image\n", dev);
+        return EINVAL;
+    }
+
+    if ((error = rofs_read_table(info.get(), sb.inodes_offset, sb.inode_count, info->inodes)) ||
+        (error = rofs_read_table(info.get(), sb.dirents_offset, sb.dirent_count, info->dirents)) ||
+        (error = rofs_read_table(info.get(), sb.blocks_offset, sb.block_count, info->blocks)) ||
+        (error = rofs_read_table(info.get(), sb.names_offset, sb.names_size, info->names))) {
+        return error;
+    }
+    rofs_init_blocks(info.get());
+    trace_rofs_mount(dev, sb.inode_count, sb.block_count);
+
+    auto* vp = mp->m_root->d_vnode;
+    auto& root = info->inodes[0];
+    vp->v_mode = root.mode & ~S_IFMT;
+    vp->v_size = root.size;
+
+    // The image can't be modified, whatever the caller asked for.
+    mp->m_flags |= MNT_RDONLY;
+    mp->m_data = info.release();
+    return 0;
+}
+
+static int rofs_unmount(struct mount* mp, int flags)
+{
+    auto* info = rofs_info_of(mp);
+
+    release_mp_dentries(mp);
+    rofs_release_blocks(info);
+    delete info;
+    mp->m_data = nullptr;
+    return 0;
+}
+
+static int rofs_statfs(struct mount* mp, struct statfs* statp)
+{
+    auto* info = rofs_info_of(mp);
+
+    statp->f_bsize = rofs_block_size;
+    statp->f_frsize = rofs_block_size;
+    statp->f_blocks = info->sb.block_count;
+    statp->f_bfree = 0;
+    statp->f_bavail = 0;
+    statp->f_files = info->sb.inode_count;
+    statp->f_ffree = 0;
+    statp->f_namelen = NAME_MAX;
+    statp->f_flags = ST_RDONLY;
+    return 0;
+}
+
+extern "C" int rofs_init(void)
+{
+    return 0;
+}
+
+vfsops rofs_vfsops = {
+    rofs_mount,                  // vfs_mount
+    rofs_unmount,                // vfs_unmount
+    (vfsop_sync_t) vfs_nullop,   // vfs_sync
+    (vfsop_vget_t) vfs_nullop,   // vfs_vget
+    rofs_statfs,                 // vfs_statfs
+    &rofs_vnops,                 // vfs_vnops
+};
@@ -0,0 +1,412 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+
+#include <osv/prex.h>
+#include <osv/vnode.h>
+#include <osv/file.h>
+#include <osv/mount.h>
+#include <osv/uio.h>
+#include <osv/mmu.hh>
+#include <osv/pagealloc.hh>
+#include <osv/pagecache.hh>
+#include <osv/mempool.hh>
+#include <osv/trace.hh>
+#include "fs/vfs/vfs.h"
+
+#include "rofs.hh"
+
+extern "C" int lz4_decompress(void* src, void* dst, size_t s_len, size_t d_len, int n);
+
+TRACEPOINT(trace_rofs_read_block, "index=%d compressed=%d", uint64_t, bool);
+TRACEPOINT(trace_rofs_shrink, "freed=%d", size_t);
+
+// The block pages of all mounts are under one lock, and the ones nobody uses
+// on one LRU list, least recently used first.
+static mutex rofs_lock;
+static boost::intrusive::list<rofs_page,
+    boost::intrusive::member_hook<rofs_page, boost::intrusive::list_member_hook<>,
+                                  &rofs_page::lru_link>> rofs_lru;
+
+static void rofs_free_page(rofs_page* p)
+{
+    memory::free_page(p->addr);
+    delete p;
+}
+
+class rofs_shrinker : public memory::shrinker {
+public:
+    rofs_shrinker() : shrinker("rofs") {}
+    size_t request_memory(size_t s, bool hard);
+};
+
+// Frees pages nobody reads or maps; they are read in again on their next use.
+size_t rofs_shrinker::request_memory(size_t s, bool hard)
+{
+    size_t ret = 0;
+    WITH_LOCK(rofs_lock) {
+        while (!rofs_lru.empty() && (hard || ret < s)) {
+            auto& p = rofs_lru.front();
+            rofs_lru.pop_front();
+            p.info->pages[p.index] = nullptr;
+            rofs_free_page(&p);
+            ret += mmu::page_size;
+        }
+    }
+    trace_rofs_shrink(ret);
+    return ret;
+}
+
+void rofs_init_blocks(rofs_info* info)
+{
+    static rofs_shrinker* shrinker = new rofs_shrinker;
+    (void)shrinker;
+
+    info->pages.resize(info->blocks.size());
+}
+
+// Frees the pages of a file system being unmounted, except those still
+// mapped, which go with their last mapping.
+void rofs_release_blocks(rofs_info* info)
+{
+    WITH_LOCK(rofs_lock) {
+        for (auto& p : info->pages) {
+            if (!p) {
+                continue;
+            }
+            if (p->refs) {
+                p->info = nullptr;
+            } else {
+                rofs_lru.erase(rofs_lru.iterator_to(*p));
+                rofs_free_page(p);
+            }
+            p = nullptr;
+        }
+    }
+}
+
+static rofs_inode* rofs_node(struct vnode* vp)
+{
+    return static_cast<rofs_inode*>(vp->v_data);
+}
+
+static rofs_inode* rofs_node(struct vnode* vp, rofs_info* info)
+{
+    if (vp->v_ino == 0) {
+        // the root vnode is created by the vfs before we get to see it
+        return &info->inodes[0];
+    }
+    return rofs_node(vp);
+}
+
+static int rofs_fill_block(rofs_info* info, const rofs_block& b, void* page)
+{
+    if (!(b.flags & ROFS_BLOCK_COMPRESSED)) {
+        // Uncompressed blocks are page aligned in the image, so they are
+        // read straight into the page that will later be mapped.
+        int error = rofs_read_data(info->dev, b.offset, mmu::page_size, page);
+        if (!error && b.length < mmu::page_size) {
+            memset(static_cast<char*>(page) + b.length, 0, mmu::page_size - b.length);
+        }
+        return error;
+    }
+
+    std::unique_ptr<char[]> buf(new char[b.length]);
+    int error = rofs_read_data(info->dev, b.offset, b.length, buf.get());
+    if (error) {
+        return error;
+    }
+    memset(page, 0, mmu::page_size);
+    if (lz4_decompress(buf.get(), page, b.length, rofs_block_size, 0)) {
+        return EIO;
+    }
+    return 0;
+}
+
+static void rofs_ref_block(rofs_page* p)
+{
+    if (p->refs++ == 0) {
+        rofs_lru.erase(rofs_lru.iterator_to(*p));
+    }
+}
+
+// Returns, referenced, the page holding data block @index, reading and
+// decompressing it on first use. The page can be handed out to the page
+// cache and mapped without copying; rofs_put_block() drops the reference.
+int rofs_get_block(rofs_info* info, uint64_t index, rofs_page** page)
+{
+    if (index >= info->blocks.size()) {
+        return EIO;
+    }
+    WITH_LOCK(rofs_lock) {
+        auto p = info->pages[index];
+        if (p) {
+            rofs_ref_block(p);
+            *page = p;
+            return 0;
+        }
+    }
+
+    auto& b = info->blocks[index];
+    trace_rofs_read_block(index, b.flags & ROFS_BLOCK_COMPRESSED);
+
+    void* addr = memory::alloc_page();
+    int error = rofs_fill_block(info, b, addr);
+    if (error) {
+        memory::free_page(addr);
+        return error;
+    }
+    auto p = new rofs_page(addr, info, index);
+
+    // Two readers may have raced to bring in the same block, keep
+    // whichever got there first.
+    WITH_LOCK(rofs_lock) {
+        auto& slot = info->pages[index];
+        if (slot) {
+            rofs_ref_block(slot);
+        } else {
+            slot = p;
+            p = nullptr;
+            info->blocks_read++;
+            if (b.flags & ROFS_BLOCK_COMPRESSED) {
+                info->blocks_decompressed++;
+            }
+        }
+        *page = slot;
+    }
+    if (p) {
+        rofs_free_page(p);
+    }
+    return 0;
+}
+
+void rofs_put_block(rofs_page* p)
+{
+    WITH_LOCK(rofs_lock) {
+        if (--p->refs) {
+            return;
+        }
+        if (p->info) {
+            rofs_lru.push_back(*p);
+            return;
+        }
+    }
+    rofs_free_page(p);
+}
+
+static int rofs_read(struct vnode* vp, struct file* fp, struct uio* uio, int ioflag)
+{
+    auto* info = rofs_info_of(vp->v_mount);
+    auto* np = rofs_node(vp, info);
+
+    if (vp->v_type == VDIR) {
+        return EISDIR;
+    }
+    if (vp->v_type != VREG) {
+        return EINVAL;
+    }
+    if (uio->uio_offset < 0) {
+        return EINVAL;
+    }
+
+    while (uio->uio_resid > 0 && uio->uio_offset < (off_t)np->size) {
+        uint64_t block = uio->uio_offset / rofs_block_size;
+        size_t in_block = uio->uio_offset % rofs_block_size;
+        size_t len = std::min<uint64_t>({rofs_block_size - in_block,
+                                         np->size - uio->uio_offset,
+                                         uint64_t(uio->uio_resid)});
+        rofs_page* page;
+        int error = rofs_get_block(info, np->data_index + block, &page);
+        if (error) {
+            return error;
+        }
+        error = uiomove(static_cast<char*>(page->addr) + in_block, len, uio);
+        rofs_put_block(page);
+        if (error) {
+            return error;
+        }
+    }
+    return 0;
+}
+
+// Called by the page cache on a read fault of an mmap()ed file: hand it the
+// block page itself so that it is mapped (copy-on-write) with no copy. The
+// page cache keeps our reference until the page is no longer mapped.
+static int rofs_cache(struct vnode* vp, struct file* fp, struct uio* uio)
+{
+    auto* info = rofs_info_of(vp->v_mount);
+    auto* np = rofs_node(vp, info);
+
+    if (vp->v_type != VREG) {
+        return EINVAL;
+    }
+    if (uio->uio_offset < 0) {
+        return EINVAL;
+    }
+    if (uio->uio_resid == 0 || uio->uio_offset >= (off_t)np->size) {
+        return 0;
+    }
+
+    assert(uio->uio_offset % rofs_block_size == 0);
+    rofs_page* page;
+    int error = rofs_get_block(info, np->data_index + uio->uio_offset / rofs_block_size, &page);
+    if (error) {
+        return error;
+    }
+    auto* key = static_cast<pagecache::hashkey*>(uio->uio_iov->iov_base);
+    pagecache::map_read_only_page(key, page->addr, [page] { rofs_put_block(page); });
+    uio->uio_resid = 0;
+    return 0;
+}
+
+static int rofs_lookup(struct vnode* dvp, char* name, struct vnode** vpp)
+{
+    auto* info = rofs_info_of(dvp->v_mount);
+    auto* dnp = rofs_node(dvp, info);
+    struct vnode* vp;
+
+    *vpp = nullptr;
+
+    if (*name == '\0') {
+        return ENOENT;
+    }
+    if (!S_ISDIR(dnp->mode)) {
+        return ENOTDIR;
+    }
+
+    size_t len = strlen(name);
+    auto first = info->dirents.begin() + dnp->data_index;
+    auto last = first + dnp->data_count;
+    // mkrofs.py sorts the entries of each directory by name
+    auto it = std::lower_bound(first, last, name, [&] (const rofs_dirent& d, const char* n) {
+        int c = memcmp(&info->names[d.name_offset], n, std::min<size_t>(d.name_len, len));
+        return c < 0 || (c == 0 && d.name_len < len);
+    });
+    if (it == last || it->name_len != len ||
+        memcmp(&info->names[it->name_offset], name, len)) {
+        return ENOENT;
+    }
+    // A corrupt image must not send us past the inode table
+    if (it->ino >= info->inodes.size()) {
+        return EIO;
+    }
+
+    if (vget(dvp->v_mount, it->ino, &vp)) {
+        /* found in cache */
+        *vpp = vp;
+        return 0;
+    }
+    if (!vp) {
+        return ENOMEM;
+    }
+    auto* np = &info->inodes[it->ino];
+    vp->v_data = np;
+    vp->v_mode = np->mode & ~S_IFMT;
+    vp->v_type = S_ISDIR(np->mode) ? VDIR : VREG;
+    vp->v_size = np->size;
+
+    *vpp = vp;
+    return 0;
+}
+
+static int rofs_readdir(struct vnode* vp, struct file* fp, struct dirent* dir)
+{
+    auto* info = rofs_info_of(vp->v_mount);
+    auto* dnp = rofs_node(vp, info);
+
+    if (fp->f_offset == 0) {
+        dir->d_type = DT_DIR;
+        if (vfs_dname_copy((char *)&dir->d_name, ".", sizeof(dir->d_name))) {
+            return EINVAL;
+        }
+    } else if (fp->f_offset == 1) {
+        dir->d_type = DT_DIR;
+        if (vfs_dname_copy((char *)&dir->d_name, "..", sizeof(dir->d_name))) {
+            return EINVAL;
+        }
+    } else {
+        uint64_t i = fp->f_offset - 2;
+        if (i >= dnp->data_count) {
+            return ENOENT;
+        }
+        auto& d = info->dirents[dnp->data_index + i];
+        if (d.name_len >= sizeof(dir->d_name)) {
+            return EINVAL;
+        }
+        if (d.ino >= info->inodes.size()) {
+            return EIO;
+        }
+        dir->d_type = S_ISDIR(info->inodes[d.ino].mode) ? DT_DIR : DT_REG;
+        memcpy(dir->d_name, &info->names[d.name_offset], d.name_len);
+        dir->d_name[d.name_len] = '\0';
+    }
+    dir->d_fileno = fp->f_offset;
+
+    fp->f_offset++;
+
+    return 0;
+}
+
+static int rofs_getattr(struct vnode* vp, struct vattr* attr)
+{
+    auto* info = rofs_info_of(vp->v_mount);
+
+    attr->va_nodeid = vp->v_ino;
+    attr->va_size = vp->v_size;
+    attr->va_nlink = 1;
+    attr->va_fsid = reinterpret_cast<uintptr_t>(info->dev);
+    return 0;
+}
+
+#define rofs_open       ((vnop_open_t)vop_nullop)
+#define rofs_close      ((vnop_close_t)vop_nullop)
+#define rofs_write      ((vnop_write_t)vop_erofs)
+#define rofs_seek       ((vnop_seek_t)vop_nullop)
+#define rofs_ioctl      ((vnop_ioctl_t)vop_einval)
+#define rofs_fsync      ((vnop_fsync_t)vop_nullop)
+#define rofs_create     ((vnop_create_t)vop_erofs)
+#define rofs_remove     ((vnop_remove_t)vop_erofs)
+#define rofs_rename     ((vnop_rename_t)vop_erofs)
+#define rofs_mkdir      ((vnop_mkdir_t)vop_erofs)
+#define rofs_rmdir      ((vnop_rmdir_t)vop_erofs)
+#define rofs_setattr    ((vnop_setattr_t)vop_erofs)
+#define rofs_inactive   ((vnop_inactive_t)vop_nullop)
+#define rofs_truncate   ((vnop_truncate_t)vop_erofs)
+#define rofs_link       ((vnop_link_t)vop_erofs)
+#define rofs_fallocate  ((vnop_fallocate_t)vop_erofs)
+#define rofs_readlink   ((vnop_readlink_t)vop_einval)
+#define rofs_symlink    ((vnop_symlink_t)vop_erofs)
+
+struct vnops rofs_vnops = {
+    rofs_open,          // vop_open
+    rofs_close,         // vop_close
+    rofs_read,          // vop_read
+    rofs_write,         // vop_write
+    rofs_seek,          // vop_seek
+    rofs_ioctl,         // vop_ioctl
+    rofs_fsync,         // vop_fsync
+    rofs_readdir,       // vop_readdir
+    rofs_lookup,        // vop_lookup
+    rofs_create,        // vop_create
+    rofs_remove,        // vop_remove
+    rofs_rename,        // vop_remame
+    rofs_mkdir,         // vop_mkdir
+    rofs_rmdir,         // vop_rmdir
+    rofs_getattr,       // vop_getattr
+    rofs_setattr,       // vop_setattr
+    rofs_inactive,      // vop_inactive
+    rofs_truncate,      // vop_truncate
+    rofs_link,          // vop_link
+    rofs_cache,         // vop_cache
+    rofs_fallocate,     // vop_fallocate
+    rofs_readlink,      // vop_readlink
+    rofs_symlink,       // vop_symlink
+};
@@ -152,6 +152,27 @@ int fget(int fd, struct file **out_fp)
     return 0;
 }
 
+/*
+ * Retrieves the type of the file installed at fd without taking a reference.
+ * The answer is only a hint for picking an implementation: the caller still
+ * has to fget() the fd to use it.
+ */
+int fget_type(int fd, filetype_t *out_type)
+{
+    if (fd < 0 || fd >= FDMAX)
+        return EBADF;
+
+    WITH_LOCK(rcu_read_lock) {
+        struct file *fp = gfdt[fd].read();
+        if (fp == NULL) {
+            return EBADF;
+        }
+        *out_type = fp->f_type;
+    }
+
+    return 0;
+}
+
 file::file(unsigned flags, filetype_t type, void *opaque)
     : f_flags(flags)
     , f_count(1)
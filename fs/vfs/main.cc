@@ -1843,25 +1843,12 @@ int nmount(struct iovec *iov, unsigned niov, int flags)
     return sys_mount(a.from, a.fspath, a.fstype, flags, nullptr);
 }
 
-extern "C" void mount_zfs_rootfs(void)
+// Mounts everything listed in /etc/fstab of the new root, except the
+// root itself which the caller has already taken care of.
+static void mount_fstab(void)
 {
     int ret;
 
-    if (mkdir("/zfs", 0755) < 0)
-        kprintf("failed to create /zfs, error = %s\n", strerror(errno));
-
-    ret = sys_umount("/dev");
-    if (ret)
-        kprintf("failed to unmount /dev, error = %s\n", strerror(ret));
-
-    ret = sys_mount("/dev/vblk0.1", "/zfs", "zfs", 0, (void *)"osv/zfs");
-    if (ret)
-        kprintf("failed to mount /zfs, error = %s\n", strerror(ret));
-
-    ret = sys_pivot_root("/zfs", "/");
-    if (ret)
-        kprintf("failed to pivot root, error = %s\n", strerror(ret));
-
     auto ent = setmntent("/etc/fstab", "r");
     if (!ent) {
         return;
@@ -1886,6 +1873,64 @@ extern "C" void mount_zfs_rootfs(void)
     endmntent(ent);
 }
 
+extern "C" void mount_zfs_rootfs(void)
+{
+    int ret;
+
+    if (mkdir("/zfs", 0755) < 0)
+        kprintf("failed to create /zfs, error = %s\n", strerror(errno));
+
+    ret = sys_umount("/dev");
+    if (ret)
+        kprintf("failed to unmount /dev, error = %s\n", strerror(ret));
+
+    ret = sys_mount("/dev/vblk0.1", "/zfs", "zfs", 0, (void *)"osv/zfs");
+    if (ret)
+        kprintf("failed to mount /zfs, error = %s\n", strerror(ret));
+
+    ret = sys_pivot_root("/zfs", "/");
+    if (ret)
+        kprintf("failed to pivot root, error = %s\n", strerror(ret));
+
+    mount_fstab();
+}
+
+// Mounts the read-only image built by scripts/mkrofs.py as the root, in
+// place of ZFS. Like for ZFS, the remaining mounts come from /etc/fstab;
+// /tmp gets a ramfs since the root itself can't be written to.
+extern "C" int mount_rofs_rootfs(void)
+{
+    int ret;
+
+    if (mkdir("/rofs", 0755) < 0)
+        kprintf("failed to create /rofs, error = %s\n", strerror(errno));
+
+    ret = sys_mount("/dev/vblk0.1", "/rofs", "rofs", MNT_RDONLY, 0);
+    if (ret) {
+        kprintf("failed to mount /rofs, error = %s\n", strerror(ret));
+        rmdir("/rofs");
+        return ret;
+    }
+
+    ret = sys_umount("/dev");
+    if (ret)
+        kprintf("failed to unmount /dev, error = %s\n", strerror(ret));
+
+    ret = sys_pivot_root("/rofs", "/");
+    if (ret) {
+        kprintf("failed to pivot root, error = %s\n", strerror(ret));
+        return ret;
+    }
+
+    mount_fstab();
+
+    ret = sys_mount("", "/tmp", "ramfs", 0, NULL);
+    if (ret)
+        kprintf("failed to mount /tmp, error = %s\n", strerror(ret));
+
+    return 0;
+}
+
 extern "C" void unmount_rootfs(void)
 {
     int ret;
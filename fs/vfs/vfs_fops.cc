@@ -157,6 +157,9 @@ void vfs_file::sync(off_t start, off_t end)
 // eviction that will hold the mmu-side lock that protects the mappings
 // Always follow that order. We however can't just get rid of the mmu-side lock,
 // because not all invalidations will be synchronous.
+//
+// Returns 0 if the page is now in the page cache, -1 if it is a hole, or the
+// error the file system got bringing it in.
 int vfs_file::get_arcbuf(void* key, off_t offset)
 {
     struct vnode *vp = f_dentry->d_vnode;
@@ -172,8 +175,11 @@ int vfs_file::get_arcbuf(void* key, off_t offset)
     data.uio_rw = UIO_READ;
 
     vn_lock(vp);
-    assert(VOP_CACHE(vp, this, &data) == 0);
+    int error = VOP_CACHE(vp, this, &data);
     vn_unlock(vp);
+    if (error) {
+        return error;
+    }
 
     return (data.uio_resid != 0) ? -1 : 0;
 }
@@ -182,6 +188,11 @@ std::unique_ptr<mmu::file_vma> vfs_file::mmap(addr_range range, unsigned flags,
 {
 	auto fp = this;
 	struct vnode *vp = fp->f_dentry->d_vnode;
+	// Stores through a shared mapping would go to the file
+	if ((flags & mmu::mmap_shared) && (perm & mmu::perm_write) &&
+	    (!(fp->f_flags & FWRITE) || (vp->v_mount->m_flags & MNT_RDONLY))) {
+		throw make_error(EACCES);
+	}
 	if (!vp->v_op->vop_cache || (vp->v_size < (off_t)mmu::page_size)) {
 		return mmu::default_file_mmap(this, range, flags, perm, offset);
 	}
@@ -493,6 +493,13 @@ vop_eperm(void)
 	return EPERM;
 }
 
+int
+vop_erofs(void)
+{
+
+	return EROFS;
+}
+
 /*
  * vnode_init() is called once (from vfs_init)
  * in initialization.
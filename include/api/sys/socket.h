@@ -188,6 +188,9 @@ struct ucred
 #define SO_PEEK_OFF             42
 #define SO_NOFCS                43
 #define SO_LOCK_FILTER          44
+#define SO_SELECT_ERR_QUEUE     45
+#define SO_BUSY_POLL            46
+#define SO_ZEROCOPY             60
 
 #define SOL_RAW         255
 #define SOL_DECNET      261
@@ -216,6 +219,7 @@ struct ucred
 #define MSG_NOSIGNAL  0x4000
 #define MSG_MORE      0x8000
 #define MSG_WAITFORONE 0x10000
+#define MSG_ZEROCOPY  0x4000000
 #define MSG_CMSG_CLOEXEC 0x40000000
 
 #define __CMSG_LEN(cmsg) (((cmsg)->cmsg_len + sizeof(long) - 1) & ~(long)(sizeof(long) - 1))
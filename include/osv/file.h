@@ -190,6 +190,9 @@ int fdrop(struct file* fp);
 /* Get fp from fd and increment refcount */
 int fget(int fd, struct file** fp);
 
+/* Get the type of the file at fd without taking a reference */
+int fget_type(int fd, filetype_t* type);
+
 bool is_nonblock(struct file *f);
 
 __END_DECLS
@@ -34,6 +34,23 @@ void free_phys_contiguous_aligned(void* p);
 
 void setup_free_memory(void* start, size_t bytes);
 
+// Keeps the free memory of each NUMA node apart, once the topology is known
+void setup_numa();
+
+// The NUMA node the current thread's allocations prefer
+unsigned numa_node();
+
+// While alive, makes the large allocations of the current thread come from
+// the memory of @node, where it has any free. For memory that is going to
+// be used by a cpu other than the current one, like its stacks.
+class numa_node_scope {
+public:
+    explicit numa_node_scope(unsigned node);
+    ~numa_node_scope();
+private:
+    int _saved;
+};
+
 void debug_memory_pool(size_t *total, size_t *contig);
 
 namespace bi = boost::intrusive;
@@ -56,20 +73,25 @@ private:
 private:
     bool have_full_pages();
     void add_page();
+    void free_page(page_header* header);
     static page_header* to_header(free_object* object);
+    static unsigned compute_slab_pages(size_t size);
 
     // should get called with the preemption lock taken
     void free_same_cpu(free_object* obj, unsigned cpu_id);
     void free_different_cpu(free_object* obj, unsigned obj_cpu, unsigned cur_cpu);
 private:
     unsigned _size;
+    unsigned _slab_pages;
 
+    // Heads each slab: a single page, or for the larger objects, several
+    // pages starting on a max_slab_size boundary.
     struct page_header {
         pool* owner;
         unsigned cpu_id;
         unsigned nalloc;
         bi::list_member_hook<> free_link;
-        free_object* local_free;  // free objects in this page
+        free_object* local_free;  // free objects in this slab
     };
 
     typedef bi::list<page_header,
@@ -87,6 +109,7 @@ private:
 public:
     static const size_t max_object_size;
     static const size_t min_object_size;
+    static const size_t max_slab_size;
 };
 
 struct page_range {
@@ -34,12 +34,14 @@ enum class mem_area {
     page,
     mempool,
     debug,
+    mempool_slab,
 };
 
 constexpr mem_area identity_mapped_areas[] = {
     mem_area::main,
     mem_area::page,
     mem_area::mempool,
+    mem_area::mempool_slab,
 };
 
 constexpr uintptr_t mem_area_size = uintptr_t(1) << 44;
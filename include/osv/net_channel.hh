@@ -20,6 +20,7 @@
 
 struct mbuf;
 struct pollreq;
+struct ifnet;
 
 // The BSD headers #define a macro called free, so including mempool
 // directly will yield trouble. We only need those two functions.
@@ -31,16 +32,22 @@ extern void* memory::alloc_page();
 class net_channel {
 private:
     std::function<void (mbuf*)> _process_packet;
+    // the interface feeding us, which busy polling may poll
+    ifnet* _intf;
     ring_spsc<mbuf*, 256> _queue;
     sched::thread_handle _waiting_thread CACHELINE_ALIGNED;
     // extra list of threads to wake
     osv::rcu_ptr<std::vector<pollreq*>> _pollers;
     mutex _pollers_mutex;
 public:
-    explicit net_channel(std::function<void (mbuf*)> process_packet)
-        : _process_packet(std::move(process_packet)) {}
+    explicit net_channel(std::function<void (mbuf*)> process_packet,
+                         ifnet* intf = nullptr)
+        : _process_packet(std::move(process_packet)), _intf(intf) {}
+    ifnet* intf() const { return _intf; }
     // producer: try to push a packet
     bool push(mbuf* m) { return _queue.push(m); }
+    // consumer: check for queued packets without consuming them
+    bool empty() const { return !_queue.size(); }
     // consumer: wake the consumer (best used after multiple push()s)
     void wake() {
         _waiting_thread.wake();
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef OSV_NUMA_HH
+#define OSV_NUMA_HH
+
+#include <osv/types.h>
+
+// NUMA topology: which physical memory and which cpus belong to which node,
+// and how far apart the nodes are. Filled in at boot from the firmware's
+// tables (on x64, ACPI's SRAT and SLIT) before the cpus are brought up.
+// Without them, everything is on node 0.
+//
+// The topology is kept in fixed size arrays, as it is needed by the page
+// allocator before any constructors run.
+
+namespace numa {
+
+constexpr unsigned max_nodes = 64;
+constexpr unsigned max_memory_ranges = 128;
+
+// The distance from a node to itself, as in the ACPI SLIT
+constexpr unsigned local_distance = 10;
+constexpr unsigned remote_distance = 20;
+
+struct memory_range {
+    u64 start;
+    u64 end;
+    unsigned node;
+};
+
+// Returns the node for a firmware proximity domain, allocating a new node
+// for a domain not seen before
+unsigned node_for_domain(u32 domain);
+void add_memory(u64 start, u64 size, unsigned node);
+// @from and @to are proximity domains, as the SLIT has them
+void set_domain_distance(u32 from, u32 to, unsigned distance);
+// Called once the firmware tables are parsed
+void commit_topology();
+
+unsigned nr_nodes();
+unsigned nr_memory_ranges();
+const memory_range& get_memory_range(unsigned i);
+unsigned distance(unsigned from, unsigned to);
+// The nodes in order of distance from @node, starting with @node itself;
+// nr_nodes() entries
+const unsigned* nearest_nodes(unsigned node);
+// The node of a physical address, or 0 if the firmware did not describe it
+unsigned phys_node(u64 pa);
+// Whether a node's memory starts or ends at @pa
+bool is_boundary(u64 pa);
+
+}
+
+#endif
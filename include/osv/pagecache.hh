@@ -8,6 +8,7 @@
 #include <osv/file.h>
 #include <osv/vfs_file.hh>
 #include <osv/mmu.hh>
+#include <functional>
 
 struct arc_buf;
 typedef arc_buf arc_buf_t;
@@ -35,4 +36,5 @@ bool release(vfs_file* fp, void *addr, off_t offset, mmu::hw_ptep<0> ptep);
 void sync(vfs_file* fp, off_t start, off_t end);
 void unmap_arc_buf(arc_buf_t* ab);
 void map_arc_buf(hashkey* key, arc_buf_t* ab, void* page);
+void map_read_only_page(hashkey* key, void* page, std::function<void ()> release);
 }
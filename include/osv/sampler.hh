@@ -9,11 +9,16 @@
 #define _OSV_SAMPLER_HH
 
 #include <osv/clock.hh>
+#include <string>
 
 namespace prof {
 
 struct config {
     osv::clock::uptime::duration period;
+    // If non-zero, the sampler counts the stacks it samples in memory, up
+    // to this many distinct stacks per cpu, instead of logging each sample
+    // to the trace buffer. See get_folded_stacks().
+    unsigned max_stacks;
 };
 
 /**
@@ -21,6 +26,8 @@ struct config {
  *
  * Returns true if sampler was started with the new config, false otherwise.
  * If sampler was already running, false is returned.
+ * False is also returned if there isn't enough memory for the stack
+ * tables config::max_stacks asks for.
  *
  * May block.
  */
@@ -33,6 +40,17 @@ bool start_sampler(config) throw();
  */
 void stop_sampler() throw();
 
+/**
+ * Returns the stacks counted by the current or last sampler run which
+ * had config::max_stacks set, in the folded format flame graph tools
+ * take: one line per distinct stack, outermost frame first, frames
+ * separated by ';', followed by a space and the number of samples.
+ * Samples which found their cpu's table full are counted as "[dropped]".
+ *
+ * May block.
+ */
+std::string get_folded_stacks();
+
 }
 
 #endif
@@ -67,6 +67,16 @@ class cpu_set {
 public:
     explicit cpu_set() : _mask() {}
     cpu_set(const cpu_set& other) : _mask(other._mask.load(std::memory_order_relaxed)) {}
+    cpu_set& operator=(const cpu_set& other) {
+        _mask.store(other._mask.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+    unsigned long to_ulong() const {
+        return _mask.load(std::memory_order_relaxed);
+    }
+    bool test(unsigned c) const {
+        return c < max_cpus && (_mask.load(std::memory_order_relaxed) & (1UL << c));
+    }
     void set(unsigned c) {
         _mask.fetch_or(1UL << c, std::memory_order_release);
     }
@@ -392,6 +402,20 @@ public:
     cpu* get_cpu() const {
         return _detached_state.get()->_cpu;
     }
+    /**
+     * Restrict the CPUs the thread may run on
+     *
+     * Once this returns the current thread is running on one of @cpus;
+     * any other thread is moved there the next time it is woken up or
+     * looked at by its CPU's load balancer, and load balancing will never
+     * move it out of the set.
+     *
+     * Returns false, changing nothing, if @cpus contains no existing CPU,
+     * if the thread was pinned with attr::pin(), or if it is the current
+     * thread, must leave its CPU and is in a migrate_disable() section.
+     */
+    bool set_affinity(const cpu_set& cpus);
+    cpu_set get_affinity() const;
     // wake up after acquiring mtx
     //
     // mtx must be locked, and wr must be a free wait_record that will
@@ -566,6 +590,7 @@ private:
     std::unique_ptr<detached_state> _detached_state;
     attr _attr;
     int _migration_lock_counter;
+    cpu_set _affinity;
     arch_thread _arch;
     unsigned int _id;
     std::atomic<bool> _interrupted;
@@ -679,6 +704,7 @@ struct cpu : private timer_base::client {
     explicit cpu(unsigned id);
     unsigned id;
     struct arch_cpu arch;
+    unsigned node = 0; // NUMA node
     thread* bringup_thread;
     runqueue_type runqueue;
     timer_list timers;
@@ -691,12 +717,16 @@ struct cpu : private timer_base::client {
     cpu_set incoming_wakeups_mask;
     incoming_wakeup_queue* incoming_wakeups;
     thread* terminating_thread;
+    // A thread moving itself off this CPU, sent on its way by the next
+    // thread to run here, see thread::set_affinity()
+    thread* migrating_thread;
     osv::clock::uptime::time_point running_since;
     char* percpu_base;
     static cpu* current();
     void init_on_cpu();
     static void schedule();
     void handle_incoming_wakeups();
+    void send_migrating_thread();
     bool poll_wakeup_queue();
     void idle();
     void do_idle();
@@ -707,6 +737,7 @@ struct cpu : private timer_base::client {
     unsigned load();
     void reschedule_from_interrupt();
     void enqueue(thread& t);
+    void send_to(thread& t, cpu* target);
     void init_idle_thread();
     virtual void timer_fired() override;
     class notifier;
@@ -42,6 +42,7 @@ struct trace_record {
     u64 time;
     unsigned cpu;
     bool backtrace : 1;  // 10-element backtrace precedes parameters
+    u16 size;            // of the whole record, for the streaming exporter
     union {
         u8 buffer[0];
         long align[0];
@@ -281,6 +282,11 @@ public:
     bool backtrace() const {
         return _backtrace;
     }
+    // For wrappers called from C, which can't use the patched call site:
+    // true while the tracepoint logs or has probes.
+    const bool* active_flag() const {
+        return &active;
+    }
 
     void enable(bool = true);
     void backtrace(bool);
@@ -321,6 +327,7 @@ private:
     void deactivate(const tracepoint_id &, void * site, void * slow_path);
     void update();
     static std::unordered_set<tracepoint_id>& known_ids();
+public:
     static const size_t backtrace_len = 10;
 };
 
@@ -359,6 +366,9 @@ public:
             return;
         }
         auto tr = allocate_trace_record(payload_size(as));
+        if (!tr) {
+            return; // dropped, the exporter has fallen behind
+        }
         auto buffer = tr->buffer;
         log_backtrace(tr, buffer);
         serialize(buffer, as);
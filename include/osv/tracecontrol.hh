@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <regex>
+#include <chrono>
 
 class tracepoint_base;
 
@@ -49,6 +50,37 @@ set_event_state(const std::regex &, bool enable, bool stacktrace = false);
 event_info
 set_event_state(tracepoint_base &, bool enable, bool stacktrace = false);
 
+/**
+ * Streams trace records, as they are logged, to @target: a file or
+ * device ("file:<path>", or just the path) or a TCP connection
+ * ("tcp:<address>:<port>"). The stream can be read with scripts/trace.py.
+ *
+ * While exporting, records the exporter hasn't caught up with are not
+ * overwritten; new records are dropped instead, and their number is
+ * recorded in the stream.
+ *
+ * Throws std::runtime_error if the target cannot be opened, or if an
+ * export is already running.
+ */
+void
+start_export(const std::string & target);
+
+/**
+ * Flushes the records logged so far and stops the export, if any.
+ */
+void
+stop_export();
+
+struct export_stats {
+    unsigned long records;  // exported
+    unsigned long lost;     // dropped because the exporter fell behind
+    unsigned long bytes;    // written to the target
+    std::chrono::nanoseconds cpu_time;  // used by the exporter thread
+};
+
+export_stats
+get_export_stats();
+
 
 }
 
@@ -5,38 +5,519 @@
  * BSD license as described in the LICENSE file in the top-level directory.
  */
 
+// Unix-domain (AF_LOCAL) stream and datagram sockets, both unnamed
+// (socketpair()) and bound to a name in the file system or in the abstract
+// namespace.
+//
+// Data is queued in page-sized chunks which move from writer to reader by
+// reference. A blocking writer with more data than fits in the receive
+// buffer doesn't copy the rest at all: it lends its own buffers to the
+// queue and waits until the reader has copied from them directly, so bulk
+// transfers cost a single copy. File descriptors passed with SCM_RIGHTS
+// travel in the queue along with the data they were sent with.
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
 #include "af_local.h"
-#include "pipe_buffer.hh"
 
 #include <fs/fs.hh>
-#include <osv/socket.hh>
 #include <osv/fcntl.h>
+#include <osv/poll.h>
+#include <osv/uio.h>
+#include <osv/mutex.h>
+#include <osv/condvar.h>
 #include <libc/libc.hh>
 
 #include <fcntl.h>
-#include <sys/socket.h>
+#include <stddef.h>
 #include <sys/poll.h>
 #include <utility>
 #include <sys/ioctl.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/intrusive_ptr.hpp>
+
+// Bytes of data a socket may have queued for its reader. Buffers lent by
+// blocked writers don't count.
+static constexpr size_t max_buf = 256 * 1024;
+// Lend rather than copy when at least this much doesn't fit
+static constexpr size_t direct_min = 16 * 1024;
+static constexpr size_t chunk_size = 4096;
+static constexpr unsigned max_backlog = 128;
+
+// A writer waiting for the reader to consume the buffers it lent
+struct direct_write {
+    unsigned pending = 0;
+    size_t consumed = 0;
+};
+
+struct segment {
+    char* base = nullptr;           // unread data
+    size_t len = 0;
+    std::unique_ptr<char[]> page;   // our copy of the data, or null if lent
+    size_t room = 0;                // free space after the data in page
+    direct_write* lender = nullptr;
+    std::vector<fileref> rights;    // SCM_RIGHTS sent with this data
+    std::string from;               // datagrams: the sender's name
+};
+
+struct af_local_buffer {
+public:
+    explicit af_local_buffer(bool dgram) : dgram(dgram) {}
+    af_local_buffer(const af_local_buffer&) = delete;
+    int read(uio* data, bool nonblock, bool waitall, bool peek,
+             std::vector<fileref>* rights, std::string* from, size_t* msglen);
+    int write(uio* data, bool nonblock, std::vector<fileref>&& rights,
+              const std::string& from);
+    int read_events();
+    int write_events();
+    void detach_sender();
+    void detach_receiver();
+    void attach_sender(struct file *f);
+    void attach_receiver(struct file *f);
+private:
+    int read_events_unlocked();
+    int write_events_unlocked();
+    void wake_readers();
+    void wake_writers();
+    void peek_locked(uio* data, std::vector<fileref>* rights, std::string* from,
+                     size_t* msglen);
+    void append(uio* data, size_t n, std::vector<fileref>& rights);
+    int write_direct(uio* data, std::vector<fileref>& rights);
+    int write_dgram(uio* data, bool nonblock, std::vector<fileref>& rights,
+                    const std::string& from);
+private:
+    mutex mtx;
+    std::deque<segment> q;
+    size_t queued = 0;
+    // A datagram buffer has any number of senders, and never ends
+    const bool dgram;
+    struct file *receiver = nullptr;
+    struct file *sender = nullptr;
+    std::atomic<unsigned> refs = {};
+    condvar may_read;
+    condvar may_write;
+    friend void intrusive_ptr_add_ref(af_local_buffer* p) {
+        p->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    friend void intrusive_ptr_release(af_local_buffer* p) {
+        if (p->refs.fetch_add(-1, std::memory_order_acquire) == 1) {
+            delete p;
+        }
+    }
+};
+
+typedef boost::intrusive_ptr<af_local_buffer> af_local_buffer_ref;
+
+void af_local_buffer::detach_sender()
+{
+    WITH_LOCK(mtx) {
+        if (sender) {
+            sender = nullptr;
+            if (receiver)
+                poll_wake(receiver, POLLHUP);
+            may_read.wake_all();
+        }
+    }
+}
+
+void af_local_buffer::detach_receiver()
+{
+    WITH_LOCK(mtx) {
+        if (receiver) {
+            receiver = nullptr;
+            if (sender)
+                poll_wake(sender, POLLERR|POLLOUT);
+            may_write.wake_all();
+        }
+    }
+}
+
+void af_local_buffer::attach_sender(struct file *f)
+{
+    assert(sender == nullptr && !dgram);
+    sender = f;
+}
+
+void af_local_buffer::attach_receiver(struct file *f)
+{
+    assert(receiver == nullptr);
+    receiver = f;
+}
+
+int af_local_buffer::read_events_unlocked()
+{
+    int ret = 0;
+    ret |= !q.empty() ? POLLIN : 0;
+    ret |= !dgram && !sender ? POLLHUP : 0;
+    return ret;
+}
+
+int af_local_buffer::write_events_unlocked()
+{
+    if (!receiver) {
+        return POLLERR|POLLOUT;
+    }
+    return queued < max_buf ? POLLOUT : 0;
+}
+
+int af_local_buffer::read_events()
+{
+    WITH_LOCK(mtx) {
+        return read_events_unlocked();
+    }
+}
+
+int af_local_buffer::write_events()
+{
+    WITH_LOCK(mtx) {
+        return write_events_unlocked();
+    }
+}
+
+void af_local_buffer::wake_readers()
+{
+    if (receiver) {
+        poll_wake(receiver, (POLLIN | POLLRDNORM));
+    }
+    may_read.wake_all();
+}
+
+void af_local_buffer::wake_writers()
+{
+    if (sender && (write_events_unlocked() & POLLOUT)) {
+        poll_wake(sender, (POLLOUT | POLLWRNORM));
+    }
+    may_write.wake_all();
+}
+
+// Copies the data read() would to @data, but leaves it queued. File
+// descriptors are returned as new references to the same files. Called
+// with mtx held and the queue not empty.
+void af_local_buffer::peek_locked(uio* data, std::vector<fileref>* rights,
+    std::string* from, size_t* msglen)
+{
+    for (auto& s : q) {
+        if (!s.rights.empty()) {
+            if (&s != &q.front()) {
+                break;
+            }
+            if (rights) {
+                *rights = s.rights;
+            }
+        }
+        uiomove(s.base, std::min<size_t>(s.len, data->uio_resid), data);
+        if (dgram) {
+            if (msglen) {
+                *msglen = s.len;
+            }
+            if (from) {
+                *from = s.from;
+            }
+            break;
+        }
+        if (!data->uio_resid) {
+            break;
+        }
+    }
+}
+
+// With @peek, waits for data as usual but returns what is queued then, even
+// with @waitall.
+int af_local_buffer::read(uio* data, bool nonblock, bool waitall, bool peek,
+    std::vector<fileref>* rights, std::string* from, size_t* msglen)
+{
+    if (!data->uio_resid && !dgram) {
+        return 0;
+    }
+    WITH_LOCK(mtx) {
+        if (peek) {
+            while (q.empty()) {
+                if (!dgram && !sender) {
+                    return 0;
+                }
+                if (nonblock) {
+                    return EAGAIN;
+                }
+                may_read.wait(&mtx);
+            }
+            peek_locked(data, rights, from, msglen);
+            return 0;
+        }
+        bool copied = false;
+        while (true) {
+            if (q.empty()) {
+                if ((!dgram && !sender) || (nonblock && copied)) {
+                    break;
+                }
+                if (nonblock) {
+                    return EAGAIN;
+                }
+                may_read.wait(&mtx);
+                continue;
+            }
+            auto& s = q.front();
+            // File descriptors are received along with the first byte
+            // they were sent with, and never merged with others
+            if (!s.rights.empty()) {
+                if (copied) {
+                    break;
+                }
+                if (rights) {
+                    *rights = std::move(s.rights);
+                }
+                s.rights.clear();
+            }
+            auto n = std::min<size_t>(s.len, data->uio_resid);
+            uiomove(s.base, n, data);
+            copied = true;
+            if (dgram) {
+                // The rest of a datagram which doesn't fit is discarded
+                if (msglen) {
+                    *msglen = s.len;
+                }
+                if (from) {
+                    *from = std::move(s.from);
+                }
+                queued -= s.len;
+                q.pop_front();
+                break;
+            }
+            s.base += n;
+            s.len -= n;
+            if (s.lender) {
+                s.lender->consumed += n;
+            } else {
+                queued -= n;
+            }
+            if (!s.len) {
+                if (s.lender) {
+                    s.lender->pending--;
+                }
+                q.pop_front();
+            }
+            if (!data->uio_resid || (q.empty() && !waitall)) {
+                break;
+            }
+            if (q.empty()) {
+                wake_writers();
+            }
+        }
+        wake_writers();
+    }
+    return 0;
+}
+
+// Copies @n bytes from @data to the end of the queue, attaching @rights to
+// the first of them
+void af_local_buffer::append(uio* data, size_t n, std::vector<fileref>& rights)
+{
+    if (rights.empty() && !q.empty()) {
+        auto& t = q.back();
+        if (t.page && t.room) {
+            auto m = std::min(n, t.room);
+            uiomove(t.base + t.len, m, data);
+            t.len += m;
+            t.room -= m;
+            queued += m;
+            n -= m;
+        }
+    }
+    while (n) {
+        segment s;
+        s.page.reset(new char[chunk_size]);
+        s.base = s.page.get();
+        s.len = std::min(n, chunk_size);
+        s.room = chunk_size - s.len;
+        uiomove(s.base, s.len, data);
+        s.rights = std::move(rights);
+        rights.clear();
+        queued += s.len;
+        n -= s.len;
+        q.push_back(std::move(s));
+    }
+}
+
+// Queues the rest of @data by reference, and waits for the reader to copy
+// it. Called with mtx held.
+int af_local_buffer::write_direct(uio* data, std::vector<fileref>& rights)
+{
+    direct_write dw;
+    for (int i = 0; i < data->uio_iovcnt; i++) {
+        auto& iov = data->uio_iov[i];
+        if (!iov.iov_len) {
+            continue;
+        }
+        segment s;
+        s.base = static_cast<char*>(iov.iov_base);
+        s.len = iov.iov_len;
+        s.lender = &dw;
+        s.rights = std::move(rights);
+        rights.clear();
+        dw.pending++;
+        q.push_back(std::move(s));
+    }
+    wake_readers();
+    while (dw.pending && receiver) {
+        may_write.wait(&mtx);
+    }
+    if (dw.pending) {
+        // The reader went away: take back what it didn't read
+        q.erase(std::remove_if(q.begin(), q.end(),
+                [&] (const segment& s) { return s.lender == &dw; }), q.end());
+    }
+    data->uio_resid -= dw.consumed;
+    return 0;
+}
+
+int af_local_buffer::write_dgram(uio* data, bool nonblock,
+    std::vector<fileref>& rights, const std::string& from)
+{
+    size_t len = data->uio_resid;
+    if (len > max_buf) {
+        return EMSGSIZE;
+    }
+    while (receiver && queued + len > max_buf) {
+        if (nonblock) {
+            return EAGAIN;
+        }
+        may_write.wait(&mtx);
+    }
+    if (!receiver) {
+        return ECONNREFUSED;
+    }
+    segment s;
+    s.page.reset(new char[std::max<size_t>(len, 1)]);
+    s.base = s.page.get();
+    s.len = len;
+    uiomove(s.base, len, data);
+    s.rights = std::move(rights);
+    s.from = from;
+    queued += len;
+    q.push_back(std::move(s));
+    wake_readers();
+    return 0;
+}
 
-using namespace std;
+int af_local_buffer::write(uio* data, bool nonblock,
+    std::vector<fileref>&& rights, const std::string& from)
+{
+    WITH_LOCK(mtx) {
+        if (dgram) {
+            return write_dgram(data, nonblock, rights, from);
+        }
+        if (!data->uio_resid) {
+            return 0;
+        }
+        auto total = data->uio_resid;
+        while (data->uio_resid) {
+            if (!receiver) {
+                // FIXME: If we don't generate a SIGPIPE here, at least assert
+                // that the user did not install a SIGPIPE handler.
+                return data->uio_resid < total ? 0 : EPIPE;
+            }
+            size_t space = max_buf - std::min(queued, max_buf);
+            size_t resid = data->uio_resid;
+            if (!nonblock && resid > space && resid - space >= direct_min) {
+                // We'd have to wait for the reader anyway: copy what fits,
+                // and let it take the rest directly from our buffers.
+                append(data, space, rights);
+                write_direct(data, rights);
+                return data->uio_resid < total ? 0 : EPIPE;
+            }
+            if (!space) {
+                if (nonblock) {
+                    return data->uio_resid < total ? 0 : EAGAIN;
+                }
+                wake_readers();
+                may_write.wait(&mtx);
+                continue;
+            }
+            append(data, std::min(space, resid), rights);
+        }
+        wake_readers();
+    }
+    return 0;
+}
+
+// The accept queue of a listening stream socket
+struct af_local_listener {
+    mutex mtx;
+    condvar may_accept;
+    condvar may_connect;
+    std::deque<fileref> backlog;
+    unsigned max_backlog = 1;
+    struct file* owner;     // the listening socket, until it is closed
+    std::atomic<unsigned> refs = {};
+
+    explicit af_local_listener(struct file* f) : owner(f) {}
+    friend void intrusive_ptr_add_ref(af_local_listener* p) {
+        p->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    friend void intrusive_ptr_release(af_local_listener* p) {
+        if (p->refs.fetch_add(-1, std::memory_order_acquire) == 1) {
+            delete p;
+        }
+    }
+};
+
+typedef boost::intrusive_ptr<af_local_listener> af_local_listener_ref;
 
 struct af_local final : public special_file {
-    af_local(const pipe_buffer_ref& s, const pipe_buffer_ref& r)
-            : special_file(FREAD|FWRITE, DTYPE_UNSPEC), send(s), receive(r) { init(); }
-    af_local(pipe_buffer_ref&& s, pipe_buffer_ref&& r)
-            : special_file(FREAD|FWRITE, DTYPE_UNSPEC), send(std::move(s)), receive(std::move(r)) { init(); }
+    af_local(int type, unsigned flags);
+    af_local(int type, const af_local_buffer_ref& s, const af_local_buffer_ref& r)
+            : special_file(FREAD|FWRITE, DTYPE_UNSPEC), type(type), send(s), receive(r) { init(); }
+    af_local(int type, af_local_buffer_ref&& s, af_local_buffer_ref&& r)
+            : special_file(FREAD|FWRITE, DTYPE_UNSPEC), type(type), send(std::move(s)), receive(std::move(r)) { init(); }
     void init();
     virtual int ioctl(u_long com, void *data) override;
     virtual int read(uio* data, int flags) override;
     virtual int write(uio* data, int flags) override;
     virtual int poll(int events) override;
+    virtual int stat(struct stat* buf) override;
     virtual int close() override;
 
-    pipe_buffer_ref send;
-    pipe_buffer_ref receive;
+    af_local_buffer_ref get_send() { SCOPE_LOCK(f_lock); return send; }
+    af_local_buffer_ref get_receive() { SCOPE_LOCK(f_lock); return receive; }
+    af_local_listener_ref get_listener() { SCOPE_LOCK(f_lock); return listener; }
+
+    const int type;
+    af_local_buffer_ref send;
+    af_local_buffer_ref receive;
+    af_local_listener_ref listener;
+    std::string name;       // our address (sun_path), if bound
+    std::string key;        // our entry in the names table, if bound
+    std::string peer_name;
+};
+
+// What a bound name leads to
+struct af_local_name {
+    int type;
+    af_local* owner;                    // for identification only
+    af_local_listener_ref listener;     // stream sockets, once listening
+    af_local_buffer_ref dgram;          // datagram sockets: their queue
 };
 
+static mutex names_mutex;
+static std::unordered_map<std::string, af_local_name> names;
+
+af_local::af_local(int type, unsigned flags)
+    : special_file(flags, DTYPE_UNSPEC), type(type)
+{
+    // A datagram socket can be sent to as soon as it is bound
+    if (type == SOCK_DGRAM) {
+        receive = new af_local_buffer(true);
+        receive->attach_receiver(this);
+    }
+}
+
 int af_local::ioctl(u_long cmd, void *data)
 {
     int error = ENOTTY;
@@ -56,35 +537,85 @@ int af_local::ioctl(u_long cmd, void *data)
 
 void af_local::init()
 {
-    send->attach_sender(this);
+    if (type == SOCK_STREAM) {
+        send->attach_sender(this);
+    }
     receive->attach_receiver(this);
 }
 
 int af_local::read(uio* data, int flags)
 {
-    return receive->read(data, is_nonblock(this));
+    auto r = get_receive();
+    if (!r) {
+        return ENOTCONN;
+    }
+    return r->read(data, is_nonblock(this), false, false, nullptr, nullptr, nullptr);
 }
 
 int af_local::write(uio* data, int flags)
 {
-    return send->write(data, is_nonblock(this));
+    auto s = get_send();
+    if (!s) {
+        return ENOTCONN;
+    }
+    return s->write(data, is_nonblock(this), {}, name);
 }
 
 int af_local::poll(int events)
 {
     int revents = 0;
-    if (events & POLLIN) {
-        revents |= receive->read_events();
+    auto l = get_listener();
+    if (l) {
+        WITH_LOCK(l->mtx) {
+            if ((events & POLLIN) && !l->backlog.empty()) {
+                revents |= POLLIN;
+            }
+        }
+        return revents;
     }
-    if (events & POLLOUT) {
-        revents |= send->write_events();
+    auto r = get_receive();
+    auto s = get_send();
+    if ((events & POLLIN) && r) {
+        revents |= r->read_events();
+    }
+    if ((events & POLLOUT) && s) {
+        revents |= s->write_events();
     }
     return revents;
 }
 
+int af_local::stat(struct stat* buf)
+{
+    memset(buf, 0, sizeof(*buf));
+    buf->st_mode = S_IFSOCK | 0777;
+    return 0;
+}
+
 int af_local::close()
 {
-    if (send) {
+    af_local_listener_ref l;
+    std::deque<fileref> backlog;
+    WITH_LOCK(f_lock) {
+        l = std::move(listener);
+    }
+    if (l) {
+        WITH_LOCK(l->mtx) {
+            l->owner = nullptr;
+            // Closing these disconnects their clients
+            backlog.swap(l->backlog);
+            l->may_accept.wake_all();
+            l->may_connect.wake_all();
+        }
+    }
+    if (!key.empty()) {
+        WITH_LOCK(names_mutex) {
+            auto i = names.find(key);
+            if (i != names.end() && i->second.owner == this) {
+                names.erase(i);
+            }
+        }
+    }
+    if (send && type == SOCK_STREAM) {
         send->detach_sender();
     }
     if (receive) {
@@ -95,15 +626,128 @@ int af_local::close()
     return 0;
 }
 
+// Returns the AF_LOCAL socket @fd refers to, if it is one, holding a
+// reference to it in @ref
+static af_local* af_local_from_fd(int fd, fileref& ref)
+{
+    ref = fileref_from_fd(fd);
+    return dynamic_cast<af_local*>(ref.get());
+}
+
+// Extracts the name from a sockaddr_un: a path, or if it starts with a NUL,
+// a name in the abstract namespace, of which all bytes count.
+static int parse_name(const void* addr, socklen_t len, std::string& name)
+{
+    auto sun = static_cast<const sockaddr_un*>(addr);
+    constexpr auto path_off = offsetof(sockaddr_un, sun_path);
+    if (!addr || len <= path_off || len > sizeof(sockaddr_un) ||
+        sun->sun_family != AF_UNIX) {
+        return EINVAL;
+    }
+    len -= path_off;
+    if (sun->sun_path[0]) {
+        name.assign(sun->sun_path, strnlen(sun->sun_path, len));
+    } else {
+        name.assign(sun->sun_path, len);
+    }
+    return 0;
+}
+
+static void put_name(const std::string& name, void* addr, socklen_t* len)
+{
+    if (!addr || !len) {
+        return;
+    }
+    sockaddr_un sun = {};
+    sun.sun_family = AF_UNIX;
+    memcpy(sun.sun_path, name.data(), name.size());
+    socklen_t full = offsetof(sockaddr_un, sun_path) + name.size();
+    if (!name.empty() && name[0]) {
+        full = std::min<socklen_t>(full + 1, sizeof(sun));
+    }
+    memcpy(addr, &sun, std::min(*len, full));
+    *len = full;
+}
+
+// Names in the file system are looked up by the socket file's inode, so
+// that renaming or unlinking it works as on Linux.
+static int name_key(const std::string& name, std::string& key, bool create)
+{
+    if (!name[0]) {
+        key = name;
+        return 0;
+    }
+    if (create && mknod(name.c_str(), S_IFSOCK | 0777, 0) < 0) {
+        return errno == EEXIST ? EADDRINUSE : errno;
+    }
+    struct stat st;
+    if (::stat(name.c_str(), &st) < 0) {
+        return errno;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        return ECONNREFUSED;
+    }
+    key = "/" + std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino);
+    return 0;
+}
+
+static int lookup_name(const void* addr, socklen_t len, int type,
+                       af_local_name& out)
+{
+    std::string name, key;
+    int error = parse_name(addr, len, name);
+    if (!error) {
+        error = name_key(name, key, false);
+    }
+    if (error) {
+        return error;
+    }
+    WITH_LOCK(names_mutex) {
+        auto i = names.find(key);
+        if (i == names.end()) {
+            return ECONNREFUSED;
+        }
+        if (i->second.type != type) {
+            return EPROTOTYPE;
+        }
+        out = i->second;
+    }
+    return 0;
+}
+
+int socket_af_local(int type, int proto)
+{
+    unsigned flags = FREAD|FWRITE;
+    if (type & SOCK_NONBLOCK) {
+        flags |= FNONBLOCK;
+    }
+    type &= ~(SOCK_NONBLOCK|SOCK_CLOEXEC);
+    if (type != SOCK_STREAM && type != SOCK_DGRAM) {
+        return libc_error(ESOCKTNOSUPPORT);
+    }
+    if (proto != 0) {
+        return libc_error(EPROTONOSUPPORT);
+    }
+    try {
+        fileref f = make_file<af_local>(type, flags);
+        fdesc fd(f);
+        return fd.release();
+    } catch (int error) {
+        return libc_error(error);
+    }
+}
+
 int socketpair_af_local(int type, int proto, int sv[2])
 {
-    assert(type == SOCK_STREAM);
+    type &= ~(SOCK_NONBLOCK|SOCK_CLOEXEC);
+    assert(type == SOCK_STREAM || type == SOCK_DGRAM);
     assert(proto == 0);
-    pipe_buffer_ref b1{new pipe_buffer};
-    pipe_buffer_ref b2{new pipe_buffer};
+    bool dgram = type == SOCK_DGRAM;
+    af_local_buffer_ref b1{new af_local_buffer(dgram)};
+    af_local_buffer_ref b2{new af_local_buffer(dgram)};
     try {
-        fileref f1 = make_file<af_local>(b1, b2);
-        fileref f2 = make_file<af_local>(std::move(b2), std::move(b1));
+        fileref f1 = make_file<af_local>(type, b1, b2);
+        fileref f2 = make_file<af_local>(type, std::move(b2), std::move(b1));
         fdesc fd1(f1);
         fdesc fd2(f2);
         // all went well, user owns descriptors now
@@ -115,31 +759,502 @@ int socketpair_af_local(int type, int proto, int sv[2])
     }
 }
 
+int bind_af_local(int fd, const void* addr, socklen_t len)
+{
+    fileref ref;
+    auto f = af_local_from_fd(fd, ref);
+    if (!f) {
+        return ENOTSOCK;
+    }
+    std::string name, key;
+    int error = parse_name(addr, len, name);
+    if (error) {
+        return error;
+    }
+    SCOPE_LOCK(f->f_lock);
+    if (!f->key.empty()) {
+        return EINVAL;
+    }
+    error = name_key(name, key, true);
+    if (error) {
+        return error;
+    }
+    WITH_LOCK(names_mutex) {
+        // A file system name may be left over from a socket whose file was
+        // removed since, and whose inode was reused: it is unreachable.
+        if (!name[0] && names.count(key)) {
+            return EADDRINUSE;
+        }
+        names[key] = af_local_name{f->type, f, nullptr, f->receive};
+    }
+    f->name = name;
+    f->key = key;
+    return 0;
+}
+
+int listen_af_local(int fd, int backlog)
+{
+    fileref ref;
+    auto f = af_local_from_fd(fd, ref);
+    if (!f) {
+        return ENOTSOCK;
+    }
+    if (f->type != SOCK_STREAM) {
+        return EOPNOTSUPP;
+    }
+    backlog = std::max(1, std::min<int>(backlog, max_backlog));
+    SCOPE_LOCK(f->f_lock);
+    if (f->key.empty() || f->send) {
+        return EINVAL;
+    }
+    if (f->listener) {
+        WITH_LOCK(f->listener->mtx) {
+            f->listener->max_backlog = backlog;
+        }
+        return 0;
+    }
+    f->listener = new af_local_listener(f);
+    f->listener->max_backlog = backlog;
+    WITH_LOCK(names_mutex) {
+        auto i = names.find(f->key);
+        if (i != names.end() && i->second.owner == f) {
+            i->second.listener = f->listener;
+        }
+    }
+    return 0;
+}
+
+static int connect_stream(af_local* f, af_local_listener_ref l)
+{
+    af_local_buffer_ref up{new af_local_buffer(false)};
+    af_local_buffer_ref down{new af_local_buffer(false)};
+    fileref peer;
+    try {
+        peer = make_file<af_local>(SOCK_STREAM, down, up);
+    } catch (int error) {
+        return error;
+    }
+    auto p = static_cast<af_local*>(peer.get());
+    WITH_LOCK(f->f_lock) {
+        if (f->send || f->listener) {
+            return EISCONN;
+        }
+        f->send = up;
+        f->receive = down;
+        f->send->attach_sender(f);
+        f->receive->attach_receiver(f);
+        p->peer_name = f->name;
+    }
+    int error = 0;
+    WITH_LOCK(l->mtx) {
+        while (l->owner && l->backlog.size() >= l->max_backlog) {
+            if (is_nonblock(f)) {
+                error = EAGAIN;
+                break;
+            }
+            l->may_connect.wait(&l->mtx);
+        }
+        if (!error && !l->owner) {
+            error = ECONNREFUSED;
+        }
+        if (!error) {
+            p->name = static_cast<af_local*>(l->owner)->name;
+            l->backlog.push_back(peer);
+            poll_wake(l->owner, (POLLIN | POLLRDNORM));
+            l->may_accept.wake_all();
+        }
+    }
+    if (error) {
+        WITH_LOCK(f->f_lock) {
+            f->send->detach_sender();
+            f->receive->detach_receiver();
+            f->send.reset();
+            f->receive.reset();
+        }
+        return error;
+    }
+    WITH_LOCK(f->f_lock) {
+        f->peer_name = p->name;
+    }
+    return 0;
+}
+
+int connect_af_local(int fd, const void* addr, socklen_t len)
+{
+    fileref ref;
+    auto f = af_local_from_fd(fd, ref);
+    if (!f) {
+        return ENOTSOCK;
+    }
+    af_local_name target;
+    int error = lookup_name(addr, len, f->type, target);
+    if (error) {
+        return error;
+    }
+    if (f->type == SOCK_STREAM) {
+        if (!target.listener) {
+            return ECONNREFUSED;
+        }
+        return connect_stream(f, target.listener);
+    }
+    // A datagram socket just remembers where to send
+    std::string name;
+    parse_name(addr, len, name);
+    SCOPE_LOCK(f->f_lock);
+    f->send = target.dgram;
+    f->peer_name = name;
+    return 0;
+}
+
+int accept_af_local(int fd, void* addr, socklen_t* len, int flags, int* out_fd)
+{
+    fileref ref;
+    auto f = af_local_from_fd(fd, ref);
+    if (!f) {
+        return ENOTSOCK;
+    }
+    auto l = f->get_listener();
+    if (!l) {
+        return EINVAL;
+    }
+    fileref peer;
+    WITH_LOCK(l->mtx) {
+        while (l->owner && l->backlog.empty()) {
+            if (is_nonblock(f)) {
+                return EAGAIN;
+            }
+            l->may_accept.wait(&l->mtx);
+        }
+        if (!l->owner) {
+            return EBADF;
+        }
+        peer = std::move(l->backlog.front());
+        l->backlog.pop_front();
+        l->may_connect.wake_all();
+    }
+    auto p = static_cast<af_local*>(peer.get());
+    if (flags & SOCK_NONBLOCK) {
+        FD_LOCK(p);
+        p->f_flags |= FNONBLOCK;
+        FD_UNLOCK(p);
+    }
+    try {
+        fdesc nfd(peer);
+        put_name(p->peer_name, addr, len);
+        *out_fd = nfd.release();
+        return 0;
+    } catch (int error) {
+        return error;
+    }
+}
+
+int getsockname_af_local(int fd, void* addr, socklen_t* len)
+{
+    fileref ref;
+    auto f = af_local_from_fd(fd, ref);
+    if (!f) {
+        return ENOTSOCK;
+    }
+    SCOPE_LOCK(f->f_lock);
+    put_name(f->name, addr, len);
+    return 0;
+}
+
+int getpeername_af_local(int fd, void* addr, socklen_t* len)
+{
+    fileref ref;
+    auto f = af_local_from_fd(fd, ref);
+    if (!f) {
+        return ENOTSOCK;
+    }
+    SCOPE_LOCK(f->f_lock);
+    if (!f->send) {
+        return ENOTCONN;
+    }
+    put_name(f->peer_name, addr, len);
+    return 0;
+}
+
+int sendmsg_af_local(int fd, const struct msghdr* msg, int flags, ssize_t* bytes)
+{
+    fileref ref;
+    auto f = af_local_from_fd(fd, ref);
+    if (!f) {
+        return ENOTSOCK;
+    }
+    if (!(f->f_flags & FWRITE)) {
+        return EPIPE;
+    }
+
+    std::vector<fileref> rights;
+    for (auto cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(const_cast<msghdr*>(msg), cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        auto fds = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        auto n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < n; i++) {
+            auto fp = fileref_from_fd(fds[i]);
+            if (!fp) {
+                return EBADF;
+            }
+            rights.push_back(std::move(fp));
+        }
+    }
+
+    af_local_buffer_ref s;
+    if (msg->msg_name && f->type == SOCK_DGRAM) {
+        af_local_name target;
+        int error = lookup_name(msg->msg_name, msg->msg_namelen, f->type, target);
+        if (error) {
+            return error;
+        }
+        s = target.dgram;
+    } else {
+        s = f->get_send();
+    }
+    if (!s) {
+        return ENOTCONN;
+    }
+    // Queueing a socket on a buffer that socket itself holds would leave the
+    // two referencing each other once every fd is closed, and there is no
+    // garbage collector to find such cycles, so refuse to create one.
+    for (auto& fp : rights) {
+        auto g = dynamic_cast<af_local*>(fp.get());
+        if (g && (g->get_send() == s || g->get_receive() == s)) {
+            return EINVAL;
+        }
+    }
+
+
+    std::vector<iovec> iov(msg->msg_iov, msg->msg_iov + msg->msg_iovlen);
+    uio data = {};
+    data.uio_iov = iov.data();
+    data.uio_iovcnt = iov.size();
+    for (auto& v : iov) {
+        data.uio_resid += v.iov_len;
+    }
+    data.uio_rw = UIO_WRITE;
+    auto total = data.uio_resid;
+    bool nonblock = is_nonblock(f) || (flags & MSG_DONTWAIT);
+    int error = s->write(&data, nonblock, std::move(rights), f->name);
+    *bytes = total - data.uio_resid;
+    return error;
+}
+
+int recvmsg_af_local(int fd, struct msghdr* msg, int flags, ssize_t* bytes)
+{
+    fileref ref;
+    auto f = af_local_from_fd(fd, ref);
+    if (!f) {
+        return ENOTSOCK;
+    }
+    auto r = f->get_receive();
+    if (!r) {
+        return ENOTCONN;
+    }
+    std::vector<iovec> iov(msg->msg_iov, msg->msg_iov + msg->msg_iovlen);
+    uio data = {};
+    data.uio_iov = iov.data();
+    data.uio_iovcnt = iov.size();
+    for (auto& v : iov) {
+        data.uio_resid += v.iov_len;
+    }
+    data.uio_rw = UIO_READ;
+    auto total = data.uio_resid;
+    msg->msg_flags = 0;
+    if (!(f->f_flags & FREAD)) {
+        *bytes = 0;
+        msg->msg_namelen = 0;
+        msg->msg_controllen = 0;
+        return 0;
+    }
+
+    std::vector<fileref> rights;
+    std::string from;
+    size_t msglen = 0;
+    bool nonblock = is_nonblock(f) || (flags & MSG_DONTWAIT);
+    int error = r->read(&data, nonblock, flags & MSG_WAITALL, flags & MSG_PEEK,
+                        &rights, &from, &msglen);
+    if (error) {
+        return error;
+    }
+    *bytes = total - data.uio_resid;
+    if (f->type == SOCK_DGRAM) {
+        if (msglen > size_t(*bytes)) {
+            msg->msg_flags |= MSG_TRUNC;
+            if (flags & MSG_TRUNC) {
+                *bytes = msglen;
+            }
+        }
+        put_name(from, msg->msg_name, &msg->msg_namelen);
+    } else {
+        msg->msg_namelen = 0;
+    }
+
+    // Install the file descriptors received, as many as fit; the rest are
+    // closed when rights goes away.
+    socklen_t room = msg->msg_control ? msg->msg_controllen : 0;
+    msg->msg_controllen = 0;
+    if (rights.empty()) {
+        return 0;
+    }
+    size_t fit = room >= CMSG_LEN(sizeof(int)) ?
+            (room - CMSG_LEN(0)) / sizeof(int) : 0;
+    fit = std::min(fit, rights.size());
+    if (fit < rights.size()) {
+        msg->msg_flags |= MSG_CTRUNC;
+    }
+    if (!fit) {
+        return 0;
+    }
+    auto cmsg = CMSG_FIRSTHDR(msg);
+    auto fds = reinterpret_cast<int*>(CMSG_DATA(cmsg));
+    size_t n = 0;
+    for (; n < fit; n++) {
+        try {
+            fdesc nfd(rights[n]);
+            fds[n] = nfd.release();
+        } catch (int error) {
+            msg->msg_flags |= MSG_CTRUNC;
+            break;
+        }
+    }
+    if (n) {
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+        msg->msg_controllen = CMSG_SPACE(n * sizeof(int));
+    }
+    return 0;
+}
+
+int sendto_af_local(int fd, const void* buf, size_t len, int flags,
+                    const void* addr, socklen_t alen, ssize_t* bytes)
+{
+    iovec iov = { const_cast<void*>(buf), len };
+    msghdr msg = {};
+    msg.msg_name = const_cast<void*>(addr);
+    msg.msg_namelen = alen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    return sendmsg_af_local(fd, &msg, flags, bytes);
+}
+
+int recvfrom_af_local(int fd, void* buf, size_t len, int flags,
+                      void* addr, socklen_t* alen, ssize_t* bytes)
+{
+    iovec iov = { buf, len };
+    msghdr msg = {};
+    msg.msg_name = addr;
+    msg.msg_namelen = alen ? *alen : 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    int error = recvmsg_af_local(fd, &msg, flags, bytes);
+    if (!error && alen) {
+        *alen = msg.msg_namelen;
+    }
+    return error;
+}
+
+int getsockopt_af_local(int fd, int level, int optname, void* optval,
+                        socklen_t* optlen)
+{
+    fileref ref;
+    auto f = af_local_from_fd(fd, ref);
+    if (!f) {
+        return ENOTSOCK;
+    }
+    if (level != SOL_SOCKET) {
+        return ENOPROTOOPT;
+    }
+    int val;
+    switch (optname) {
+    case SO_TYPE:
+        val = f->type;
+        break;
+    case SO_DOMAIN:
+        val = AF_UNIX;
+        break;
+    case SO_ERROR:
+        val = 0;
+        break;
+    case SO_SNDBUF:
+    case SO_RCVBUF:
+        val = max_buf;
+        break;
+    case SO_ACCEPTCONN:
+        val = bool(f->get_listener());
+        break;
+    default:
+        return ENOPROTOOPT;
+    }
+    if (*optlen < sizeof(int)) {
+        return EINVAL;
+    }
+    memcpy(optval, &val, sizeof(int));
+    *optlen = sizeof(int);
+    return 0;
+}
+
+int setsockopt_af_local(int fd, int level, int optname, const void* optval,
+                        socklen_t optlen)
+{
+    fileref ref;
+    auto f = af_local_from_fd(fd, ref);
+    if (!f) {
+        return ENOTSOCK;
+    }
+    if (level != SOL_SOCKET) {
+        return ENOPROTOOPT;
+    }
+    switch (optname) {
+    // Accepted for compatibility, but our buffers are of a fixed size
+    case SO_SNDBUF:
+    case SO_RCVBUF:
+    case SO_REUSEADDR:
+    case SO_KEEPALIVE:
+    case SO_PASSCRED:
+        return 0;
+    default:
+        return ENOPROTOOPT;
+    }
+}
+
 int shutdown_af_local(int fd, int how) {
-    fileref fr(fileref_from_fd(fd));
+    fileref fr;
+    auto f = af_local_from_fd(fd, fr);
     if (!fr) {
         return EBADF;
     }
-    auto f = dynamic_cast<af_local*>(fr.get());
     if (!f) {
         return ENOTSOCK;
     }
+    auto r = f->get_receive();
+    auto s = f->get_send();
+    if (!s && f->type == SOCK_STREAM) {
+        return ENOTCONN;
+    }
     switch (how) {
     case SHUT_RD:
-        f->receive->detach_receiver();
+        r->detach_receiver();
         FD_LOCK(f);
         f->f_flags &= ~FREAD;
         FD_UNLOCK(f);
         break;
     case SHUT_WR:
-        f->send->detach_sender();
+        if (s) {
+            s->detach_sender();
+        }
         FD_LOCK(f);
         f->f_flags &= ~FWRITE;
         FD_UNLOCK(f);
         break;
     case SHUT_RDWR:
-        f->receive->detach_receiver();
-        f->send->detach_sender();
+        r->detach_receiver();
+        if (s) {
+            s->detach_sender();
+        }
         FD_LOCK(f);
         f->f_flags &= ~(FREAD|FWRITE);
         FD_UNLOCK(f);
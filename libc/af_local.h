@@ -12,10 +12,32 @@
 extern "C" {
 #endif
 
+int socket_af_local(int type, int proto);
+
 int socketpair_af_local(int type, int proto, int sv[2]);
 
 int shutdown_af_local(int fd, int how);
 
+// The following return ENOTSOCK if fd isn't an AF_LOCAL socket, and
+// otherwise 0 or an errno value (the addresses are struct sockaddr_un)
+
+int bind_af_local(int fd, const void* addr, socklen_t len);
+int connect_af_local(int fd, const void* addr, socklen_t len);
+int listen_af_local(int fd, int backlog);
+int accept_af_local(int fd, void* addr, socklen_t* len, int flags, int* out_fd);
+int getsockname_af_local(int fd, void* addr, socklen_t* len);
+int getpeername_af_local(int fd, void* addr, socklen_t* len);
+int sendmsg_af_local(int fd, const struct msghdr* msg, int flags, ssize_t* bytes);
+int recvmsg_af_local(int fd, struct msghdr* msg, int flags, ssize_t* bytes);
+int sendto_af_local(int fd, const void* buf, size_t len, int flags,
+                    const void* addr, socklen_t alen, ssize_t* bytes);
+int recvfrom_af_local(int fd, void* buf, size_t len, int flags,
+                      void* addr, socklen_t* alen, ssize_t* bytes);
+int getsockopt_af_local(int fd, int level, int optname, void* optval,
+                        socklen_t* optlen);
+int setsockopt_af_local(int fd, int level, int optname, const void* optval,
+                        socklen_t optlen);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,6 +7,7 @@
 
 #include <osv/sched.hh>
 #include "signal.hh"
+#include "libc.hh"
 #include <pthread.h>
 #include <errno.h>
 #include <mutex>
@@ -64,9 +65,36 @@ namespace pthread_private {
         size_t stack_size;
         size_t guard_size;
         bool detached;
-        thread_attr() : stack_begin{}, stack_size{1<<20}, guard_size{4096}, detached{false} {}
+        // CPUs the thread may run on, as a sched::cpu_set mask; 0 for all
+        unsigned long affinity;
+        thread_attr() : stack_begin{}, stack_size{1<<20}, guard_size{4096}, detached{false}, affinity{} {}
     };
 
+    // CPUs beyond the last one we can have are silently dropped, as Linux
+    // does for CPUs that aren't online.
+    static sched::cpu_set from_cpu_set_t(size_t size, const cpu_set_t* cpus)
+    {
+        sched::cpu_set ret;
+        for (unsigned i = 0; i < sched::max_cpus; i++) {
+            if (CPU_ISSET_S(i, size, cpus)) {
+                ret.set(i);
+            }
+        }
+        return ret;
+    }
+
+    static int to_cpu_set_t(sched::cpu_set mask, size_t size, cpu_set_t* cpus)
+    {
+        if (size * 8 < sched::cpus.size()) {
+            return EINVAL;
+        }
+        CPU_ZERO_S(size, cpus);
+        for (auto i : mask) {
+            CPU_SET_S(i, size, cpus);
+        }
+        return 0;
+    }
+
     pthread::pthread(void *(*start)(void *arg), void *arg, sigset_t sigset,
                      const thread_attr* attr)
             : _thread([=] {
@@ -76,6 +104,15 @@ namespace pthread_private {
             }, attributes(attr ? *attr : thread_attr()))
     {
         _thread.set_cleanup([=] { delete this; });
+        if (attr && attr->affinity) {
+            sched::cpu_set cpus;
+            for (unsigned i = 0; i < sched::max_cpus; i++) {
+                if (attr->affinity & (1UL << i)) {
+                    cpus.set(i);
+                }
+            }
+            _thread.set_affinity(cpus);
+        }
         _thread.start();
     }
 
@@ -733,3 +770,92 @@ int pthread_setname_np(pthread_t p, const char* name)
     pthread::from_libc(p)->_thread.set_name(name);
     return 0;
 }
+
+int pthread_setaffinity_np(pthread_t p, size_t cpusetsize, const cpu_set_t *cpuset)
+{
+    if (!pthread::from_libc(p)->_thread.set_affinity(from_cpu_set_t(cpusetsize, cpuset))) {
+        return EINVAL;
+    }
+    return 0;
+}
+
+int pthread_getaffinity_np(pthread_t p, size_t cpusetsize, cpu_set_t *cpuset)
+{
+    return to_cpu_set_t(pthread::from_libc(p)->_thread.get_affinity(), cpusetsize, cpuset);
+}
+
+int pthread_attr_setaffinity_np(pthread_attr_t *attr, size_t cpusetsize, const cpu_set_t *cpuset)
+{
+    auto a = from_libc(attr);
+    auto cpus = from_cpu_set_t(cpusetsize, cpuset);
+    // Like sched_setaffinity(), refuse a set with no existing CPU in it
+    bool any = false;
+    for (auto i : sched::cpu_set(cpus)) {
+        any |= i < sched::cpus.size();
+    }
+    if (!any) {
+        return EINVAL;
+    }
+    a->affinity = cpus.to_ulong();
+    return 0;
+}
+
+int pthread_attr_getaffinity_np(const pthread_attr_t *attr, size_t cpusetsize, cpu_set_t *cpuset)
+{
+    auto a = from_libc(attr);
+    sched::cpu_set mask;
+    for (unsigned i = 0; i < sched::cpus.size(); i++) {
+        if (!a->affinity || (a->affinity & (1UL << i))) {
+            mask.set(i);
+        }
+    }
+    return to_cpu_set_t(mask, cpusetsize, cpuset);
+}
+
+// Linux's affinity calls take a thread id; 0 means the calling thread.
+static sched::thread* affinity_thread(pid_t pid)
+{
+    if (pid == 0) {
+        return sched::thread::current();
+    }
+    return sched::thread::find_by_id(pid);
+}
+
+int sched_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t *cpuset)
+{
+    auto t = affinity_thread(pid);
+    if (!t) {
+        return libc_error(ESRCH);
+    }
+    if (!t->set_affinity(from_cpu_set_t(cpusetsize, cpuset))) {
+        return libc_error(EINVAL);
+    }
+    return 0;
+}
+
+int sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t *cpuset)
+{
+    auto t = affinity_thread(pid);
+    if (!t) {
+        return libc_error(ESRCH);
+    }
+    int error = to_cpu_set_t(t->get_affinity(), cpusetsize, cpuset);
+    if (error) {
+        return libc_error(error);
+    }
+    return 0;
+}
+
+int sched_getcpu(void)
+{
+    return sched::cpu::current()->id;
+}
+
+int __sched_cpucount(size_t cpusetsize, const cpu_set_t *cpuset)
+{
+    int count = 0;
+    for (size_t i = 0; i < cpusetsize / sizeof(long); i++) {
+        count += __builtin_popcountl(reinterpret_cast<const unsigned long*>(cpuset)[i]);
+    }
+    return count;
+}
@@ -1,6 +1,6 @@
 #include <string.h>
 
-int memcmp(const void *vl, const void *vr, size_t n)
+int memcmp_base(const void *vl, const void *vr, size_t n)
 {
 	const unsigned char *l=vl, *r=vr;
 	for (; n && *l == *r; n--, l++, r++);
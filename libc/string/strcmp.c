@@ -1,7 +1,6 @@
 #include <string.h>
 
-#undef strcmp
-int strcmp(const char *l, const char *r)
+int strcmp_base(const char *l, const char *r)
 {
 	for (; *l==*r && *l && *r; l++, r++);
 	return *(unsigned char *)l - *(unsigned char *)r;
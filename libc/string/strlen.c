@@ -8,7 +8,7 @@
 #define HIGHS (ONES * (UCHAR_MAX/2+1))
 #define HASZERO(x) (((x)-ONES) & ~(x) & HIGHS)
 
-size_t strlen(const char *s)
+size_t strlen_base(const char *s)
 {
 	const char *a = s;
 	const size_t *w;
@@ -1,8 +1,8 @@
 #include <string.h>
 
-void *__memrchr(const void *, int, size_t);
+void *memrchr(const void *, int, size_t);
 
 char *strrchr(const char *s, int c)
 {
-	return __memrchr(s, c, strlen(s) + 1);
+	return memrchr(s, c, strlen(s) + 1);
 }
@@ -15,6 +15,8 @@
 
 #include <syscall.h>
 #include <stdarg.h>
+#include <sched.h>
+#include <algorithm>
 #include <time.h>
 
 #include <unordered_map>
@@ -129,6 +131,19 @@ int futex(int *uaddr, int op, int val, const struct timespec *timeout,
         } while (0)
 
 
+// The raw system call returns the size of the mask it filled, unlike
+// the libc function.
+static long sys_sched_getaffinity(pid_t pid, unsigned len, cpu_set_t *mask)
+{
+    int ret = sched_getaffinity(pid, len, mask);
+    if (ret < 0) {
+        return ret;
+    }
+    return std::min<size_t>(len, (sched::cpus.size() + 63) / 64 * 8);
+}
+
+#define __NR_sys_sched_getaffinity __NR_sched_getaffinity
+
 long syscall(long number, ...)
 {
     switch (number) {
@@ -137,6 +152,8 @@ long syscall(long number, ...)
     SYSCALL2(clock_gettime, clockid_t, struct timespec *);
     SYSCALL2(clock_getres, clockid_t, struct timespec *);
     SYSCALL6(futex, int *, int, int, const struct timespec *, int *, int);
+    SYSCALL3(sched_setaffinity, pid_t, size_t, const cpu_set_t *);
+    SYSCALL3(sys_sched_getaffinity, pid_t, unsigned, cpu_set_t *);
     }
 
     abort("syscall(): unimplemented system call %d. Aborting.\n", number);
@@ -26,6 +26,7 @@
 #include "arch.hh"
 #include "arch-setup.hh"
 #include "osv/trace.hh"
+#include <osv/tracecontrol.hh>
 #include <osv/power.hh>
 #include <osv/rcu.hh>
 #include <osv/mempool.hh>
@@ -78,6 +79,7 @@ extern "C" {
     void premain();
     void vfs_init(void);
     void mount_zfs_rootfs(void);
+    int mount_rofs_rootfs(void);
     void ramdisk_init(void);
 }
 
@@ -121,8 +123,11 @@ static std::string opt_console = "all";
 static bool opt_verbose = false;
 static std::string opt_chdir;
 static bool opt_bootchart = false;
+static std::string opt_rootfs = "zfs";
+static std::string opt_trace_export;
 
 static int sampler_frequency;
+static unsigned sampler_stacks;
 static bool opt_enable_sampler = false;
 
 std::tuple<int, char**> parse_options(int ac, char** av)
@@ -144,16 +149,20 @@ std::tuple<int, char**> parse_options(int ac, char** av)
     desc.add_options()
         ("help", "show help text")
         ("sampler", bpo::value<int>(), "start stack sampling profiler")
+        ("sampler-stacks", bpo::value<unsigned>(), "count up to this many distinct sampled stacks per cpu in memory, for /proc/profile, instead of tracing each sample")
         ("trace", bpo::value<std::vector<std::string>>(), "tracepoints to enable")
         ("trace-backtrace", "log backtraces in the tracepoint log")
+        ("trace-export", bpo::value<std::string>(), "stream the tracepoint log to file:<path> or tcp:<address>:<port>")
         ("leak", "start leak detector after boot")
         ("nomount", "don't mount the file system")
         ("norandom", "don't initialize any random device")
+        ("busy-poll", bpo::value<int>(), "busy poll sockets for data for this many microseconds before sleeping (SO_BUSY_POLL default)")
         ("noshutdown", "continue running after main() returns")
         ("verbose", "be verbose, print debug messages")
         ("console", bpo::value<std::vector<std::string>>(), "select console driver")
         ("env", bpo::value<std::vector<std::string>>(), "set Unix-like environment variable (putenv())")
         ("cwd", bpo::value<std::vector<std::string>>(), "set current working directory")
+        ("rootfs", bpo::value<std::vector<std::string>>(), "root filesystem to use (zfs or rofs)")
         ("bootchart", "perform a test boot measuring a time distribution of the various operations\n")
     ;
     bpo::variables_map vars;
@@ -185,6 +194,10 @@ std::tuple<int, char**> parse_options(int ac, char** av)
         opt_log_backtrace = true;
     }
 
+    if (vars.count("trace-export")) {
+        opt_trace_export = vars["trace-export"].as<std::string>();
+    }
+
     if (vars.count("verbose")) {
         opt_verbose = true;
         enable_verbose();
@@ -195,10 +208,18 @@ std::tuple<int, char**> parse_options(int ac, char** av)
         opt_enable_sampler = true;
     }
 
+    if (vars.count("sampler-stacks")) {
+        sampler_stacks = vars["sampler-stacks"].as<unsigned>();
+    }
+
     if (vars.count("bootchart")) {
         opt_bootchart = true;
     }
 
+    if (vars.count("busy-poll")) {
+        net_busy_poll = vars["busy-poll"].as<int>();
+    }
+
     if (vars.count("trace")) {
         auto tv = vars["trace"].as<std::vector<std::string>>();
         for (auto t : tv) {
@@ -236,6 +257,14 @@ std::tuple<int, char**> parse_options(int ac, char** av)
         opt_chdir = v.front();
     }
 
+    if (vars.count("rootfs")) {
+        auto v = vars["rootfs"].as<std::vector<std::string>>();
+        if (v.size() > 1) {
+            printf("Ignoring '--rootfs' options after the first.");
+        }
+        opt_rootfs = v.front();
+    }
+
     av += nr_options;
     ac -= nr_options;
     return std::make_tuple(ac, av);
@@ -328,11 +357,15 @@ void* do_main_thread(void *_commands)
     boot_time.event("drivers loaded");
 
     if (opt_mount) {
-        mount_zfs_rootfs();
-        bsd_shrinker_init();
-        zfsdev::zfsdev_init();
+        if (opt_rootfs == "rofs" && mount_rofs_rootfs() == 0) {
+            boot_time.event("ROFS mounted");
+        } else {
+            mount_zfs_rootfs();
+            bsd_shrinker_init();
+            zfsdev::zfsdev_init();
+            boot_time.event("ZFS mounted");
+        }
     }
-    boot_time.event("ZFS mounted");
 
     bool has_if = false;
     osv::for_each_if([&has_if] (std::string if_name) {
@@ -349,6 +382,15 @@ void* do_main_thread(void *_commands)
         dhcp_start(true);
     }
 
+    // Needs the file system or the network, depending on the target
+    if (!opt_trace_export.empty()) {
+        try {
+            trace::start_export(opt_trace_export);
+        } catch (std::runtime_error& e) {
+            printf("%s\n", e.what());
+        }
+    }
+
     if (!opt_chdir.empty()) {
         debug("Chdir to: '%s'\n", opt_chdir.c_str());
 
@@ -432,7 +474,8 @@ void main_cont(int ac, char** av)
 
 #ifndef AARCH64_PORT_STUB
     if (opt_enable_sampler) {
-        prof::config config{std::chrono::nanoseconds(1000000000 / sampler_frequency)};
+        prof::config config{std::chrono::nanoseconds(1000000000 / sampler_frequency),
+                            sampler_stacks};
         prof::start_sampler(config);
     }
 #endif /* !AARCH64_PORT_STUB */
@@ -450,6 +493,8 @@ void main_cont(int ac, char** av)
         sched::thread::wait_until([] { return false; });
     }
 
+    trace::stop_export();
+
     if (memory::tracker_enabled) {
         debug("Leak testing done. Please use 'osv leak show' in gdb to analyze results.\n");
         osv::halt();
@@ -215,3 +215,30 @@ def show_results(mallocs, node_filters, sorter, group_by, symbol_resolver,
         printer=printer,
         order_by=order_by,
         node_filter=node_filter)
+
+#
+# Prints, for each allocator and size class, how many allocations were made,
+# the bytes requested and handed out, and the share of the latter wasted by
+# rounding up to the size class.
+#
+def show_fragmentation(mallocs, printer=prof.default_printer):
+    classes = {}
+    for buf in mallocs:
+        for desc in mallocs[buf]:
+            key = (desc.alloc_type, desc.alloc_len)
+            count, req, alloc = classes.get(key, (0, 0, 0))
+            classes[key] = (count + 1, req + desc.req_len, alloc + desc.alloc_len)
+
+    printer("%-10s %10s %10s %14s %14s %8s\n" % ("allocator", "class", "count",
+        "requested", "allocated", "unused"))
+    totals = {}
+    for (alloc_type, alloc_len), (count, req, alloc) in sorted(classes.items()):
+        printer("%-10s %10d %10d %14d %14d %7.1f%%\n" % (alloc_type, alloc_len,
+            count, req, alloc, (alloc - req) * 100.0 / alloc))
+        t_count, t_req, t_alloc = totals.get(alloc_type, (0, 0, 0))
+        totals[alloc_type] = (t_count + count, t_req + req, t_alloc + alloc)
+
+    printer("\n")
+    for alloc_type, (count, req, alloc) in sorted(totals.items()):
+        printer("%-10s %10s %10d %14d %14d %7.1f%%\n" % (alloc_type, "total",
+            count, req, alloc, (alloc - req) * 100.0 / alloc))
@@ -0,0 +1,312 @@
+#!/usr/bin/python
+
+# Builds a read-only image (see fs/rofs/rofs.hh for the layout) out of a
+# manifest, in the same format taken by mkbootfs.py and upload_manifest.py.
+
+import os, sys, struct, optparse, io, stat
+try:
+    import configparser
+except ImportError:
+    import ConfigParser as configparser
+try:
+    import lz4.block
+    have_lz4 = True
+except ImportError:
+    have_lz4 = False
+
+make_option = optparse.make_option
+
+defines = {}
+def add_var(option, opt, value, parser):
+    var, val = value.split('=')
+    defines[var] = val
+
+opt = optparse.OptionParser(option_list = [
+        make_option('-o',
+                    dest = 'output',
+                    help = 'write to FILE',
+                    metavar = 'FILE'),
+        make_option('-d',
+                    dest = 'depends',
+                    help = 'write dependencies to FILE',
+                    metavar = 'FILE',
+                    default = None),
+        make_option('-m',
+                    dest = 'manifest',
+                    help = 'read manifest from FILE',
+                    metavar = 'FILE'),
+        make_option('-D',
+                    type = 'string',
+                    help = 'define VAR=DATA',
+                    metavar = 'VAR=DATA',
+                    action = 'callback',
+                    callback = add_var),
+        make_option('--no-compress',
+                    dest = 'compress',
+                    action = 'store_false',
+                    default = True,
+                    help = 'store all blocks uncompressed'),
+        make_option('--compress-elf',
+                    dest = 'compress_elf',
+                    action = 'store_true',
+                    default = False,
+                    help = 'also compress ELF objects, which are otherwise '
+                           'left uncompressed so they can be mapped directly'),
+])
+
+block_size = 4096
+magic = b'OSVROFS1'
+version = 1
+block_compressed = 0x1
+
+superblock_fmt = '<8sIIQQQQQQQQ'
+inode_fmt = '<QQQQ'
+dirent_fmt = '<QII'
+block_fmt = '<QII'
+
+def align_up(x, a):
+    return (x + a - 1) & ~(a - 1)
+
+# Directories walked for '/**' entries are appended to dirs, so that the
+# image can depend on them and be rebuilt when files come or go.
+def expand(items, dirs):
+    for name, hostname in items:
+        if name.endswith('/**') and hostname.endswith('/**'):
+            name = name[:-2]
+            hostname = hostname[:-2]
+            for dirpath, dirnames, filenames in os.walk(hostname):
+                dirs.append(dirpath)
+                for filename in filenames:
+                    relpath = dirpath[len(hostname):]
+                    if relpath != "" :
+                        relpath += "/"
+                    yield (name + relpath + filename,
+                           hostname + relpath + filename)
+        elif '/&/' in name and hostname.endswith('/&'):
+            prefix, suffix = name.split('/&/', 1)
+            yield (prefix + '/' + suffix, hostname[:-1] + suffix)
+        else:
+            yield (name, hostname)
+
+def unsymlink(f):
+    # rofs has no symbolic links, so even links the manifest asks to keep
+    # ('!' prefix) are replaced by their target
+    if f.startswith('!'):
+        f = f[1:]
+    try:
+        link = os.readlink(f)
+        if link.startswith('/'):
+            # try to find a match
+            base = os.path.dirname(f)
+            while not os.path.exists(base + link):
+                base = os.path.dirname(base)
+        else:
+            base = os.path.dirname(f) + '/'
+        return unsymlink(base + link)
+    except Exception:
+        return f
+
+# Plain LZ4 block format compressor, used when the lz4 module isn't
+# available on the build host.
+def lz4_compress_slow(src):
+    n = len(src)
+    out = bytearray()
+
+    def put_length(l):
+        while l >= 255:
+            out.append(255)
+            l -= 255
+        out.append(l)
+
+    def put_sequence(literals, match_len, offset):
+        lit = len(literals)
+        token = (min(lit, 15) << 4)
+        if match_len:
+            token |= min(match_len - 4, 15)
+        out.append(token)
+        if lit >= 15:
+            put_length(lit - 15)
+        out.extend(literals)
+        if match_len:
+            out.extend(struct.pack('<H', offset))
+            if match_len - 4 >= 15:
+                put_length(match_len - 4 - 15)
+
+    anchor = 0
+    i = 0
+    table = {}
+    # the last match must start 12 bytes before the end of the block and
+    # the last 5 bytes are always literals
+    limit = n - 12
+    while i < limit:
+        seq = src[i:i + 4]
+        ref = table.get(seq)
+        table[seq] = i
+        if ref is None or i - ref > 65535:
+            i += 1
+            continue
+        match_len = 4
+        max_len = n - 5 - i
+        while match_len < max_len and src[ref + match_len] == src[i + match_len]:
+            match_len += 1
+        put_sequence(src[anchor:i], match_len, i - ref)
+        i += match_len
+        anchor = i
+    put_sequence(src[anchor:], 0, 0)
+    return bytes(out)
+
+def lz4_compress(data):
+    if have_lz4:
+        payload = lz4.block.compress(data, store_size = False)
+    else:
+        payload = lz4_compress_slow(data)
+    # same framing as the ZFS lz4 code we decompress with
+    return struct.pack('>I', len(payload)) + payload
+
+def is_elf(hostname):
+    with open(hostname, 'rb') as f:
+        return f.read(4) == b'\x7fELF'
+
+class node(object):
+    def __init__(self, hostname = None):
+        self.hostname = hostname
+        self.children = {}
+        self.ino = None
+        if hostname is None:
+            self.mode = stat.S_IFDIR | 0o755
+            self.size = 0
+        else:
+            st = os.stat(hostname)
+            self.mode = stat.S_IFREG | (st.st_mode & 0o777)
+            self.size = st.st_size
+
+    def is_dir(self):
+        return stat.S_ISDIR(self.mode)
+
+def build_tree(files):
+    root = node()
+    # mount points used by /etc/fstab and mount_rofs_rootfs()
+    for d in ('dev', 'proc', 'tmp'):
+        root.children[d.encode()] = node()
+    for name, hostname in files:
+        parts = [p.encode() for p in name.split('/') if p]
+        d = root
+        for p in parts[:-1]:
+            d = d.children.setdefault(p, node())
+        if os.path.isdir(hostname):
+            d.children.setdefault(parts[-1], node())
+        else:
+            d.children[parts[-1]] = node(hostname)
+    return root
+
+def main():
+    (options, args) = opt.parse_args()
+
+    depends = io.StringIO()
+    if options.depends:
+        depends = open(options.depends, 'w')
+    manifest = configparser.SafeConfigParser()
+    manifest.optionxform = str # avoid lowercasing
+    manifest.read(options.manifest)
+
+    depends.write(u'%s: \\\n' % (options.output,))
+
+    files = dict([(f, manifest.get('manifest', f, vars = defines))
+                  for f in manifest.options('manifest')])
+    dirs = []
+    files = list(expand(files.items(), dirs))
+    files = [(x, unsymlink(y)) for (x, y) in files]
+    for d in dirs:
+        depends.write(u'\t%s \\\n' % (d,))
+
+    root = build_tree(files)
+
+    # Number the inodes breadth first, so that the entries of a directory
+    # are contiguous in the dirent table, sorted by name for lookup.
+    inodes = [root]
+    dirents = []
+    names = bytearray()
+    nblocks = 0
+    i = 0
+    while i < len(inodes):
+        n = inodes[i]
+        i += 1
+        if n.is_dir():
+            n.data_index = len(dirents)
+            n.data_count = len(n.children)
+            for name in sorted(n.children):
+                child = n.children[name]
+                child.ino = len(inodes)
+                inodes.append(child)
+                dirents.append((child.ino, len(names), len(name)))
+                names.extend(name)
+        else:
+            n.data_index = nblocks
+            n.data_count = (n.size + block_size - 1) // block_size
+            nblocks += n.data_count
+    root.ino = 0
+
+    inodes_offset = block_size
+    dirents_offset = align_up(inodes_offset + len(inodes) * struct.calcsize(inode_fmt), 8)
+    blocks_offset = align_up(dirents_offset + len(dirents) * struct.calcsize(dirent_fmt), 8)
+    names_offset = align_up(blocks_offset + nblocks * struct.calcsize(block_fmt), 8)
+    data_offset = align_up(names_offset + len(names), block_size)
+
+    out = open(options.output, 'wb')
+
+    blocks = []
+    pos = data_offset
+    stored = 0
+    for n in inodes:
+        if n.is_dir():
+            continue
+        depends.write(u'\t%s \\\n' % (n.hostname,))
+        compress = options.compress and (options.compress_elf or not is_elf(n.hostname))
+        with open(n.hostname, 'rb') as f:
+            for b in range(n.data_count):
+                data = f.read(block_size)
+                frame = lz4_compress(data) if compress else None
+                if frame is not None and len(frame) <= block_size - block_size // 8:
+                    out.seek(pos)
+                    out.write(frame)
+                    blocks.append((pos, len(frame), block_compressed))
+                    pos = align_up(pos + len(frame), 8)
+                    stored += len(frame)
+                else:
+                    pos = align_up(pos, block_size)
+                    out.seek(pos)
+                    out.write(data)
+                    blocks.append((pos, len(data), 0))
+                    pos += len(data)
+                    stored += block_size
+    end = align_up(pos, block_size)
+
+    out.seek(0)
+    out.write(struct.pack(superblock_fmt, magic, version, block_size,
+                          len(inodes), inodes_offset,
+                          len(dirents), dirents_offset,
+                          len(blocks), blocks_offset,
+                          len(names), names_offset))
+    out.seek(inodes_offset)
+    for n in inodes:
+        out.write(struct.pack(inode_fmt, n.mode, n.size, n.data_index, n.data_count))
+    out.seek(dirents_offset)
+    for d in dirents:
+        out.write(struct.pack(dirent_fmt, *d))
+    out.seek(blocks_offset)
+    for b in blocks:
+        out.write(struct.pack(block_fmt, *b))
+    out.seek(names_offset)
+    out.write(names)
+    out.truncate(end)
+    out.close()
+
+    depends.write(u'\n\n')
+    depends.close()
+
+    logical = sum(n.size for n in inodes if not n.is_dir())
+    print('rofs: %d files, %d bytes of data stored in %d bytes' %
+          (len(inodes) - len([n for n in inodes if n.is_dir()]), logical, stored))
+
+if __name__ == "__main__":
+    main()
@@ -2,12 +2,21 @@ import os
 import mmap
 import struct
 import sys
+import heapq
+from collections import defaultdict
 from osv import debug
 
 # version 2 introduced thread_name
 # version 3 introduced variable-length arguments (blob)
 _format_version = 3
 
+# Written by the in-guest exporter (--trace-export), see core/trace.cc
+_stream_magic = b'OSVTRACE'
+_stream_version = 1
+_chunk_tracepoint = 1
+_chunk_records = 2
+_chunk_lost = 3
+
 def nanos_to_millis(nanos):
     return float(nanos) / 1000000
 
@@ -304,6 +313,60 @@ def read(buffer_view):
         data = unpacker.unpack(tp.signature)
         yield Trace(tp, thread, thread_name, time, cpu, data, backtrace=backtrace)
 
+def expand_signature(sig):
+    # const char* arguments are logged as fixed-size pascal strings
+    return sig.replace('p', '50p')
+
+def is_stream(buffer):
+    return buffer[:len(_stream_magic)] == _stream_magic
+
+def read_stream(buffer, lost):
+    """
+    Reads a stream written by the in-guest exporter. Fills @lost with the
+    number of records each cpu dropped because the exporter fell behind.
+    A stream cut short, e.g. by a connection going down, is read up to
+    its last complete chunk.
+    """
+    unpacker = SlidingUnpacker(buffer)
+    magic, version, backtrace_len = unpacker.unpack('8sII')
+    if version != _stream_version:
+        raise Exception('Stream version mismatch, current is %d got %d' % (_stream_version, version))
+
+    tracepoints = {}
+    traces = defaultdict(list)
+    while unpacker.offset + 8 <= len(buffer):
+        type, length = unpacker.unpack('II')
+        end = unpacker.offset + length
+        if end > len(buffer):
+            break
+
+        if type == _chunk_tracepoint:
+            key, = unpacker.unpack('Q')
+            tracepoints[key] = TracePoint(key, unpacker.unpack_str(),
+                expand_signature(unpacker.unpack_str()), unpacker.unpack_str())
+        elif type == _chunk_records:
+            cpu_id, _ = unpacker.unpack('II')
+            while unpacker.offset < end:
+                start = unpacker.offset
+                tp_key, thread, thread_name, time, cpu, flags, _, size = unpacker.unpack('QQ16sQIBBH')
+                thread_name = thread_name.partition(b'\0')[0].decode()
+                tp = tracepoints[tp_key]
+
+                backtrace = None
+                if flags & 1:
+                    backtrace = unpacker.unpack('Q' * backtrace_len)
+
+                data = unpacker.unpack(tp.signature)
+                unpacker.offset = start + size
+                traces[cpu_id].append(Trace(tp, thread, thread_name, time, cpu, data, backtrace=backtrace))
+        elif type == _chunk_lost:
+            cpu_id, _, count = unpacker.unpack('IIQ')
+            lost[cpu_id] = count
+
+        unpacker.offset = end
+
+    return heapq.merge(*traces.values())
+
 def write(traces, writer):
     packer = WritingPacker(writer)
     packer.pack('i', _format_version)
@@ -329,6 +392,7 @@ class read_file:
     def __init__(self, filename):
         self.filename = filename
         self.map = None
+        self.lost = {}
 
     def __enter__(self):
         self.file = open(self.filename, 'r+b')
@@ -341,6 +405,8 @@ class read_file:
         self.file.close()
 
     def get_traces(self):
+        if is_stream(self.map):
+            return read_stream(self.map, self.lost)
         return read(self.map)
 
 def write_to_file(filename, traces):
@@ -6,6 +6,7 @@ import re
 import os
 import math
 import subprocess
+import socket
 from itertools import ifilter
 from collections import defaultdict
 from operator import attrgetter
@@ -125,6 +126,9 @@ def mem_analys(args):
 
     with get_trace_reader(args) as reader:
         memory_analyzer.process_records(mallocs, reader.get_traces())
+        if args.fragmentation:
+            memory_analyzer.show_fragmentation(mallocs)
+            return
         memory_analyzer.show_results(mallocs,
             node_filters=node_filters,
             sorter=args.sort,
@@ -275,6 +279,27 @@ def extract(args):
         print("error: %s not found" % (elf_path))
         sys.exit(1)
 
+def receive(args):
+    ls = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    ls.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    ls.bind(('', args.port))
+    ls.listen(1)
+    print("Waiting for a trace stream (--trace-export=tcp:<host>:%d) ..." % args.port)
+    conn, addr = ls.accept()
+    total = 0
+    with open(args.tracefile, 'wb') as out:
+        try:
+            while True:
+                data = conn.recv(65536)
+                if not data:
+                    break
+                out.write(data)
+                total += len(data)
+        except KeyboardInterrupt:
+            pass
+    conn.close()
+    print("Received %d bytes from %s into %s" % (total, addr[0], args.tracefile))
+
 def prof_wait(args):
     show_profile(args, get_wait_profile)
 
@@ -422,6 +447,8 @@ def print_summary(args, printer=sys.stdout.write):
                 if timed:
                     timed_samples.append(timed)
 
+        lost = getattr(reader, 'lost', {})
+
     if args.timed:
         timed_samples.extend((timed_producer.finish()))
 
@@ -431,6 +458,9 @@ def print_summary(args, printer=sys.stdout.write):
 
     print "Collected %d samples spanning %s" % (count, prof.format_time(max_time - min_time))
 
+    if lost:
+        print "Lost %d samples, the exporter could not keep up" % sum(lost.values())
+
     max_name_len = reduce(max, map(lambda tp: len(tp.name), count_per_tp.iterkeys()))
     format = "  %%-%ds %%8s" % (max_name_len)
     print "\nTracepoint statistics:\n"
@@ -571,6 +601,15 @@ if __name__ == "__main__":
     cmd_extract.add_argument("-r", "--remote", action="store", help="remote node address:port")
     cmd_extract.set_defaults(func=extract)
 
+    cmd_receive = subparsers.add_parser("receive", help="receive a trace streamed by a running instance", description="""
+        Listens for a trace streamed by an OSv instance started with --trace-export=tcp:<host>:<port>,
+        and saves it until the instance closes the connection. The saved file can be used with the
+        other commands.
+        """)
+    add_trace_source_options(cmd_receive)
+    cmd_receive.add_argument("-p", "--port", action="store", type=int, default=9999, help="port to listen on")
+    cmd_receive.set_defaults(func=receive)
+
     cmd_pcap_dump = subparsers.add_parser("pcap-dump")
     add_trace_source_options(cmd_pcap_dump)
     cmd_pcap_dump.set_defaults(func=pcap_dump)
@@ -596,6 +635,8 @@ if __name__ == "__main__":
         nargs='*', help='groups allocations by given criteria')
     cmd_memory_analyzer.add_argument("--no-backtrace", action="store_false",
         default=True, dest='backtrace', help="never show backtrace")
+    cmd_memory_analyzer.add_argument("--fragmentation", action="store_true",
+        help="only summarize the space lost to rounding up, per size class")
     add_symbol_resolution_options(cmd_memory_analyzer)
     group = cmd_memory_analyzer.add_argument_group('backtrace options')
     add_backtrace_options(group)
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Compares named AF_UNIX stream sockets with loopback TCP, for bulk
+// throughput with a few write sizes, and for the round trip latency of
+// one-byte messages.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using _clock = std::chrono::high_resolution_clock;
+
+static const char* sock_path = "/tmp/misc-af-local.sock";
+static const int tcp_port = 7778;
+
+static int listen_on(bool unix_domain)
+{
+    int ls;
+    if (unix_domain) {
+        unlink(sock_path);
+        ls = socket(AF_UNIX, SOCK_STREAM, 0);
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, sock_path);
+        if (bind(ls, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror("bind");
+            exit(1);
+        }
+    } else {
+        ls = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(tcp_port);
+        if (bind(ls, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror("bind");
+            exit(1);
+        }
+    }
+    listen(ls, 1);
+    return ls;
+}
+
+static int connect_to(bool unix_domain)
+{
+    int s;
+    int r;
+    if (unix_domain) {
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, sock_path);
+        r = connect(s, (struct sockaddr*)&addr, sizeof(addr));
+    } else {
+        s = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(tcp_port);
+        r = connect(s, (struct sockaddr*)&addr, sizeof(addr));
+    }
+    if (r < 0) {
+        perror("connect");
+        exit(1);
+    }
+    return s;
+}
+
+// Returns MB/s
+static double throughput(bool unix_domain, size_t bufsize, size_t total)
+{
+    int ls = listen_on(unix_domain);
+    std::thread reader([&] {
+        int s = accept(ls, nullptr, nullptr);
+        std::vector<char> buf(bufsize);
+        while (read(s, buf.data(), buf.size()) > 0) {
+        }
+        close(s);
+    });
+    int s = connect_to(unix_domain);
+    std::vector<char> buf(bufsize, 'x');
+    auto start = _clock::now();
+    for (size_t sent = 0; sent < total; sent += bufsize) {
+        if (write(s, buf.data(), bufsize) != (ssize_t)bufsize) {
+            perror("write");
+            exit(1);
+        }
+    }
+    close(s);
+    reader.join();
+    auto sec = std::chrono::duration<double>(_clock::now() - start).count();
+    close(ls);
+    return total / sec / 1e6;
+}
+
+// Returns the average round trip, in microseconds
+static double latency(bool unix_domain, int rounds)
+{
+    int ls = listen_on(unix_domain);
+    std::thread echo([&] {
+        int s = accept(ls, nullptr, nullptr);
+        if (!unix_domain) {
+            int one = 1;
+            setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        char c;
+        while (read(s, &c, 1) == 1 && write(s, &c, 1) == 1) {
+        }
+        close(s);
+    });
+    int s = connect_to(unix_domain);
+    char c = 'x';
+    auto start = _clock::now();
+    for (int i = 0; i < rounds; i++) {
+        if (write(s, &c, 1) != 1 || read(s, &c, 1) != 1) {
+            perror("ping");
+            exit(1);
+        }
+    }
+    auto usec = std::chrono::duration<double, std::micro>(_clock::now() - start).count();
+    close(s);
+    echo.join();
+    close(ls);
+    return usec / rounds;
+}
+
+int main(int argc, char** argv)
+{
+    size_t total = 1 << 30;
+    int rounds = 100000;
+    if (argc > 1) {
+        total = atol(argv[1]) << 20;
+    }
+
+    for (size_t bufsize : { 4096, 65536, 1 << 20 }) {
+        printf("%7zu byte writes: AF_UNIX %8.0f MB/s, loopback TCP %8.0f MB/s\n",
+            bufsize, throughput(true, bufsize, total),
+            throughput(false, bufsize, total));
+    }
+    printf("round trip: AF_UNIX %.2f usecs, loopback TCP %.2f usecs\n",
+        latency(true, rounds), latency(false, rounds));
+    unlink(sock_path);
+    return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measures callout_reset()/callout_stop() throughput with as many armed
+// callouts as a busy server has TCP timers: every "connection" owns a
+// retransmit-like and a delayed-ACK-like callout, each protected by the
+// connection's lock, which are constantly rearmed and stopped without
+// ever being allowed to fire.
+
+#include <osv/sched.hh>
+#include <osv/clock.hh>
+#include <osv/latch.hh>
+#include <bsd/porting/callout.h>
+#include <bsd/porting/netport.h>
+#include <bsd/porting/sync_stub.h>
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using _clock = std::chrono::high_resolution_clock;
+
+struct connection {
+    struct mtx lock;
+    struct callout rexmt;
+    struct callout delack;
+};
+
+static std::atomic<unsigned> fired_wrong_cpu;
+static std::atomic<unsigned> fired;
+
+struct fire_arg {
+    struct callout* c;
+    unsigned cpu;
+};
+
+static void never(void* arg)
+{
+    abort();
+}
+
+static void check_cpu(void* arg)
+{
+    auto fa = static_cast<fire_arg*>(arg);
+    if (sched::cpu::current()->id != fa->cpu) {
+        fired_wrong_cpu++;
+    }
+    fired++;
+}
+
+static double test_reset_stop(unsigned nthreads, unsigned nconns, unsigned iterations)
+{
+    std::vector<connection> conns(nconns);
+    for (auto& c : conns) {
+        mtx_init(&c.lock, "conn", NULL, MTX_DEF);
+        callout_init_mtx(&c.rexmt, &c.lock, 0);
+        callout_init_mtx(&c.delack, &c.lock, 0);
+    }
+
+    thread_barrier starting_line(nthreads + 1);
+    std::vector<sched::thread*> threads;
+    unsigned per_thread = nconns / nthreads;
+    for (unsigned i = 0; i < nthreads; i++) {
+        auto first = &conns[i * per_thread];
+        threads.push_back(new sched::thread([=, &starting_line] {
+            starting_line.arrive();
+            for (unsigned it = 0; it < iterations; it++) {
+                for (unsigned j = 0; j < per_thread; j++) {
+                    auto& c = first[j];
+                    mtx_lock(&c.lock);
+                    // Timeouts are long enough never to fire during the test
+                    callout_reset(&c.rexmt, 200 * hz + j % 64, never, &c);
+                    if (it % 2) {
+                        callout_stop(&c.delack);
+                    } else {
+                        callout_reset(&c.delack, 100 * hz, never, &c);
+                    }
+                    mtx_unlock(&c.lock);
+                }
+            }
+        }, sched::thread::attr().pin(sched::cpus[i % sched::cpus.size()])));
+    }
+    for (auto t : threads) {
+        t->start();
+    }
+    starting_line.arrive();
+    auto start = _clock::now();
+    for (auto t : threads) {
+        t->join();
+        delete t;
+    }
+    auto sec = std::chrono::duration<double>(_clock::now() - start).count();
+
+    for (auto& c : conns) {
+        callout_drain(&c.rexmt);
+        callout_drain(&c.delack);
+        mtx_destroy(&c.lock);
+    }
+    // two operations per connection per iteration
+    return 2.0 * per_thread * nthreads * iterations / sec;
+}
+
+// Callouts armed on a CPU must fire there
+static void test_fire_cpu(unsigned per_cpu)
+{
+    auto ncpus = sched::cpus.size();
+    std::vector<struct callout> callouts(ncpus * per_cpu);
+    std::vector<fire_arg> args(callouts.size());
+    fired = 0;
+    fired_wrong_cpu = 0;
+
+    std::vector<sched::thread*> threads;
+    for (unsigned i = 0; i < ncpus; i++) {
+        threads.push_back(new sched::thread([&, i] {
+            for (unsigned j = i * per_cpu; j < (i + 1) * per_cpu; j++) {
+                callout_init(&callouts[j], 1);
+                args[j] = { &callouts[j], sched::cpu::current()->id };
+                callout_reset(&callouts[j], 1 + j % 50, check_cpu, &args[j]);
+            }
+        }, sched::thread::attr().pin(sched::cpus[i])));
+    }
+    for (auto t : threads) {
+        t->start();
+    }
+    for (auto t : threads) {
+        t->join();
+        delete t;
+    }
+    while (fired < callouts.size()) {
+        sched::thread::sleep(std::chrono::milliseconds(10));
+    }
+    for (auto& c : callouts) {
+        callout_drain(&c);
+    }
+    printf("fired %u callouts, %u on the wrong CPU\n",
+        fired.load(), fired_wrong_cpu.load());
+    assert(fired_wrong_cpu == 0);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned nconns = 100000;
+    unsigned iterations = 20;
+    if (argc > 1) {
+        nconns = atoi(argv[1]);
+    }
+
+    test_fire_cpu(1000);
+
+    for (unsigned nthreads = 1; nthreads <= sched::cpus.size(); nthreads *= 2) {
+        auto rate = test_reset_stop(nthreads, nconns, iterations);
+        printf("%u connections, %u threads: %.0f reset/stop per second\n",
+            nconns, nthreads, rate);
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measures the cost of reading the time: the kernel's uptime clock, which
+// the scheduler and the tracepoints use, and clock_gettime() with the
+// monotonic and realtime clocks. Each is read in a loop by one thread, and
+// then by one thread on every cpu at the same time, to show any sharing
+// between cpus.
+
+#include <osv/clock.hh>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+
+using _clock = std::chrono::high_resolution_clock;
+
+// Returns ns per call
+static double measure(std::function<void ()> read, unsigned long count)
+{
+    auto start = _clock::now();
+    for (unsigned long i = 0; i < count; i++) {
+        read();
+    }
+    return std::chrono::duration<double, std::nano>(_clock::now() - start).count() / count;
+}
+
+// Returns the average ns per call over @nthreads threads, one per cpu
+static double measure_concurrent(std::function<void ()> read, unsigned long count,
+    unsigned nthreads)
+{
+    std::vector<double> results(nthreads);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < nthreads; i++) {
+        threads.emplace_back([&, i] {
+            cpu_set_t cs;
+            CPU_ZERO(&cs);
+            CPU_SET(i, &cs);
+            pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+            results[i] = measure(read, count);
+        });
+    }
+    double sum = 0;
+    for (unsigned i = 0; i < nthreads; i++) {
+        threads[i].join();
+        sum += results[i];
+    }
+    return sum / nthreads;
+}
+
+// Checks the clock never goes backwards, on any cpu, while threads
+// migrate between the cpus
+static bool check_monotonic(unsigned long count, unsigned nthreads)
+{
+    std::atomic<bool> ok(true);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < nthreads; i++) {
+        threads.emplace_back([&] {
+            auto last = osv::clock::uptime::now();
+            for (unsigned long j = 0; j < count; j++) {
+                auto now = osv::clock::uptime::now();
+                if (now < last) {
+                    ok = false;
+                }
+                last = now;
+                if (j % 1000 == 0) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long count = 10000000;
+    if (argc > 1) {
+        count = atol(argv[1]);
+    }
+    unsigned ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    struct {
+        const char* name;
+        std::function<void ()> read;
+    } clocks[] = {
+        { "osv::clock::uptime::now()", [] { osv::clock::uptime::now(); } },
+        { "clock_gettime(MONOTONIC)", [] {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+        } },
+        { "clock_gettime(REALTIME)", [] {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+        } },
+    };
+
+    printf("%-28s %12s %12s\n", "", "1 thread", "all cpus");
+    for (auto& c : clocks) {
+        printf("%-28s %9.1f ns %9.1f ns\n", c.name, measure(c.read, count),
+            measure_concurrent(c.read, count, ncpus));
+    }
+
+    bool ok = check_monotonic(count / 10, ncpus * 2);
+    printf("uptime clock %s monotonic across cpus\n", ok ? "is" : "is NOT");
+    return ok ? 0 : 1;
+}
@@ -21,6 +21,7 @@
 #include <mutex>
 #include <memory>
 #include <cstdlib>
+#include <malloc.h>
 
 unsigned int threads = 2;
 using namespace std::chrono;
@@ -164,6 +165,23 @@ void do_run(std::function <void ()> fn, std::string name)
     std::cout << name << ",free,"   << fmin << "," << fmax << "," << fmean << "," << fstdev << "\n";
 }
 
+// Internal fragmentation of every request size in (from, to]: how much of
+// what malloc() really hands out (malloc_usable_size()) is not asked for.
+// Printed as "frag,<from>-<to>,<average %>,<worst %>".
+static void report_fragmentation(long from, long to)
+{
+    double sum = 0, worst = 0;
+    for (long len = from + 1; len <= to; len++) {
+        void* p = malloc(len);
+        auto usable = malloc_usable_size(p);
+        free(p);
+        double waste = 100.0 * (usable - len) / usable;
+        sum += waste;
+        worst = std::max(worst, waste);
+    }
+    std::cout << "frag," << from << "-" << to << "," << sum / (to - from) << "," << worst << "\n";
+}
+
 static constexpr long up_max = 1 << 20;
 static constexpr long smp_max = 256 << 10;
 
@@ -177,9 +195,18 @@ int main(int argc, char **argv)
         threads = atoi(argv[1]);
     }
 
+    for (long i = 8; i < 64 << 10; i <<= 1) {
+        report_fragmentation(i, i << 1);
+    }
+
     for (long i = 8; i <= up_max; i <<= 1) {
         do_run([&] { measure_up([&] { return i; }); }, "up," + std::to_string(i));
     }
+    // Sizes which are not a power of two, where finer size classes help
+    for (long i = 16; i < up_max; i <<= 1) {
+        long len = i + i / 2;
+        do_run([&] { measure_up([&] { return len; }); }, "up," + std::to_string(len));
+    }
     do_run([&] { measure_up([&] { return distribution(generator); }); },  "up,random");
 
     for (long i = 8; i <= smp_max; i <<= 1) {
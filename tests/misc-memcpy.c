@@ -14,9 +14,11 @@
 #include <limits.h>
 
 
-#define MIN_SIZE 4
-#define MAX_SIZE (32 << 10)
+// Each run does at most LOOPS calls, and moves about BYTES bytes, so the
+// large sizes do not take forever. The sizes past the cache sizes show the
+// non-temporal copies.
 #define LOOPS 1000000
+#define BYTES (256 << 20)
 #define RUNS 30
 
 static float vector[RUNS];
@@ -28,7 +30,16 @@ static unsigned long gtime()
     return tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
 }
 
-void statistics(const char *name, int size)
+static int loops(size_t size)
+{
+    if (size <= BYTES / LOOPS) {
+        return LOOPS;
+    }
+    return BYTES / size;
+}
+
+// Prints the ns per call, and the GB/s at the mean
+void statistics(const char *name, size_t size)
 {
     float min, max, mean, stdev;
     min = INT_MAX;
@@ -55,7 +66,8 @@ void statistics(const char *name, int size)
     }
     stdev = sqrtf(stdev / RUNS);
 
-    printf("%s,%d,%f,%f,%f,%f\n", name, size, min, max, mean, stdev);
+    printf("%s,%zu,%f,%f,%f,%f,%.2f\n", name, size, min, max, mean, stdev,
+            mean > 0 ? size / mean : 0);
 
 }
 
@@ -63,18 +75,18 @@ void test_memcpy(size_t size)
 {
     void *src = malloc(size);
     void *dest= malloc(size);
-    int r, i;
+    int r, i, n = loops(size);
 
     memset(src, 'c', size);
 
     for (r = 0; r < RUNS; ++r) {
         unsigned long t1 = gtime();
-        for (i= 0; i < LOOPS; ++i) {
+        for (i= 0; i < n; ++i) {
             memcpy(dest, src, size);
         }
         unsigned long t2 = gtime();
 
-        vector[r] = (float)(t2-t1) / LOOPS;
+        vector[r] = (float)(t2-t1) / n;
     }
 
     statistics("memcpy", size);
@@ -86,17 +98,17 @@ void test_memcpy(size_t size)
 void test_memset(size_t size)
 {
     void *buf= malloc(size);
-    int r, i;
+    int r, i, n = loops(size);
 
 
     for (r = 0; r < RUNS; ++r) {
         unsigned long t1 = gtime();
-        for (i= 0; i < LOOPS; ++i) {
+        for (i= 0; i < n; ++i) {
             memset(buf, 'c', size);
         }
         unsigned long t2 = gtime();
 
-        vector[r] = (float)(t2-t1) / LOOPS;
+        vector[r] = (float)(t2-t1) / n;
     }
 
     statistics("memset", size);
@@ -104,12 +116,36 @@ void test_memset(size_t size)
     free(buf);
 }
 
+// Moves the buffer up by a few bytes, so memmove() has to copy backwards
+void test_memmove(size_t size)
+{
+    char *buf = malloc(size + 64);
+    int r, i, n = loops(size);
+
+    memset(buf, 'c', size + 64);
+
+    for (r = 0; r < RUNS; ++r) {
+        unsigned long t1 = gtime();
+        for (i= 0; i < n; ++i) {
+            memmove(buf + 8, buf, size);
+        }
+        unsigned long t2 = gtime();
+
+        vector[r] = (float)(t2-t1) / n;
+    }
+
+    statistics("memmove", size);
+
+    free(buf);
+}
+
 int main()
 {
     size_t i;
     size_t sizes[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 15, 16, 17,
             31, 32, 33, 64, 128, 255, 256, 257, 512, 1024, 2048,
-            4096, 8192, 16386, 32768
+            4096, 8192, 16386, 32768, 64 << 10, 256 << 10, 1 << 20,
+            4 << 20, 16 << 20, 64 << 20
     };
     size_t nsizes = sizeof(sizes) / sizeof(*sizes);
     for (i = 0; i < nsizes; ++i) {
@@ -120,6 +156,10 @@ int main()
         test_memset(sizes[i]);
     }
 
+    for (i = 0; i < nsizes; ++i) {
+        test_memmove(sizes[i]);
+    }
+
 
     return 0;
 }
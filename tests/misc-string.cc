@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measures strlen(), strchr(), strcmp(), memchr(), memrchr() and memcmp(),
+// in the C and SSE2 versions, on strings from 8 bytes to 64K. Each
+// call runs over the whole string: nothing to find, or nothing different.
+// Prints the ns per call and the GB/s for each.
+//
+// misc-string.so [bytes per measurement]
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+extern "C" {
+size_t strlen_base(const char *s);
+size_t strlen_sse2(const char *s);
+char *strchr_base(const char *s, int c);
+char *strchr_sse2(const char *s, int c);
+int strcmp_base(const char *l, const char *r);
+int strcmp_sse2(const char *l, const char *r);
+void *memchr_base(const void *s, int c, size_t n);
+void *memchr_sse2(const void *s, int c, size_t n);
+void *memrchr_base(const void *s, int c, size_t n);
+void *memrchr_sse2(const void *s, int c, size_t n);
+int memcmp_base(const void *l, const void *r, size_t n);
+int memcmp_sse2(const void *l, const void *r, size_t n);
+}
+
+using _clock = std::chrono::high_resolution_clock;
+
+// Keeps the calls from being optimized away
+static volatile size_t sink;
+
+// Returns ns per call
+static double measure(std::function<size_t ()> call, unsigned long count)
+{
+    auto start = _clock::now();
+    for (unsigned long i = 0; i < count; i++) {
+        sink = call();
+    }
+    return std::chrono::duration<double, std::nano>(_clock::now() - start).count() / count;
+}
+
+struct variant {
+    std::string name;
+    size_t (*strlen)(const char *s);
+    char *(*strchr)(const char *s, int c);
+    int (*strcmp)(const char *l, const char *r);
+    void *(*memchr)(const void *s, int c, size_t n);
+    void *(*memrchr)(const void *s, int c, size_t n);
+    int (*memcmp)(const void *l, const void *r, size_t n);
+};
+
+int main(int argc, char** argv)
+{
+    size_t bytes = 1 << 30;
+    if (argc > 1) {
+        bytes = atol(argv[1]);
+    }
+
+    std::vector<variant> variants = {
+        { "C", strlen_base, strchr_base, strcmp_base, memchr_base, memrchr_base, memcmp_base },
+        { "SSE2", strlen_sse2, strchr_sse2, strcmp_sse2, memchr_sse2, memrchr_sse2, memcmp_sse2 },
+    };
+
+    const size_t max_size = 64 << 10;
+    // The second string starts at a different alignment, as is usual
+    auto a = static_cast<char*>(malloc(max_size + 1));
+    auto b = static_cast<char*>(malloc(max_size + 2)) + 1;
+
+    printf("%-8s %-6s %7s %12s %10s\n", "", "", "bytes", "ns/call", "GB/s");
+    for (size_t size = 8; size <= max_size; size *= 4) {
+        memset(a, 'a', size);
+        a[size] = 0;
+        memcpy(b, a, size + 1);
+        auto count = bytes / size;
+        for (auto& v : variants) {
+            struct {
+                const char* name;
+                std::function<size_t ()> call;
+            } functions[] = {
+                { "strlen", [&] { return v.strlen(a); } },
+                { "strchr", [&] { return size_t(v.strchr(a, 'b')); } },
+                { "strcmp", [&] { return size_t(v.strcmp(a, b)); } },
+                { "memchr", [&] { return size_t(v.memchr(a, 'b', size)); } },
+                { "memrchr", [&] { return size_t(v.memrchr(a, 'b', size)); } },
+                { "memcmp", [&] { return size_t(v.memcmp(a, b, size)); } },
+            };
+            for (auto& f : functions) {
+                auto ns = measure(f.call, count);
+                printf("%-8s %-6s %7zu %12.1f %10.2f\n", f.name, v.name.c_str(),
+                    size, ns, size / ns);
+            }
+        }
+    }
+    return 0;
+}
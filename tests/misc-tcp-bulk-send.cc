@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measures bulk TCP sends to a host that discards the data, with TCP
+// segmentation offload on eth0, with the segmentation done in software
+// just before the driver (GSO), and with neither, for a few write sizes.
+// With TSO or GSO, the data is copied into 16K clusters and goes through
+// TCP and IP 64K at a time. Prints the MB/s, the packets/s on the wire,
+// and the CPU time spent per GB sent, which counts all the CPUs' busy
+// time, so the network stack's threads are in it too.
+//
+// On the host, before running this test:
+//
+// $ nc -lk 9999 > /dev/null
+//
+// GSO is meant for hosts without TSO, e.g. QEMU with
+// -device virtio-net-pci,host_tso4=off, where the TSO lines are skipped.
+//
+// misc-tcp-bulk-send.so [host address] [port] [megabytes per measurement]
+
+#include <bsd/porting/networking.hh>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include <chrono>
+#include <vector>
+
+using _clock = std::chrono::high_resolution_clock;
+
+static double cpu_seconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct result {
+    double mb_per_sec;
+    double kpackets_per_sec;
+    double cpu_sec_per_gb;
+};
+
+static bool measure(const sockaddr_in& addr, size_t write_size, size_t total,
+        const std::vector<char>& buf, result& r)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0 || connect(s, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        return false;
+    }
+    int mss = 0;
+    socklen_t len = sizeof(mss);
+    if (getsockopt(s, IPPROTO_TCP, TCP_MAXSEG, &mss, &len) < 0 || mss <= 0) {
+        perror("TCP_MAXSEG");
+        close(s);
+        return false;
+    }
+    auto start = _clock::now();
+    auto cpu_start = cpu_seconds();
+    size_t done = 0;
+    while (done < total) {
+        auto n = write(s, buf.data(), std::min(write_size, total - done));
+        if (n <= 0) {
+            perror("write");
+            close(s);
+            return false;
+        }
+        done += n;
+    }
+    // Wait for the peer to have it all, so what is still queued counts
+    shutdown(s, SHUT_WR);
+    char c;
+    while (read(s, &c, 1) > 0);
+    auto secs = std::chrono::duration<double>(_clock::now() - start).count();
+    auto cpu = cpu_seconds() - cpu_start;
+    close(s);
+    r.mb_per_sec = total / secs / 1e6;
+    r.kpackets_per_sec = (total + mss - 1) / mss / secs / 1e3;
+    r.cpu_sec_per_gb = cpu / (total / 1e9);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    const char* host = "192.168.122.1";
+    int port = 9999;
+    size_t total = size_t(1) << 30;
+    if (argc > 1) {
+        host = argv[1];
+    }
+    if (argc > 2) {
+        port = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        total = atol(argv[3]) << 20;
+    }
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (!inet_aton(host, &addr.sin_addr)) {
+        printf("FAIL: bad address %s\n", host);
+        return 1;
+    }
+
+    std::vector<char> buf(256 << 10, 'A');
+
+    struct {
+        const char* name;
+        bool tso, gso;
+    } modes[] = {
+        { "TSO", true, true },
+        { "GSO", false, true },
+        { "none", false, false },
+    };
+
+    // Only EOPNOTSUPP means the interface lacks the capability; any other
+    // error means the toggle is broken, and the rows would measure the
+    // wrong mode.
+    auto set_mode = [] (bool tso, bool gso) {
+        int error = osv::if_set_tso("eth0", tso);
+        if (!error) {
+            error = osv::if_set_gso("eth0", gso);
+        }
+        if (error && error != EOPNOTSUPP) {
+            printf("FAIL: cannot set TSO %d GSO %d on eth0: %s\n",
+                tso, gso, strerror(error));
+        }
+        return error;
+    };
+
+    bool failed = false;
+    printf("%-6s %10s %10s %10s %12s\n", "", "write", "MB/s", "kpkts/s", "CPU s/GB");
+    for (auto& mode : modes) {
+        int error = set_mode(mode.tso, mode.gso);
+        if (error == EOPNOTSUPP) {
+            printf("%-6s (not available on eth0)\n", mode.name);
+            continue;
+        } else if (error) {
+            failed = true;
+            continue;
+        }
+        for (size_t write_size : { 16 << 10, 64 << 10, 256 << 10 }) {
+            result r;
+            if (!measure(addr, write_size, total, buf, r)) {
+                failed = true;
+                break;
+            }
+            printf("%-6s %10zu %10.1f %10.1f %12.3f\n", mode.name,
+                write_size, r.mb_per_sec, r.kpackets_per_sec, r.cpu_sec_per_gb);
+        }
+    }
+    // Back to the defaults: TSO where the host has it, GSO otherwise
+    int error = set_mode(true, true);
+    if (error == EOPNOTSUPP) {
+        error = set_mode(false, true);
+    }
+    if (error) {
+        failed = true;
+    }
+
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed ? 1 : 0;
+}
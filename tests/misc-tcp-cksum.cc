@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measures TCP throughput over the loopback, with the checksums offloaded,
+// which on the loopback means they are not computed at all, and without:
+// then the sender sums the data while copying it in from write(), and the
+// receiver checks the sums. The data is checked too. Each is measured with
+// lo0's own MTU and with an Ethernet one, where a TCP segment is much
+// smaller than a send buffer cluster; the MSS column shows what TCP used.
+//
+// misc-tcp-cksum.so [megabytes per measurement]
+
+#include <bsd/porting/networking.hh>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using _clock = std::chrono::high_resolution_clock;
+
+// The data is this pattern over and over, so it can be checked whatever
+// the sizes of the reads
+static const size_t period = 251;
+
+static std::vector<char> pattern;
+
+static bool failed;
+
+// The MSS of the last connection measure() made
+static int mss;
+
+static int listen_on_loopback(sockaddr_in& addr)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (s < 0 || bind(s, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+            listen(s, 1) < 0 || getsockname(s, (sockaddr*)&addr, &len) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    return s;
+}
+
+static void receive(int ls, size_t total)
+{
+    int s = accept(ls, nullptr, nullptr);
+    std::vector<char> buf(64 << 10);
+    size_t done = 0;
+    while (done < total) {
+        auto n = read(s, buf.data(), buf.size());
+        if (n <= 0) {
+            perror("read");
+            failed = true;
+            break;
+        }
+        if (memcmp(buf.data(), pattern.data() + done % period, n)) {
+            printf("FAIL: bad data after %zu bytes\n", done);
+            failed = true;
+        }
+        done += n;
+    }
+    close(s);
+}
+
+// Returns MB/s
+static double measure(size_t write_size, size_t total)
+{
+    sockaddr_in addr;
+    int ls = listen_on_loopback(addr);
+    std::thread receiver([=] { receive(ls, total); });
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(s, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    socklen_t optlen = sizeof(mss);
+    getsockopt(s, IPPROTO_TCP, TCP_MAXSEG, &mss, &optlen);
+    auto start = _clock::now();
+    size_t done = 0;
+    while (done < total) {
+        auto n = write(s, pattern.data() + done % period,
+                std::min(write_size, total - done));
+        if (n <= 0) {
+            perror("write");
+            exit(1);
+        }
+        done += n;
+    }
+    receiver.join();
+    auto secs = std::chrono::duration<double>(_clock::now() - start).count();
+    close(s);
+    close(ls);
+    return total / secs / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+    size_t total = size_t(1) << 30;
+    if (argc > 1) {
+        total = atol(argv[1]) << 20;
+    }
+
+    const size_t max_write = 256 << 10;
+    pattern.resize(max_write + period);
+    for (size_t i = 0; i < pattern.size(); i++) {
+        pattern[i] = i % period;
+    }
+
+    ifreq ifr = {};
+    strcpy(ifr.ifr_name, "lo0");
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0 || ioctl(s, SIOCGIFMTU, &ifr) < 0) {
+        perror("SIOCGIFMTU");
+        return 1;
+    }
+    close(s);
+    const int lo_mtu = ifr.ifr_mtu;
+
+    printf("%-10s %6s %6s %10s %10s\n", "checksums", "MTU", "MSS", "write", "MB/s");
+    for (int mtu : { lo_mtu, 1500 }) {
+        if (osv::if_set_mtu("lo0", mtu)) {
+            printf("FAIL: cannot set the MTU of lo0 to %d\n", mtu);
+            failed = true;
+            break;
+        }
+        for (bool offload : { true, false }) {
+            if (osv::if_set_csum_offload("lo0", offload)) {
+                printf("FAIL: cannot set checksum offload on lo0\n");
+                failed = true;
+                break;
+            }
+            for (size_t write_size : { 1 << 10, 16 << 10, 64 << 10, 256 << 10 }) {
+                auto mb_per_sec = measure(write_size, total);
+                printf("%-10s %6d %6d %10zu %10.1f\n",
+                    offload ? "offloaded" : "software", mtu, mss,
+                    write_size, mb_per_sec);
+            }
+        }
+    }
+    if (osv::if_set_csum_offload("lo0", true)) {
+        printf("FAIL: cannot restore checksum offload on lo0\n");
+        failed = true;
+    }
+    if (osv::if_set_mtu("lo0", lo_mtu)) {
+        printf("FAIL: cannot restore the MTU of lo0\n");
+        failed = true;
+    }
+
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measures how many TCP connections per second a server accepts over the
+// loopback, from 1 up to all the CPUs, with the server threads all accepting
+// on one listening socket. On each CPU there is a server thread, looping
+// accepting a connection and closing it, and a client thread, connecting and
+// closing as fast as it can, so the handshakes complete all over. Prints the
+// connections/s and the CPU time, of all the CPUs, spent per connection.
+//
+// misc-tcp-conn-rate.so [seconds per measurement]
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using _clock = std::chrono::high_resolution_clock;
+
+static std::atomic<bool> running;
+static std::atomic<unsigned long> accepted;
+static std::atomic<unsigned long> failed_connects;
+
+static double cpu_seconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void pin(unsigned cpu)
+{
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    CPU_SET(cpu, &cs);
+    pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+}
+
+static int listen_on_loopback(sockaddr_in& addr)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (s < 0 || bind(s, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+            listen(s, 1024) < 0 || getsockname(s, (sockaddr*)&addr, &len) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    return s;
+}
+
+static void server(int ls, unsigned cpu)
+{
+    pin(cpu);
+    while (running) {
+        int s = accept(ls, nullptr, nullptr);
+        if (s < 0) {
+            break;
+        }
+        close(s);
+        accepted++;
+    }
+}
+
+static bool connect_once(const sockaddr_in& addr)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    struct linger lg = { 1, 0 };    // don't fill up TIME_WAIT
+    setsockopt(s, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    bool ok = connect(s, (sockaddr*)&addr, sizeof(addr)) == 0;
+    close(s);
+    return ok;
+}
+
+static void client(sockaddr_in addr, unsigned cpu)
+{
+    pin(cpu);
+    while (running) {
+        if (!connect_once(addr)) {
+            failed_connects++;
+        }
+    }
+}
+
+struct result {
+    double conns_per_sec;
+    double cpu_us_per_conn;
+};
+
+static result measure(unsigned nthreads, int seconds)
+{
+    sockaddr_in addr;
+    int ls = listen_on_loopback(addr);
+    running = true;
+    accepted = 0;
+    std::vector<std::thread> servers, clients;
+    for (unsigned i = 0; i < nthreads; i++) {
+        servers.emplace_back(server, ls, i);
+    }
+    for (unsigned i = 0; i < nthreads; i++) {
+        clients.emplace_back(client, addr, i);
+    }
+
+    auto start = _clock::now();
+    auto cpu_start = cpu_seconds();
+    auto accepted_start = accepted.load();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    auto n = accepted - accepted_start;
+    auto secs = std::chrono::duration<double>(_clock::now() - start).count();
+    auto cpu = cpu_seconds() - cpu_start;
+
+    running = false;
+    for (auto& t : clients) {
+        t.join();
+    }
+    // Wake up the servers still blocked in accept()
+    for (unsigned i = 0; i < nthreads; i++) {
+        connect_once(addr);
+    }
+    for (auto& t : servers) {
+        t.join();
+    }
+    close(ls);
+    return { n / secs, n ? cpu / n * 1e6 : 0 };
+}
+
+int main(int argc, char** argv)
+{
+    int seconds = 5;
+    if (argc > 1) {
+        seconds = atoi(argv[1]);
+    }
+    unsigned ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    bool failed = false;
+    printf("%7s %14s %14s\n", "threads", "connections/s", "CPU us/conn");
+    for (unsigned n = 1; n <= ncpus; n *= 2) {
+        auto r = measure(n, seconds);
+        printf("%7u %14.0f %14.1f\n", n, r.conns_per_sec, r.cpu_us_per_conn);
+        if (r.conns_per_sec == 0) {
+            printf("FAIL: no connections accepted\n");
+            failed = true;
+        }
+    }
+    if (failed_connects) {
+        printf("%lu connects failed\n", failed_connects.load());
+    }
+
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+//
+// Measures TCP round trip latency with small messages, with the socket
+// sleeping until the interface's interrupt wakes it up, and with the socket
+// busy polling the interface (SO_BUSY_POLL). Run an echo server on the host:
+//
+// $ socat tcp-listen:7777,fork,reuseaddr exec:cat
+//
+// and point this test at it:
+//
+// misc-tcp-pingpong.so 192.168.122.1 [port] [round trips] [busy poll usecs]
+//
+// Without an address it runs its own echo server over loopback, which has
+// no interrupts to avoid, so it only serves as a baseline.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+using _clock = std::chrono::high_resolution_clock;
+
+static void echo_server(int ls)
+{
+    int s = accept(ls, nullptr, nullptr);
+    if (s < 0) {
+        perror("accept");
+        return;
+    }
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    char buf[64];
+    ssize_t r;
+    while ((r = read(s, buf, sizeof(buf))) > 0) {
+        if (write(s, buf, r) != r) {
+            break;
+        }
+    }
+    close(s);
+}
+
+static int listen_loopback(int port)
+{
+    int ls = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(ls, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(ls, 1) < 0) {
+        perror("bind/listen");
+        exit(1);
+    }
+    return ls;
+}
+
+static void test(const char* host, int port, int rounds, int busy_poll)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (setsockopt(s, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) < 0) {
+        perror("SO_BUSY_POLL");
+        exit(1);
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(host);
+    addr.sin_port = htons(port);
+    if (connect(s, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+
+    std::vector<double> rtt;
+    rtt.reserve(rounds);
+    char c = 'x';
+    // The first round trips warm up caches and the connection
+    for (int i = -rounds / 10; i < rounds; i++) {
+        auto start = _clock::now();
+        if (write(s, &c, 1) != 1 || read(s, &c, 1) != 1) {
+            perror("ping");
+            exit(1);
+        }
+        auto usec = std::chrono::duration<double, std::micro>(_clock::now() - start).count();
+        if (i >= 0) {
+            rtt.push_back(usec);
+        }
+    }
+    close(s);
+
+    std::sort(rtt.begin(), rtt.end());
+    double sum = 0;
+    for (auto x : rtt) {
+        sum += x;
+    }
+    auto pct = [&] (double p) { return rtt[std::min<size_t>(rtt.size() - 1, rtt.size() * p)]; };
+    printf("busy poll %3d usecs: round trip avg %7.1f  min %7.1f  "
+        "50%% %7.1f  99%% %7.1f  99.9%% %7.1f usecs\n",
+        busy_poll, sum / rtt.size(), rtt.front(), pct(0.5), pct(0.99), pct(0.999));
+}
+
+int main(int argc, char** argv)
+{
+    const char* host = nullptr;
+    int port = 7777;
+    int rounds = 100000;
+    int busy_poll = 50;
+    if (argc > 1) {
+        host = argv[1];
+    }
+    if (argc > 2) {
+        port = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        rounds = atoi(argv[3]);
+    }
+    if (argc > 4) {
+        busy_poll = atoi(argv[4]);
+    }
+
+    for (int usecs : { 0, busy_poll }) {
+        if (host) {
+            test(host, port, rounds, usecs);
+        } else {
+            int ls = listen_loopback(port);
+            std::thread server(echo_server, ls);
+            test("127.0.0.1", port, rounds, usecs);
+            server.join();
+            close(ls);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measures the rate at which a multi-threaded server accepts connections
+// over loopback, with all its threads accepting on one shared listening
+// socket, and with one SO_REUSEPORT listening socket per thread.
+//
+// Each server thread is pinned to a CPU, and loops accepting a connection,
+// reading its request byte, answering it and closing it. Client threads
+// connect, send a byte, wait for the answer and close, as fast as they can.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using _clock = std::chrono::high_resolution_clock;
+
+static std::atomic<bool> running;
+static std::atomic<unsigned> servers_left;
+
+static int listen_on(int port, bool reuseport)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (reuseport && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        perror("SO_REUSEPORT");
+        exit(1);
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(s, 1024) < 0) {
+        perror("bind/listen");
+        exit(1);
+    }
+    return s;
+}
+
+static void pin(unsigned cpu)
+{
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    CPU_SET(cpu, &cs);
+    pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+}
+
+static void server(int ls, unsigned cpu, unsigned long* count)
+{
+    pin(cpu);
+    char c;
+    while (running) {
+        int s = accept(ls, nullptr, nullptr);
+        if (s < 0) {
+            break;
+        }
+        if (read(s, &c, 1) == 1) {
+            write(s, &c, 1);
+        }
+        close(s);
+        ++*count;
+    }
+    servers_left--;
+}
+
+// Doesn't wait for the answer if @wait is false, as nobody may be left
+// accepting on the listener the connection lands on.
+static bool connect_once(int port, bool wait = true)
+{
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    char c = 'x';
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    struct linger lg = { 1, 0 };    // don't fill up TIME_WAIT
+    setsockopt(s, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    bool ok = connect(s, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+              (!wait || (write(s, &c, 1) == 1 && read(s, &c, 1) == 1));
+    close(s);
+    return ok;
+}
+
+static void client(int port)
+{
+    while (running) {
+        connect_once(port);
+    }
+}
+
+// Returns the connection rate, and each server thread's share in @counts
+static double test(unsigned nthreads, bool reuseport, int port, int seconds,
+    std::vector<unsigned long>& counts)
+{
+    std::vector<int> listeners;
+    for (unsigned i = 0; i < (reuseport ? nthreads : 1); i++) {
+        listeners.push_back(listen_on(port, reuseport));
+    }
+    counts.assign(nthreads, 0);
+
+    running = true;
+    servers_left = nthreads;
+    std::vector<std::thread> servers, clients;
+    for (unsigned i = 0; i < nthreads; i++) {
+        servers.emplace_back(server, listeners[i % listeners.size()], i,
+                             &counts[i]);
+    }
+    for (unsigned i = 0; i < nthreads; i++) {
+        clients.emplace_back(client, port);
+    }
+
+    auto start = _clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running = false;
+    for (auto& t : clients) {
+        t.join();
+    }
+    auto sec = std::chrono::duration<double>(_clock::now() - start).count();
+    // Wake up the servers still blocked in accept(). Connections are
+    // hashed over the listeners, so keep connecting until all are gone.
+    while (servers_left) {
+        connect_once(port, false);
+    }
+    for (auto& t : servers) {
+        t.join();
+    }
+    for (auto ls : listeners) {
+        close(ls);
+    }
+
+    unsigned long total = 0;
+    for (auto c : counts) {
+        total += c;
+    }
+    return total / sec;
+}
+
+int main(int argc, char** argv)
+{
+    int seconds = 5;
+    int port = 7777;
+    if (argc > 1) {
+        seconds = atoi(argv[1]);
+    }
+    unsigned ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (unsigned n = 1; n <= ncpus; n *= 2) {
+        for (bool reuseport : { false, true }) {
+            std::vector<unsigned long> counts;
+            auto rate = test(n, reuseport, port++, seconds, counts);
+            printf("%2u threads, %-22s %8.0f connections/s  [",
+                n, reuseport ? "SO_REUSEPORT listeners:" : "one shared listener:",
+                rate);
+            for (auto c : counts) {
+                printf(" %lu", c);
+            }
+            printf(" ]\n");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+//
+// Measures single stream TCP receive throughput, and how much CPU time the
+// guest spends per GB received (in the driver, the stack and this reader
+// together). Run it, then send it as much data as you like from the host:
+//
+// $ dd if=/dev/zero bs=1M count=10000 | nc 192.168.122.89 5555
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <chrono>
+
+using _clock = std::chrono::high_resolution_clock;
+
+static double cputime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv)
+{
+    int port = 5555;
+    size_t bufsize = 64 * 1024;
+    if (argc > 1) {
+        port = atoi(argv[1]);
+    }
+
+    int ls = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in laddr = {};
+    laddr.sin_family = AF_INET;
+    laddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    laddr.sin_port = htons(port);
+    if (bind(ls, (struct sockaddr*)&laddr, sizeof(laddr)) < 0 ||
+        listen(ls, 1) < 0) {
+        perror("bind/listen");
+        return 1;
+    }
+
+    printf("Waiting for a connection on port %d...\n", port);
+    int s = accept(ls, nullptr, nullptr);
+    if (s < 0) {
+        perror("accept");
+        return 1;
+    }
+
+    auto buf = static_cast<char*>(malloc(bufsize));
+    size_t total = 0;
+    auto start = _clock::now();
+    auto cpu_start = cputime();
+    ssize_t r;
+    while ((r = read(s, buf, bufsize)) > 0) {
+        total += r;
+    }
+    auto sec = std::chrono::duration<double>(_clock::now() - start).count();
+    auto cpu = cputime() - cpu_start;
+    if (r < 0) {
+        perror("read");
+    }
+
+    double gb = total / 1e9;
+    printf("received %zu bytes in %.3f seconds: %.1f Mbit/s\n",
+        total, sec, total * 8 / sec / 1e6);
+    if (total) {
+        printf("CPU time: %.3f seconds, %.3f seconds per GB\n", cpu, cpu / gb);
+    }
+
+    free(buf);
+    close(s);
+    close(ls);
+    return r < 0;
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measures TCP sends over the loopback, copied as usual, and with
+// MSG_ZEROCOPY, where the stack sends from the caller's pages and reports
+// on the error queue when it no longer needs them. The sender writes from a
+// ring of buffers and reuses one only after its sends completed, so the
+// receiver, which checks the data, would see it if that came too early.
+// Sends smaller than kern.ipc.zerocopy_min are copied anyway, and have to
+// say so. Prints the MB/s and the CPU time spent per GB, of all the CPUs.
+//
+// misc-tcp-zerocopy.so [megabytes per measurement]
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+// As in <linux/errqueue.h>
+struct extended_err {
+    uint32_t ee_errno;
+    uint8_t ee_origin;
+    uint8_t ee_type;
+    uint8_t ee_code;
+    uint8_t ee_pad;
+    uint32_t ee_info;
+    uint32_t ee_data;
+};
+static const int origin_zerocopy = 5;
+static const int code_zerocopy_copied = 1;
+
+using _clock = std::chrono::high_resolution_clock;
+
+static bool failed;
+
+static double cpu_seconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int listen_on_loopback(sockaddr_in& addr)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (s < 0 || bind(s, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+            listen(s, 1) < 0 || getsockname(s, (sockaddr*)&addr, &len) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    return s;
+}
+
+// The byte at offset off of the stream is the number of the write it came
+// from, so a buffer overwritten while still being sent shows
+static void receive(int ls, size_t write_size, size_t total)
+{
+    int s = accept(ls, nullptr, nullptr);
+    std::vector<uint8_t> buf(64 << 10);
+    size_t done = 0;
+    while (done < total) {
+        auto n = read(s, buf.data(), buf.size());
+        if (n <= 0) {
+            perror("read");
+            failed = true;
+            break;
+        }
+        uint8_t bad = 0;
+        for (ssize_t i = 0; i < n; i++) {
+            bad |= buf[i] ^ uint8_t((done + i) / write_size);
+        }
+        if (bad) {
+            printf("FAIL: bad data in the %zu bytes after %zu\n", size_t(n), done);
+            failed = true;
+        }
+        done += n;
+    }
+    close(s);
+}
+
+struct completions {
+    std::vector<int> slot_of;       // by send id
+    std::vector<int> outstanding;   // sends by slot
+    size_t done = 0;
+    size_t copied = 0;
+};
+
+// Reads the completions off the error queue, waiting for some if wait
+static void drain(int s, completions& c, bool wait)
+{
+    if (wait) {
+        pollfd pfd = { s, 0, 0 };
+        if (poll(&pfd, 1, 10000) != 1 || !(pfd.revents & POLLERR)) {
+            printf("FAIL: no completion after 10 seconds\n");
+            exit(1);
+        }
+    }
+    for (;;) {
+        char control[128];
+        msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(s, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno != EAGAIN) {
+                perror("recvmsg");
+                exit(1);
+            }
+            return;
+        }
+        auto cm = CMSG_FIRSTHDR(&msg);
+        if (!cm || cm->cmsg_level != IPPROTO_IP) {
+            printf("FAIL: no IP_RECVERR message\n");
+            exit(1);
+        }
+        extended_err ee;
+        memcpy(&ee, CMSG_DATA(cm), sizeof(ee));
+        if (ee.ee_errno || ee.ee_origin != origin_zerocopy ||
+                ee.ee_info > ee.ee_data || ee.ee_data >= c.slot_of.size()) {
+            printf("FAIL: bad completion %u-%u\n", ee.ee_info, ee.ee_data);
+            exit(1);
+        }
+        for (auto id = ee.ee_info; id <= ee.ee_data; id++) {
+            c.outstanding[c.slot_of[id]]--;
+            c.done++;
+            if (ee.ee_code == code_zerocopy_copied) {
+                c.copied++;
+            }
+        }
+    }
+}
+
+struct result {
+    double mb_per_sec;
+    double cpu_sec_per_gb;
+    size_t sends;
+    size_t copied;
+};
+
+static result measure(bool zerocopy, size_t write_size, size_t total)
+{
+    sockaddr_in addr;
+    int ls = listen_on_loopback(addr);
+    std::thread receiver([=] { receive(ls, write_size, total); });
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    if (zerocopy && setsockopt(s, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        perror("SO_ZEROCOPY");
+        exit(1);
+    }
+    if (connect(s, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+
+    // Enough buffers to keep a few MB in flight
+    size_t nslots = std::max<size_t>((4 << 20) / write_size, 4);
+    std::vector<std::vector<uint8_t>> slots(nslots, std::vector<uint8_t>(write_size));
+    completions c;
+    c.outstanding.resize(nslots);
+
+    auto start = _clock::now();
+    auto cpu_start = cpu_seconds();
+    size_t done = 0;
+    for (size_t w = 0; done < total; w++) {
+        auto slot = w % nslots;
+        while (c.outstanding[slot]) {
+            drain(s, c, true);
+        }
+        auto& buf = slots[slot];
+        memset(buf.data(), uint8_t(w), write_size);
+        size_t len = std::min(write_size, total - done);
+        for (size_t sent = 0; sent < len;) {
+            auto n = send(s, buf.data() + sent, len - sent, zerocopy ? MSG_ZEROCOPY : 0);
+            if (n <= 0) {
+                perror("send");
+                exit(1);
+            }
+            if (zerocopy) {
+                c.slot_of.push_back(slot);
+                c.outstanding[slot]++;
+            }
+            sent += n;
+        }
+        done += len;
+        if (zerocopy) {
+            drain(s, c, false);
+        }
+    }
+    receiver.join();
+    while (c.done < c.slot_of.size()) {
+        drain(s, c, true);
+    }
+    auto secs = std::chrono::duration<double>(_clock::now() - start).count();
+    auto cpu = cpu_seconds() - cpu_start;
+    close(s);
+    close(ls);
+    return { total / secs / 1e6, cpu / (total / 1e9), c.slot_of.size(), c.copied };
+}
+
+int main(int argc, char** argv)
+{
+    size_t total = size_t(1) << 30;
+    if (argc > 1) {
+        total = atol(argv[1]) << 20;
+    }
+
+    printf("%-9s %10s %10s %12s  %s\n", "send", "write", "MB/s", "CPU s/GB", "copied/sends");
+    for (size_t write_size : { 4 << 10, 64 << 10, 256 << 10, 1 << 20 }) {
+        for (bool zerocopy : { false, true }) {
+            auto r = measure(zerocopy, write_size, total);
+            printf("%-9s %10zu %10.1f %12.3f  %zu/%zu\n", zerocopy ? "zerocopy" : "copy",
+                write_size, r.mb_per_sec, r.cpu_sec_per_gb, r.copied, r.sends);
+            // Below the threshold, every send is copied and has to say so
+            if (zerocopy && write_size < 16384 && r.copied != r.sends) {
+                printf("FAIL: small sends not reported copied\n");
+                failed = true;
+            }
+        }
+    }
+
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed ? 1 : 0;
+}
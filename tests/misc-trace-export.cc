@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measures the cost of streaming the tracepoint log out of the guest.
+//
+// First the cost of one enabled tracepoint hit, with the log only kept in
+// memory and with it also being exported, then a steady load of a given
+// number of hits per second (a million by default), spread over a few
+// threads, reporting how much CPU the exporter used and how many records
+// it could not keep up with. Export to a file, or stream to the host with:
+//
+// $ scripts/trace.py receive -p 9999 tracefile
+//
+// misc-trace-export.so [file:<path> | tcp:<address>:<port>] [hits/s] [seconds] [threads]
+
+#include <osv/trace.hh>
+#include <osv/tracecontrol.hh>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using _clock = std::chrono::high_resolution_clock;
+
+tracepoint<10101, u64, u64> trace_bench("bench", "%d %d");
+
+// The slow path is what an enabled tracepoint runs; calling it directly
+// works from a module, which has no patch sites of its own.
+static inline void hit(u64 i)
+{
+    trace_bench.trace_slow_path(std::make_tuple(i, i * 2));
+}
+
+// Returns the cost of a hit in nanoseconds
+static double hit_cost(unsigned long count)
+{
+    auto start = _clock::now();
+    for (unsigned long i = 0; i < count; i++) {
+        hit(i);
+    }
+    return std::chrono::duration<double, std::nano>(_clock::now() - start).count() / count;
+}
+
+// Each thread hits the tracepoint rate/nthreads times a second, in bursts
+// of a millisecond's worth.
+static void steady_load(unsigned long rate, int seconds, unsigned nthreads)
+{
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < nthreads; t++) {
+        threads.emplace_back([=] {
+            const unsigned long burst = rate / nthreads / 1000;
+            auto next = _clock::now();
+            for (int ms = 0; ms < seconds * 1000; ms++) {
+                for (unsigned long i = 0; i < burst; i++) {
+                    hit(i);
+                }
+                next += std::chrono::milliseconds(1);
+                std::this_thread::sleep_until(next);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string target = "file:/tmp/misc-trace-export.trace";
+    unsigned long rate = 1000000;
+    int seconds = 5;
+    unsigned nthreads = 4;
+    if (argc > 1) {
+        target = argv[1];
+    }
+    if (argc > 2) {
+        rate = atol(argv[2]);
+    }
+    if (argc > 3) {
+        seconds = atoi(argv[3]);
+    }
+    if (argc > 4) {
+        nthreads = atoi(argv[4]);
+    }
+
+    const unsigned long count = 10000000;
+    printf("disabled tracepoint:         %6.1f ns/hit\n", hit_cost(count));
+    trace_bench.enable();
+    printf("in-memory log only:          %6.1f ns/hit\n", hit_cost(count));
+
+    try {
+        trace::start_export(target);
+    } catch (std::runtime_error& e) {
+        printf("%s\n", e.what());
+        return 1;
+    }
+    auto before = trace::get_export_stats();
+    printf("exported log (unthrottled):  %6.1f ns/hit\n", hit_cost(count));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto after = trace::get_export_stats();
+    printf("  %lu of %lu records dropped\n", after.lost - before.lost, count);
+
+    before = after;
+    auto start = _clock::now();
+    steady_load(rate, seconds, nthreads);
+    // Let the exporter catch up with the last records
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    after = trace::get_export_stats();
+    auto sec = std::chrono::duration<double>(_clock::now() - start).count();
+    auto cpu = std::chrono::duration<double>(after.cpu_time - before.cpu_time).count();
+    printf("%lu hits/s over %u threads for %d seconds:\n", rate, nthreads, seconds);
+    printf("  exported %lu records, %.1f MB/s, dropped %lu\n",
+        after.records - before.records, (after.bytes - before.bytes) / sec / 1e6,
+        after.lost - before.lost);
+    printf("  exporter CPU usage %.1f%%, %.1f ns/record\n", cpu / sec * 100,
+        cpu * 1e9 / std::max(1UL, after.records - before.records));
+
+    trace::stop_export();
+    trace_bench.enable(false);
+    return 0;
+}
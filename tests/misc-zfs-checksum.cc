@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Checksum microbenchmark: verifies that every fletcher-4 and SHA-256
+// implementation this cpu supports gives the same result as the portable
+// one, then measures the throughput of each.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+// Mirror the declarations in zfs_fletcher.h and sys/zio_checksum.h
+extern "C" {
+
+struct zio_cksum_t {
+    uint64_t zc_word[4];
+};
+
+typedef void zio_checksum_t(const void* data, uint64_t size, zio_cksum_t* zcp);
+
+struct fletcher_4_ops_t {
+    zio_checksum_t* compute_native;
+    zio_checksum_t* compute_byteswap;
+    int (*valid)(void);
+    const char* name;
+};
+
+struct zio_sha256_ops_t {
+    zio_checksum_t* compute;
+    int (*valid)(void);
+    const char* name;
+};
+
+int fletcher_4_impl_count(void);
+const fletcher_4_ops_t* fletcher_4_impl(int);
+const fletcher_4_ops_t* fletcher_4_impl_selected(void);
+int zio_sha256_impl_count(void);
+const zio_sha256_ops_t* zio_sha256_impl(int);
+const zio_sha256_ops_t* zio_sha256_impl_selected(void);
+
+}
+
+static std::chrono::high_resolution_clock s_clock;
+
+struct impl {
+    const char* name;
+    zio_checksum_t* func;
+    bool selected;
+};
+
+static std::vector<impl> fletcher_impls(bool byteswap)
+{
+    std::vector<impl> ret;
+    for (int i = 0; i < fletcher_4_impl_count(); i++) {
+        auto ops = fletcher_4_impl(i);
+        if (ops->valid && !ops->valid()) {
+            continue;
+        }
+        ret.push_back({ops->name,
+                       byteswap ? ops->compute_byteswap : ops->compute_native,
+                       ops == fletcher_4_impl_selected()});
+    }
+    return ret;
+}
+
+static std::vector<impl> sha256_impls()
+{
+    std::vector<impl> ret;
+    for (int i = 0; i < zio_sha256_impl_count(); i++) {
+        auto ops = zio_sha256_impl(i);
+        if (ops->valid && !ops->valid()) {
+            continue;
+        }
+        ret.push_back({ops->name, ops->compute, ops == zio_sha256_impl_selected()});
+    }
+    return ret;
+}
+
+// Compare every implementation to the first (portable) one, over sizes
+// that are and aren't multiples of the vector width, and misaligned buffers.
+static int verify(const char* what, const std::vector<impl>& impls,
+                  const char* buf, size_t max)
+{
+    int failures = 0;
+    for (size_t size = 0; size <= max; size = size < 512 ? size + 4 : size * 2 + 4) {
+        for (size_t misalign : {0, 4}) {
+            zio_cksum_t ref, r;
+            impls[0].func(buf + misalign, size, &ref);
+            for (size_t i = 1; i < impls.size(); i++) {
+                memset(&r, 0, sizeof(r));
+                impls[i].func(buf + misalign, size, &r);
+                if (memcmp(&r, &ref, sizeof(r))) {
+                    printf("FAIL: %s %s differs from %s, size %zu offset %zu\n",
+                           what, impls[i].name, impls[0].name, size, misalign);
+                    failures++;
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+static void bench(const char* what, const std::vector<impl>& impls,
+                  const char* buf, size_t size, size_t total)
+{
+    for (auto& im : impls) {
+        zio_cksum_t r;
+        auto iterations = total / size;
+        auto start = s_clock.now();
+        for (size_t i = 0; i < iterations; i++) {
+            im.func(buf, size, &r);
+        }
+        std::chrono::duration<double> sec = s_clock.now() - start;
+        printf("%-18s %-8s %8zu bytes: %8.2f MB/s%s\n", what, im.name, size,
+               iterations * size / sec.count() / (1024 * 1024),
+               im.selected ? " (selected)" : "");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const size_t max = 128 * 1024;
+    // room for the misaligned runs
+    std::vector<char> data(max + 64);
+    srand(0);
+    for (auto& c : data) {
+        c = rand();
+    }
+    const char* buf = data.data();
+
+    auto f4 = fletcher_impls(false);
+    auto f4bs = fletcher_impls(true);
+    auto sha = sha256_impls();
+
+    int failures = 0;
+    failures += verify("fletcher4", f4, buf, max);
+    failures += verify("fletcher4-byteswap", f4bs, buf, max);
+    failures += verify("sha256", sha, buf, max);
+    if (failures) {
+        printf("%d mismatches\n", failures);
+        return 1;
+    }
+    printf("all implementations agree\n");
+
+    for (size_t size : {4096, 131072}) {
+        bench("fletcher4", f4, buf, size, 1024 * 1024 * 1024);
+        bench("fletcher4-byteswap", f4bs, buf, size, 1024 * 1024 * 1024);
+        bench("sha256", sha, buf, size, 256 * 1024 * 1024);
+    }
+    return 0;
+}
@@ -7,7 +7,13 @@
 
 #include <sys/socket.h>
 #include <sys/poll.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stddef.h>
+#include <vector>
 #include <osv/sched.hh>
 #include <osv/debug.hh>
 
@@ -20,6 +26,186 @@ static void report(bool ok, const char* msg)
     debug("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
 }
 
+static socklen_t make_addr(sockaddr_un& addr, const char* path, bool abstract = false)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (abstract) {
+        // abstract names start with a NUL, and all their bytes count
+        strcpy(addr.sun_path + 1, path);
+        return offsetof(sockaddr_un, sun_path) + 1 + strlen(path);
+    }
+    strcpy(addr.sun_path, path);
+    return sizeof(addr);
+}
+
+static void test_named_stream(const char* path, bool abstract)
+{
+    sockaddr_un addr;
+    auto len = make_addr(addr, path, abstract);
+    if (!abstract) {
+        unlink(path);
+    }
+
+    int ls = socket(AF_UNIX, SOCK_STREAM, 0);
+    report(ls >= 0, "socket(AF_UNIX, SOCK_STREAM)");
+    int r = bind(ls, (sockaddr*)&addr, len);
+    report(r == 0, "bind");
+    if (!abstract) {
+        struct stat st;
+        report(stat(path, &st) == 0 && S_ISSOCK(st.st_mode), "bind creates a socket file");
+    }
+    int ls2 = socket(AF_UNIX, SOCK_STREAM, 0);
+    r = bind(ls2, (sockaddr*)&addr, len);
+    report(r == -1 && errno == EADDRINUSE, "bind to a name in use");
+    close(ls2);
+
+    int c = socket(AF_UNIX, SOCK_STREAM, 0);
+    r = connect(c, (sockaddr*)&addr, len);
+    report(r == -1 && errno == ECONNREFUSED, "connect before listen");
+    close(c);
+
+    r = listen(ls, 10);
+    report(r == 0, "listen");
+    c = socket(AF_UNIX, SOCK_STREAM, 0);
+    r = connect(c, (sockaddr*)&addr, len);
+    report(r == 0, "connect");
+    sockaddr_un peer;
+    socklen_t peerlen = sizeof(peer);
+    int s = accept(ls, (sockaddr*)&peer, &peerlen);
+    report(s >= 0 && peer.sun_family == AF_UNIX, "accept");
+
+    sockaddr_un name;
+    socklen_t namelen = sizeof(name);
+    r = getpeername(c, (sockaddr*)&name, &namelen);
+    report(r == 0 && (abstract ? !memcmp(name.sun_path, addr.sun_path, len - offsetof(sockaddr_un, sun_path))
+                               : !strcmp(name.sun_path, path)), "getpeername");
+
+    char msg[] = "hello", reply[] = "wrong";
+    r = write(c, msg, 5);
+    report(r == 5 && read(s, reply, 5) == 5 && !memcmp(msg, reply, 5), "client to server");
+    r = send(s, "12345", 5, 0);
+    report(r == 5 && recv(c, reply, 5, 0) == 5 && !memcmp("12345", reply, 5), "server to client");
+
+    // More than the socket buffers: the writer lends the rest of its buffer
+    std::vector<char> big(4 << 20), got(big.size());
+    for (size_t i = 0; i < big.size(); i++) {
+        big[i] = i * 7;
+    }
+    sched::thread reader([&] {
+        size_t total = 0;
+        ssize_t n;
+        while (total < got.size() && (n = read(s, got.data() + total, got.size() - total)) > 0) {
+            total += n;
+        }
+    });
+    reader.start();
+    r = write(c, big.data(), big.size());
+    reader.join();
+    report(r == (int)big.size() && big == got, "large write");
+
+    close(c);
+    report(read(s, reply, 5) == 0, "read after client closed");
+    close(s);
+    close(ls);
+
+    if (!abstract) {
+        c = socket(AF_UNIX, SOCK_STREAM, 0);
+        r = connect(c, (sockaddr*)&addr, len);
+        report(r == -1 && errno == ECONNREFUSED, "connect after listener closed");
+        close(c);
+        unlink(path);
+        c = socket(AF_UNIX, SOCK_STREAM, 0);
+        r = connect(c, (sockaddr*)&addr, len);
+        report(r == -1 && errno == ENOENT, "connect to a removed name");
+        close(c);
+    }
+}
+
+static void test_dgram(const char* path)
+{
+    sockaddr_un a1, a2;
+    auto len1 = make_addr(a1, path, true);
+    auto len2 = make_addr(a2, "tst-af-local-client", true);
+    int s1 = socket(AF_UNIX, SOCK_DGRAM, 0);
+    int s2 = socket(AF_UNIX, SOCK_DGRAM, 0);
+    report(bind(s1, (sockaddr*)&a1, len1) == 0 && bind(s2, (sockaddr*)&a2, len2) == 0,
+           "bind datagram sockets");
+    int r = sendto(s2, "one", 3, 0, (sockaddr*)&a1, len1);
+    r += sendto(s2, "two!", 4, 0, (sockaddr*)&a1, len1);
+    report(r == 7, "sendto");
+    char buf[16];
+    sockaddr_un from;
+    socklen_t fromlen = sizeof(from);
+    r = recvfrom(s1, buf, sizeof(buf), 0, (sockaddr*)&from, &fromlen);
+    report(r == 3 && !memcmp(buf, "one", 3) && fromlen == len2 &&
+           !memcmp(from.sun_path, a2.sun_path, len2 - offsetof(sockaddr_un, sun_path)),
+           "recvfrom keeps message boundaries and reports the sender");
+    r = recv(s1, buf, 2, 0);
+    report(r == 2 && !memcmp(buf, "tw", 2), "truncated datagram");
+    r = recv(s1, buf, sizeof(buf), MSG_DONTWAIT);
+    report(r == -1 && errno == EAGAIN, "rest of a truncated datagram is discarded");
+    report(connect(s1, (sockaddr*)&a2, len2) == 0 && send(s1, "back", 4, 0) == 4 &&
+           recv(s2, buf, sizeof(buf), 0) == 4, "connected datagram socket");
+    close(s2);
+    r = send(s1, "back", 4, 0);
+    report(r == -1 && errno == ECONNREFUSED, "send to a closed datagram socket");
+    close(s1);
+}
+
+static void test_scm_rights()
+{
+    int s[2], p[2];
+    socketpair(AF_LOCAL, SOCK_STREAM, 0, s);
+    pipe(p);
+
+    char c = 'x';
+    iovec iov = { &c, 1 };
+    char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &p[1], sizeof(int));
+    report(sendmsg(s[0], &msg, 0) == 1, "sendmsg with SCM_RIGHTS");
+    close(p[1]);
+
+    memset(control, 0, sizeof(control));
+    msg.msg_controllen = sizeof(control);
+    c = 0;
+    int r = recvmsg(s[1], &msg, 0);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    int fd = -1;
+    if (r == 1 && cmsg && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    report(r == 1 && c == 'x' && fd >= 0 && fd != p[1], "recvmsg with SCM_RIGHTS");
+    char buf[5];
+    report(write(fd, "pipe", 4) == 4 && read(p[0], buf, 4) == 4 && !memcmp(buf, "pipe", 4),
+           "received descriptor works");
+    close(fd);
+    close(p[0]);
+
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &s[0], sizeof(int));
+    r = sendmsg(s[0], &msg, 0);
+    report(r == -1 && errno == EINVAL, "can't send a socket over itself");
+    memcpy(CMSG_DATA(cmsg), &s[1], sizeof(int));
+    r = sendmsg(s[0], &msg, 0);
+    report(r == -1 && errno == EINVAL, "can't send a socket to itself");
+    close(s[0]);
+    close(s[1]);
+}
+
 int main(int ac, char** av)
 {
     int s[2];
@@ -120,6 +306,11 @@ int main(int ac, char** av)
     report(r == 0, "close when other end is SHUT_WR");
 
 
+    test_named_stream("/tmp/tst-af-local.sock", false);
+    test_named_stream("tst-af-local", true);
+    test_dgram("tst-af-local-server");
+    test_scm_rights();
+
     std::vector<int> sockets;
     while (socketpair(AF_LOCAL, SOCK_STREAM, 0, s) == 0) {
         sockets.push_back(s[0]);
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Tests the Linux CPU affinity APIs: threads pinned with them must never
+// run elsewhere, even while the load balancer is busy moving other
+// threads around, and changing a thread's affinity must move it.
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <atomic>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, std::string msg)
+{
+    ++tests;
+    fails += !ok;
+    std::cout << (ok ? "PASS" : "FAIL") << ": " << msg << "\n";
+}
+
+static std::atomic<bool> stop;
+
+static void* spin(void*)
+{
+    while (!stop.load(std::memory_order_relaxed)) {
+        sched_yield();
+    }
+    return nullptr;
+}
+
+struct pinned_arg {
+    int cpu;
+    std::atomic<long> wrong_cpu;
+    std::atomic<long> checks;
+};
+
+static void* pinned(void* arg)
+{
+    auto pa = static_cast<pinned_arg*>(arg);
+    while (!stop.load(std::memory_order_relaxed)) {
+        if (sched_getcpu() != pa->cpu) {
+            pa->wrong_cpu++;
+        }
+        pa->checks++;
+        if (pa->checks % 64 == 0) {
+            sched_yield();
+        }
+    }
+    return nullptr;
+}
+
+static cpu_set_t one_cpu(int cpu)
+{
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    CPU_SET(cpu, &cs);
+    return cs;
+}
+
+int main(int ac, char** av)
+{
+    int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    cpu_set_t cs;
+    report(sched_getaffinity(0, sizeof(cs), &cs) == 0, "sched_getaffinity");
+    report(CPU_COUNT(&cs) == ncpus, "all CPUs allowed by default");
+    int cpu = sched_getcpu();
+    report(cpu >= 0 && cpu < ncpus && CPU_ISSET(cpu, &cs), "sched_getcpu");
+
+    // Move ourselves around
+    bool moved = true;
+    for (int i = 0; i < ncpus; i++) {
+        cs = one_cpu(i);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs) != 0 ||
+            sched_getcpu() != i) {
+            moved = false;
+        }
+    }
+    report(moved, "pthread_setaffinity_np migrates the current thread");
+    cpu_set_t got;
+    report(pthread_getaffinity_np(pthread_self(), sizeof(got), &got) == 0 &&
+           CPU_EQUAL(&got, &cs), "pthread_getaffinity_np");
+    CPU_ZERO(&cs);
+    report(sched_setaffinity(0, sizeof(cs), &cs) == -1 && errno == EINVAL,
+           "empty mask refused");
+    pthread_attr_t empty_attr;
+    pthread_attr_init(&empty_attr);
+    report(pthread_attr_setaffinity_np(&empty_attr, sizeof(cs), &cs) == EINVAL,
+           "empty mask refused in attributes");
+    pthread_attr_destroy(&empty_attr);
+    for (int i = 0; i < ncpus; i++) {
+        CPU_SET(i, &cs);
+    }
+    report(sched_setaffinity(0, sizeof(cs), &cs) == 0, "sched_setaffinity");
+
+    // One pinned thread per CPU, created pinned through its attributes,
+    // competing with twice as many unpinned threads the load balancer
+    // will keep moving.
+    stop = false;
+    std::vector<pthread_t> spinners(ncpus * 2);
+    for (auto& t : spinners) {
+        pthread_create(&t, nullptr, spin, nullptr);
+    }
+    std::vector<pinned_arg> args(ncpus);
+    std::vector<pthread_t> pinned_threads(ncpus);
+    for (int i = 0; i < ncpus; i++) {
+        args[i].cpu = i;
+        args[i].wrong_cpu = 0;
+        args[i].checks = 0;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        cs = one_cpu(i);
+        pthread_attr_setaffinity_np(&attr, sizeof(cs), &cs);
+        pthread_create(&pinned_threads[i], &attr, pinned, &args[i]);
+        pthread_attr_destroy(&attr);
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(3));
+    stop = true;
+    for (auto t : pinned_threads) {
+        pthread_join(t, nullptr);
+    }
+    for (auto t : spinners) {
+        pthread_join(t, nullptr);
+    }
+    long wrong = 0, checks = 0;
+    for (auto& a : args) {
+        wrong += a.wrong_cpu;
+        checks += a.checks;
+    }
+    std::cout << checks << " checks, " << wrong << " on the wrong CPU\n";
+    report(checks > 0 && wrong == 0, "pinned threads never migrate");
+
+    // Pin a running thread from outside: it must end up on its CPU and
+    // then stay there.
+    stop = false;
+    pinned_arg arg;
+    arg.cpu = ncpus - 1;
+    arg.wrong_cpu = 0;
+    arg.checks = 0;
+    pthread_t t;
+    pthread_create(&t, nullptr, [] (void* a) -> void* {
+        auto pa = static_cast<pinned_arg*>(a);
+        while (sched_getcpu() != pa->cpu && !stop.load()) {
+            sched_yield();
+        }
+        return pinned(a);
+    }, &arg);
+    cs = one_cpu(arg.cpu);
+    report(pthread_setaffinity_np(t, sizeof(cs), &cs) == 0,
+           "pthread_setaffinity_np on another thread");
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    stop = true;
+    pthread_join(t, nullptr);
+    report(arg.checks > 0 && arg.wrong_cpu == 0, "other thread moved to its CPU");
+
+    std::cout << "SUMMARY: " << tests << " tests, " << fails << " failures\n";
+    return fails == 0 ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Checks the Internet checksum of mbuf chains, against a plain byte loop:
+// of data the checksum has to read, and of data m_uiotombuf() summed while
+// copying it in, which is then taken in parts, as TCP does with m_copym(),
+// including in MSS-sized segments.
+// Also checks in_cksum_copy(). All with random lengths and alignments.
+//
+// tst-in-cksum.so [iterations] [seed]
+
+#include <bsd/porting/netport.h>
+#include <bsd/sys/sys/param.h>
+#include <bsd/sys/sys/mbuf.h>
+#include <machine/in_cksum.h>
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <random>
+#include <vector>
+
+static int failures;
+
+static void expect(bool ok, const char* what, size_t len, size_t off)
+{
+    if (!ok && failures++ < 20) {
+        printf("FAIL: %s, length %zu, offset %zu\n", what, len, off);
+    }
+}
+
+// The folded sum of the 16-bit little-endian words at p
+static unsigned reference_sum(const unsigned char* p, size_t len)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum += i & 1 ? p[i] << 8 : p[i];
+    }
+    while (sum > 0xffff) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum;
+}
+
+// The sums 0 and 0xffff are the same
+static bool same_sum(unsigned a, unsigned b)
+{
+    return a % 0xffff == b % 0xffff;
+}
+
+static std::mt19937 rng;
+
+static size_t random_length()
+{
+    switch (rng() % 4) {
+    case 0: return rng() % 70000;
+    case 1: return rng() % 4000;
+    default: return rng() % 200;
+    }
+}
+
+static void check_copy(std::vector<unsigned char>& src, std::vector<unsigned char>& dst)
+{
+    auto len = random_length();
+    auto soff = rng() % 64, doff = rng() % 64;
+    src.resize(len + 64);
+    dst.assign(len + 64, 0);
+    for (auto& c : src) {
+        c = rng();
+    }
+    unsigned sum = in_cksum_copy(src.data() + soff, dst.data() + doff, len);
+    expect(same_sum(sum, reference_sum(src.data() + soff, len)), "in_cksum_copy", len, soff);
+    expect(!memcmp(src.data() + soff, dst.data() + doff, len), "in_cksum_copy data", len, soff);
+}
+
+// Puts the data in an mbuf chain, from a few iovecs, with or without the
+// sums, and checks the checksums of random parts of it
+static void check_chain(std::vector<unsigned char>& data, bool datasum)
+{
+    auto len = random_length() + 1;
+    data.resize(len);
+    for (auto& c : data) {
+        c = rng();
+    }
+    std::vector<iovec> iov;
+    for (size_t done = 0; done < len;) {
+        size_t n = std::min<size_t>(len - done, rng() % 2 ? rng() % 3000 + 1 : len);
+        iov.push_back({ data.data() + done, n });
+        done += n;
+    }
+    uio u = {};
+    u.uio_iov = iov.data();
+    u.uio_iovcnt = iov.size();
+    u.uio_resid = len;
+    u.uio_rw = UIO_WRITE;
+    auto m = m_uiotombuf(&u, M_WAITOK, 0, rng() % 16, 0,
+                         M_PKTHDR | (datasum ? M_DATASUM : 0));
+    expect(m != nullptr, "m_uiotombuf", len, 0);
+    if (!m) {
+        return;
+    }
+    auto what = datasum ? "in_cksum_skip, summed data" : "in_cksum_skip";
+    expect(same_sum(in_cksum(m, len), 0xffff & ~reference_sum(data.data(), len)), what, len, 0);
+    for (int i = 0; i < 10; i++) {
+        size_t off = rng() % len;
+        size_t n = 1 + rng() % (len - off);
+        unsigned expected = 0xffff & ~reference_sum(data.data() + off, n);
+        // Skipping into the chain, and a copy of that part of it
+        expect(same_sum(in_cksum_skip(m, off + n, off), expected), what, n, off);
+        auto copy = m_copym(m, off, n, M_WAITOK);
+        expect(same_sum(in_cksum(copy, n), expected), what, n, off);
+        m_freem(copy);
+    }
+    // And in the segments TCP sends on an MTU 1500 link, from a random
+    // point on, which rarely line up with the chunks that were summed
+    for (size_t off = rng() % 1448; off < len; off += 1448) {
+        size_t n = std::min<size_t>(1448, len - off);
+        unsigned expected = 0xffff & ~reference_sum(data.data() + off, n);
+        auto copy = m_copym(m, off, n, M_WAITOK);
+        expect(same_sum(in_cksum(copy, n), expected), what, n, off);
+        m_freem(copy);
+    }
+    m_freem(m);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long iterations = 20000;
+    unsigned seed = 1;
+    if (argc > 1) {
+        iterations = atol(argv[1]);
+    }
+    if (argc > 2) {
+        seed = atoi(argv[2]);
+    }
+    rng.seed(seed);
+
+    std::vector<unsigned char> a, b;
+    for (unsigned long i = 0; i < iterations; i++) {
+        check_copy(a, b);
+        check_chain(a, false);
+        check_chain(a, true);
+    }
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
@@ -6,7 +6,10 @@
 */
 
 #include <string.h>
+#include <stdlib.h>
 #include <iostream>
+#include <vector>
+#include <algorithm>
 
 // This test assures that the "memmove" function works as expected in the various
 // situations it can be used at.
@@ -111,6 +114,54 @@ int main()
         pass_if(buf_tmp, loop_results[i], 16);
     }
 
+    // Large moves, which go through the block copies, at all alignments
+    // of the source and the distance between source and destination.
+    // 16MB is past the size memcpy() and memmove() copy with non-temporal
+    // stores.
+    for (size_t size : { 300, 1000, 5000, 70000, 16 << 20 }) {
+        std::vector<char> buf(size + 384), expected(size + 384);
+        for (int dist : { -129, -64, -33, -8, -1, 1, 7, 32, 64, 100 }) {
+            for (int off = 0; off < 64; off += (size > 70000 ? 31 : 1)) {
+                for (size_t i = 0; i < buf.size(); i++) {
+                    buf[i] = expected[i] = i * 7 + off;
+                }
+                char *src = buf.data() + 192 + off;
+                for (size_t i = 0; i < size; i++) {
+                    expected[192 + off + dist + i] = src[i];
+                }
+                memmove(src + dist, src, size);
+                if (buf != expected) {
+                    std::cerr << "ERROR: memmove of " << size << " bytes by "
+                              << dist << " at offset " << off << "\n";
+                    exit(1);
+                }
+            }
+        }
+    }
+
+    // And large copies and sets, which do not overlap
+    for (size_t size : { 300, 1000, 5000, 70000, 16 << 20 }) {
+        std::vector<char> src(size + 64), dest(size + 128);
+        for (auto& c : src) {
+            c = rand();
+        }
+        for (int off = 0; off < 64; off += 7) {
+            std::fill(dest.begin(), dest.end(), 0);
+            memcpy(dest.data() + off, src.data() + 64 - off, size);
+            if (memcmp(dest.data() + off, src.data() + 64 - off, size) ||
+                    dest[off + size] || (off && dest[off - 1])) {
+                std::cerr << "ERROR: memcpy of " << size << " bytes at offset " << off << "\n";
+                exit(1);
+            }
+            memset(dest.data() + off, 'x', size);
+            if (dest[off + size] || (off && dest[off - 1]) ||
+                    std::count(dest.begin(), dest.end(), 'x') != long(size)) {
+                std::cerr << "ERROR: memset of " << size << " bytes at offset " << off << "\n";
+                exit(1);
+            }
+        }
+    }
+
     std::cerr << "PASSED\n";
     return 0;
 }
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Checks the NUMA topology, and that memory comes from the local node.
+// Without NUMA it only checks everything is on node 0; to test NUMA, give
+// QEMU a few nodes, e.g.:
+//
+// $ scripts/run.py -c 4 -m 2G -e tests/tst-numa.so
+//       --pass-args="-numa node,cpus=0-1,mem=1G -numa node,cpus=2-3,mem=1G"
+
+#include <osv/numa.hh>
+#include <osv/sched.hh>
+#include <osv/mmu.hh>
+#include <osv/mempool.hh>
+
+#include <stdlib.h>
+
+#include <iostream>
+
+static int failures;
+
+static void expect(bool ok, const std::string& what)
+{
+    if (!ok) {
+        std::cout << "FAIL: " << what << "\n";
+        failures++;
+    }
+}
+
+static unsigned node_of(void* p)
+{
+    return numa::phys_node(mmu::virt_to_phys(p));
+}
+
+int main(int argc, char **argv)
+{
+    auto nodes = numa::nr_nodes();
+    std::cout << nodes << " nodes\n";
+    for (unsigned i = 0; i < nodes; i++) {
+        std::cout << "node " << i << " distances:";
+        for (unsigned j = 0; j < nodes; j++) {
+            std::cout << " " << numa::distance(i, j);
+        }
+        std::cout << "\n";
+        expect(numa::nearest_nodes(i)[0] == i, "a node is nearest to itself");
+    }
+    for (unsigned i = 0; i < numa::nr_memory_ranges(); i++) {
+        auto& r = numa::get_memory_range(i);
+        std::cout << "memory " << std::hex << r.start << "-" << r.end
+                  << std::dec << " on node " << r.node << "\n";
+    }
+
+    for (auto c : sched::cpus) {
+        expect(c->node < nodes, "cpu node in range");
+        auto t = new sched::thread([c, nodes] {
+            // Large allocations and pinned threads' stacks come from the
+            // cpu's own node
+            void* p = malloc(1 << 20);
+            int on_stack;
+            std::cout << "cpu " << c->id << " on node " << c->node
+                      << ": malloc on node " << node_of(p)
+                      << ", stack on node " << node_of(&on_stack) << "\n";
+            expect(node_of(p) == c->node, "malloc() from the local node");
+            expect(node_of(&on_stack) == c->node, "stack on the local node");
+            free(p);
+            // And from another node when asked for
+            auto other = numa::nearest_nodes(c->node)[nodes - 1];
+            memory::numa_node_scope scope(other);
+            p = malloc(1 << 20);
+            expect(node_of(p) == other, "malloc() from a chosen node");
+            free(p);
+        }, sched::thread::attr().pin(c));
+        t->start();
+        t->join();
+        delete t;
+    }
+
+    std::cout << (failures ? "FAILED" : "PASSED") << "\n";
+    return failures ? 1 : 0;
+}
@@ -9,6 +9,16 @@
 #include <chrono>
 #include <thread>
 #include <iostream>
+#include <sstream>
+#include <cassert>
+
+// Not static, so the profile can name it
+void __attribute__((noinline)) spin(std::chrono::milliseconds duration)
+{
+    auto end = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < end) {
+    }
+}
 
 int main(int argc, char const *argv[])
 {
@@ -30,6 +40,25 @@ int main(int argc, char const *argv[])
     std::cout << "Stopping" << std::endl;
     prof::stop_sampler();
 
+    std::cout << "Counting stacks" << std::endl;
+    prof::config stacks_config = { std::chrono::milliseconds(1), 1024 };
+    prof::start_sampler(stacks_config);
+    spin(std::chrono::milliseconds(100));
+    prof::stop_sampler();
+
+    unsigned long samples = 0, in_spin = 0;
+    std::istringstream folded(prof::get_folded_stacks());
+    std::string line;
+    while (std::getline(folded, line)) {
+        auto count = std::stoul(line.substr(line.rfind(' ') + 1));
+        samples += count;
+        if (line.find("spin(") != std::string::npos) {
+            in_spin += count;
+        }
+    }
+    std::cout << samples << " samples, " << in_spin << " in spin()" << std::endl;
+    assert(in_spin > 0);
+
     std::cout << "Done" << std::endl;
     return 0;
 }
@@ -64,6 +64,52 @@ static int test_taskq(void)
 	return 0;
 }
 
+#define PCPU_TASKS	64
+
+static struct ostask	pcpu_tasks[PCPU_TASKS];
+static int		pcpu_ran;
+
+static void
+tq_pcpu_func(void *arg)
+{
+	mutex_lock(&tq_mutex);
+	if (++pcpu_ran == PCPU_TASKS)
+		cv_broadcast(&tq_wait);
+	mutex_unlock(&tq_mutex);
+}
+
+/*
+ * Spread tasks over all CPUs, including ones that don't exist (they wrap
+ * around), and the current one.
+ */
+static int test_pcpu_taskq(void)
+{
+	struct taskq *tq;
+	int i;
+
+	tq = taskq_create_pcpu("test_pcpu", 1);
+	if (!tq) {
+		kprintf("failed to create per-cpu taskq\n");
+		return 1;
+	}
+
+	pcpu_ran = 0;
+	for (i = 0; i < PCPU_TASKS; i++) {
+		int cpu = (i % 3 == 0) ? TASKQ_ANYCPU : i;
+		taskq_dispatch_safe_cpu(tq, tq_pcpu_func, NULL, 0,
+		    &pcpu_tasks[i], cpu);
+	}
+
+	mutex_lock(&tq_mutex);
+	while (pcpu_ran != PCPU_TASKS)
+		cv_wait(&tq_wait, &tq_mutex);
+	mutex_unlock(&tq_mutex);
+	kprintf("per-cpu taskq ran %d tasks\n", pcpu_ran);
+
+	taskq_destroy(tq);
+	return 0;
+}
+
 static int test_system_taskq(void)
 {
 	return do_test(system_taskq, "system taskq");
@@ -75,5 +121,7 @@ int main(int argc, char **argv)
 		return 1;
 	if (test_system_taskq())
 		return 1;
+	if (test_pcpu_taskq())
+		return 1;
 	return 0;
 }
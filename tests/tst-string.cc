@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Checks the SSE2 versions of strlen(), strchr(), strcmp(), memchr(),
+// memrchr() and memcmp(), and the ones the kernel exports, against the C
+// versions, with random strings of random lengths and alignments.
+// The strings are also put right against an inaccessible page, which the
+// functions must not touch. memchr() is also given a length of SIZE_MAX.
+//
+// tst-string.so [iterations] [seed]
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+extern "C" {
+size_t strlen_base(const char *s);
+size_t strlen_sse2(const char *s);
+char *strchr_base(const char *s, int c);
+char *strchr_sse2(const char *s, int c);
+int strcmp_base(const char *l, const char *r);
+int strcmp_sse2(const char *l, const char *r);
+void *memchr_base(const void *s, int c, size_t n);
+void *memchr_sse2(const void *s, int c, size_t n);
+void *memrchr_base(const void *s, int c, size_t n);
+void *memrchr_sse2(const void *s, int c, size_t n);
+int memcmp_base(const void *l, const void *r, size_t n);
+int memcmp_sse2(const void *l, const void *r, size_t n);
+}
+
+struct variant {
+    std::string name;
+    size_t (*strlen)(const char *s);
+    char *(*strchr)(const char *s, int c);
+    int (*strcmp)(const char *l, const char *r);
+    void *(*memchr)(const void *s, int c, size_t n);
+    void *(*memrchr)(const void *s, int c, size_t n);
+    int (*memcmp)(const void *l, const void *r, size_t n);
+};
+
+static std::vector<variant> variants;
+
+static int failures;
+
+static void expect(bool ok, const variant& v, const char* what, size_t len, size_t align)
+{
+    if (!ok && failures++ < 20) {
+        printf("FAIL: %s %s, length %zu, alignment %zu\n", v.name.c_str(), what, len, align);
+    }
+}
+
+static int sign(int x)
+{
+    return (x > 0) - (x < 0);
+}
+
+static std::mt19937 rng;
+
+// Mostly a few distinct characters, so the one looked for is often there,
+// and sometimes bytes with the top bit set
+static void fill(char* p, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        p[i] = rng() % 16 ? 1 + rng() % 4 : 0x80 + rng() % 128;
+    }
+}
+
+static size_t random_length()
+{
+    switch (rng() % 8) {
+    case 0: return rng() % 4000;
+    case 1: return rng() % 500;
+    default: return rng() % 100;
+    }
+}
+
+// Checks all the functions on a string of @len at @s, and a copy of it at
+// @t, which must have room for @len + 1 bytes
+static void check(char* s, char* t, size_t len, size_t align)
+{
+    fill(s, len);
+    s[len] = 0;
+    memcpy(t, s, len + 1);
+    int c = rng() % 8 ? 1 + rng() % 4 : 0x80 + rng() % 128;
+    // Maybe end the copy early, or make it differ somewhere
+    if (len && rng() % 2) {
+        t[rng() % len] = rng() % 4 ? 1 + rng() % 4 : 0;
+    }
+    for (auto& v : variants) {
+        expect(v.strlen(s) == strlen_base(s), v, "strlen", len, align);
+        expect(v.strchr(s, c) == strchr_base(s, c), v, "strchr", len, align);
+        expect(v.strchr(s, 0) == strchr_base(s, 0), v, "strchr(0)", len, align);
+        expect(v.memchr(s, c, len) == memchr_base(s, c, len), v, "memchr", len, align);
+        // As strnlen(s, SIZE_MAX) calls it: the end must not wrap around
+        expect(v.memchr(s, 0, SIZE_MAX) == s + len, v, "memchr(SIZE_MAX)", len, align);
+        expect(v.memrchr(s, c, len) == memrchr_base(s, c, len), v, "memrchr", len, align);
+        expect(sign(v.strcmp(s, t)) == sign(strcmp_base(s, t)), v, "strcmp", len, align);
+        expect(sign(v.strcmp(t, s)) == sign(strcmp_base(t, s)), v, "strcmp", len, align);
+        expect(sign(v.memcmp(s, t, len)) == sign(memcmp_base(s, t, len)), v, "memcmp", len, align);
+        expect(sign(v.memcmp(t, s, len)) == sign(memcmp_base(t, s, len)), v, "memcmp", len, align);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long iterations = 200000;
+    unsigned seed = 1;
+    if (argc > 1) {
+        iterations = atol(argv[1]);
+    }
+    if (argc > 2) {
+        seed = atoi(argv[2]);
+    }
+    rng.seed(seed);
+
+    variants.push_back({"sse2", strlen_sse2, strchr_sse2, strcmp_sse2,
+                        memchr_sse2, memrchr_sse2, memcmp_sse2});
+    variants.push_back({"default", strlen, strchr, strcmp, memchr, memrchr, memcmp});
+    for (auto& v : variants) {
+        printf("testing %s\n", v.name.c_str());
+    }
+
+    // Two usable pages with inaccessible pages around them: strings are
+    // put either anywhere in the first page, or against one of the guards
+    const size_t page = 4096;
+    auto area = static_cast<char*>(mmap(nullptr, 5 * page, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0));
+    if (area == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    mprotect(area, page, PROT_NONE);
+    mprotect(area + 2 * page, page, PROT_NONE);
+    mprotect(area + 4 * page, page, PROT_NONE);
+    char* first = area + page;
+    char* second = area + 3 * page;
+
+    for (unsigned long i = 0; i < iterations; i++) {
+        auto len = std::min(random_length(), page - 64);
+        char *s, *t;
+        switch (rng() % 3) {
+        case 0:
+            // Anywhere, differently aligned
+            s = first + rng() % 64;
+            t = second + rng() % 64;
+            break;
+        case 1:
+            // Right after the guard page
+            s = first;
+            t = second;
+            break;
+        default:
+            // Ending right at the guard page, the copy differently aligned
+            s = first + page - len - 1;
+            t = second + page - len - 1 - rng() % 8;
+            break;
+        }
+        check(s, t, len, reinterpret_cast<uintptr_t>(s) % 64);
+    }
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}